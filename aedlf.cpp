@@ -1,56 +1,90 @@
-#include "third-part/npy.hpp"
-#include "include/math/matrix.hpp"
-#include "include/math/tools.hpp"
-#include "include/graph/components/data.hpp"
-#include "include/graph/components/fc.hpp"
-#include "include/graph/components/logloss.hpp"
-#include "include/graph/components/sigmoid.hpp"
-#include "include/utils/node_construct.hpp"
-#include "include/utils/output.hpp"
-#include <vector>
-#include <memory>
-#include <iostream>
-
-
-
-int main() {
-    using namespace aedlf;
-    using node_ptr = std::shared_ptr<graph::BaseNode<double>>;
-    using node_ptr_c = std::shared_ptr<std::vector<node_ptr>>;
-    std::vector<double> train_data;
-    std::vector<unsigned long> train_data_shape; // 200 4
-    bool train_data_fortran;
-    std::vector<double> train_label;
-    std::vector<unsigned long> train_label_shape;
-    bool train_label_fortran;
-    npy::LoadArrayFromNumpy("./train_data.npy", train_data_shape, train_data_fortran, train_data);
-    npy::LoadArrayFromNumpy("./train_label.npy", train_label_shape, train_label_fortran, train_label);
-    Matrix<double> t_data {{50, 1, 1, 4}, std::make_shared<std::vector<double>>(train_data)};
-    Matrix<double> t_label {{50, 1, 1, 1}, std::make_shared<std::vector<double>>(train_label)};
-    // compute graph start
-    node_ptr label_node {utils::construct_data_node("label_node", t_label)};
-    components::Data<double> input_data {"data_layer"};
-    components::FC<double> fc_layer {"mlp_layer", 4, 1, "ones"};
-    components::LogLoss<double> loss_layer {"loss_layer"};
-    components::Sigmoid<double> sigmoid_layer {"sigmoid_layer"};
-    node_ptr_c i_data {input_data(t_data)};
-    node_ptr_c fc_out {fc_layer(i_data)};
-    node_ptr_c sigmoid_out {sigmoid_layer(fc_out)};
-    sigmoid_out->push_back(label_node);
-    node_ptr_c loss {loss_layer(sigmoid_out)};
-    //compute graph end
-    float lr {1e-4};
-    for(int i {0}; i < 200; ++i) {
-        loss_layer.forward();
-        fc_layer.backward(loss->at(0));
-        fc_layer.update(lr);
-        input_data.clear_jacobi();
-        fc_layer.clear_jacobi();
-        loss_layer.clear_jacobi();
-        sigmoid_layer.clear_jacobi();
-        std::cout << "index: " << i << " loss: ";
-        Matrix<double> loss_value {loss->at(0)->get_data()};
-        utils::print_matrix<double>(loss_value);
-    }
-    return 0;
+#include "include/data/data_loader.hpp"
+#include "include/math/matrix.hpp"
+#include "include/math/tools.hpp"
+#include "include/graph/components/data.hpp"
+#include "include/graph/components/fc.hpp"
+#include "include/graph/components/logloss.hpp"
+#include "include/graph/components/sigmoid.hpp"
+#include "include/graph/graph.hpp"
+#include "include/graph/checkpoint.hpp"
+#include "include/graph/quantized_graph.hpp"
+#include "include/utils/node_construct.hpp"
+#include "include/utils/output.hpp"
+#include <vector>
+#include <memory>
+#include <iostream>
+#include <string>
+
+
+
+int main(int argc, char** argv) {
+    using namespace aedlf;
+    using node_ptr = std::shared_ptr<graph::BaseNode<float>>;
+    using node_ptr_c = std::shared_ptr<std::vector<node_ptr>>;
+    // 后台线程从映射的npy文件里组装batch，这里一个batch就是全部50个样本，不打乱；文件是float64，读的时候转成float
+    data::DataLoader<float> train_loader {
+        std::make_shared<data::NpyDataset<float>>("./train_data.npy"), // 50 4
+        std::make_shared<data::NpyDataset<float>>("./train_label.npy"),
+        50, false
+    };
+    Matrix<float> t_data;
+    Matrix<float> t_label;
+    train_loader.next(t_data, t_label);
+    // compute graph start
+    node_ptr label_node {utils::construct_data_node("label_node", t_label)};
+    components::Data<float> input_data {"data_layer"};
+    components::FC<float> fc_layer {"mlp_layer", 4, 1, "ones"};
+    components::LogLoss<float> loss_layer {"loss_layer"};
+    components::Sigmoid<float> sigmoid_layer {"sigmoid_layer"};
+    node_ptr_c i_data {input_data(t_data)};
+    node_ptr_c fc_out {fc_layer(i_data)};
+    node_ptr_c sigmoid_out {sigmoid_layer(fc_out)};
+    sigmoid_out->push_back(label_node);
+    node_ptr_c loss {loss_layer(sigmoid_out)};
+    //compute graph end
+    graph::Graph<float> compute_graph {loss->at(0)};
+    compute_graph.forward();
+    compute_graph.plan_memory();
+    std::cout << "memory plan: " << compute_graph.get_memory_plan().get_peak_bytes() << " bytes, "
+        << compute_graph.get_memory_plan().get_naive_bytes() << " bytes without reuse" << std::endl;
+    // 传入checkpoint路径时直接加载训练好的参数，不再训练
+    if(argc > 1) {
+        graph::Checkpoint<float> {argv[1]}.load(compute_graph);
+        std::cout << "loaded " << argv[1] << std::endl;
+    }
+    float lr {5e-2};
+    for(int i {0}; argc == 1 && i < 200; ++i) {
+        // 换成下一个batch，不用重建图；一个epoch取完时next返回false，再取一次就是新epoch的第一个
+        if(i > 0 && !train_loader.next(i_data->at(0), label_node)) {
+            train_loader.next(i_data->at(0), label_node);
+        }
+        compute_graph.forward();
+        // 规划以后梯度槽位和中间结果共用，clear_jacobi不能动它们，loss应该和不调用时一样
+        compute_graph.clear_jacobi();
+        compute_graph.backward();
+        compute_graph.update(lr);
+        std::cout << "index: " << i << " loss: ";
+        Matrix<float> loss_value {loss->at(0)->get_data()};
+        utils::print_matrix<float>(loss_value);
+    }
+    if(argc == 1) {
+        graph::Checkpoint<float>::save(compute_graph, "./aedlf.ckpt");
+        std::cout << "saved ./aedlf.ckpt" << std::endl;
+    }
+    // 训练完以后只做前向：丢掉梯度，中间结果按只前传的存活区间复用内存
+    compute_graph.set_inference(true);
+    compute_graph.forward();
+    std::cout << "inference memory plan: " << compute_graph.get_memory_plan().get_peak_bytes() << " bytes, loss: ";
+    Matrix<float> inference_loss {loss->at(0)->get_data()};
+    utils::print_matrix<float>(inference_loss);
+    // int8推理：用当前batch校准激活值的范围，FC的权重按输出通道量化
+    graph::QuantizedGraph<float> int8_graph {compute_graph};
+    int8_graph.calibrate();
+    int8_graph.quantize();
+    int8_graph.forward();
+    std::cout << "int8 weights: " << int8_graph.get_weight_bytes() << " bytes, "
+        << int8_graph.get_float_weight_bytes() << " bytes in float, loss: ";
+    Matrix<float> int8_loss {int8_graph.get_output()->get_data()};
+    utils::print_matrix<float>(int8_loss);
+    return 0;
 }
\ No newline at end of file
@@ -0,0 +1,294 @@
+#include "bench.hpp"
+#include "../include/math/matrix.hpp"
+#include "../include/math/tools.hpp"
+#include "../include/graph/node/common/base.hpp"
+#include "../include/graph/node/pool.hpp"
+#include "../include/graph/components/fc.hpp"
+#include "../include/graph/components/conv.hpp"
+#include "../include/graph/components/sigmoid.hpp"
+#include "../include/graph/graph.hpp"
+#include "../include/graph/quantized_graph.hpp"
+#include "../include/utils/node_construct.hpp"
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+
+namespace {
+    using namespace aedlf;
+    using matrix_dim = std::vector<unsigned long>;
+    using node_ptr = std::shared_ptr<graph::BaseNode<double>>;
+    using node_ptr_c = std::shared_ptr<std::vector<node_ptr>>;
+
+    std::string dim_name(const matrix_dim& dim) {
+        std::ostringstream name;
+        for(size_t i {0}; i < dim.size(); ++i) {
+            name << (i == 0 ? "" : "x") << dim[i];
+        }
+        return name.str();
+    }
+
+    // double的用例名字不带后缀，和之前的结果保持可比
+    template <typename MType>
+    std::string type_suffix() {
+        return std::is_same<MType, float>::value ? "_f32" : "";
+    }
+
+    template <typename MType = double>
+    Matrix<MType> random_matrix(matrix_dim dim) {
+        Matrix<MType> m;
+        matrix_tools::MakeMatrix<MType> mm {dim};
+        mm.gaussian(m);
+        return m;
+    }
+
+    template <typename MType = double>
+    void add_matrix_mul(bench::Registry& registry, matrix_dim a_dim, unsigned long n) {
+        matrix_dim b_dim {a_dim[0], a_dim[1], a_dim[3], n};
+        double flops {2.0 * a_dim[0] * a_dim[1] * a_dim[2] * a_dim[3] * n};
+        registry.add("Matrix/mul" + type_suffix<MType>() + "/" + dim_name(a_dim) + "*" + dim_name(b_dim), [a_dim, b_dim] {
+            std::shared_ptr<Matrix<MType>> a {std::make_shared<Matrix<MType>>(random_matrix<MType>(a_dim))};
+            std::shared_ptr<Matrix<MType>> b {std::make_shared<Matrix<MType>>(random_matrix<MType>(b_dim))};
+            return bench::run_func {[a, b] {
+                // mul总是把结果写进新分配的内存，浅拷贝一份就不会改掉a的尺寸
+                Matrix<MType> c {*a};
+                c.mul(*b);
+            }};
+        }, flops);
+    }
+
+    // add和mul_v的广播，addend是1的维度按NumPy规则广播
+    void add_matrix_elementwise(bench::Registry& registry, matrix_dim dim, matrix_dim addend_dim) {
+        std::string shape_name {dim_name(dim) + "+" + dim_name(addend_dim)};
+        registry.add("Matrix/add/" + shape_name, [dim, addend_dim] {
+            std::shared_ptr<Matrix<double>> a {std::make_shared<Matrix<double>>(random_matrix(dim))};
+            std::shared_ptr<Matrix<double>> b {std::make_shared<Matrix<double>>(random_matrix(addend_dim))};
+            return bench::run_func {[a, b] {
+                a->add(*b);
+            }};
+        });
+        registry.add("Matrix/mul_v/" + shape_name, [dim, addend_dim] {
+            std::shared_ptr<Matrix<double>> a {std::make_shared<Matrix<double>>(random_matrix(dim))};
+            std::shared_ptr<Matrix<double>> b {std::make_shared<Matrix<double>>(addend_dim, 1.0)};
+            return bench::run_func {[a, b] {
+                a->mul_v(*b);
+            }};
+        });
+    }
+
+    void add_make_matrix(bench::Registry& registry, matrix_dim dim, unsigned long kernel_size, unsigned long padding, unsigned long stride) {
+        std::string shape_name {dim_name(dim) + "/k" + std::to_string(kernel_size) + "p" + std::to_string(padding) + "s" + std::to_string(stride)};
+        registry.add("MakeMatrix/add_padding/" + shape_name, [dim, padding] {
+            std::shared_ptr<Matrix<double>> m {std::make_shared<Matrix<double>>(random_matrix(dim))};
+            std::shared_ptr<Matrix<double>> result {std::make_shared<Matrix<double>>()};
+            return bench::run_func {[m, result, padding] {
+                matrix_tools::MakeMatrix<double> mm;
+                mm.add_padding(*m, *result, padding, 0);
+            }};
+        });
+        registry.add("MakeMatrix/img2col/" + shape_name, [dim, kernel_size, padding, stride] {
+            std::shared_ptr<Matrix<double>> padded {std::make_shared<Matrix<double>>()};
+            std::shared_ptr<Matrix<double>> col {std::make_shared<Matrix<double>>()};
+            matrix_tools::MakeMatrix<double> mm;
+            Matrix<double> m {random_matrix(dim)};
+            mm.add_padding(m, *padded, padding, 0);
+            return bench::run_func {[padded, col, kernel_size, stride] {
+                matrix_tools::MakeMatrix<double> mm;
+                mm.img2col(*padded, *col, kernel_size, stride);
+            }};
+        });
+        registry.add("MakeMatrix/col2img/" + shape_name, [dim, kernel_size, padding, stride] {
+            std::shared_ptr<Matrix<double>> col {std::make_shared<Matrix<double>>()};
+            std::shared_ptr<Matrix<double>> img {std::make_shared<Matrix<double>>()};
+            matrix_tools::MakeMatrix<double> mm;
+            Matrix<double> padded;
+            Matrix<double> m {random_matrix(dim)};
+            mm.add_padding(m, padded, padding, 0);
+            mm.img2col(padded, *col, kernel_size, stride);
+            matrix_dim padded_dim {padded.get_dim()};
+            return bench::run_func {[col, img, kernel_size, stride, padded_dim] {
+                matrix_tools::MakeMatrix<double> mm;
+                mm.col2img(*col, *img, kernel_size, stride, padded_dim);
+            }};
+        });
+    }
+
+    // 前向加上对输入的梯度
+    void add_max_pool(bench::Registry& registry, matrix_dim dim, unsigned long kernel_size, unsigned long stride) {
+        std::string shape_name {dim_name(dim) + "/k" + std::to_string(kernel_size) + "s" + std::to_string(stride)};
+        registry.add("MaxPool2dNode/forward_backward/" + shape_name, [dim, kernel_size, stride] {
+            node_ptr input {std::make_shared<graph::BaseNode<double>>("bench_pool_input", random_matrix(dim))};
+            matrix_dim out_dim {dim[0], dim[1], (dim[2] - kernel_size) / stride + 1, (dim[3] - kernel_size) / stride + 1};
+            node_ptr pool {std::make_shared<graph::MaxPool2dNode<double>>("bench_pool", out_dim, matrix_dim {kernel_size, kernel_size}, stride)};
+            pool->add_parent(input);
+            std::shared_ptr<Matrix<double>> grad_output {std::make_shared<Matrix<double>>(out_dim, 1.0)};
+            return bench::run_func {[input, pool, grad_output] {
+                pool->compute_forward();
+                pool->vjp(*grad_output);
+            }};
+        });
+    }
+
+    // 一次完整的训练迭代：forward、backward、update，和aedlf.cpp里一样先规划内存
+    template <typename MType = double>
+    struct TrainStep {
+        std::vector<std::shared_ptr<void>> keep_alive; // 组件持有节点，图执行期间不能析构
+        std::shared_ptr<graph::Graph<MType>> compute_graph;
+    };
+
+    template <typename MType = double>
+    bench::run_func train_step_run(std::shared_ptr<TrainStep<MType>> step) {
+        step->compute_graph->forward();
+        step->compute_graph->plan_memory();
+        return bench::run_func {[step] {
+            step->compute_graph->forward();
+            step->compute_graph->backward();
+            step->compute_graph->update(MType(1e-6));
+        }};
+    }
+
+    // precision为bfloat16时是混合精度：float32主权重，前向舍入到bf16，带动态loss scaling
+    template <typename MType = double>
+    void add_fc_step(bench::Registry& registry, unsigned long batch, unsigned long input_dim, unsigned long output_dim, Precision precision = Precision::float32) {
+        double flops {3 * 2.0 * batch * input_dim * output_dim};
+        std::string suffix {precision == Precision::bfloat16 ? "_bf16" : type_suffix<MType>()};
+        registry.add("FC/train_step" + suffix + "/" + std::to_string(batch) + "x" + std::to_string(input_dim) + "->" + std::to_string(output_dim), [batch, input_dim, output_dim, precision] {
+            using node_ptr_c = std::shared_ptr<std::vector<std::shared_ptr<graph::BaseNode<MType>>>>;
+            std::shared_ptr<TrainStep<MType>> step {std::make_shared<TrainStep<MType>>()};
+            Matrix<MType> x {random_matrix<MType>(matrix_dim {batch, 1, 1, input_dim})};
+            std::shared_ptr<components::FC<MType>> fc {std::make_shared<components::FC<MType>>("bench_fc", input_dim, output_dim)};
+            std::shared_ptr<components::Sigmoid<MType>> sigmoid {std::make_shared<components::Sigmoid<MType>>("bench_sigmoid")};
+            node_ptr_c out {(*sigmoid)((*fc)({utils::construct_data_node("bench_fc_input", x)}))};
+            step->keep_alive = {fc, sigmoid};
+            step->compute_graph = std::make_shared<graph::Graph<MType>>(out->at(0));
+            if(precision == Precision::bfloat16) {
+                step->compute_graph->set_precision(precision);
+                step->compute_graph->enable_loss_scaling();
+            }
+            return train_step_run(step);
+        }, flops);
+    }
+
+    void add_conv_step(bench::Registry& registry, matrix_dim dim, unsigned long output_channel, unsigned long kernel_size, unsigned long padding, unsigned long stride, bool fused) {
+        unsigned long output_h {(dim[2] + 2 * padding - kernel_size) / stride + 1};
+        unsigned long output_w {(dim[3] + 2 * padding - kernel_size) / stride + 1};
+        double flops {3 * 2.0 * dim[0] * dim[1] * output_channel * kernel_size * kernel_size * output_h * output_w};
+        std::string shape_name {dim_name(dim) + "->" + std::to_string(output_channel) + "/k" + std::to_string(kernel_size) + "p" + std::to_string(padding) + "s" + std::to_string(stride)};
+        registry.add(std::string {"Conv2d/train_step"} + (fused ? "" : "_unfused") + "/" + shape_name, [dim, output_channel, kernel_size, padding, stride, fused] {
+            std::shared_ptr<TrainStep<>> step {std::make_shared<TrainStep<>>()};
+            Matrix<double> x {random_matrix(dim)};
+            std::shared_ptr<components::Conv2d<double>> conv {std::make_shared<components::Conv2d<double>>("bench_conv", dim[1], output_channel, kernel_size, padding, stride)};
+            conv->set_fused(fused);
+            node_ptr_c out {(*conv)({utils::construct_data_node("bench_conv_input", x)})};
+            step->keep_alive = {conv};
+            step->compute_graph = std::make_shared<graph::Graph<double>>(out->at(0));
+            return train_step_run(step);
+        }, flops);
+    }
+
+    // 只做前向推理，图切到推理模式；int8时先用同一个batch校准再量化
+    struct InferenceStep {
+        std::vector<std::shared_ptr<void>> keep_alive;
+        std::shared_ptr<graph::Graph<float>> compute_graph;
+        std::shared_ptr<graph::QuantizedGraph<float>> int8_graph;
+    };
+
+    bench::run_func inference_run(std::shared_ptr<InferenceStep> step, bool int8) {
+        step->compute_graph->set_inference(true);
+        step->compute_graph->forward();
+        if(!int8) {
+            return bench::run_func {[step] {
+                step->compute_graph->forward();
+            }};
+        }
+        step->int8_graph = std::make_shared<graph::QuantizedGraph<float>>(*step->compute_graph);
+        step->int8_graph->calibrate();
+        step->int8_graph->quantize();
+        return bench::run_func {[step] {
+            step->int8_graph->forward();
+        }};
+    }
+
+    void add_fc_inference(bench::Registry& registry, unsigned long batch, unsigned long input_dim, unsigned long output_dim, bool int8) {
+        double flops {2.0 * batch * input_dim * output_dim};
+        registry.add(std::string {"FC/inference"} + (int8 ? "_int8" : "_f32") + "/" + std::to_string(batch) + "x" + std::to_string(input_dim) + "->" + std::to_string(output_dim), [batch, input_dim, output_dim, int8] {
+            using node_ptr_c = std::shared_ptr<std::vector<std::shared_ptr<graph::BaseNode<float>>>>;
+            std::shared_ptr<InferenceStep> step {std::make_shared<InferenceStep>()};
+            Matrix<float> x {random_matrix<float>(matrix_dim {batch, 1, 1, input_dim})};
+            std::shared_ptr<components::FC<float>> fc {std::make_shared<components::FC<float>>("bench_fc", input_dim, output_dim)};
+            node_ptr_c out {(*fc)({utils::construct_data_node("bench_fc_input", x)})};
+            step->keep_alive = {fc};
+            step->compute_graph = std::make_shared<graph::Graph<float>>(out->at(0));
+            return inference_run(step, int8);
+        }, flops);
+    }
+
+    void add_conv_inference(bench::Registry& registry, matrix_dim dim, unsigned long output_channel, unsigned long kernel_size, unsigned long padding, unsigned long stride, bool int8) {
+        unsigned long output_h {(dim[2] + 2 * padding - kernel_size) / stride + 1};
+        unsigned long output_w {(dim[3] + 2 * padding - kernel_size) / stride + 1};
+        double flops {2.0 * dim[0] * dim[1] * output_channel * kernel_size * kernel_size * output_h * output_w};
+        std::string shape_name {dim_name(dim) + "->" + std::to_string(output_channel) + "/k" + std::to_string(kernel_size) + "p" + std::to_string(padding) + "s" + std::to_string(stride)};
+        registry.add(std::string {"Conv2d/inference"} + (int8 ? "_int8" : "_f32") + "/" + shape_name, [dim, output_channel, kernel_size, padding, stride, int8] {
+            using node_ptr_c = std::shared_ptr<std::vector<std::shared_ptr<graph::BaseNode<float>>>>;
+            std::shared_ptr<InferenceStep> step {std::make_shared<InferenceStep>()};
+            Matrix<float> x {random_matrix<float>(dim)};
+            std::shared_ptr<components::Conv2d<float>> conv {std::make_shared<components::Conv2d<float>>("bench_conv", dim[1], output_channel, kernel_size, padding, stride)};
+            node_ptr_c out {(*conv)({utils::construct_data_node("bench_conv_input", x)})};
+            step->keep_alive = {conv};
+            step->compute_graph = std::make_shared<graph::Graph<float>>(out->at(0));
+            return inference_run(step, int8);
+        }, flops);
+    }
+
+    void register_benchmarks(bench::Registry& registry) {
+        add_matrix_mul(registry, matrix_dim {1, 1, 64, 64}, 64);
+        add_matrix_mul(registry, matrix_dim {1, 1, 256, 256}, 256);
+        add_matrix_mul(registry, matrix_dim {1, 1, 512, 512}, 512);
+        add_matrix_mul(registry, matrix_dim {1, 1, 1000, 33}, 17);
+        add_matrix_mul(registry, matrix_dim {8, 4, 64, 64}, 64);
+        add_matrix_mul<float>(registry, matrix_dim {1, 1, 256, 256}, 256);
+        add_matrix_mul<float>(registry, matrix_dim {1, 1, 512, 512}, 512);
+        add_matrix_mul<float>(registry, matrix_dim {1, 1, 1024, 1024}, 1024);
+        add_matrix_mul<float>(registry, matrix_dim {1, 1, 4096, 4096}, 1);
+        add_matrix_mul<float>(registry, matrix_dim {16, 8, 32, 32}, 32);
+        add_matrix_elementwise(registry, matrix_dim {8, 16, 64, 64}, matrix_dim {8, 16, 64, 64});
+        add_matrix_elementwise(registry, matrix_dim {8, 16, 64, 64}, matrix_dim {8, 16, 1, 64});
+        add_matrix_elementwise(registry, matrix_dim {8, 16, 64, 64}, matrix_dim {1, 16, 64, 64});
+        add_matrix_elementwise(registry, matrix_dim {8, 16, 64, 64}, matrix_dim {1, 16, 1, 1});
+        add_matrix_elementwise(registry, matrix_dim {256, 1, 1, 1024}, matrix_dim {256, 1, 1, 1});
+        add_make_matrix(registry, matrix_dim {8, 16, 32, 32}, 3, 1, 1);
+        add_make_matrix(registry, matrix_dim {8, 16, 32, 32}, 5, 2, 2);
+        add_max_pool(registry, matrix_dim {8, 16, 64, 64}, 2, 2);
+        add_max_pool(registry, matrix_dim {8, 16, 63, 63}, 3, 2);
+        add_fc_step(registry, 64, 256, 128);
+        add_fc_step(registry, 50, 4, 1);
+        add_fc_step<float>(registry, 64, 256, 128);
+        add_fc_step<float>(registry, 64, 256, 128, Precision::bfloat16);
+        add_conv_step(registry, matrix_dim {8, 16, 32, 32}, 32, 3, 1, 1, true);
+        add_conv_step(registry, matrix_dim {8, 16, 32, 32}, 32, 3, 1, 1, false);
+        add_conv_step(registry, matrix_dim {8, 16, 32, 32}, 32, 5, 2, 2, true);
+        add_conv_step(registry, matrix_dim {8, 3, 64, 64}, 16, 7, 3, 2, true);
+        add_fc_inference(registry, 64, 256, 128, false);
+        add_fc_inference(registry, 64, 256, 128, true);
+        add_fc_inference(registry, 256, 1024, 512, false);
+        add_fc_inference(registry, 256, 1024, 512, true);
+        add_conv_inference(registry, matrix_dim {8, 16, 32, 32}, 32, 3, 1, 1, false);
+        add_conv_inference(registry, matrix_dim {8, 16, 32, 32}, 32, 3, 1, 1, true);
+    }
+}
+
+
+int main(int argc, char** argv) {
+    try {
+        register_benchmarks(aedlf::bench::Registry::global());
+        return aedlf::bench::run_main(argc, argv);
+    }
+    catch(const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,238 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../include/utils/thread_pool.hpp"
+
+
+namespace aedlf {
+    namespace bench {
+        /*
+        自带的基准测试框架，不依赖第三方库
+        每个用例的setup只执行一次，返回每轮要计时的函数；先预热一次，再把迭代次数加大到一轮超过min_time，按这个次数重复repetitions轮
+        结果输出成JSON，字段和Google Benchmark一致（context、benchmarks、name、run_type、iterations、real_time、time_unit），可以直接用它的compare.py比较两次结果
+        命令行参数：--filter=子串 --min_time=秒 --repetitions=轮数 --out=文件 --list
+        */
+        using run_func = std::function<void()>;
+        using setup_func = std::function<run_func()>;
+
+        struct Case {
+            std::string name;
+            setup_func setup;
+            double flops; // 每次迭代的浮点运算次数，0表示不统计
+        };
+
+        struct Options {
+            std::string filter;
+            double min_time {0.2};
+            unsigned long repetitions {5};
+            std::string output;
+            bool list {false};
+        };
+
+        struct Result {
+            std::string name;
+            unsigned long iterations;
+            std::vector<double> times; // 每轮里单次迭代的耗时，纳秒
+            double flops;
+        };
+
+        class Registry {
+            public:
+                static Registry& global();
+                void add(std::string name, setup_func setup, double flops = 0);
+                const std::vector<Case>& get_cases() const;
+            private:
+                std::vector<Case> cases;
+        };
+
+        inline Registry& Registry::global() {
+            static Registry registry;
+            return registry;
+        }
+
+        inline void Registry::add(std::string name, setup_func setup, double flops) {
+            for(const Case& c : cases) {
+                if(c.name == name) {
+                    throw std::runtime_error("Benchmark `" + name + "` is registered twice");
+                }
+            }
+            cases.push_back(Case {name, setup, flops});
+        }
+
+        inline const std::vector<Case>& Registry::get_cases() const {
+            return cases;
+        }
+
+        inline Options parse_options(int argc, char** argv) {
+            Options options;
+            for(int i {1}; i < argc; ++i) {
+                std::string arg {argv[i]};
+                std::string::size_type eq {arg.find('=')};
+                std::string key {arg.substr(0, eq)};
+                std::string value {eq == std::string::npos ? "" : arg.substr(eq + 1)};
+                if(key == "--filter") {
+                    options.filter = value;
+                }
+                else if(key == "--min_time") {
+                    options.min_time = std::atof(value.c_str());
+                }
+                else if(key == "--repetitions") {
+                    options.repetitions = std::max(1ul, std::strtoul(value.c_str(), nullptr, 10));
+                }
+                else if(key == "--out") {
+                    options.output = value;
+                }
+                else if(key == "--list") {
+                    options.list = true;
+                }
+                else {
+                    throw std::runtime_error("Unknown benchmark option `" + arg + "`");
+                }
+            }
+            return options;
+        }
+
+        inline double time_iterations(const run_func& run, unsigned long iterations) {
+            std::chrono::steady_clock::time_point begin {std::chrono::steady_clock::now()};
+            for(unsigned long i {0}; i < iterations; ++i) {
+                run();
+            }
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        }
+
+        inline Result run_case(const Case& c, const Options& options) {
+            run_func run {c.setup()};
+            run(); // 预热，第一次迭代会分配内存、建线程池
+            // 按上一轮的耗时估计需要的迭代次数，多估一些，每次最多放大10倍
+            unsigned long iterations {1};
+            double seconds {time_iterations(run, iterations)};
+            while(seconds < options.min_time) {
+                double predict {options.min_time * 1.4 / std::max(seconds, 1e-9) * iterations};
+                iterations = std::max(iterations + 1, std::min(static_cast<unsigned long>(predict), iterations * 10));
+                seconds = time_iterations(run, iterations);
+            }
+            Result result {c.name, iterations, {}, c.flops};
+            result.times.push_back(seconds * 1e9 / iterations);
+            for(unsigned long r {1}; r < options.repetitions; ++r) {
+                result.times.push_back(time_iterations(run, iterations) * 1e9 / iterations);
+            }
+            return result;
+        }
+
+        inline std::string json_escape(const std::string& s) {
+            std::string escaped;
+            for(char ch : s) {
+                if(ch == '"' || ch == '\\') {
+                    escaped += '\\';
+                }
+                escaped += ch;
+            }
+            return escaped;
+        }
+
+        inline void write_entry(std::ostream& out, const Result& result, const std::string& run_type, const std::string& aggregate_name, double time, bool last) {
+            std::string name {aggregate_name.empty() ? result.name : result.name + "_" + aggregate_name};
+            out << "    {\n";
+            out << "      \"name\": \"" << json_escape(name) << "\",\n";
+            out << "      \"run_name\": \"" << json_escape(result.name) << "\",\n";
+            out << "      \"run_type\": \"" << run_type << "\",\n";
+            if(!aggregate_name.empty()) {
+                out << "      \"aggregate_name\": \"" << aggregate_name << "\",\n";
+            }
+            out << "      \"repetitions\": " << result.times.size() << ",\n";
+            out << "      \"iterations\": " << result.iterations << ",\n";
+            out << "      \"real_time\": " << time << ",\n";
+            out << "      \"cpu_time\": " << time << ",\n";
+            out << "      \"time_unit\": \"ns\"";
+            if(result.flops > 0 && aggregate_name != "stddev") {
+                out << ",\n      \"GFLOPS\": " << result.flops / time;
+            }
+            out << "\n    }" << (last ? "\n" : ",\n");
+        }
+
+        inline void write_json(std::ostream& out, const std::vector<Result>& results) {
+            char date[32];
+            std::time_t now {std::time(nullptr)};
+            std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+            const char* env_allocator {std::getenv("AEDLF_ALLOCATOR")};
+            out.precision(6);
+            out << std::fixed;
+            out << "{\n  \"context\": {\n";
+            out << "    \"date\": \"" << date << "\",\n";
+            out << "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n";
+            out << "    \"num_threads\": " << utils::ThreadPool::global().get_worker_num() + 1 << ",\n";
+            out << "    \"allocator\": \"" << (env_allocator == nullptr ? "pool" : json_escape(env_allocator)) << "\",\n";
+#ifdef NDEBUG
+            out << "    \"library_build_type\": \"release\"\n";
+#else
+            out << "    \"library_build_type\": \"debug\"\n";
+#endif
+            out << "  },\n  \"benchmarks\": [\n";
+            for(size_t i {0}; i < results.size(); ++i) {
+                const Result& result {results[i]};
+                for(double time : result.times) {
+                    write_entry(out, result, "iteration", "", time, false);
+                }
+                std::vector<double> sorted {result.times};
+                std::sort(sorted.begin(), sorted.end());
+                double mean {0};
+                for(double time : sorted) {
+                    mean += time / sorted.size();
+                }
+                double variance {0};
+                for(double time : sorted) {
+                    variance += (time - mean) * (time - mean) / std::max<size_t>(sorted.size() - 1, 1);
+                }
+                double median {sorted.size() % 2 == 1 ? sorted[sorted.size() / 2] : (sorted[sorted.size() / 2 - 1] + sorted[sorted.size() / 2]) / 2};
+                write_entry(out, result, "aggregate", "mean", mean, false);
+                write_entry(out, result, "aggregate", "median", median, false);
+                write_entry(out, result, "aggregate", "stddev", std::sqrt(variance), i + 1 == results.size());
+            }
+            out << "  ]\n}\n";
+        }
+
+        // 跑完所有匹配的用例，进度写stderr，JSON写stdout或者--out指定的文件
+        inline int run_main(int argc, char** argv) {
+            Options options {parse_options(argc, argv)};
+            std::vector<Result> results;
+            for(const Case& c : Registry::global().get_cases()) {
+                if(!options.filter.empty() && c.name.find(options.filter) == std::string::npos) {
+                    continue;
+                }
+                if(options.list) {
+                    std::cout << c.name << std::endl;
+                    continue;
+                }
+                results.push_back(run_case(c, options));
+                std::vector<double> sorted {results.back().times};
+                std::sort(sorted.begin(), sorted.end());
+                std::cerr << c.name << ": " << sorted[sorted.size() / 2] / 1e3 << " us x " << results.back().iterations << std::endl;
+            }
+            if(options.list) {
+                return 0;
+            }
+            if(options.output.empty()) {
+                write_json(std::cout, results);
+                return 0;
+            }
+            std::ofstream out {options.output};
+            if(!out) {
+                throw std::runtime_error("Can not open `" + options.output + "`");
+            }
+            write_json(out, results);
+            return 0;
+        }
+    }
+}
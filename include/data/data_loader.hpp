@@ -0,0 +1,240 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "npy_dataset.hpp"
+#include "../graph/node/common/base.hpp"
+#include "../utils/profiler.hpp"
+
+
+namespace aedlf {
+    namespace data {
+        /*
+        后台线程按顺序组装mini-batch，训练第N个batch的同时第N+1、N+2个已经在准备
+        一共prefetch_num + 1个槽位，next交出去的槽位在下一次next之前不会被覆盖，所以交出去的Matrix可以直接绑到图的输入节点上
+        每个epoch开始时打乱样本顺序，shuffle为false时按顺序读，并提前madvise后面要读的页
+        最后一个batch不满batch_size时尺寸会变小，Graph::forward发现输入尺寸变化会自己重新规划内存；drop_last为true时丢掉它
+        */
+        template <typename MType>
+        class DataLoader {
+            public:
+                using node_ptr = std::shared_ptr<graph::BaseNode<MType>>;
+                using dataset_ptr = std::shared_ptr<NpyDataset<MType>>;
+                DataLoader(dataset_ptr data, dataset_ptr label, unsigned long batch_size, bool shuffle = true, unsigned long prefetch_num = 2, bool drop_last = false, unsigned long seed = 0);
+                DataLoader(const DataLoader&) = delete;
+                DataLoader& operator=(const DataLoader&) = delete;
+                ~DataLoader();
+                unsigned long size() const; // 每个epoch的batch数
+                unsigned long get_epoch() const;
+                void start_epoch(); // 打乱顺序，丢掉还没取走的batch，从头开始组装；第一次next之前不用调用
+                bool next(Matrix<MType>& data, Matrix<MType>& label); // 拿到下一个batch（浅拷贝），epoch结束时返回false，再调用就开始新的epoch
+                bool next(node_ptr data_node, node_ptr label_node); // 拿到下一个batch直接绑到输入节点上
+            private:
+                struct Slot {
+                    Matrix<MType> data;
+                    Matrix<MType> label;
+                };
+                void worker_loop();
+                void fill(Slot& slot, unsigned long batch_i);
+                void restart();
+                dataset_ptr data_set;
+                dataset_ptr label_set;
+                unsigned long batch_size;
+                bool shuffle;
+                bool drop_last;
+                std::mt19937_64 engine;
+                std::vector<unsigned long> order; // 这个epoch的样本顺序
+                std::vector<Slot> slots;
+                unsigned long batch_num;
+                unsigned long epoch {0};
+                bool started {false};
+                // 下面的计数都由lock保护，跨epoch一直累加，第i个batch放在slots[i % slots.size()]，交出去的槽位在新epoch里也不会马上被覆盖
+                unsigned long epoch_begin {0}; // 这个epoch第一个batch的全局序号
+                unsigned long produced {0};
+                unsigned long consumed {0};
+                bool holding {false}; // 最后交出去的槽位还在用
+                bool filling {false};
+                bool stopping {false};
+                std::exception_ptr error;
+                std::mutex lock;
+                std::condition_variable producer_cv;
+                std::condition_variable consumer_cv;
+                std::thread worker;
+        };
+
+        template <typename MType>
+        DataLoader<MType>::DataLoader(dataset_ptr data, dataset_ptr label, unsigned long batch_size, bool shuffle, unsigned long prefetch_num, bool drop_last, unsigned long seed)
+            : data_set(data), label_set(label), batch_size(batch_size), shuffle(shuffle), drop_last(drop_last), engine(seed), slots(prefetch_num + 1) {
+            if(!data_set || batch_size == 0) {
+                throw std::runtime_error("`DataLoader` needs a dataset and a positive batch size");
+            }
+            if(label_set && label_set->size() != data_set->size()) {
+                throw std::runtime_error("`DataLoader` got data and label with different sample numbers");
+            }
+            batch_num = drop_last ? data_set->size() / batch_size : (data_set->size() + batch_size - 1) / batch_size;
+            order.resize(data_set->size());
+            std::iota(order.begin(), order.end(), 0ul);
+            worker = std::thread {&DataLoader<MType>::worker_loop, this};
+        }
+
+        template <typename MType>
+        DataLoader<MType>::~DataLoader() {
+            {
+                std::lock_guard<std::mutex> guard {lock};
+                stopping = true;
+            }
+            producer_cv.notify_all();
+            worker.join();
+        }
+
+        template <typename MType>
+        unsigned long DataLoader<MType>::size() const {
+            return batch_num;
+        }
+
+        template <typename MType>
+        unsigned long DataLoader<MType>::get_epoch() const {
+            return epoch;
+        }
+
+        template <typename MType>
+        void DataLoader<MType>::restart() {
+            // 调用时持有lock，并且worker没有在填槽位；上一个epoch没取走的batch直接丢掉
+            if(shuffle) {
+                std::shuffle(order.begin(), order.end(), engine);
+            }
+            produced = consumed;
+            epoch_begin = consumed;
+            started = true;
+            ++epoch;
+        }
+
+        template <typename MType>
+        void DataLoader<MType>::start_epoch() {
+            {
+                std::unique_lock<std::mutex> guard {lock};
+                consumer_cv.wait(guard, [this] { return !filling; });
+                restart();
+            }
+            producer_cv.notify_all();
+        }
+
+        template <typename MType>
+        void DataLoader<MType>::worker_loop() {
+            std::unique_lock<std::mutex> guard {lock};
+            while(true) {
+                // 还有batch没组装，并且对应的槽位已经还回来了
+                producer_cv.wait(guard, [this] {
+                    unsigned long released {consumed - (holding ? 1 : 0)};
+                    return stopping || (started && error == nullptr && produced - epoch_begin < batch_num && produced < released + slots.size());
+                });
+                if(stopping) {
+                    return;
+                }
+                unsigned long slot_i {produced % slots.size()};
+                unsigned long batch_i {produced - epoch_begin};
+                filling = true;
+                guard.unlock();
+                try {
+                    fill(slots[slot_i], batch_i);
+                }
+                catch(...) {
+                    guard.lock();
+                    error = std::current_exception();
+                    filling = false;
+                    consumer_cv.notify_all();
+                    continue;
+                }
+                guard.lock();
+                filling = false;
+                ++produced;
+                consumer_cv.notify_all();
+            }
+        }
+
+        template <typename MType>
+        void DataLoader<MType>::fill(Slot& slot, unsigned long batch_i) {
+            utils::ProfileScope profile {"data_loader", "data"};
+            unsigned long begin {batch_i * batch_size};
+            unsigned long count {std::min(batch_size, data_set->size() - begin)};
+            if(shuffle) {
+                std::vector<unsigned long> indices(order.begin() + begin, order.begin() + begin + count);
+                data_set->read_batch(indices, slot.data);
+                if(label_set) {
+                    label_set->read_batch(indices, slot.label);
+                }
+                return;
+            }
+            // 顺序读的时候让内核先把下一个batch的页读进来
+            unsigned long next_begin {begin + count};
+            if(next_begin < data_set->size()) {
+                unsigned long next_count {std::min(batch_size, data_set->size() - next_begin)};
+                data_set->prefetch(next_begin, next_count);
+                if(label_set) {
+                    label_set->prefetch(next_begin, next_count);
+                }
+            }
+            data_set->read_batch(begin, count, slot.data);
+            if(label_set) {
+                label_set->read_batch(begin, count, slot.label);
+            }
+        }
+
+        template <typename MType>
+        bool DataLoader<MType>::next(Matrix<MType>& data, Matrix<MType>& label) {
+            utils::ProfileScope profile {"data_loader_wait", "data"};
+            if(batch_num == 0) {
+                return false;
+            }
+            std::unique_lock<std::mutex> guard {lock};
+            if(!started || consumed - epoch_begin == batch_num) {
+                if(started) {
+                    // 这个epoch已经取完，先报告结束，下一次调用再开始新的epoch
+                    started = false;
+                    return false;
+                }
+                consumer_cv.wait(guard, [this] { return !filling; });
+                restart();
+                producer_cv.notify_all();
+            }
+            // 上一个交出去的槽位可以重新填了
+            holding = false;
+            producer_cv.notify_all();
+            consumer_cv.wait(guard, [this] { return produced > consumed || error != nullptr; });
+            if(error != nullptr) {
+                std::exception_ptr e {error};
+                error = nullptr;
+                started = false;
+                std::rethrow_exception(e);
+            }
+            Slot& slot {slots[consumed % slots.size()]};
+            data = slot.data;
+            label = slot.label;
+            ++consumed;
+            holding = true;
+            return true;
+        }
+
+        template <typename MType>
+        bool DataLoader<MType>::next(node_ptr data_node, node_ptr label_node) {
+            Matrix<MType> data;
+            Matrix<MType> label;
+            if(!next(data, label)) {
+                return false;
+            }
+            // DataNode::set_data沿用建图时每个样本的形状，只换batch维
+            data_node->set_data(data);
+            if(label_node) {
+                label_node->set_data(label);
+            }
+            return true;
+        }
+    }
+}
@@ -0,0 +1,342 @@
+#pragma once
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../../third-part/npy.hpp"
+#include "../math/matrix.hpp"
+
+
+namespace aedlf {
+    namespace data {
+        /*
+        只读映射整个文件，不读进内存，页面在第一次访问时才由内核从文件里换进来
+        映射是文件背书的干净页，内存紧张时内核可以直接丢掉，所以文件可以比内存大
+        */
+        class MappedFile {
+            public:
+                explicit MappedFile(const std::string& path);
+                MappedFile(const MappedFile&) = delete;
+                MappedFile& operator=(const MappedFile&) = delete;
+                ~MappedFile();
+                const char* data() const;
+                std::size_t size() const;
+                const std::string& get_path() const;
+                void advise(std::size_t offset, std::size_t len, int advice) const; // madvise，范围按页对齐
+            private:
+                std::string path;
+                void* address {nullptr};
+                std::size_t length {0};
+        };
+
+        inline MappedFile::MappedFile(const std::string& path) : path(path) {
+            int fd {::open(path.c_str(), O_RDONLY)};
+            if(fd < 0) {
+                throw std::runtime_error("Can not open `" + path + "`: " + std::strerror(errno));
+            }
+            struct stat file_stat;
+            if(::fstat(fd, &file_stat) != 0) {
+                int error {errno};
+                ::close(fd);
+                throw std::runtime_error("Can not stat `" + path + "`: " + std::strerror(error));
+            }
+            length = static_cast<std::size_t>(file_stat.st_size);
+            if(length == 0) {
+                ::close(fd);
+                throw std::runtime_error("`" + path + "` is empty");
+            }
+            address = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            int error {errno};
+            // 映射建立以后文件描述符就不需要了
+            ::close(fd);
+            if(address == MAP_FAILED) {
+                address = nullptr;
+                throw std::runtime_error("Can not mmap `" + path + "`: " + std::strerror(error));
+            }
+        }
+
+        inline MappedFile::~MappedFile() {
+            if(address != nullptr) {
+                ::munmap(address, length);
+            }
+        }
+
+        inline const char* MappedFile::data() const {
+            return static_cast<const char*>(address);
+        }
+
+        inline std::size_t MappedFile::size() const {
+            return length;
+        }
+
+        inline const std::string& MappedFile::get_path() const {
+            return path;
+        }
+
+        inline void MappedFile::advise(std::size_t offset, std::size_t len, int advice) const {
+            if(len == 0 || offset >= length) {
+                return;
+            }
+            std::size_t page {static_cast<std::size_t>(::sysconf(_SC_PAGESIZE))};
+            std::size_t begin {offset / page * page};
+            std::size_t end {std::min(offset + len, length)};
+            // 只是提示，失败了也不影响正确性
+            ::madvise(static_cast<char*>(address) + begin, end - begin, advice);
+        }
+
+        /*
+        基于mmap的.npy数据集，打开时只解析头部，不拷贝数据
+        第0维是样本，npy的shape映射到Matrix的(n, c, h, w)：1维是(n, 1, 1, 1)，2维是(n, 1, 1, d)，3维是(n, 1, h, w)，4维原样
+        dtype和MType相同时get_ptr直接给出映射页面上的指针，read_batch是一次memcpy；不同时逐个元素转换
+        只支持C顺序、本机字节序的实数和整数类型
+        */
+        template <typename MType>
+        class NpyDataset {
+            public:
+                using matrix_dim = std::vector<unsigned long>;
+                explicit NpyDataset(const std::string& path);
+                NpyDataset(const std::string& path, matrix_dim sample_dim); // sample_dim是(c, h, w)，元素个数要和每个样本一致
+                unsigned long size() const; // 样本数
+                const matrix_dim& get_shape() const; // npy里的原始shape
+                matrix_dim get_sample_dim() const; // (1, c, h, w)
+                matrix_dim get_batch_dim(unsigned long batch) const; // (batch, c, h, w)
+                unsigned long get_sample_len() const;
+                bool is_zero_copy() const; // dtype和MType相同，get_ptr可用
+                const MType* get_ptr(unsigned long index) const; // 第index个样本在映射页面上的地址，不拷贝
+                void read_batch(unsigned long begin, unsigned long count, Matrix<MType>& batch) const; // 连续的count个样本，batch尺寸相同时复用原来的内存
+                void read_batch(const std::vector<unsigned long>& indices, Matrix<MType>& batch) const; // 按下标取样本，打乱顺序时用
+                void prefetch(unsigned long begin, unsigned long count) const; // 提前让内核读入这些样本所在的页
+                void release(unsigned long begin, unsigned long count) const; // 用完的页交还给内核
+            private:
+                using convert_func = void (*)(const char* src, unsigned long n, MType* dst);
+                template <typename From>
+                static void convert(const char* src, unsigned long n, MType* dst);
+                static convert_func select_convert(const npy::dtype_t& dtype);
+                void parse_header();
+                const char* sample_bytes(unsigned long index) const;
+                std::shared_ptr<MappedFile> file;
+                matrix_dim shape;
+                matrix_dim sample_dim {1, 1, 1};
+                unsigned long sample_len {1};
+                std::size_t item_size {0};
+                std::size_t data_offset {0};
+                bool same_type {false};
+                convert_func convert_p {nullptr};
+        };
+
+        template <typename MType>
+        NpyDataset<MType>::NpyDataset(const std::string& path) : file(std::make_shared<MappedFile>(path)) {
+            parse_header();
+            // 第0维之外的部分放到(c, h, w)的后面几维
+            if(shape.size() > 4) {
+                throw std::runtime_error("`" + path + "` has more than 4 dimensions");
+            }
+            for(size_t i {1}; i < shape.size(); ++i) {
+                sample_dim[3 - shape.size() + i] = shape[i];
+            }
+        }
+
+        template <typename MType>
+        NpyDataset<MType>::NpyDataset(const std::string& path, matrix_dim sample_dim) : file(std::make_shared<MappedFile>(path)) {
+            parse_header();
+            if(sample_dim.size() != 3 || sample_dim[0] * sample_dim[1] * sample_dim[2] != sample_len) {
+                throw std::runtime_error("Sample shape does not match `" + path + "`");
+            }
+            this->sample_dim = sample_dim;
+        }
+
+        template <typename MType>
+        void NpyDataset<MType>::parse_header() {
+            // magic(6) + 版本(2) + 头长度(1.0是2字节，2.0和3.0是4字节，小端)
+            const char* bytes {file->data()};
+            std::size_t file_size {file->size()};
+            const std::string& path {file->get_path()};
+            if(file_size < npy::magic_string_length + 4 || std::memcmp(bytes, npy::magic_string, npy::magic_string_length) != 0) {
+                throw std::runtime_error("`" + path + "` is not a npy file");
+            }
+            unsigned char major {static_cast<unsigned char>(bytes[npy::magic_string_length])};
+            const unsigned char* len_p {reinterpret_cast<const unsigned char*>(bytes + npy::magic_string_length + 2)};
+            std::size_t header_len {0};
+            std::size_t prefix_len {npy::magic_string_length + 2};
+            if(major == 1) {
+                header_len = len_p[0] | (len_p[1] << 8);
+                prefix_len += 2;
+            }
+            else if((major == 2 || major == 3) && file_size >= prefix_len + 4) {
+                header_len = len_p[0] | (len_p[1] << 8) | (len_p[2] << 16) | (static_cast<std::size_t>(len_p[3]) << 24);
+                prefix_len += 4;
+            }
+            else {
+                throw std::runtime_error("`" + path + "` has an unsupported npy version");
+            }
+            if(prefix_len + header_len > file_size) {
+                throw std::runtime_error("`" + path + "` has a truncated npy header");
+            }
+            npy::header_t header {npy::parse_header(std::string(bytes + prefix_len, header_len))};
+            if(header.fortran_order && header.shape.size() > 1) {
+                throw std::runtime_error("`" + path + "` is stored in Fortran order");
+            }
+            if(header.dtype.byteorder != npy::host_endian_char && header.dtype.byteorder != npy::no_endian_char) {
+                throw std::runtime_error("`" + path + "` is not stored in host byte order");
+            }
+            shape = matrix_dim(header.shape.begin(), header.shape.end());
+            if(shape.empty()) {
+                // 标量当成一个样本
+                shape.push_back(1);
+            }
+            sample_len = 1;
+            for(size_t i {1}; i < shape.size(); ++i) {
+                sample_len *= shape[i];
+            }
+            item_size = header.dtype.itemsize;
+            data_offset = prefix_len + header_len;
+            if(data_offset + item_size * sample_len * shape[0] > file_size) {
+                throw std::runtime_error("`" + path + "` is shorter than its header says");
+            }
+            convert_p = select_convert(header.dtype);
+            same_type = header.dtype.tie() == npy::dtype_map.at(std::type_index(typeid(MType))).tie();
+        }
+
+        template <typename MType>
+        template <typename From>
+        void NpyDataset<MType>::convert(const char* src, unsigned long n, MType* dst) {
+            // 映射的数据不一定按From对齐，逐个memcpy出来
+            for(unsigned long i {0}; i < n; ++i) {
+                From value;
+                std::memcpy(&value, src + i * sizeof(From), sizeof(From));
+                dst[i] = static_cast<MType>(value);
+            }
+        }
+
+        template <typename MType>
+        typename NpyDataset<MType>::convert_func NpyDataset<MType>::select_convert(const npy::dtype_t& dtype) {
+            if(dtype.kind == 'f' && dtype.itemsize == 4) {
+                return &NpyDataset<MType>::convert<float>;
+            }
+            if(dtype.kind == 'f' && dtype.itemsize == 8) {
+                return &NpyDataset<MType>::convert<double>;
+            }
+            if(dtype.kind == 'i' && dtype.itemsize == 1) {
+                return &NpyDataset<MType>::convert<std::int8_t>;
+            }
+            if(dtype.kind == 'i' && dtype.itemsize == 2) {
+                return &NpyDataset<MType>::convert<std::int16_t>;
+            }
+            if(dtype.kind == 'i' && dtype.itemsize == 4) {
+                return &NpyDataset<MType>::convert<std::int32_t>;
+            }
+            if(dtype.kind == 'i' && dtype.itemsize == 8) {
+                return &NpyDataset<MType>::convert<std::int64_t>;
+            }
+            if(dtype.kind == 'u' && dtype.itemsize == 1) {
+                return &NpyDataset<MType>::convert<std::uint8_t>;
+            }
+            if(dtype.kind == 'u' && dtype.itemsize == 2) {
+                return &NpyDataset<MType>::convert<std::uint16_t>;
+            }
+            if(dtype.kind == 'u' && dtype.itemsize == 4) {
+                return &NpyDataset<MType>::convert<std::uint32_t>;
+            }
+            if(dtype.kind == 'u' && dtype.itemsize == 8) {
+                return &NpyDataset<MType>::convert<std::uint64_t>;
+            }
+            throw std::runtime_error("Unsupported npy dtype `" + dtype.str() + "`");
+        }
+
+        template <typename MType>
+        unsigned long NpyDataset<MType>::size() const {
+            return shape[0];
+        }
+
+        template <typename MType>
+        const typename NpyDataset<MType>::matrix_dim& NpyDataset<MType>::get_shape() const {
+            return shape;
+        }
+
+        template <typename MType>
+        typename NpyDataset<MType>::matrix_dim NpyDataset<MType>::get_sample_dim() const {
+            return get_batch_dim(1);
+        }
+
+        template <typename MType>
+        typename NpyDataset<MType>::matrix_dim NpyDataset<MType>::get_batch_dim(unsigned long batch) const {
+            return matrix_dim {batch, sample_dim[0], sample_dim[1], sample_dim[2]};
+        }
+
+        template <typename MType>
+        unsigned long NpyDataset<MType>::get_sample_len() const {
+            return sample_len;
+        }
+
+        template <typename MType>
+        bool NpyDataset<MType>::is_zero_copy() const {
+            return same_type && reinterpret_cast<std::uintptr_t>(file->data() + data_offset) % alignof(MType) == 0;
+        }
+
+        template <typename MType>
+        const char* NpyDataset<MType>::sample_bytes(unsigned long index) const {
+            return file->data() + data_offset + index * sample_len * item_size;
+        }
+
+        template <typename MType>
+        const MType* NpyDataset<MType>::get_ptr(unsigned long index) const {
+            if(!is_zero_copy()) {
+                throw std::runtime_error("`" + file->get_path() + "` can not be viewed as the matrix type without conversion");
+            }
+            if(index >= size()) {
+                throw std::runtime_error("Sample index out of range");
+            }
+            return reinterpret_cast<const MType*>(sample_bytes(index));
+        }
+
+        template <typename MType>
+        void NpyDataset<MType>::read_batch(unsigned long begin, unsigned long count, Matrix<MType>& batch) const {
+            if(begin + count > size()) {
+                throw std::runtime_error("Batch range out of range");
+            }
+            batch.resize(get_batch_dim(count), MType(0));
+            MType* dst {batch.mutable_data()};
+            if(same_type) {
+                std::memcpy(dst, sample_bytes(begin), count * sample_len * sizeof(MType));
+                return;
+            }
+            convert_p(sample_bytes(begin), count * sample_len, dst);
+        }
+
+        template <typename MType>
+        void NpyDataset<MType>::read_batch(const std::vector<unsigned long>& indices, Matrix<MType>& batch) const {
+            batch.resize(get_batch_dim(indices.size()), MType(0));
+            MType* dst {batch.mutable_data()};
+            for(size_t i {0}; i < indices.size(); ++i) {
+                if(indices[i] >= size()) {
+                    throw std::runtime_error("Sample index out of range");
+                }
+                if(same_type) {
+                    std::memcpy(dst + i * sample_len, sample_bytes(indices[i]), sample_len * sizeof(MType));
+                }
+                else {
+                    convert_p(sample_bytes(indices[i]), sample_len, dst + i * sample_len);
+                }
+            }
+        }
+
+        template <typename MType>
+        void NpyDataset<MType>::prefetch(unsigned long begin, unsigned long count) const {
+            file->advise(data_offset + begin * sample_len * item_size, count * sample_len * item_size, MADV_WILLNEED);
+        }
+
+        template <typename MType>
+        void NpyDataset<MType>::release(unsigned long begin, unsigned long count) const {
+            // 只读的文件映射，丢掉以后再访问会重新从文件读，不会丢数据
+            file->advise(data_offset + begin * sample_len * item_size, count * sample_len * item_size, MADV_DONTNEED);
+        }
+    }
+}
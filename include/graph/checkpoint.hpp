@@ -0,0 +1,329 @@
+#pragma once
+#include "./graph.hpp"
+#include "./node/weight.hpp"
+#include "../data/npy_dataset.hpp"
+#include "../math/matrix.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+
+namespace aedlf {
+    namespace graph {
+        /*
+        checkpoint文件：保存图里所有可训练的叶子节点（权重、bias），按节点名字索引
+        布局（本机字节序）：
+            magic "AEDLFCKP"，uint32版本，uint32张量个数，uint64索引字节数
+            索引：每个张量依次是uint32名字长度、名字、char类型（'f'）、uint8元素字节数、uint16保留、uint64 dim[4]、uint64数据偏移
+            数据：每个张量的起始偏移按64字节对齐
+        打开时mmap整个文件，只解析索引；类型和MType相同时get_ptr直接给出映射页面上的指针
+        bf16混合精度下保存的是完整精度的主权重
+        以后有了优化器，它的状态按"节点名/状态名"作为名字存进同一个文件
+        */
+        struct CheckpointFormat {
+            static const char* magic() { return "AEDLFCKP"; };
+            static const std::size_t magic_len {8};
+            static const std::uint32_t version {1};
+            static const std::size_t alignment {64};
+        };
+
+        template <typename MType>
+        class Checkpoint {
+            public:
+                using matrix_dim = std::vector<unsigned long>;
+                explicit Checkpoint(const std::string& path);
+                size_t size() const;
+                bool contains(const std::string& name) const;
+                std::vector<std::string> get_names() const; // 按写入的顺序
+                matrix_dim get_dim(const std::string& name) const;
+                bool is_zero_copy(const std::string& name) const; // 类型和MType相同，get_ptr可用
+                const MType* get_ptr(const std::string& name) const; // 映射页面上的数据，不拷贝，Checkpoint析构以后失效
+                void read(const std::string& name, Matrix<MType>& m) const; // 拷贝（必要时转换类型）到m里，尺寸相同时复用m的内存
+                static void save(const Graph<MType>& graph, const std::string& path);
+                void load(const Graph<MType>& graph) const; // 按名字写回图里的参数，缺少或者尺寸不同时抛异常
+            protected:
+                struct Entry {
+                    std::string name;
+                    char kind;
+                    std::size_t item_size;
+                    matrix_dim dim;
+                    std::size_t offset;
+                };
+                static std::vector<std::shared_ptr<BaseNode<MType>>> trainable_nodes(const Graph<MType>& graph);
+                const Entry& find(const std::string& name) const;
+                void parse_index();
+                std::shared_ptr<data::MappedFile> file;
+                std::vector<Entry> entries;
+                std::map<std::string, size_t> entry_index;
+        };
+
+        template <typename MType>
+        Checkpoint<MType>::Checkpoint(const std::string& path) : file(std::make_shared<data::MappedFile>(path)) {
+            parse_index();
+        }
+
+        template <typename MType>
+        std::vector<std::shared_ptr<BaseNode<MType>>> Checkpoint<MType>::trainable_nodes(const Graph<MType>& graph) {
+            std::vector<std::shared_ptr<BaseNode<MType>>> result;
+            const std::vector<std::shared_ptr<BaseNode<MType>>>& nodes {graph.get_nodes()};
+            for(size_t i {0}; i < nodes.size(); ++i) {
+                if(nodes[i]->get_parents_len() == 0 && nodes[i]->is_require_grad()) {
+                    result.push_back(nodes[i]);
+                }
+            }
+            return result;
+        }
+
+        template <typename MType>
+        void Checkpoint<MType>::save(const Graph<MType>& graph, const std::string& path) {
+            std::vector<std::shared_ptr<BaseNode<MType>>> nodes {trainable_nodes(graph)};
+            std::vector<Matrix<MType>> values;
+            std::map<std::string, size_t> names;
+            for(size_t i {0}; i < nodes.size(); ++i) {
+                const std::string& name {nodes[i]->get_name()};
+                if(!names.insert(std::make_pair(name, i)).second) {
+                    throw std::runtime_error("Checkpoint needs unique node names, `" + name + "` appears twice");
+                }
+                std::shared_ptr<WeightNode<MType>> weight {std::dynamic_pointer_cast<WeightNode<MType>>(nodes[i])};
+                values.push_back(weight ? weight->get_master() : nodes[i]->get_data());
+            }
+            // 先算出索引的长度，数据从索引后面第一个对齐的位置开始
+            std::size_t index_len {0};
+            for(size_t i {0}; i < nodes.size(); ++i) {
+                index_len += 4 + nodes[i]->get_name().size() + 4 + 8 * 5;
+            }
+            std::size_t header_len {CheckpointFormat::magic_len + 4 + 4 + 8};
+            std::size_t offset {header_len + index_len};
+            std::vector<std::size_t> offsets;
+            for(size_t i {0}; i < values.size(); ++i) {
+                offset = (offset + CheckpointFormat::alignment - 1) / CheckpointFormat::alignment * CheckpointFormat::alignment;
+                offsets.push_back(offset);
+                offset += values[i].get_data()->size() * sizeof(MType);
+            }
+            // 先写临时文件再改名，写到一半失败不会破坏原来的checkpoint
+            std::string tmp_path {path + ".tmp"};
+            {
+                std::ofstream out {tmp_path, std::ios::binary | std::ios::trunc};
+                if(!out) {
+                    throw std::runtime_error("Can not write `" + tmp_path + "`");
+                }
+                auto put = [&out](const void* p, std::size_t len) {
+                    out.write(static_cast<const char*>(p), static_cast<std::streamsize>(len));
+                };
+                std::uint32_t version {CheckpointFormat::version};
+                std::uint32_t count {static_cast<std::uint32_t>(values.size())};
+                std::uint64_t index_len_u64 {index_len};
+                put(CheckpointFormat::magic(), CheckpointFormat::magic_len);
+                put(&version, 4);
+                put(&count, 4);
+                put(&index_len_u64, 8);
+                for(size_t i {0}; i < values.size(); ++i) {
+                    const std::string& name {nodes[i]->get_name()};
+                    std::uint32_t name_len {static_cast<std::uint32_t>(name.size())};
+                    char kind {'f'};
+                    std::uint8_t item_size {sizeof(MType)};
+                    std::uint16_t reserved {0};
+                    put(&name_len, 4);
+                    put(name.data(), name.size());
+                    put(&kind, 1);
+                    put(&item_size, 1);
+                    put(&reserved, 2);
+                    matrix_dim dim {values[i].get_dim()};
+                    for(size_t d {0}; d < 4; ++d) {
+                        std::uint64_t dim_u64 {dim[d]};
+                        put(&dim_u64, 8);
+                    }
+                    std::uint64_t offset_u64 {offsets[i]};
+                    put(&offset_u64, 8);
+                }
+                const char zeros[CheckpointFormat::alignment] {};
+                std::size_t written {header_len + index_len};
+                for(size_t i {0}; i < values.size(); ++i) {
+                    put(zeros, offsets[i] - written);
+                    std::size_t len {values[i].get_data()->size() * sizeof(MType)};
+                    put(values[i].get_data()->data(), len);
+                    written = offsets[i] + len;
+                }
+                if(!out) {
+                    throw std::runtime_error("Failed writing `" + tmp_path + "`");
+                }
+            }
+            if(std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+                std::remove(tmp_path.c_str());
+                throw std::runtime_error("Can not rename `" + tmp_path + "` to `" + path + "`");
+            }
+        }
+
+        template <typename MType>
+        void Checkpoint<MType>::parse_index() {
+            const char* bytes {file->data()};
+            std::size_t file_size {file->size()};
+            const std::string& path {file->get_path()};
+            std::size_t pos {0};
+            // 映射的数据不一定按字段对齐，逐个memcpy出来
+            auto take = [&](void* p, std::size_t len) {
+                if(pos + len > file_size) {
+                    throw std::runtime_error("`" + path + "` is a truncated checkpoint");
+                }
+                std::memcpy(p, bytes + pos, len);
+                pos += len;
+            };
+            if(file_size < CheckpointFormat::magic_len || std::memcmp(bytes, CheckpointFormat::magic(), CheckpointFormat::magic_len) != 0) {
+                throw std::runtime_error("`" + path + "` is not a checkpoint");
+            }
+            pos = CheckpointFormat::magic_len;
+            std::uint32_t version {0};
+            std::uint32_t count {0};
+            std::uint64_t index_len {0};
+            take(&version, 4);
+            take(&count, 4);
+            take(&index_len, 8);
+            if(version != CheckpointFormat::version) {
+                throw std::runtime_error("`" + path + "` has an unsupported checkpoint version");
+            }
+            for(std::uint32_t i {0}; i < count; ++i) {
+                Entry entry {};
+                std::uint32_t name_len {0};
+                take(&name_len, 4);
+                if(pos + name_len > file_size) {
+                    throw std::runtime_error("`" + path + "` is a truncated checkpoint");
+                }
+                entry.name.assign(bytes + pos, name_len);
+                pos += name_len;
+                std::uint8_t item_size {0};
+                std::uint16_t reserved {0};
+                take(&entry.kind, 1);
+                take(&item_size, 1);
+                take(&reserved, 2);
+                entry.item_size = item_size;
+                unsigned long numel {1};
+                for(size_t d {0}; d < 4; ++d) {
+                    std::uint64_t dim {0};
+                    take(&dim, 8);
+                    entry.dim.push_back(static_cast<unsigned long>(dim));
+                    numel *= entry.dim.back();
+                }
+                std::uint64_t offset {0};
+                take(&offset, 8);
+                entry.offset = static_cast<std::size_t>(offset);
+                if(entry.kind != 'f' || (entry.item_size != 4 && entry.item_size != 8)) {
+                    throw std::runtime_error("`" + path + "` has an unsupported type for `" + entry.name + "`");
+                }
+                if(entry.offset > file_size || numel * entry.item_size > file_size - entry.offset) {
+                    throw std::runtime_error("`" + path + "` is shorter than its index says");
+                }
+                entry_index[entry.name] = entries.size();
+                entries.push_back(entry);
+            }
+        }
+
+        template <typename MType>
+        const typename Checkpoint<MType>::Entry& Checkpoint<MType>::find(const std::string& name) const {
+            auto iter = entry_index.find(name);
+            if(iter == entry_index.end()) {
+                throw std::runtime_error("`" + file->get_path() + "` has no tensor named `" + name + "`");
+            }
+            return entries[iter->second];
+        }
+
+        template <typename MType>
+        size_t Checkpoint<MType>::size() const {
+            return entries.size();
+        }
+
+        template <typename MType>
+        bool Checkpoint<MType>::contains(const std::string& name) const {
+            return entry_index.count(name) != 0;
+        }
+
+        template <typename MType>
+        std::vector<std::string> Checkpoint<MType>::get_names() const {
+            std::vector<std::string> names;
+            for(size_t i {0}; i < entries.size(); ++i) {
+                names.push_back(entries[i].name);
+            }
+            return names;
+        }
+
+        template <typename MType>
+        typename Checkpoint<MType>::matrix_dim Checkpoint<MType>::get_dim(const std::string& name) const {
+            return find(name).dim;
+        }
+
+        template <typename MType>
+        bool Checkpoint<MType>::is_zero_copy(const std::string& name) const {
+            const Entry& entry {find(name)};
+            return std::is_floating_point<MType>::value && entry.item_size == sizeof(MType) && entry.offset % alignof(MType) == 0;
+        }
+
+        template <typename MType>
+        const MType* Checkpoint<MType>::get_ptr(const std::string& name) const {
+            if(!is_zero_copy(name)) {
+                throw std::runtime_error("`" + name + "` in `" + file->get_path() + "` can not be viewed as the matrix type without conversion");
+            }
+            return reinterpret_cast<const MType*>(file->data() + find(name).offset);
+        }
+
+        template <typename MType>
+        void Checkpoint<MType>::read(const std::string& name, Matrix<MType>& m) const {
+            const Entry& entry {find(name)};
+            m.resize(entry.dim, MType(0));
+            MType* dst {m.mutable_data()};
+            unsigned long numel {m.get_data()->size()};
+            const char* src {file->data() + entry.offset};
+            if(is_zero_copy(name)) {
+                std::memcpy(dst, src, numel * sizeof(MType));
+                return;
+            }
+            for(unsigned long i {0}; i < numel; ++i) {
+                if(entry.item_size == 4) {
+                    float value;
+                    std::memcpy(&value, src + i * 4, 4);
+                    dst[i] = static_cast<MType>(value);
+                }
+                else {
+                    double value;
+                    std::memcpy(&value, src + i * 8, 8);
+                    dst[i] = static_cast<MType>(value);
+                }
+            }
+        }
+
+        template <typename MType>
+        void Checkpoint<MType>::load(const Graph<MType>& graph) const {
+            std::vector<std::shared_ptr<BaseNode<MType>>> nodes {trainable_nodes(graph)};
+            // 先全部检查一遍，不会只加载了一半
+            for(size_t i {0}; i < nodes.size(); ++i) {
+                if(get_dim(nodes[i]->get_name()) != nodes[i]->get_data_dim()) {
+                    throw std::runtime_error("`" + nodes[i]->get_name() + "` in `" + file->get_path() + "` has a different shape");
+                }
+            }
+            Matrix<MType> converted {};
+            for(size_t i {0}; i < nodes.size(); ++i) {
+                const std::string& name {nodes[i]->get_name()};
+                const MType* src {nullptr};
+                if(is_zero_copy(name)) {
+                    src = get_ptr(name);
+                }
+                else {
+                    read(name, converted);
+                    src = converted.get_data()->data();
+                }
+                std::shared_ptr<WeightNode<MType>> weight {std::dynamic_pointer_cast<WeightNode<MType>>(nodes[i])};
+                if(weight) {
+                    weight->set_weight(src);
+                    continue;
+                }
+                Matrix<MType>& node_data {nodes[i]->get_m_data()};
+                std::copy(src, src + node_data.get_data()->size(), node_data.mutable_data());
+            }
+        }
+    }
+}
@@ -35,8 +35,9 @@ namespace aedlf {
                 void backward(node_ptr end) override;
                 void forward() override;
                 void update(MType lr) override;
-                Matrix<MType> get_output() override;
+                Matrix<MType> get_data() override;
                 void clear_jacobi() override;
+                void set_fused(bool fused); // 构建之前调用，false时退回Padding -> Img2col -> Conv2d的节点链
             protected:
                 node_ptr weight_node;
                 node_ptr bias_node;
@@ -54,6 +55,7 @@ namespace aedlf {
                 std::string weight_init;
                 std::string bias_init;
                 MType padding_init;
+                bool fused {true};
         };
 
         template <typename MType>
@@ -66,7 +68,7 @@ namespace aedlf {
             this->in_channel = in_channel;
             this->output_channel = output_channel;
             this->kernel_size = kernel_shape {kernel_size, kernel_size};
-            this-padding_size = kernel_shape {padding, padding};
+            this->padding_size = kernel_shape {padding, padding};
             this->stride = stride;
             this->weight_init = weight_init;
             this->bias_init = bias_init;
@@ -79,7 +81,7 @@ namespace aedlf {
             this->in_channel = in_channel;
             this->output_channel = output_channel;
             this->kernel_size = kernel_shape {kernel_size};
-            this-padding_size = kernel_shape {padding};
+            this->padding_size = kernel_shape {padding};
             this->stride = stride;
             this->weight_init = weight_init;
             this->bias_init = bias_init;
@@ -92,7 +94,7 @@ namespace aedlf {
             this->in_channel = in_channel;
             this->output_channel = output_channel;
             this->kernel_size = kernel_size;
-            this-padding_size = padding;
+            this->padding_size = padding;
             this->stride = stride;
             this->weight_init = weight_init;
             this->bias_init = bias_init;
@@ -101,56 +103,81 @@ namespace aedlf {
         }
         
 
+        template <typename MType>
+        void Conv2d<MType>::set_fused(bool fused) {
+            assert(!BaseComponent<MType>::complete_construct);
+            this->fused = fused;
+        }
+
         template <typename MType>
         void Conv2d<MType>::construct(node_ptr_c input_node_c) {
             node_ptr input {input_node_c->at(0)};
             matrix_dim c_dim {input->get_data_dim()};
-            matrix_tools::MakeMatrix<MType> mm;
-            output_h = int(std::max(std::floor((c_dim[2] + 2 * padding_size[0] - kernel_size[0] - 2) / stride + 1), 0.0));
-            output_w = int(std::max(std::floor((c_dim[3] + 2 * padding_size[1] - kernel_size[1] - 2) / stride + 1), 0.0));
-            assert(output_h > 0 && output_w > 0);
-            // init padding
-            c_dim[2] = c_dim[2] + 2 * padding_size[0];
-            c_dim[3] = c_dim[3] + 2 * padding_size[1];
-            padding_node = std::make_shared<graph::PaddingNode<MType>>(
-                BaseComponent<MType>::layer_name + "_PADDING",
-                c_dim
-            );
-            // init img2col
-            c_dim[2] = kernel_size[0] * kernel_size[1];
-            c_dim[3] = output_h * output_w;
-            img2col_node = std::make_shared<graph::Img2colNode<MType>>(
-                BaseComponent<MType>::layer_name + "_IMG2COL",
-                c_dim
-            );
-            // init weight
-            c_dim[1] = in_channel;
-            c_dim[2] = output_channel;
-            c_dim[3] = kernel_size[0] * kernel_size[1];
+            assert(c_dim[1] == in_channel && stride > 0);
+            assert(c_dim[2] + 2 * padding_size[0] >= kernel_size[0] && c_dim[3] + 2 * padding_size[1] >= kernel_size[1]);
+            output_h = (c_dim[2] + 2 * padding_size[0] - kernel_size[0]) / stride + 1;
+            output_w = (c_dim[3] + 2 * padding_size[1] - kernel_size[1]) / stride + 1;
+            unsigned long batch {c_dim[0]};
+            // init weight，权重和bias的batch维固定是1，前向时广播到每个样本上，换batch大小不用重建图
             weight_node = std::make_shared<graph::WeightNode<MType>>(
                 BaseComponent<MType>::layer_name + "_WEIGHT",
-                c_dim
+                matrix_dim {1, in_channel, output_channel, kernel_size[0] * kernel_size[1]}
             );
             weight_node->init_data(weight_init);
-            // init bias
-            c_dim[1] = 1;
-            c_dim[2] = output_channel;
-            c_dim[3] = output_h * output_w;
-            bias_node = std::make_shared<graph::MulNode<MType>>(
-                BaseComponent<MType>::layer_name + "_BIAS",
-                c_dim
-            );
-            // init conv
-            conv_node = std::make_shared<graph::Conv2dNode<MType>>(
-                BaseComponent<MType>::layer_name + "_CORE",
-                c_dim
-            );
-            // connect graph
-            padding_node->add_parent(input);
-            img2col_node->add_parent(padding_node);
-            conv_node->add_parent(weight_node);
-            conv_node->add_parent(img2col_node);
-            conv_node->add_parent(bias_node);
+            if(fused) {
+                // 直接在原图上卷积，不生成填充后的图像和img2col矩阵
+                bias_node = std::make_shared<graph::WeightNode<MType>>(
+                    BaseComponent<MType>::layer_name + "_BIAS",
+                    matrix_dim {1, 1, output_channel, output_h * output_w}
+                );
+                bias_node->init_data(bias_init);
+                conv_node = std::make_shared<graph::FusedConv2dNode<MType>>(
+                    BaseComponent<MType>::layer_name + "_CORE",
+                    matrix_dim {batch, 1, output_channel, output_h * output_w},
+                    kernel_size,
+                    padding_size,
+                    stride,
+                    padding_init
+                );
+                conv_node->add_parent(weight_node);
+                conv_node->add_parent(input);
+                conv_node->add_parent(bias_node);
+            }
+            else {
+                // init padding
+                c_dim[2] = c_dim[2] + 2 * padding_size[0];
+                c_dim[3] = c_dim[3] + 2 * padding_size[1];
+                padding_node = std::make_shared<graph::PaddingNode<MType>>(
+                    BaseComponent<MType>::layer_name + "_PADDING",
+                    c_dim,
+                    padding_size,
+                    padding_init
+                );
+                // init img2col
+                c_dim[2] = kernel_size[0] * kernel_size[1];
+                c_dim[3] = output_h * output_w;
+                img2col_node = std::make_shared<graph::Img2colNode<MType>>(
+                    BaseComponent<MType>::layer_name + "_IMG2COL",
+                    c_dim,
+                    kernel_size,
+                    stride
+                );
+                // Conv2dNode要求bias和w * x的尺寸相同，按输入通道各有一份
+                bias_node = std::make_shared<graph::WeightNode<MType>>(
+                    BaseComponent<MType>::layer_name + "_BIAS",
+                    matrix_dim {1, in_channel, output_channel, output_h * output_w}
+                );
+                bias_node->init_data(bias_init);
+                conv_node = std::make_shared<graph::Conv2dNode<MType>>(
+                    BaseComponent<MType>::layer_name + "_CORE",
+                    matrix_dim {batch, 1, output_channel, output_h * output_w}
+                );
+                padding_node->add_parent(input);
+                img2col_node->add_parent(padding_node);
+                conv_node->add_parent(weight_node);
+                conv_node->add_parent(img2col_node);
+                conv_node->add_parent(bias_node);
+            }
             BaseComponent<MType>::in_c = input_node_c;
             BaseComponent<MType>::out_c->push_back(conv_node);
             BaseComponent<MType>::complete_construct = true;
@@ -171,21 +198,24 @@ namespace aedlf {
         }
 
         template <typename MType>
-        Matrix<MType> Conv2d<MType>::get_output() {
-            return conv_node.get_data();
+        Matrix<MType> Conv2d<MType>::get_data() {
+            return conv_node->get_data();
         }
 
         template <typename MType>
         void Conv2d<MType>::clear_jacobi() {
             weight_node->clear_jacobi();
             bias_node->clear_jacobi();
-            padding_node->clear_jacobi();
-            img2col_node->clear_jacobi();
+            if(!fused) {
+                padding_node->clear_jacobi();
+                img2col_node->clear_jacobi();
+            }
             conv_node->clear_jacobi();
         }
 
         template <typename MType>
         void Conv2d<MType>::backward(node_ptr end) {
+            utils::ProfileScope profile {BaseComponent<MType>::layer_name, "component_backward"};
             BaseComponent<MType>::in_c->at(0)->backward(end);
             weight_node->backward(end);
             bias_node->backward(end);
@@ -193,13 +223,15 @@ namespace aedlf {
 
         template <typename MType>
         void Conv2d<MType>::forward() {
+            utils::ProfileScope profile {BaseComponent<MType>::layer_name, "component_forward"};
             conv_node->forward();
         }
 
         template <typename MType>
         void Conv2d<MType>::update(MType lr) {
-            weight_node->update(lr);
-            bias_node->update(lr);
+            utils::ProfileScope profile {BaseComponent<MType>::layer_name, "component_update"};
+            weight_node->run_update(lr);
+            bias_node->run_update(lr);
         }
     }
 }
\ No newline at end of file
@@ -75,6 +75,7 @@ namespace aedlf {
 
         template <typename MType>
         void Data<MType>::backward(node_ptr end) {
+            utils::ProfileScope profile {BaseComponent<MType>::layer_name, "component_backward"};
             data_node->backward(end);
         }
     }
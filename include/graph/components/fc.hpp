@@ -61,22 +61,19 @@ namespace aedlf {
                 input->view_data({c_dim[0], 1, input_dim_, 1});
             }
             // modify input_data 
-            // init weight
-            c_dim[2] = output_dim_;
-            c_dim[3] = input_dim_;
+            // init weight，参数的batch维固定是1，前向时广播到每个样本上，换batch大小不用重建图
             weight_node = std::make_shared<graph::WeightNode<MType>>(
                 BaseComponent<MType>::layer_name + "_WEIGHT",
-                c_dim
+                matrix_dim {1, 1, output_dim_, input_dim_}
             );
             weight_node->init_data(weight_init_);
             // init bias
-            c_dim[2] = output_dim_;
-            c_dim[3] = 1;
             bias_node = std::make_shared<graph::WeightNode<MType>>(
                 BaseComponent<MType>::layer_name + "_BIAS",
-                c_dim
+                matrix_dim {1, 1, output_dim_, 1}
             );
             bias_node->init_data(bias_init_);
+            c_dim = matrix_dim {c_dim[0], 1, output_dim_, 1};
             mul_node = std::make_shared<graph::MulNode<MType>>(
                 BaseComponent<MType>::layer_name + "_MUL",
                 c_dim
@@ -131,21 +128,23 @@ namespace aedlf {
 
         template <typename MType>
         void FC<MType>::backward(node_ptr end) {
+            utils::ProfileScope profile {BaseComponent<MType>::layer_name, "component_backward"};
             weight_node->backward(end);
             bias_node->backward(end);
-            weight_node->view_jacobi(origin_dim);
             BaseComponent<MType>::in_c->at(0)->backward(end);
         }
 
         template <typename MType>
         void FC<MType>::forward() {
+            utils::ProfileScope profile {BaseComponent<MType>::layer_name, "component_forward"};
             add_node->forward();
         }
 
         template <typename MType>
         void FC<MType>::update(MType lr) {
-            weight_node->update(lr);
-            bias_node->update(lr);
+            utils::ProfileScope profile {BaseComponent<MType>::layer_name, "component_update"};
+            weight_node->run_update(lr);
+            bias_node->run_update(lr);
         }
     }
 }
\ No newline at end of file
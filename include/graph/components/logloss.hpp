@@ -68,11 +68,13 @@ namespace aedlf {
 
         template <typename MType>
         void LogLoss<MType>::forward() {
+            utils::ProfileScope profile {BaseComponent<MType>::layer_name, "component_forward"};
             loss_node->forward();
         }
 
         template <typename MType>
         void LogLoss<MType>::backward(node_ptr end) {
+            utils::ProfileScope profile {BaseComponent<MType>::layer_name, "component_backward"};
             BaseComponent<MType>::in_c->at(0)->backward(end);
         }
 
@@ -134,11 +134,13 @@ namespace aedlf {
 
         template <typename MType>
         void MaxPool2d<MType>::backward(node_ptr end) {
+            utils::ProfileScope profile {BaseComponent<MType>::layer_name, "component_backward"};
             BaseComponent<MType>::in_c->at(0)->backward(end);
         }
 
         template <typename MType>
         void MaxPool2d<MType>::forward() {
+            utils::ProfileScope profile {BaseComponent<MType>::layer_name, "component_forward"};
             maxpool_node->forward();
         }
     }
@@ -65,11 +65,13 @@ namespace aedlf {
 
         template <typename MType>
         void Sigmoid<MType>::forward() {
+            utils::ProfileScope profile {BaseComponent<MType>::layer_name, "component_forward"};
             activate_node->forward();
         }
 
         template <typename MType>
         void Sigmoid<MType>::backward(node_ptr end) {
+            utils::ProfileScope profile {BaseComponent<MType>::layer_name, "component_backward"};
             BaseComponent<MType>::in_c->at(0)->backward(end);
             activate_node->backward(end);
         }
@@ -1,24 +1,542 @@
 #pragma once
-#include "./node/base.hpp"
+#include "./node/common/base.hpp"
+#include "./memory_plan.hpp"
+#include "./loss_scaler.hpp"
+#include "../math/bfloat16.hpp"
+#include "../utils/allocator.hpp"
 #include "../math/matrix.hpp"
 #include <cstddef>
+#include <cassert>
 #include <stdexcept>
-#include <set>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+#include <memory>
 
 
 namespace aedlf {
     namespace graph {
+        /*
+        从输出节点编译出来的计算图，节点按拓扑序排成一个数组，父节点用下标表示（CSR格式）
+        forward/backward只需要顺序遍历执行计划，不再递归，也不再每次都遍历children/parents
+        梯度缓冲区在第一次backward时按节点数据尺寸分配，之后每次只清零
+        plan_memory之后所有中间结果和梯度都绑定到按存活区间复用的槽位上，训练循环里不再分配这些内存
+        规划以后不要再单独调用节点或组件的clear_jacobi，槽位是共享的，清空会影响其他张量
+        混合精度：set_precision(bfloat16)以后每个节点前传完都把结果舍入到bf16，权重节点改用主权重更新；enable_loss_scaling以后backward的起点是scale，update先把梯度除回去，有inf/nan就跳过这一步
+        推理模式：set_inference(true)以后节点丢掉梯度和只给反向用的缓存，第一次forward以后按只前传的存活区间规划内存，中间结果在最后一个子节点算完以后就让出槽位，只有输出节点的结果保证可读
+        */
         template <typename MType>
         class Graph {
             public:
                 using node_ptr = std::shared_ptr<BaseNode<MType>>;
                 using node_ptr_c = std::vector<std::shared_ptr<BaseNode<MType>>>;
-                virtual ~Graph();
+                using index_c = std::vector<size_t>;
+                using matrix_dim = std::vector<unsigned long>;
+                using matrix_data_p = typename Matrix<MType>::matrix_data_p;
                 Graph() {};
-                virtual void forward(std::initializer_list<Matrix<MType>> input_m) = 0; //常规前传
-                void clear_jacobi();
+                Graph(node_ptr output_node);
+                virtual ~Graph();
+                void compile(node_ptr output_node); // 重新编译执行计划，图结构改变以后需要调用
+                virtual void forward(); // 按拓扑序执行所有节点
+                virtual void forward(std::initializer_list<Matrix<MType>> input_m); // 按拓扑序依次替换输入节点的数据再前传
+                virtual void backward(); // 输出节点对所有需要梯度的节点求梯度，结果在各节点的jacobi里
+                virtual void update(MType lr); // 开了loss scaling的话梯度里有inf/nan时不更新
+                void clear_jacobi(); // 规划内存以后什么都不做，梯度由backward按需清零
+                void set_precision(Precision precision);
+                Precision get_precision() const;
+                void enable_loss_scaling(const LossScaler<MType>& scaler = LossScaler<MType> {});
+                void disable_loss_scaling();
+                bool is_loss_scaling() const;
+                const LossScaler<MType>& get_loss_scaler() const;
+                void set_inference(bool inference); // 推理模式下不能backward和update
+                bool is_inference() const;
+                size_t size() const;
+                node_ptr get_node(size_t node_id) const;
+                node_ptr get_output() const;
+                const node_ptr_c& get_nodes() const;
+                const index_c& get_input_index() const;
+                const index_c& get_forward_plan() const;
+                const index_c& get_backward_plan() const;
+                size_t get_parents_len(size_t node_id) const;
+                size_t get_parent_index(size_t node_id, size_t parent_i) const;
+                void plan_memory(bool training = true); // 需要先forward一次确定每个节点的尺寸，training为false时不保留反向传播需要的中间结果
+                void release_memory_plan(); // 每个节点换回独立的内存
+                bool is_memory_planned() const;
+                const MemoryPlan<MType>& get_memory_plan() const;
+                const utils::ScratchArena& get_scratch() const;
             protected:
-                
+                void run_forward_plan();
+                void prepare_grad_buffer();
+                void fill_grad(node_ptr node, MType value);
+                bool input_dim_changed();
+                node_ptr output;
+                node_ptr_c nodes; // 拓扑序，父节点在前
+                index_c parent_offset; // 节点i的父节点下标在parent_index[parent_offset[i], parent_offset[i + 1])里
+                index_c parent_index;
+                index_c input_index; // 不需要梯度的叶子节点，也就是输入数据
+                index_c forward_plan; // 有父节点的节点，前传时依次计算
+                index_c backward_plan; // 需要往回传梯度的节点，已经是逆拓扑序
+                index_c grad_index; // 需要梯度缓冲区的节点
+                MemoryPlan<MType> memory_plan;
+                bool memory_planned {false};
+                bool plan_for_training {true};
+                std::vector<matrix_data_p> arena; // 每个槽位一块内存
+                std::vector<matrix_dim> planned_input_dim;
+                index_c activation_index; // 绑定了槽位的中间结果
+                std::vector<index_c> grad_init; // backward第k步之前需要清零的梯度
+                std::shared_ptr<utils::ScratchArena> scratch {std::make_shared<utils::ScratchArena>()}; // 规划以后vjp里的临时变量都放在这里，每次backward开头整块重置
+                Precision precision {Precision::float32};
+                bool loss_scaling {false};
+                LossScaler<MType> loss_scaler;
+                bool inference {false};
         };
+
+        template <typename MType>
+        Graph<MType>::Graph(node_ptr output_node) {
+            compile(output_node);
+        }
+
+        template <typename MType>
+        Graph<MType>::~Graph() {
+
+        }
+
+        template <typename MType>
+        void Graph<MType>::compile(node_ptr output_node) {
+            if(memory_planned) {
+                release_memory_plan();
+            }
+            output = output_node;
+            nodes = BaseNode<MType>::topological_order(output_node);
+            std::unordered_map<BaseNode<MType>*, size_t> node_id;
+            for(size_t i {0}; i < nodes.size(); ++i) {
+                node_id[nodes[i].get()] = i;
+            }
+            parent_offset.assign(1, 0);
+            parent_index.clear();
+            input_index.clear();
+            forward_plan.clear();
+            backward_plan.clear();
+            grad_index.clear();
+            // 节点需要梯度：本身需要梯度，并且是可训练的叶子节点或者至少有一个父节点需要梯度
+            std::vector<bool> need_grad(nodes.size(), false);
+            for(size_t i {0}; i < nodes.size(); ++i) {
+                size_t parents_len {nodes[i]->get_parents_len()};
+                bool parent_need_grad {false};
+                for(size_t parent_i {0}; parent_i < parents_len; ++parent_i) {
+                    size_t p {node_id.at(nodes[i]->get_parent(parent_i).get())};
+                    parent_index.push_back(p);
+                    parent_need_grad = parent_need_grad || need_grad[p];
+                }
+                parent_offset.push_back(parent_index.size());
+                if(parents_len == 0) {
+                    need_grad[i] = nodes[i]->is_require_grad();
+                    if(!need_grad[i]) {
+                        input_index.push_back(i);
+                    }
+                }
+                else {
+                    need_grad[i] = nodes[i]->is_require_grad() && parent_need_grad;
+                    if(!need_grad[i]) {
+                        // 梯度传不到任何可训练节点，子节点的vjp就不用再算它的梯度了
+                        nodes[i]->no_grad();
+                    }
+                    forward_plan.push_back(i);
+                }
+                if(need_grad[i]) {
+                    grad_index.push_back(i);
+                }
+            }
+            for(size_t i {nodes.size()}; i > 0; --i) {
+                if(need_grad[i - 1] && get_parents_len(i - 1) != 0) {
+                    backward_plan.push_back(i - 1);
+                }
+            }
+            if(precision != Precision::float32) {
+                // 新加进来的权重节点也要换成主权重
+                set_precision(precision);
+            }
+            if(inference) {
+                for(size_t i {0}; i < nodes.size(); ++i) {
+                    nodes[i]->set_inference(true);
+                }
+            }
+        }
+
+        template <typename MType>
+        void Graph<MType>::forward() {
+            if(!output) {
+                throw std::runtime_error("`Graph` is not compiled");
+            }
+            bool replan {memory_planned && input_dim_changed()};
+            if(replan) {
+                // 输入尺寸变了，原来的槽位大小不对，先换回独立内存，算完再重新规划
+                release_memory_plan();
+            }
+            utils::Profiler::global().next_iteration();
+            run_forward_plan();
+            if(replan || (inference && !memory_planned)) {
+                // 绑定槽位以后原来的结果就丢了，按新的绑定再算一遍，backward和输出拿到的才是这一次的结果
+                plan_memory(plan_for_training && !inference);
+                run_forward_plan();
+            }
+        }
+
+        template <typename MType>
+        void Graph<MType>::run_forward_plan() {
+            for(size_t i {0}; i < forward_plan.size(); ++i) {
+                node_ptr node {nodes[forward_plan[i]]};
+                node->run_forward();
+                // 模拟bf16计算：下一个节点拿到的输入只有bf16的精度，loss本身保留完整精度
+                if(precision == Precision::bfloat16 && node != output) {
+                    Matrix<MType>& result {node->get_m_data()};
+                    MType* result_p {result.mutable_data()};
+                    kernel::round_bfloat16(result.get_data()->size(), result_p, result_p);
+                }
+            }
+        }
+
+        template <typename MType>
+        void Graph<MType>::forward(std::initializer_list<Matrix<MType>> input_m) {
+            if(input_m.size() > input_index.size()) {
+                throw std::runtime_error("`Graph` got more input matrices than input nodes");
+            }
+            size_t input_i {0};
+            for(auto m_iter = input_m.begin(); m_iter != input_m.end(); ++m_iter, ++input_i) {
+                nodes[input_index[input_i]]->set_data(*m_iter);
+            }
+            forward();
+        }
+
+        template <typename MType>
+        void Graph<MType>::prepare_grad_buffer() {
+            // 尺寸不变就只清零，不重新分配
+            for(size_t i {0}; i < grad_index.size(); ++i) {
+                node_ptr node {nodes[grad_index[i]]};
+                matrix_dim data_dim {node->get_data_dim()};
+                if(node->is_jacobi_exists() && node->get_jacobi_dim() == data_dim) {
+                    fill_grad(node, MType(0));
+                }
+                else {
+                    node->clear_jacobi();
+                    node->accumulate_jacobi(Matrix<MType>(data_dim, MType(0)));
+                }
+            }
+        }
+
+        template <typename MType>
+        void Graph<MType>::fill_grad(node_ptr node, MType value) {
+            // 原地改节点自己的梯度，绑定槽位时写进槽位，和别的矩阵共用内存时先分开
+            Matrix<MType>& grad {node->get_m_jacobi()};
+            MType* grad_p {grad.mutable_data()};
+            std::fill(grad_p, grad_p + grad.get_data()->size(), value);
+        }
+
+        template <typename MType>
+        void Graph<MType>::backward() {
+            if(!output) {
+                throw std::runtime_error("`Graph` is not compiled");
+            }
+            if(inference) {
+                throw std::runtime_error("`Graph` is in inference mode, call set_inference(false) before backward");
+            }
+            if(backward_plan.empty()) {
+                return;
+            }
+            if(memory_planned && !plan_for_training) {
+                throw std::runtime_error("`Graph` memory is planned for inference, call plan_memory(true) before backward");
+            }
+            // 还有节点需要梯度的话输出节点一定也需要，缓冲区已经分配好了
+            if(!memory_planned) {
+                prepare_grad_buffer();
+            }
+            fill_grad(output, loss_scaling ? loss_scaler.get_scale() : MType(1));
+            // 梯度都绑定在槽位上以后，vjp里新建的矩阵都是临时的
+            std::unique_ptr<utils::ScratchScope> scratch_scope;
+            if(memory_planned) {
+                scratch->reset();
+                scratch_scope.reset(new utils::ScratchScope {*scratch});
+            }
+            for(size_t i {0}; i < backward_plan.size(); ++i) {
+                if(memory_planned) {
+                    // 槽位可能刚被别的张量用过，第一次累加之前才清零
+                    for(size_t grad_i {0}; grad_i < grad_init[i].size(); ++grad_i) {
+                        fill_grad(nodes[grad_init[i][grad_i]], MType(0));
+                    }
+                }
+                node_ptr node {nodes[backward_plan[i]]};
+                node->run_vjp(node->get_jacobi());
+            }
+        }
+
+        template <typename MType>
+        void Graph<MType>::update(MType lr) {
+            if(inference) {
+                throw std::runtime_error("`Graph` is in inference mode, call set_inference(false) before update");
+            }
+            if(loss_scaling) {
+                // 只有叶子节点的梯度会被update用到，除回scale的同时检查有没有溢出
+                MType inv_scale {MType(1) / loss_scaler.get_scale()};
+                bool found_inf {false};
+                for(size_t i {0}; i < grad_index.size(); ++i) {
+                    node_ptr node {nodes[grad_index[i]]};
+                    if(node->get_parents_len() != 0 || !node->is_jacobi_exists()) {
+                        continue;
+                    }
+                    Matrix<MType>& grad {node->get_m_jacobi()};
+                    unsigned long grad_len {grad.get_data()->size()};
+                    MType* grad_p {grad.mutable_data()};
+                    kernel::scale(grad_len, inv_scale, grad_p);
+                    found_inf = found_inf || !LossScaler<MType>::all_finite(grad_len, grad_p);
+                }
+                loss_scaler.update(found_inf);
+                if(found_inf) {
+                    return;
+                }
+            }
+            for(size_t i {0}; i < grad_index.size(); ++i) {
+                nodes[grad_index[i]]->run_update(lr);
+            }
+        }
+
+        template <typename MType>
+        void Graph<MType>::clear_jacobi() {
+            if(memory_planned) {
+                // 梯度槽位和还活着的中间结果共用，不能在这里清零；backward在每个梯度第一次累加之前会清零（grad_init）
+                return;
+            }
+            for(size_t i {0}; i < nodes.size(); ++i) {
+                nodes[i]->clear_jacobi();
+            }
+        }
+
+        template <typename MType>
+        void Graph<MType>::set_precision(Precision precision) {
+            this->precision = precision;
+            for(size_t i {0}; i < nodes.size(); ++i) {
+                nodes[i]->set_precision(precision);
+            }
+        }
+
+        template <typename MType>
+        Precision Graph<MType>::get_precision() const {
+            return precision;
+        }
+
+        template <typename MType>
+        void Graph<MType>::enable_loss_scaling(const LossScaler<MType>& scaler) {
+            loss_scaler = scaler;
+            loss_scaling = true;
+        }
+
+        template <typename MType>
+        void Graph<MType>::disable_loss_scaling() {
+            loss_scaling = false;
+        }
+
+        template <typename MType>
+        bool Graph<MType>::is_loss_scaling() const {
+            return loss_scaling;
+        }
+
+        template <typename MType>
+        const LossScaler<MType>& Graph<MType>::get_loss_scaler() const {
+            return loss_scaler;
+        }
+
+        template <typename MType>
+        void Graph<MType>::set_inference(bool inference) {
+            if(inference == this->inference) {
+                return;
+            }
+            // 训练的规划里有梯度槽位，推理的规划里中间结果会互相覆盖，都不能沿用；推理模式下一次forward自动重新规划，回到训练以后需要的话再调用plan_memory
+            release_memory_plan();
+            this->inference = inference;
+            for(size_t i {0}; i < nodes.size(); ++i) {
+                nodes[i]->set_inference(inference);
+            }
+        }
+
+        template <typename MType>
+        bool Graph<MType>::is_inference() const {
+            return inference;
+        }
+
+        template <typename MType>
+        size_t Graph<MType>::size() const {
+            return nodes.size();
+        }
+
+        template <typename MType>
+        typename Graph<MType>::node_ptr Graph<MType>::get_node(size_t node_id) const {
+            return nodes.at(node_id);
+        }
+
+        template <typename MType>
+        typename Graph<MType>::node_ptr Graph<MType>::get_output() const {
+            return output;
+        }
+
+        template <typename MType>
+        const typename Graph<MType>::node_ptr_c& Graph<MType>::get_nodes() const {
+            return nodes;
+        }
+
+        template <typename MType>
+        const typename Graph<MType>::index_c& Graph<MType>::get_input_index() const {
+            return input_index;
+        }
+
+        template <typename MType>
+        const typename Graph<MType>::index_c& Graph<MType>::get_forward_plan() const {
+            return forward_plan;
+        }
+
+        template <typename MType>
+        const typename Graph<MType>::index_c& Graph<MType>::get_backward_plan() const {
+            return backward_plan;
+        }
+
+        template <typename MType>
+        size_t Graph<MType>::get_parents_len(size_t node_id) const {
+            return parent_offset[node_id + 1] - parent_offset[node_id];
+        }
+
+        template <typename MType>
+        size_t Graph<MType>::get_parent_index(size_t node_id, size_t parent_i) const {
+            assert(parent_i < get_parents_len(node_id));
+            return parent_index[parent_offset[node_id] + parent_i];
+        }
+
+        template <typename MType>
+        bool Graph<MType>::input_dim_changed() {
+            for(size_t i {0}; i < input_index.size(); ++i) {
+                if(nodes[input_index[i]]->get_data_dim() != planned_input_dim[i]) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        template <typename MType>
+        void Graph<MType>::plan_memory(bool training) {
+            if(!output) {
+                throw std::runtime_error("`Graph` is not compiled");
+            }
+            if(memory_planned) {
+                release_memory_plan();
+            }
+            plan_for_training = training;
+            memory_plan.clear();
+            size_t nodes_len {nodes.size()};
+            size_t backward_len {training ? backward_plan.size() : 0};
+            size_t end_step {nodes_len + backward_len};
+            // 时间轴：前传第i步是拓扑序里的第i个节点，反传第k步是nodes_len + k，最后是update
+            std::vector<size_t> backward_step(nodes_len, size_t(-1));
+            for(size_t k {0}; k < backward_len; ++k) {
+                backward_step[backward_plan[k]] = nodes_len + k;
+            }
+            // 中间结果在最后一个子节点前传以后失效，训练时还要等子节点和自己的vjp做完
+            std::vector<size_t> last_use(nodes_len, 0);
+            std::vector<size_t> grad_first(nodes_len, size_t(-1));
+            for(size_t i {0}; i < nodes_len; ++i) {
+                last_use[i] = std::max(last_use[i], i);
+                if(backward_step[i] != size_t(-1)) {
+                    last_use[i] = std::max(last_use[i], backward_step[i]);
+                }
+                for(size_t parent_i {0}; parent_i < get_parents_len(i); ++parent_i) {
+                    size_t p {get_parent_index(i, parent_i)};
+                    last_use[p] = std::max(last_use[p], i);
+                    if(backward_step[i] != size_t(-1)) {
+                        last_use[p] = std::max(last_use[p], backward_step[i]);
+                        grad_first[p] = std::min(grad_first[p], backward_step[i]);
+                    }
+                }
+            }
+            size_t output_id {nodes_len - 1};
+            last_use[output_id] = end_step;
+            std::vector<size_t> activation_tensor;
+            activation_index.clear();
+            for(size_t i {0}; i < forward_plan.size(); ++i) {
+                size_t node_id {forward_plan[i]};
+                matrix_dim dim {nodes[node_id]->get_data_dim()};
+                activation_index.push_back(node_id);
+                activation_tensor.push_back(memory_plan.add_tensor(dim[0] * dim[1] * dim[2] * dim[3], node_id, last_use[node_id]));
+            }
+            // 梯度从第一次被子节点累加开始存活，中间节点做完自己的vjp就失效，叶子节点要留到update
+            std::vector<size_t> grad_tensor;
+            index_c planned_grad;
+            grad_init.assign(backward_len, index_c {});
+            if(training && backward_len != 0) {
+                grad_first[output_id] = nodes_len;
+                for(size_t i {0}; i < grad_index.size(); ++i) {
+                    size_t node_id {grad_index[i]};
+                    if(grad_first[node_id] == size_t(-1)) {
+                        continue;
+                    }
+                    matrix_dim dim {nodes[node_id]->get_data_dim()};
+                    size_t last {get_parents_len(node_id) == 0 ? end_step : backward_step[node_id]};
+                    planned_grad.push_back(node_id);
+                    grad_tensor.push_back(memory_plan.add_tensor(dim[0] * dim[1] * dim[2] * dim[3], grad_first[node_id], last));
+                    if(node_id != output_id) {
+                        grad_init[grad_first[node_id] - nodes_len].push_back(node_id);
+                    }
+                }
+            }
+            memory_plan.plan();
+            arena.assign(memory_plan.get_slots_len(), nullptr);
+            for(size_t slot_id {0}; slot_id < arena.size(); ++slot_id) {
+                arena[slot_id] = Matrix<MType>::make_data(memory_plan.get_slot_size(slot_id), MType(0));
+            }
+            // 绑定以后节点原来的数据就丢了，需要重新forward
+            for(size_t i {0}; i < activation_index.size(); ++i) {
+                node_ptr node {nodes[activation_index[i]]};
+                // 移动赋值，绑定只交给节点自己的矩阵
+                node->get_m_data() = Matrix<MType>(node->get_data_dim(), arena[memory_plan.get_slot(activation_tensor[i])]);
+            }
+            for(size_t i {0}; i < planned_grad.size(); ++i) {
+                node_ptr node {nodes[planned_grad[i]]};
+                node->get_m_jacobi() = Matrix<MType>(node->get_data_dim(), arena[memory_plan.get_slot(grad_tensor[i])]);
+            }
+            planned_input_dim.clear();
+            for(size_t i {0}; i < input_index.size(); ++i) {
+                planned_input_dim.push_back(nodes[input_index[i]]->get_data_dim());
+            }
+            memory_planned = true;
+        }
+
+        template <typename MType>
+        void Graph<MType>::release_memory_plan() {
+            if(!memory_planned) {
+                return;
+            }
+            for(size_t i {0}; i < activation_index.size(); ++i) {
+                node_ptr node {nodes[activation_index[i]]};
+                node->set_data(node->get_m_data().clone());
+            }
+            for(size_t i {0}; i < grad_index.size(); ++i) {
+                nodes[grad_index[i]]->set_jacobi(Matrix<MType> {});
+            }
+            activation_index.clear();
+            grad_init.clear();
+            arena.clear();
+            memory_plan.clear();
+            memory_planned = false;
+        }
+
+        template <typename MType>
+        bool Graph<MType>::is_memory_planned() const {
+            return memory_planned;
+        }
+
+        template <typename MType>
+        const MemoryPlan<MType>& Graph<MType>::get_memory_plan() const {
+            return memory_plan;
+        }
+
+        template <typename MType>
+        const utils::ScratchArena& Graph<MType>::get_scratch() const {
+            return *scratch;
+        }
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <cmath>
+#include <cstddef>
+
+
+namespace aedlf {
+    namespace graph {
+        /*
+        动态loss scaling：反向传播的起点乘上scale，让很小的梯度在低精度下不变成0
+        update之前把梯度除回去并检查inf/nan，溢出就跳过这一步并把scale减半，连续growth_interval步没有溢出就把scale翻倍
+        */
+        template <typename MType>
+        class LossScaler {
+            public:
+                LossScaler(MType init_scale = MType(65536), unsigned long growth_interval = 2000, MType growth_factor = MType(2), MType backoff_factor = MType(0.5));
+                MType get_scale() const;
+                void update(bool found_inf); // 每一步update以后调用，found_inf为true表示这一步被跳过了
+                unsigned long get_skipped_steps() const;
+                static bool all_finite(unsigned long n, const MType* x);
+            protected:
+                MType scale;
+                unsigned long growth_interval;
+                MType growth_factor;
+                MType backoff_factor;
+                unsigned long good_steps {0};
+                unsigned long skipped_steps {0};
+        };
+
+        template <typename MType>
+        LossScaler<MType>::LossScaler(MType init_scale, unsigned long growth_interval, MType growth_factor, MType backoff_factor)
+            : scale(init_scale), growth_interval(growth_interval), growth_factor(growth_factor), backoff_factor(backoff_factor) {
+
+        }
+
+        template <typename MType>
+        MType LossScaler<MType>::get_scale() const {
+            return scale;
+        }
+
+        template <typename MType>
+        void LossScaler<MType>::update(bool found_inf) {
+            if(found_inf) {
+                scale *= backoff_factor;
+                good_steps = 0;
+                ++skipped_steps;
+                return;
+            }
+            ++good_steps;
+            if(good_steps == growth_interval) {
+                MType grown {scale * growth_factor};
+                // 翻倍以后溢出就保持原来的scale
+                if(std::isfinite(grown)) {
+                    scale = grown;
+                }
+                good_steps = 0;
+            }
+        }
+
+        template <typename MType>
+        unsigned long LossScaler<MType>::get_skipped_steps() const {
+            return skipped_steps;
+        }
+
+        template <typename MType>
+        bool LossScaler<MType>::all_finite(unsigned long n, const MType* x) {
+            // inf - inf和nan - nan都是nan，一遍累加就能查出来，不用逐个分支
+            MType acc {0};
+            for(unsigned long i {0}; i < n; ++i) {
+                acc += x[i] - x[i];
+            }
+            return acc == MType(0);
+        }
+    }
+}
@@ -0,0 +1,152 @@
+#pragma once
+#include <cstddef>
+#include <cassert>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+
+namespace aedlf {
+    namespace graph {
+        /*
+        基于存活区间的静态内存规划
+        每个张量给出元素个数和存活区间[first, last]（执行计划里的步数），区间不相交的张量可以共用一个槽位
+        Matrix要求内存长度和尺寸完全一致，所以只有元素个数相同的张量才会共用槽位
+        所有槽位按顺序排在一块arena里，get_offset是张量在arena里的起始位置（按元素计）
+        */
+        template <typename MType>
+        class MemoryPlan {
+            public:
+                MemoryPlan() {};
+                void clear();
+                size_t add_tensor(unsigned long size, size_t first, size_t last);
+                void plan();
+                size_t get_tensors_len() const;
+                size_t get_slots_len() const;
+                size_t get_slot(size_t tensor_id) const;
+                unsigned long get_slot_size(size_t slot_id) const;
+                unsigned long get_offset(size_t tensor_id) const;
+                unsigned long get_peak() const; // arena的元素个数
+                unsigned long get_naive() const; // 不复用时所有张量的元素个数之和
+                unsigned long get_peak_bytes() const;
+                unsigned long get_naive_bytes() const;
+            protected:
+                struct TensorLife {
+                    unsigned long size;
+                    size_t first;
+                    size_t last;
+                };
+                std::vector<TensorLife> tensors;
+                std::vector<size_t> tensor_slot;
+                std::vector<unsigned long> slot_size;
+                std::vector<unsigned long> slot_offset;
+        };
+
+        template <typename MType>
+        void MemoryPlan<MType>::clear() {
+            tensors.clear();
+            tensor_slot.clear();
+            slot_size.clear();
+            slot_offset.clear();
+        }
+
+        template <typename MType>
+        size_t MemoryPlan<MType>::add_tensor(unsigned long size, size_t first, size_t last) {
+            assert(first <= last);
+            tensors.push_back(TensorLife {size, first, last});
+            return tensors.size() - 1;
+        }
+
+        template <typename MType>
+        void MemoryPlan<MType>::plan() {
+            // 按开始时间分配，槽位的最后使用时间严格小于新张量的开始时间才能复用
+            // 同一步里读父节点、写子节点的两个张量区间会相交，不会共用
+            std::vector<size_t> order(tensors.size());
+            for(size_t i {0}; i < order.size(); ++i) {
+                order[i] = i;
+            }
+            std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+                return tensors[a].first < tensors[b].first;
+            });
+            tensor_slot.assign(tensors.size(), 0);
+            slot_size.clear();
+            std::vector<size_t> slot_last;
+            std::multimap<unsigned long, size_t> free_slots; // 元素个数 -> 槽位
+            for(size_t i {0}; i < order.size(); ++i) {
+                const TensorLife& tensor {tensors[order[i]]};
+                for(size_t slot_id {0}; slot_id < slot_last.size(); ++slot_id) {
+                    if(slot_last[slot_id] != size_t(-1) && slot_last[slot_id] < tensor.first) {
+                        free_slots.insert(std::make_pair(slot_size[slot_id], slot_id));
+                        slot_last[slot_id] = size_t(-1);
+                    }
+                }
+                auto free_iter = free_slots.find(tensor.size);
+                size_t slot_id {0};
+                if(free_iter != free_slots.end()) {
+                    slot_id = free_iter->second;
+                    free_slots.erase(free_iter);
+                    slot_last[slot_id] = tensor.last;
+                }
+                else {
+                    slot_id = slot_size.size();
+                    slot_size.push_back(tensor.size);
+                    slot_last.push_back(tensor.last);
+                }
+                tensor_slot[order[i]] = slot_id;
+            }
+            slot_offset.assign(slot_size.size(), 0);
+            for(size_t slot_id {1}; slot_id < slot_size.size(); ++slot_id) {
+                slot_offset[slot_id] = slot_offset[slot_id - 1] + slot_size[slot_id - 1];
+            }
+        }
+
+        template <typename MType>
+        size_t MemoryPlan<MType>::get_tensors_len() const {
+            return tensors.size();
+        }
+
+        template <typename MType>
+        size_t MemoryPlan<MType>::get_slots_len() const {
+            return slot_size.size();
+        }
+
+        template <typename MType>
+        size_t MemoryPlan<MType>::get_slot(size_t tensor_id) const {
+            return tensor_slot.at(tensor_id);
+        }
+
+        template <typename MType>
+        unsigned long MemoryPlan<MType>::get_slot_size(size_t slot_id) const {
+            return slot_size.at(slot_id);
+        }
+
+        template <typename MType>
+        unsigned long MemoryPlan<MType>::get_offset(size_t tensor_id) const {
+            return slot_offset.at(tensor_slot.at(tensor_id));
+        }
+
+        template <typename MType>
+        unsigned long MemoryPlan<MType>::get_peak() const {
+            return slot_size.empty() ? 0 : slot_offset.back() + slot_size.back();
+        }
+
+        template <typename MType>
+        unsigned long MemoryPlan<MType>::get_naive() const {
+            unsigned long naive {0};
+            for(size_t i {0}; i < tensors.size(); ++i) {
+                naive += tensors[i].size;
+            }
+            return naive;
+        }
+
+        template <typename MType>
+        unsigned long MemoryPlan<MType>::get_peak_bytes() const {
+            return get_peak() * sizeof(MType);
+        }
+
+        template <typename MType>
+        unsigned long MemoryPlan<MType>::get_naive_bytes() const {
+            return get_naive() * sizeof(MType);
+        }
+    }
+}
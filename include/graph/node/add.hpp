@@ -11,13 +11,22 @@ namespace aedlf {
                 using BaseNode<MType>::BaseNode;
                 void compute_forward() override;
                 void compute_jacobi(Matrix<MType>& m, node_ptr parent_node) override;
+                Jacobian<MType> local_jacobi(node_ptr parent_node) override;
+                void vjp(const Matrix<MType>& grad_output) override;
         };
 
         template <typename MType>
         void AddNode<MType>::compute_forward() {
             size_t parents_len {BaseNode<MType>::get_parents_len()};
             assert(parents_len >= 2);
-            BaseNode<MType>::data.copy_from(BaseNode<MType>::get_parent(0)->get_data());
+            Matrix<MType> a {BaseNode<MType>::get_parent(0)->get_data()};
+            Matrix<MType> b {BaseNode<MType>::get_parent(1)->get_data()};
+            if(parents_len == 2 && a.get_dim() == b.get_dim()) {
+                // 尺寸相同的两个加数在一次遍历里加完
+                BaseNode<MType>::data = a + b;
+                return;
+            }
+            BaseNode<MType>::data.copy_from(a);
             for(size_t i {1}; i < parents_len; ++i) {
                 BaseNode<MType>::data += BaseNode<MType>::get_parent(i)->get_data();
             }
@@ -32,5 +41,31 @@ namespace aedlf {
             matrix_tools::MakeMatrix<MType> mm {jacobi_dim};
             mm.identity(m);
         }
+
+        template <typename MType>
+        Jacobian<MType> AddNode<MType>::local_jacobi(node_ptr) {
+            return Jacobian<MType>::identity();
+        }
+
+        template <typename MType>
+        void AddNode<MType>::vjp(const Matrix<MType>& grad_output) {
+            matrix_tools::MakeMatrix<MType> mm {};
+            for(size_t i {0}; i < BaseNode<MType>::get_parents_len(); ++i) {
+                node_ptr parent {BaseNode<MType>::get_parent(i)};
+                if(!parent->is_require_grad()) {
+                    continue;
+                }
+                if(parent->get_data_dim() == grad_output.get_dim()) {
+                    parent->accumulate_jacobi(grad_output);
+                    continue;
+                }
+                // batch是1的加数（比如bias）在前向时广播到了每个样本上
+                assert(parent->get_data_dim()[0] == 1);
+                Matrix<MType> reduced {};
+                mm.sum_batch(grad_output, reduced);
+                assert(parent->get_data_dim() == reduced.get_dim());
+                parent->accumulate_jacobi(reduced);
+            }
+        }
     }
 }
\ No newline at end of file
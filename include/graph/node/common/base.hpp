@@ -1,6 +1,9 @@
 #pragma once
 #include "../../../math/matrix.hpp"
 #include "../../../math/tools.hpp"
+#include "../../../math/jacobian.hpp"
+#include "../../../math/bfloat16.hpp"
+#include "../../../utils/profiler.hpp"
 #include <initializer_list>
 #include <stdexcept>
 #include <vector>
@@ -9,6 +12,7 @@
 #include <random>
 #include <map>
 #include <thread>
+#include <unordered_set>
 
 
 namespace aedlf {
@@ -18,7 +22,7 @@ namespace aedlf {
             public:
                 using graph_nodes = std::shared_ptr<std::vector<std::shared_ptr<BaseNode>>>;
                 using node_ptr = std::shared_ptr<BaseNode>;
-                using matrix_data_p = std::shared_ptr<std::vector<MType>>;
+                using matrix_data_p = typename Matrix<MType>::matrix_data_p;
                 using matrix_p = std::shared_ptr<Matrix<MType>>;
                 using matrix_dim = std::vector<unsigned long>;
                 BaseNode(std::string node_name, matrix_dim m_dim);
@@ -35,19 +39,28 @@ namespace aedlf {
                 virtual size_t get_childrens_len();
                 virtual void forward();
                 virtual void backward(node_ptr output_node);// 计算本节点的jacobi矩阵
+                void backward_vjp(); // 在输出节点上调用，按逆拓扑序对所有祖先节点做vjp，jacobi里存放输出对节点的梯度
+                static std::vector<node_ptr> topological_order(node_ptr output_node); // output_node的所有祖先节点（包括自己），按拓扑序排列
+                virtual void vjp(const Matrix<MType>& grad_output); // 由输出对本节点的梯度计算父节点的梯度并累加到父节点上，默认走local_jacobi
                 virtual void compute_forward() {};
+                void run_forward(); // 执行图和递归的forward都从这里调compute_forward，profiler打开时记录这一次调用
+                void run_vjp(const Matrix<MType>& grad_output);
+                void run_update(MType lr);
+                virtual double estimate_flops(bool backward); // 粗略的浮点运算次数，只给profiler用
                 virtual void compute_jacobi(Matrix<MType>& m, node_ptr parent_node) {}; //计算子节点对当前节点的jacobi矩阵，一般在子节点（计算结果）上调用这个方法可以得到本节点对子节点的jacobi矩阵
+                virtual Jacobian<MType> local_jacobi(node_ptr parent_node); // 结构化的compute_jacobi，默认把compute_jacobi的结果包装成稠密矩阵
                 virtual void no_grad();
                 virtual void ask_grad();
                 virtual void add_parent(node_ptr parent);
                 virtual void add_children(node_ptr children);
                 virtual void set_data(const Matrix<MType>& m);
+                virtual void set_jacobi(const Matrix<MType>& m);
                 virtual void clear_jacobi();
                 virtual void update(MType lr) {};
-                virtual Matrix<MType> get_data();
+                virtual Matrix<MType> get_data(); // 拷贝，O(1)，之后改写它不会影响节点
                 virtual Matrix<MType> get_jacobi();
-                virtual matrix_p get_m_data();
-                virtual matrix_p get_m_jacobi();
+                virtual Matrix<MType>& get_m_data(); // 节点自己的矩阵，要原地改数据的时候用
+                virtual Matrix<MType>& get_m_jacobi();
                 virtual matrix_dim get_data_dim();
                 virtual matrix_dim get_jacobi_dim();
                 virtual void view_data(matrix_dim shape);
@@ -57,7 +70,17 @@ namespace aedlf {
                 virtual void view_jacobi(unsigned long n, unsigned long c, unsigned long h, unsigned long w);
                 virtual void view_jacobi(std::initializer_list<unsigned long> shape);
                 virtual void init_data(std::string init_method) {};
+                virtual void set_precision(Precision /*precision*/) {}; // 只有带主权重的节点（WeightNode）会用到
+                virtual void set_inference(bool inference); // 只做前向：丢掉梯度，子类还要丢掉只给反向用的缓存
+                bool is_inference() const;
+                virtual bool is_require_grad();
+                void accumulate_jacobi(const Matrix<MType>& grad); // jacobi += grad，jacobi为空时直接拷贝
+                template <typename E>
+                void accumulate_jacobi(const expr::Expr<E>& grad); // 逐元素表达式直接累加进jacobi，不先算出临时矩阵
+                template <typename Func>
+                void accumulate_jacobi_with(const matrix_dim& dim, Func compute); // compute(out, beta)把梯度写进out：out = 梯度 + beta * out，已有同样尺寸的jacobi时直接累加进去
                 bool is_jacobi_exists();
+                const std::string& get_name() const;
             protected:
                 graph_nodes parents {std::make_shared<std::vector<std::shared_ptr<BaseNode>>>()};
                 graph_nodes childrens {std::make_shared<std::vector<std::shared_ptr<BaseNode>>>()};
@@ -66,6 +89,7 @@ namespace aedlf {
                 Matrix<MType> jacobi {}; // 结果节点对本节点的jacobi矩阵
                 bool wait_backward {false};
                 bool require_grad {true};
+                bool inference {false};
         };
 
         template <typename MType>
@@ -200,12 +224,65 @@ namespace aedlf {
                     parents->at(parent_i)->forward();
                 }
             }
-            compute_forward();
+            run_forward();
             wait_backward = true;
         }
 
+        template <typename MType>
+        void BaseNode<MType>::run_forward() {
+            utils::ProfileScope profile {name, "forward"};
+            compute_forward();
+            if(profile.is_active()) {
+                profile.set_flops(estimate_flops(false));
+            }
+        }
+
+        template <typename MType>
+        void BaseNode<MType>::run_vjp(const Matrix<MType>& grad_output) {
+            utils::ProfileScope profile {name, "backward"};
+            if(profile.is_active()) {
+                profile.set_flops(estimate_flops(true));
+            }
+            vjp(grad_output);
+        }
+
+        template <typename MType>
+        void BaseNode<MType>::run_update(MType lr) {
+            // 只有叶子节点（权重）的update会改数据，中间节点的是空操作，不记录
+            if(get_parents_len() != 0 || !utils::Profiler::global().is_enabled()) {
+                update(lr);
+                return;
+            }
+            utils::ProfileScope profile {name, "update"};
+            if(is_jacobi_exists()) {
+                profile.set_flops(2.0 * jacobi.get_data()->size());
+            }
+            update(lr);
+        }
+
+        template <typename MType>
+        double BaseNode<MType>::estimate_flops(bool backward) {
+            // 默认按逐元素计算估计：前向每个输出元素一次，反向对每个需要梯度的父节点各一次
+            if(get_parents_len() == 0 || data.is_uninitialized()) {
+                return 0;
+            }
+            double numel {static_cast<double>(data.get_data()->size())};
+            if(!backward) {
+                return numel;
+            }
+            double flops {0};
+            for(size_t parent_i {0}; parent_i < get_parents_len(); ++parent_i) {
+                if(get_parent(parent_i)->is_require_grad()) {
+                    flops += numel;
+                }
+            }
+            return flops;
+        }
+
         template <typename MType>
         void BaseNode<MType>::backward(node_ptr output_node) {
+            // 递归的backward会嵌套，汇总表里的self时间去掉了子节点的部分
+            utils::ProfileScope profile {name, "backward"};
             if(!require_grad) {
                 for(size_t children_i {0}; children_i < childrens->size(); ++children_i) {
                     jacobi += childrens->at(children_i)->jacobi;
@@ -220,40 +297,162 @@ namespace aedlf {
                 matrix_tools::MakeMatrix<MType> mm {jacobi_dim};
                 mm.identity(BaseNode<MType>::jacobi);
             }
-            matrix_dim temp_dim {1,1,1,1};
             matrix_dim children_dim {output_node->data.get_dim()};
             matrix_dim this_dim {data.get_dim()};
-            Matrix<MType> temp {temp_dim, MType(0)};
             jacobi.resize(this_dim[0], this_dim[1], children_dim[2] * children_dim[3], this_dim[2] * this_dim[3], 0);
             for(size_t children_i {0}; children_i < childrens->size(); ++children_i) {
                 if(childrens->at(children_i)->wait_backward) {
                     childrens->at(children_i)->backward(output_node);
                 }
-                childrens->at(children_i)->compute_jacobi(temp, std::enable_shared_from_this<BaseNode<MType>>::shared_from_this());
-                matrix_dim child_jacobi_dim {childrens->at(children_i)->jacobi.get_dim()};
-                matrix_dim temp_jacobi_dim {temp.get_dim()};
-                if(child_jacobi_dim[2] == temp_jacobi_dim[3]) {
-                    jacobi += childrens->at(children_i)->jacobi * temp;
-                }
-                else {
-                    jacobi += temp.mul_v(childrens->at(children_i)->jacobi);
-                }
-                
+                // jacobi += 子节点的jacobi * 子节点对本节点的局部jacobi
+                Jacobian<MType> local {childrens->at(children_i)->local_jacobi(std::enable_shared_from_this<BaseNode<MType>>::shared_from_this())};
+                local.left_mul_acc(childrens->at(children_i)->jacobi, jacobi);
             }
             jacobi.view(data.get_dim());
             wait_backward = false;
         }
 
+        template <typename MType>
+        std::vector<typename BaseNode<MType>::node_ptr> BaseNode<MType>::topological_order(node_ptr output_node) {
+            // 非递归的后序遍历，父节点一定排在子节点前面
+            std::vector<node_ptr> order;
+            std::unordered_set<BaseNode<MType>*> visited;
+            std::vector<std::pair<node_ptr, size_t>> stack;
+            stack.emplace_back(output_node, 0);
+            visited.insert(output_node.get());
+            while(!stack.empty()) {
+                node_ptr node {stack.back().first};
+                size_t parent_i {stack.back().second};
+                if(parent_i < node->get_parents_len()) {
+                    ++stack.back().second;
+                    node_ptr parent {node->get_parent(parent_i)};
+                    if(visited.insert(parent.get()).second) {
+                        stack.emplace_back(parent, 0);
+                    }
+                    continue;
+                }
+                order.push_back(node);
+                stack.pop_back();
+            }
+            return order;
+        }
+
+        template <typename MType>
+        void BaseNode<MType>::backward_vjp() {
+            // 按拓扑序倒着做，保证一个节点做vjp之前所有子节点的梯度都已经累加完
+            std::vector<node_ptr> order {topological_order(std::enable_shared_from_this<BaseNode<MType>>::shared_from_this())};
+            jacobi = Matrix<MType>(data.get_dim(), MType(1));
+            for(auto node_iter = order.rbegin(); node_iter != order.rend(); ++node_iter) {
+                node_ptr node {*node_iter};
+                if(node->is_jacobi_exists() && node->jacobi.get_dim() == node->data.get_dim()) {
+                    node->run_vjp(node->jacobi);
+                }
+                node->wait_backward = false;
+            }
+        }
+
+        template <typename MType>
+        void BaseNode<MType>::vjp(const Matrix<MType>& grad_output) {
+            // 没有专门实现vjp的节点用结构化jacobi计算，等价于输出只有一行的backward
+            matrix_dim g_dim {grad_output.get_dim()};
+            Matrix<MType> g {grad_output};
+            g.view(g_dim[0], g_dim[1], 1, g_dim[2] * g_dim[3]);
+            for(size_t parent_i {0}; parent_i < get_parents_len(); ++parent_i) {
+                node_ptr parent {get_parent(parent_i)};
+                if(!parent->is_require_grad()) {
+                    continue;
+                }
+                matrix_dim p_dim {parent->get_data_dim()};
+                Matrix<MType> acc {matrix_dim {p_dim[0], p_dim[1], 1, p_dim[2] * p_dim[3]}, MType(0)};
+                local_jacobi(parent).left_mul_acc(g, acc);
+                acc.view(p_dim);
+                parent->accumulate_jacobi(acc);
+            }
+        }
+
+        template <typename MType>
+        void BaseNode<MType>::accumulate_jacobi(const Matrix<MType>& grad) {
+            if(is_jacobi_exists() && jacobi.get_dim() == grad.get_dim()) {
+                jacobi += grad;
+                return;
+            }
+            // 不和其他矩阵共享数据，梯度要活过当前步，不能放在scratch里
+            utils::NoScratchScope persistent {};
+            jacobi = grad.clone();
+        }
+
+        template <typename MType>
+        template <typename E>
+        void BaseNode<MType>::accumulate_jacobi(const expr::Expr<E>& grad) {
+            expr::expr_shape g_shape {grad.self().shape()};
+            if(is_jacobi_exists() && jacobi.get_dim() == matrix_dim {g_shape.begin(), g_shape.end()}) {
+                jacobi += grad;
+                return;
+            }
+            utils::NoScratchScope persistent {};
+            Matrix<MType> fresh {grad};
+            jacobi = fresh;
+        }
+
+        template <typename MType>
+        template <typename Func>
+        void BaseNode<MType>::accumulate_jacobi_with(const matrix_dim& dim, Func compute) {
+            // 和accumulate_jacobi一样，只是梯度不先算到临时矩阵里：beta是1的GEMM直接加到jacobi上
+            if(is_jacobi_exists() && jacobi.get_dim() == dim) {
+                compute(jacobi, MType(1));
+                return;
+            }
+            utils::NoScratchScope persistent {};
+            Matrix<MType> fresh {};
+            compute(fresh, MType(0));
+            jacobi = fresh;
+        }
+
+        template <typename MType>
+        bool BaseNode<MType>::is_require_grad() {
+            return require_grad;
+        }
+
+        template <typename MType>
+        Jacobian<MType> BaseNode<MType>::local_jacobi(node_ptr parent_node) {
+            Matrix<MType> m {matrix_dim {1,1,1,1}, MType(0)};
+            compute_jacobi(m, parent_node);
+            return Jacobian<MType>::dense(m);
+        }
+
         template <typename MType>
         void BaseNode<MType>::set_data(const Matrix<MType>& m) {
             data = m;
         }
 
+        template <typename MType>
+        void BaseNode<MType>::set_jacobi(const Matrix<MType>& m) {
+            jacobi = m;
+        }
+
         template <typename MType>
         void BaseNode<MType>::clear_jacobi() {
             jacobi.clear_data();
         }
 
+        template <typename MType>
+        void BaseNode<MType>::set_inference(bool inference) {
+            this->inference = inference;
+            wait_backward = false;
+            if(!inference) {
+                jacobi = Matrix<MType>(matrix_dim {1,1,1,1}, MType(0));
+                return;
+            }
+            // 先换成新的空矩阵再clear_data：直接clear_data会改到共享的内存（比如规划好的槽位），容量也不释放
+            jacobi = Matrix<MType> {};
+            jacobi.clear_data();
+        }
+
+        template <typename MType>
+        bool BaseNode<MType>::is_inference() const {
+            return inference;
+        }
+
         template <typename MType>
         void BaseNode<MType>::no_grad() {
             require_grad = false;
@@ -275,13 +474,13 @@ namespace aedlf {
         }
 
         template <typename MType>
-        typename BaseNode<MType>::matrix_p BaseNode<MType>::get_m_data() {
-            return std::make_shared<Matrix<MType>>(data);
+        Matrix<MType>& BaseNode<MType>::get_m_data() {
+            return data;
         }
 
         template <typename MType>
-        typename BaseNode<MType>::matrix_p BaseNode<MType>::get_m_jacobi() {
-            return std::make_shared<Matrix<MType>>(jacobi);
+        Matrix<MType>& BaseNode<MType>::get_m_jacobi() {
+            return jacobi;
         }
 
         template <typename MType>
@@ -299,6 +498,11 @@ namespace aedlf {
             return !jacobi.is_uninitialized();
         }
 
+        template <typename MType>
+        const std::string& BaseNode<MType>::get_name() const {
+            return name;
+        }
+
         template <typename MType>
         void BaseNode<MType>::view_data(matrix_dim shape) {
             data.view(shape);
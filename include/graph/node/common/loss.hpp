@@ -10,7 +10,7 @@ namespace aedlf {
             public:
                 using graph_nodes = std::shared_ptr<std::vector<std::shared_ptr<BaseNode<MType>>>>;
                 using node_ptr = std::shared_ptr<BaseNode<MType>>;
-                using matrix_data_p = std::shared_ptr<std::vector<MType>>;
+                using matrix_data_p = typename Matrix<MType>::matrix_data_p;
                 using matrix_dim = std::vector<unsigned long>;
                 using BaseNode<MType>::BaseNode;
                 graph_nodes get_childrens() override;
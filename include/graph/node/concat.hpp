@@ -12,7 +12,7 @@ namespace aedlf {
                 using node_ptr = std::shared_ptr<BaseNode<MType>>;
                 using kernel_shape = std::vector<unsigned long>;
                 using matrix_dim = std::vector<unsigned long>;
-                using matrix_data_p = std::shared_ptr<std::vector<MType>>;
+                using matrix_data_p = typename Matrix<MType>::matrix_data_p;
                 using graph_nodes = std::shared_ptr<std::vector<std::shared_ptr<BaseNode<MType>>>>;
                 ConcatNode(std::string node_name, matrix_dim m_dim, unsigned long concat_dim) : BaseNode<MType> {node_name, m_dim}, concat_dim_(concat_dim) {};
                 ConcatNode(std::string node_name, const Matrix<MType>& m, unsigned long concat_dim) : BaseNode<MType> {node_name, m}, concat_dim_(concat_dim) {};
@@ -20,8 +20,7 @@ namespace aedlf {
                 ConcatNode(std::string node_name, matrix_data_p data, matrix_dim m_dim, node_ptr parent, unsigned long concat_dim) : BaseNode<MType> {node_name, data, m_dim, parent}, concat_dim_(concat_dim) {};
                 ConcatNode(std::string node_name, matrix_data_p data, matrix_dim m_dim, graph_nodes parents, unsigned long concat_dim) : BaseNode<MType> {node_name, data, m_dim, parents}, concat_dim_(concat_dim) {};
                 void compute_forward() override;
-                void compute_jacobi(Matrix<MType>& m, node_ptr parent_node) override;
-                void backward(node_ptr output_node) override;
+                void vjp(const Matrix<MType>& grad_output) override;
             protected:
                 matrix_tools::MakeMatrix<MType> mm;
                 unsigned long concat_dim_;
@@ -29,28 +28,40 @@ namespace aedlf {
 
         template <typename MType>
         void ConcatNode<MType>::compute_forward() {
+            // 先按拼接后的尺寸分配一次，每个父节点按视图写进自己的那一段
             size_t parents_len {BaseNode<MType>::get_parents_len()};
-            Matrix<MType>::data = BaseNode<MType>::get_parent(0)->get_data();
+            assert(parents_len >= 1 && concat_dim_ < 4);
+            matrix_dim result_dim {BaseNode<MType>::get_parent(0)->get_data_dim()};
             for(size_t i {1}; i < parents_len; ++i) {
-                Matrix<MType>::data.concat(BaseNode<MType>::get_parent(0)->get_dim(), concat_dim_);
+                result_dim[concat_dim_] += BaseNode<MType>::get_parent(i)->get_data_dim()[concat_dim_];
+            }
+            BaseNode<MType>::data.resize(result_dim, 0);
+            // 视图直接写内存，先保证这块内存只属于本节点
+            BaseNode<MType>::data.mutable_data();
+            MatrixView<MType> data_view {BaseNode<MType>::data};
+            unsigned long start {0};
+            for(size_t i {0}; i < parents_len; ++i) {
+                Matrix<MType> parent_data {BaseNode<MType>::get_parent(i)->get_data()};
+                unsigned long len {parent_data.get_dim()[concat_dim_]};
+                data_view.slice(concat_dim_, start, start + len).assign(MatrixView<MType> {parent_data});
+                start += len;
             }
         }
 
         template <typename MType>
-        void ConcatNode<MType>::compute_jacobi(Matrix<MType>& m, node_ptr parent_node) {
+        void ConcatNode<MType>::vjp(const Matrix<MType>& grad_output) {
+            // 每个父节点的梯度就是grad_output里对应的那一段
             size_t parents_len {BaseNode<MType>::get_parents_len()};
-            int parent_i {0};
-            while(parent_node != BaseNode<MType>::get_parent(parent_i) && parent_i != parents_len) {
-                ++parent_i;
+            MatrixView<MType> grad_view {grad_output};
+            unsigned long start {0};
+            for(size_t i {0}; i < parents_len; ++i) {
+                node_ptr parent {BaseNode<MType>::get_parent(i)};
+                unsigned long len {parent->get_data_dim()[concat_dim_]};
+                if(parent->is_require_grad()) {
+                    parent->accumulate_jacobi(grad_view.slice(concat_dim_, start, start + len).copy());
+                }
+                start += len;
             }
-            assert(parent_i < parents_len);
-            m = BaseNode<MType>::get_parent(parent_i)->get_data().slice(1, {parent_i, parent_i+1});
-        }
-
-        template <typename MType>
-        void ConcatNode<MType>::backward(node_ptr output_node) {
-            compute_jacobi(BaseNode<MType>::jacobi, output_node);
-            BaseNode<MType>::wait_backward = false;
         }
     }
-}
\ No newline at end of file
+}
@@ -1,6 +1,9 @@
 #pragma once
 #include "common/base.hpp"
+#include "../../math/conv.hpp"
+#include "../../math/winograd.hpp"
 #include <cstddef>
+#include <algorithm>
 
 
 namespace aedlf {
@@ -15,12 +18,43 @@ namespace aedlf {
                 using matrix_dim = std::vector<unsigned long>;
                 void compute_forward() override;
                 void compute_jacobi(Matrix<MType>& m, node_ptr parent_node) override;
+                Jacobian<MType> local_jacobi(node_ptr parent_node) override;
+                void vjp(const Matrix<MType>& grad_output) override;
+                double estimate_flops(bool backward) override;
+        };
+
+        /*
+        融合的卷积节点，直接在原图上卷积，不经过PaddingNode和Img2colNode
+        parents [w, x, b]，x是原图(n, in_channel, h, w)，w和Conv2dNode一样是(n或1, in_channel, output_channel, k_h * k_w)
+        b是(n或1, 1或in_channel, output_channel, output_h * output_w)，多个通道时和Conv2dNode一样按通道加起来
+        输出(n, 1, output_channel, output_h * output_w)，和Conv2dNode的输出一致；反向只走vjp
+        3x3、stride 1的卷积自动换成Winograd，前向和两个梯度都在变换域里算
+        */
+        template <typename MType>
+        class FusedConv2dNode : public BaseNode<MType> {
+            public:
+                using node_ptr = std::shared_ptr<BaseNode<MType>>;
+                using matrix_dim = std::vector<unsigned long>;
+                using kernel_shape = std::vector<unsigned long>;
+                FusedConv2dNode(std::string node_name, matrix_dim m_dim, kernel_shape kernel_size, kernel_shape padding, unsigned long stride, MType padding_init) : BaseNode<MType> {node_name, m_dim}, kernel_size_(kernel_size), padding_size_(padding), stride_(stride), padding_init_(padding_init) {};
+                void compute_forward() override;
+                void vjp(const Matrix<MType>& grad_output) override;
+                double estimate_flops(bool backward) override;
+                kernel::ConvShape get_conv_shape();
+                MType get_padding_value() const;
+            protected:
+                kernel_shape kernel_size_;
+                kernel_shape padding_size_;
+                unsigned long stride_;
+                MType padding_init_;
+                Matrix<MType> packed_weight {}; // (n或1, 1, output_channel, in_channel * k_h * k_w)，反向直接复用
+                Matrix<MType> winograd_weight {}; // (n或1, 1, 1, alpha * alpha * output_channel * in_channel)，3x3、stride 1时才用
+                unsigned long winograd_m {0}; // 0表示走img2col的分块GEMM
         };
 
         template <typename MType>
         void Conv2dNode<MType>::compute_forward() {
-            size_t parents_len {BaseNode<MType>::get_parents_len()};
-            assert(parents_len == 3);
+            assert(BaseNode<MType>::get_parents_len() == 3);
             /* 
             这里假设待卷积的图像已经经过了列变换，权重也已经更改过尺寸了
             权重尺寸是[n, c, output_channel, k_h * k_w]
@@ -29,12 +63,12 @@ namespace aedlf {
             强制规定wx+b parents [w, w, b]
             输出尺寸和bias相同
             */
-            Matrix<MType> result {{1,1,1,1}, 0};
-            matrix_dim result_dim {BaseNode<MType>::get_parent(2)->get_dim()};
-            result = BaseNode<MType>::get_parent(0)->get_data() * BaseNode<MType>::get_parent(1)->get_data();
+            Matrix<MType> result {BaseNode<MType>::get_parent(0)->get_data() * BaseNode<MType>::get_parent(1)->get_data()};
+            matrix_dim b_dim {BaseNode<MType>::get_parent(2)->get_data_dim()};
+            matrix_dim r_dim {result.get_dim()};
+            assert((b_dim[0] == r_dim[0] || b_dim[0] == 1) && b_dim[1] == r_dim[1] && b_dim[2] == r_dim[2] && b_dim[3] == r_dim[3]);
             result += BaseNode<MType>::get_parent(2)->get_data();
-            result = result.sum_by_dim(1);
-            BaseNode<MType>::data->copy_from(result);
+            BaseNode<MType>::data = result.sum_by_dim(1);
         }
 
         template <typename MType>
@@ -52,8 +86,7 @@ namespace aedlf {
                 jacobi_dim[3] = parent1_dim[2] * parent2_dim[3];
                 jacobi_dim[2] = parent1_dim[2] * parent1_dim[3];
                 mm.modify_dim(jacobi_dim);
-                Matrix<MType> fw_m {BaseNode<MType>::parents->at(1)->get_data()};
-                mm.diagonal(m, fw_m.T());
+                mm.diagonal(m, MatrixView<MType> {BaseNode<MType>::parents->at(1)->get_data()}.T());
             }
             else if(parent_node == BaseNode<MType>::get_parent(1)) {
                 matrix_dim parent2_dim {BaseNode<MType>::parents->at(1)->get_data().get_dim()};
@@ -71,5 +104,264 @@ namespace aedlf {
                 mm.identity(m);
             }
         }
+
+        template <typename MType>
+        Jacobian<MType> Conv2dNode<MType>::local_jacobi(node_ptr parent_node) {
+            // 和乘法节点一样，对权重是I ⊗ X^T，对列变换后的输入是W ⊗ I，对bias是单位阵
+            matrix_dim w_dim {BaseNode<MType>::get_parent(0)->get_data_dim()};
+            matrix_dim x_dim {BaseNode<MType>::get_parent(1)->get_data_dim()};
+            if(parent_node == BaseNode<MType>::get_parent(0)) {
+                return Jacobian<MType>::block_diagonal(MatrixView<MType> {BaseNode<MType>::get_parent(1)->get_data()}.T(), w_dim[2]);
+            }
+            else if(parent_node == BaseNode<MType>::get_parent(1)) {
+                return Jacobian<MType>::kronecker(BaseNode<MType>::get_parent(0)->get_data(), x_dim[3]);
+            }
+            return Jacobian<MType>::identity();
+        }
+
+        template <typename MType>
+        void Conv2dNode<MType>::vjp(const Matrix<MType>& grad_output) {
+            // 输出是按通道求和的，先把梯度复制到每个输入通道上，之后和乘法节点一样；batch是1的权重和bias梯度按batch加起来
+            node_ptr w_node {BaseNode<MType>::get_parent(0)};
+            node_ptr x_node {BaseNode<MType>::get_parent(1)};
+            node_ptr b_node {BaseNode<MType>::get_parent(2)};
+            matrix_dim b_dim {b_node->get_data_dim()};
+            matrix_dim g_dim {grad_output.get_dim()};
+            assert((g_dim[0] == b_dim[0] || b_dim[0] == 1) && g_dim[1] == 1 && g_dim[2] == b_dim[2] && g_dim[3] == b_dim[3]);
+            unsigned long channel_len {b_dim[2] * b_dim[3]};
+            Matrix<MType> g {matrix_dim {g_dim[0], b_dim[1], b_dim[2], b_dim[3]}, MType(0)};
+            const MType* g_p {grad_output.get_data()->data()};
+            MType* gb_p {g.mutable_data()};
+            for(unsigned long n {0}; n < g_dim[0]; ++n) {
+                for(unsigned long c {0}; c < b_dim[1]; ++c) {
+                    std::copy(g_p + n * channel_len, g_p + (n + 1) * channel_len, gb_p + (n * b_dim[1] + c) * channel_len);
+                }
+            }
+            matrix_tools::MakeMatrix<MType> mm {};
+            Matrix<MType> w {w_node->get_data()};
+            Matrix<MType> x {x_node->get_data()};
+            matrix_dim w_dim {w.get_dim()};
+            matrix_dim x_dim {x.get_dim()};
+            if(w_node->is_require_grad()) {
+                bool sum {w_dim[0] == 1 && g_dim[0] > 1};
+                matrix_dim w_grad_dim {sum ? 1 : std::max(g_dim[0], x_dim[0]), b_dim[1], b_dim[2], x_dim[2]};
+                w_node->accumulate_jacobi_with(w_grad_dim, [&](Matrix<MType>& out, MType beta) {
+                    if(sum) {
+                        mm.mul_bt_sum(g, x, out, MType(1), beta);
+                    }
+                    else {
+                        mm.mul_bt(g, x, out, MType(1), beta);
+                    }
+                });
+            }
+            if(x_node->is_require_grad()) {
+                matrix_dim x_grad_dim {std::max(w_dim[0], g_dim[0]), b_dim[1], w_dim[3], b_dim[3]};
+                x_node->accumulate_jacobi_with(x_grad_dim, [&](Matrix<MType>& out, MType beta) {
+                    mm.mul_at(w, g, out, MType(1), beta);
+                });
+            }
+            if(b_node->is_require_grad()) {
+                if(b_dim[0] == 1 && g_dim[0] > 1) {
+                    Matrix<MType> grad {};
+                    mm.sum_batch(g, grad);
+                    b_node->accumulate_jacobi(grad);
+                }
+                else {
+                    b_node->accumulate_jacobi(g);
+                }
+            }
+        }
+
+        template <typename MType>
+        double Conv2dNode<MType>::estimate_flops(bool backward) {
+            // 权重(n, c, output_channel, k_h * k_w)乘列矩阵(n, c, k_h * k_w, output_len)
+            matrix_dim w_dim {BaseNode<MType>::get_parent(0)->get_data_dim()};
+            matrix_dim x_dim {BaseNode<MType>::get_parent(1)->get_data_dim()};
+            double flops {2.0 * std::max(w_dim[0], x_dim[0]) * w_dim[1] * w_dim[2] * w_dim[3] * x_dim[3]};
+            return backward ? 2 * flops : flops;
+        }
+
+        template <typename MType>
+        double FusedConv2dNode<MType>::estimate_flops(bool backward) {
+            // 按直接卷积的乘加数算，Winograd实际做的乘法更少
+            kernel::ConvShape shape {get_conv_shape()};
+            double flops {2.0 * BaseNode<MType>::get_parent(1)->get_data_dim()[0] * shape.out_channel * shape.col_rows() * shape.output_len()};
+            return backward ? 2 * flops : flops;
+        }
+
+        template <typename MType>
+        kernel::ConvShape FusedConv2dNode<MType>::get_conv_shape() {
+            matrix_dim w_dim {BaseNode<MType>::get_parent(0)->get_data_dim()};
+            matrix_dim x_dim {BaseNode<MType>::get_parent(1)->get_data_dim()};
+            assert(w_dim[1] == x_dim[1] && w_dim[3] == kernel_size_[0] * kernel_size_[1]);
+            assert(x_dim[2] + 2 * padding_size_[0] >= kernel_size_[0] && x_dim[3] + 2 * padding_size_[1] >= kernel_size_[1]);
+            return kernel::ConvShape {x_dim[1], x_dim[2], x_dim[3], w_dim[2], kernel_size_[0], kernel_size_[1], padding_size_[0], padding_size_[1], stride_};
+        }
+
+        template <typename MType>
+        MType FusedConv2dNode<MType>::get_padding_value() const {
+            return padding_init_;
+        }
+
+        template <typename MType>
+        void FusedConv2dNode<MType>::compute_forward() {
+            assert(BaseNode<MType>::get_parents_len() == 3);
+            kernel::ConvShape shape {get_conv_shape()};
+            Matrix<MType> w {BaseNode<MType>::get_parent(0)->get_data()};
+            Matrix<MType> x {BaseNode<MType>::get_parent(1)->get_data()};
+            Matrix<MType> b {BaseNode<MType>::get_parent(2)->get_data()};
+            matrix_dim w_dim {w.get_dim()};
+            matrix_dim x_dim {x.get_dim()};
+            matrix_dim b_dim {b.get_dim()};
+            unsigned long batch {x_dim[0]};
+            unsigned long output_len {shape.output_len()};
+            unsigned long col_rows {shape.col_rows()};
+            assert(w_dim[0] == batch || w_dim[0] == 1);
+            assert((b_dim[0] == batch || b_dim[0] == 1) && (b_dim[1] == 1 || b_dim[1] == shape.in_channel));
+            assert(b_dim[2] == shape.out_channel && b_dim[3] == output_len);
+            winograd_m = kernel::winograd_select(shape);
+            bool check {winograd_m != 0 && kernel::winograd_mode() == kernel::WinogradMode::check};
+            const MType* w_p {w.get_data()->data()};
+            unsigned long w_len {w_dim[1] * w_dim[2] * w_dim[3]};
+            if(winograd_m == 0 || check) {
+                packed_weight.resize(matrix_dim {w_dim[0], 1, shape.out_channel, col_rows}, MType(0));
+                MType* pw_p {packed_weight.mutable_data()};
+                for(unsigned long n {0}; n < w_dim[0]; ++n) {
+                    kernel::conv_pack_weight(shape, w_p + n * w_len, pw_p + n * shape.out_channel * col_rows);
+                }
+            }
+            if(winograd_m != 0) {
+                unsigned long u_len {(winograd_m + 2) * (winograd_m + 2) * shape.out_channel * shape.in_channel};
+                winograd_weight.resize(matrix_dim {w_dim[0], 1, 1, u_len}, MType(0));
+                MType* u_p {winograd_weight.mutable_data()};
+                for(unsigned long n {0}; n < w_dim[0]; ++n) {
+                    kernel::winograd_transform_weight(shape, winograd_m, w_p + n * w_len, u_p + n * u_len);
+                }
+            }
+            BaseNode<MType>::data.resize(matrix_dim {batch, 1, shape.out_channel, output_len}, MType(0));
+            const MType* x_p {x.get_data()->data()};
+            const MType* b_p {b.get_data()->data()};
+            MType* y_p {BaseNode<MType>::data.mutable_data()};
+            unsigned long x_len {shape.in_channel * shape.in_h * shape.in_w};
+            unsigned long y_len {shape.out_channel * output_len};
+            if(winograd_m != 0) {
+                unsigned long u_len {winograd_weight.get_dim()[3]};
+                const MType* u_p {winograd_weight.get_data()->data()};
+                utils::ThreadPool::global().parallel_for(batch, y_len * shape.in_channel * 4, [&](unsigned long n) {
+                    kernel::winograd_forward(shape, winograd_m, x_p + n * x_len, u_p + (w_dim[0] == 1 ? 0 : n) * u_len, padding_init_, y_p + n * y_len);
+                });
+            }
+            if(winograd_m == 0 || check) {
+                // check时img2col的结果写到临时内存里，和Winograd的结果比较
+                std::vector<MType, utils::Allocator<MType>> reference(check ? batch * y_len : 0);
+                MType* out_p {check ? reference.data() : y_p};
+                const MType* pw_p {packed_weight.get_data()->data()};
+                unsigned long tile_len {kernel::conv_tile_len(shape)};
+                unsigned long tile_num {(output_len + tile_len - 1) / tile_len};
+                // 每个任务算一张图像的一段输出像素，互相不重叠
+                utils::ThreadPool::global().parallel_for(batch * tile_num, shape.out_channel * col_rows * tile_len, [&](unsigned long task_i) {
+                    unsigned long n {task_i / tile_num};
+                    unsigned long p_begin {task_i % tile_num * tile_len};
+                    unsigned long p_len {std::min(tile_len, output_len - p_begin)};
+                    const MType* pw_n {pw_p + (w_dim[0] == 1 ? 0 : n) * shape.out_channel * col_rows};
+                    kernel::conv2d_forward_tile(shape, x_p + n * x_len, pw_n, padding_init_, p_begin, p_len, out_p + n * y_len);
+                });
+                if(check) {
+                    kernel::winograd_check(batch * y_len, reference.data(), y_p);
+                }
+            }
+            for(unsigned long n {0}; n < batch; ++n) {
+                for(unsigned long c {0}; c < b_dim[1]; ++c) {
+                    kernel::add(y_len, b_p + ((b_dim[0] == 1 ? 0 : n) * b_dim[1] + c) * y_len, y_p + n * y_len);
+                }
+            }
+        }
+
+        template <typename MType>
+        void FusedConv2dNode<MType>::vjp(const Matrix<MType>& grad_output) {
+            node_ptr w_node {BaseNode<MType>::get_parent(0)};
+            node_ptr x_node {BaseNode<MType>::get_parent(1)};
+            node_ptr b_node {BaseNode<MType>::get_parent(2)};
+            kernel::ConvShape shape {get_conv_shape()};
+            matrix_dim w_dim {w_node->get_data_dim()};
+            matrix_dim x_dim {x_node->get_data_dim()};
+            matrix_dim b_dim {b_node->get_data_dim()};
+            unsigned long batch {x_dim[0]};
+            unsigned long col_rows {shape.col_rows()};
+            unsigned long x_len {shape.in_channel * shape.in_h * shape.in_w};
+            unsigned long y_len {shape.out_channel * shape.output_len()};
+            unsigned long w_len {w_dim[1] * w_dim[2] * w_dim[3]};
+            assert(grad_output.get_dim() == (matrix_dim {batch, 1, shape.out_channel, shape.output_len()}));
+            bool check {winograd_m != 0 && kernel::winograd_mode() == kernel::WinogradMode::check};
+            const MType* g_p {grad_output.get_data()->data()};
+            if(w_node->is_require_grad()) {
+                Matrix<MType> x {x_node->get_data()};
+                const MType* x_p {x.get_data()->data()};
+                Matrix<MType> grad {w_dim, MType(0)};
+                MType* grad_p {grad.mutable_data()};
+                if(winograd_m != 0) {
+                    // 每张图像各自在变换域里累加，再按顺序变回3x3
+                    unsigned long z_len {winograd_weight.get_dim()[3]};
+                    std::vector<MType, utils::Allocator<MType>> z(batch * z_len, MType(0));
+                    utils::ThreadPool::global().parallel_for(batch, y_len * shape.in_channel * 4, [&](unsigned long n) {
+                        kernel::winograd_backward_weight(shape, winograd_m, x_p + n * x_len, g_p + n * y_len, padding_init_, z.data() + n * z_len);
+                    });
+                    for(unsigned long n {0}; n < batch; ++n) {
+                        kernel::winograd_weight_grad_add(shape, winograd_m, z.data() + n * z_len, grad_p + (w_dim[0] == 1 ? 0 : n) * w_len);
+                    }
+                }
+                if(winograd_m == 0 || check) {
+                    // 每张图像各自算重排后的梯度，再按顺序加回(n或1, in_channel, output_channel, k_h * k_w)
+                    std::vector<MType, utils::Allocator<MType>> packed_grad(batch * shape.out_channel * col_rows, MType(0));
+                    utils::ThreadPool::global().parallel_for(batch, y_len * col_rows, [&](unsigned long n) {
+                        kernel::conv2d_backward_weight(shape, x_p + n * x_len, g_p + n * y_len, padding_init_, packed_grad.data() + n * shape.out_channel * col_rows);
+                    });
+                    std::vector<MType, utils::Allocator<MType>> reference(check ? grad.get_data()->size() : 0, MType(0));
+                    MType* out_p {check ? reference.data() : grad_p};
+                    for(unsigned long n {0}; n < batch; ++n) {
+                        kernel::conv_unpack_weight_add(shape, packed_grad.data() + n * shape.out_channel * col_rows, out_p + (w_dim[0] == 1 ? 0 : n) * w_len);
+                    }
+                    if(check) {
+                        kernel::winograd_check(reference.size(), reference.data(), grad_p);
+                    }
+                }
+                w_node->accumulate_jacobi(grad);
+            }
+            if(x_node->is_require_grad()) {
+                Matrix<MType> grad {x_dim, MType(0)};
+                MType* grad_p {grad.mutable_data()};
+                if(winograd_m != 0) {
+                    unsigned long u_len {winograd_weight.get_dim()[3]};
+                    const MType* u_p {winograd_weight.get_data()->data()};
+                    utils::ThreadPool::global().parallel_for(batch, y_len * shape.in_channel * 4, [&](unsigned long n) {
+                        kernel::winograd_backward_data(shape, winograd_m, u_p + (w_dim[0] == 1 ? 0 : n) * u_len, g_p + n * y_len, grad_p + n * x_len);
+                    });
+                }
+                if(winograd_m == 0 || check) {
+                    std::vector<MType, utils::Allocator<MType>> reference(check ? grad.get_data()->size() : 0, MType(0));
+                    MType* out_p {check ? reference.data() : grad_p};
+                    const MType* pw_p {packed_weight.get_data()->data()};
+                    utils::ThreadPool::global().parallel_for(batch, y_len * col_rows, [&](unsigned long n) {
+                        const MType* pw_n {pw_p + (w_dim[0] == 1 ? 0 : n) * shape.out_channel * col_rows};
+                        kernel::conv2d_backward_data(shape, pw_n, g_p + n * y_len, out_p + n * x_len);
+                    });
+                    if(check) {
+                        kernel::winograd_check(reference.size(), reference.data(), grad_p);
+                    }
+                }
+                x_node->accumulate_jacobi(grad);
+            }
+            if(b_node->is_require_grad()) {
+                // 每个通道上的bias都直接加到输出上，梯度都是g
+                Matrix<MType> grad {b_dim, MType(0)};
+                MType* grad_p {grad.mutable_data()};
+                for(unsigned long n {0}; n < batch; ++n) {
+                    for(unsigned long c {0}; c < b_dim[1]; ++c) {
+                        kernel::add(y_len, g_p + n * y_len, grad_p + ((b_dim[0] == 1 ? 0 : n) * b_dim[1] + c) * y_len);
+                    }
+                }
+                b_node->accumulate_jacobi(grad);
+            }
+        }
     }
-}
\ No newline at end of file
+}
@@ -10,7 +10,7 @@ namespace aedlf {
                 using BaseNode<MType>::BaseNode;
                 using graph_nodes = std::shared_ptr<std::vector<std::shared_ptr<BaseNode<MType>>>>;
                 using node_ptr = std::shared_ptr<BaseNode<MType>>;
-                using matrix_data_p = std::shared_ptr<std::vector<MType>>;
+                using matrix_data_p = typename Matrix<MType>::matrix_data_p;
                 using matrix_dim = std::vector<unsigned long>;
                 DataNode(std::string node_name, matrix_data_p data, matrix_dim m_dim, node_ptr parent);
                 DataNode(std::string node_name, matrix_data_p data, matrix_dim m_dim, graph_nodes parents);
@@ -18,10 +18,12 @@ namespace aedlf {
                 node_ptr get_parent(size_t parent_id) override;
                 size_t get_parents_len() override;
                 void add_parent(node_ptr parent) override;
+                void set_data(const Matrix<MType>& m) override; // 换一个batch的输入，沿用节点现在每个样本的形状
                 void compute_forward() override {};
                 void forward() override {};
                 void backward(node_ptr children) override {};
                 void clear_jacobi() override {};
+                bool is_require_grad() override { return require_grad; };
             protected:
                 bool require_grad {false};
         };
@@ -51,6 +53,23 @@ namespace aedlf {
             return 0;
         }
 
+        template <typename MType>
+        void DataNode<MType>::set_data(const Matrix<MType>& m) {
+            // 建图时组件可能已经把输入view成了别的形状（比如FC），每个样本的元素个数一样时新数据也这样view，只换batch维
+            Matrix<MType>& data {BaseNode<MType>::data};
+            if(data.get_data()->empty() || m.get_data()->empty()) {
+                data = m;
+                return;
+            }
+            matrix_dim old_dim {data.get_dim()};
+            matrix_dim new_dim {m.get_dim()};
+            Matrix<MType> rebound {m};
+            if(old_dim[1] * old_dim[2] * old_dim[3] == new_dim[1] * new_dim[2] * new_dim[3]) {
+                rebound.view({new_dim[0], old_dim[1], old_dim[2], old_dim[3]});
+            }
+            data = rebound;
+        }
+
         template <typename MType>
         void DataNode<MType>::add_parent(node_ptr parent) {
             std::runtime_error("`DataNode` is not allow to add `parent`");
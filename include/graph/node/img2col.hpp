@@ -10,7 +10,7 @@ namespace aedlf {
                 using ul_pos = const std::pair<unsigned long, unsigned long>;
                 using node_ptr = std::shared_ptr<BaseNode<MType>>;
                 using matrix_dim = std::vector<unsigned long>;
-                using matrix_data_p = std::shared_ptr<std::vector<MType>>;
+                using matrix_data_p = typename Matrix<MType>::matrix_data_p;
                 using graph_nodes = std::shared_ptr<std::vector<std::shared_ptr<BaseNode<MType>>>>;
                 using kernel_shape = std::vector<unsigned long>;
                 Img2colNode(std::string node_name, matrix_dim m_dim, kernel_shape kernel_size, unsigned long stride) : BaseNode<MType> {node_name, m_dim}, stride_(stride), kernel_size_(kernel_size) {};
@@ -21,6 +21,7 @@ namespace aedlf {
                 void compute_forward() override;
                 void compute_jacobi(Matrix<MType>& m, node_ptr parent_node) override;
                 void backward(node_ptr output_node) override;
+                void vjp(const Matrix<MType>& grad_output) override;
             protected:
                 matrix_tools::MakeMatrix<MType> mm;
                 unsigned long stride_;
@@ -29,9 +30,9 @@ namespace aedlf {
 
         template <typename MType>
         void Img2colNode<MType>::compute_forward() {
-            size_t parents_len {BaseNode<MType>::get_parents_len()};
-            assert(parents_len == 1);
-            mm.img2col(BaseNode<MType>::get_parent(0)->get_data(), BaseNode<MType>::data, kernel_size_, stride_);
+            assert(BaseNode<MType>::get_parents_len() == 1);
+            Matrix<MType> parent_data {BaseNode<MType>::get_parent(0)->get_data()};
+            mm.img2col(parent_data, BaseNode<MType>::data, kernel_size_, stride_);
         }
 
         template <typename MType>
@@ -45,5 +46,18 @@ namespace aedlf {
             compute_jacobi(BaseNode<MType>::jacobi, output_node);
             BaseNode<MType>::wait_backward = false;
         }
+
+        template <typename MType>
+        void Img2colNode<MType>::vjp(const Matrix<MType>& grad_output) {
+            // img2col只是搬运数据，梯度按原位置累加回去就是col2img
+            node_ptr parent {BaseNode<MType>::get_parent(0)};
+            if(!parent->is_require_grad()) {
+                return;
+            }
+            Matrix<MType> g {grad_output};
+            Matrix<MType> grad {};
+            mm.col2img(g, grad, kernel_size_, stride_, parent->get_data_dim());
+            parent->accumulate_jacobi(grad);
+        }
     }
 }
\ No newline at end of file
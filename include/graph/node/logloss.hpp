@@ -3,6 +3,7 @@
 #include "common/loss.hpp"
 #include <cstddef>
 #include <cmath>
+#include <type_traits>
 
 
 namespace aedlf {
@@ -12,7 +13,7 @@ namespace aedlf {
             public:
                 using graph_nodes = std::shared_ptr<std::vector<std::shared_ptr<BaseNode<MType>>>>;
                 using node_ptr = std::shared_ptr<BaseNode<MType>>;
-                using matrix_data_p = std::shared_ptr<std::vector<MType>>;
+                using matrix_data_p = typename Matrix<MType>::matrix_data_p;
                 using matrix_dim = std::vector<unsigned long>;
                 LogLossNode(std::string node_name, matrix_dim m_dim, std::string reduction = "mean") : LossNode<MType> {node_name, m_dim}, reduction_(reduction) {};
                 LogLossNode(std::string node_name, const Matrix<MType>& m, std::string reduction = "mean") : LossNode<MType> {node_name, m}, reduction_(reduction) {};
@@ -22,10 +23,21 @@ namespace aedlf {
                 void compute_forward() override;
                 void compute_jacobi(Matrix<MType>& m, node_ptr parent_node) override;
                 void backward(node_ptr output_node) override;
+                void vjp(const Matrix<MType>& grad_output) override;
             protected:
+                static bool is_positive(MType label);
                 std::string reduction_;
         };
 
+        template <typename MType>
+        bool LogLossNode<MType>::is_positive(MType label) {
+            // 浮点标签允许一点误差，整数标签直接比较，编译期就能确定走哪边
+            if(std::is_floating_point<MType>::value) {
+                return std::fabs(label - MType(1)) < MType(1e-4);
+            }
+            return label == MType(1);
+        }
+
         template <typename MType>
         void LogLossNode<MType>::compute_forward() {
             // 规定parent(1)为label label的值应当为0或1，parent(0)为predict
@@ -36,36 +48,25 @@ namespace aedlf {
             assert(data_dim[3] == 1 && data_dim[2] == 1 && data_dim[1] == 1);
             Matrix<MType> label_data {BaseNode<MType>::get_parent(1)->get_data()};
             Matrix<MType> pred_data {BaseNode<MType>::get_parent(0)->get_data()};
-            matrix_data_p label_p {label_data.get_m_data()};
-            matrix_data_p pred_p {pred_data.get_m_data()};
-            Matrix<MType> loss_value {{1,1,1,1}, 0};
+            matrix_data_p label_p {label_data.get_data()};
+            matrix_data_p pred_p {pred_data.get_data()};
+            Matrix<MType>& loss_value {BaseNode<MType>::data};
+            loss_value.resize(matrix_dim {1,1,1,1}, MType(0));
             MType loss_sum {0};
-            if(typeid(label_p->at(0)) == typeid(float) || typeid(label_p->at(0)) == typeid(double) || typeid(label_p->at(0)) == typeid(long double)) {
-                for(size_t i {0}; i < label_p->size(); ++i) {
-                    if(std::fabs(label_p->at(i) - 1) < 1e-4) {
-                        MType loss_piece = std::log(pred_p->at(i)) * -1.0;
-                        loss_sum += loss_piece;
-                    }
-                    else {
-                        MType loss_piece = std::log(1.0 - pred_p->at(i)) * -1.0;
-                        loss_sum += loss_piece;
-                    }
+            for(size_t i {0}; i < label_p->size(); ++i) {
+                if(is_positive(label_p->at(i))) {
+                    loss_sum -= std::log(pred_p->at(i));
                 }
-            }
-            else {
-                for(size_t i {0}; i < label_p->size(); ++i) {
-                    if(label_p->at(i) == 1) {
-                        loss_sum += std::log(pred_p->at(i)) * -1.0;
-                    }
-                    else {
-                        loss_sum += std::log(1.0 - pred_p->at(i)) * -1.0;
-                    }
+                else {
+                    loss_sum -= std::log(MType(1) - pred_p->at(i));
                 }
             }
             if(reduction_ == "mean") {
-                loss_value.set(0, loss_sum / label_p->size());
+                loss_value.set(0, loss_sum / MType(label_p->size()));
+            }
+            else {
+                loss_value.set(0, loss_sum);
             }
-            BaseNode<MType>::data = loss_value;
         }
 
         template <typename MType>
@@ -78,26 +79,14 @@ namespace aedlf {
             m.resize(BaseNode<MType>::get_parent(0)->get_data_dim(), 0);
             Matrix<MType> label_data {BaseNode<MType>::get_parent(1)->get_data()};
             Matrix<MType> pred_data {BaseNode<MType>::get_parent(0)->get_data()};
-            matrix_data_p label_p {label_data.get_m_data()};
-            matrix_data_p pred_p {pred_data.get_m_data()};
-            if(typeid(label_p->at(0)) == typeid(float) || typeid(label_p->at(0)) == typeid(double) || typeid(label_p->at(0)) == typeid(long double)) {
-                for(size_t i {0}; i < label_p->size(); ++i) {
-                    if(std::fabs(label_p->at(i) - 1) < 1e-4) {
-                        m.set(i, -1 / pred_p->at(i));
-                    }
-                    else {
-                        m.set(i, 1 / (1 - pred_p->at(i)));
-                    }
+            matrix_data_p label_p {label_data.get_data()};
+            matrix_data_p pred_p {pred_data.get_data()};
+            for(size_t i {0}; i < label_p->size(); ++i) {
+                if(is_positive(label_p->at(i))) {
+                    m.set(i, MType(-1) / pred_p->at(i));
                 }
-            }
-            else {
-                for(size_t i {0}; i < label_p->size(); ++i) {
-                    if(label_p->at(i) == 1) {
-                        m.set(i, -1 / pred_p->at(i));
-                    }
-                    else {
-                        m.set(i, 1 / (1 - pred_p->at(i)));
-                    }
+                else {
+                    m.set(i, MType(1) / (MType(1) - pred_p->at(i)));
                 }
             }
         }
@@ -107,5 +96,22 @@ namespace aedlf {
             compute_jacobi(BaseNode<MType>::jacobi, output_node);
             BaseNode<MType>::wait_backward = false;
         }
+
+        template <typename MType>
+        void LogLossNode<MType>::vjp(const Matrix<MType>& grad_output) {
+            // 输出是标量，dL/dp = g * (-1/p 或 1/(1-p))，mean还要除以元素个数
+            node_ptr pred_node {BaseNode<MType>::get_parent(0)};
+            if(!pred_node->is_require_grad()) {
+                return;
+            }
+            Matrix<MType> local {};
+            compute_jacobi(local, pred_node);
+            MType scale {grad_output.get_data()->at(0)};
+            if(reduction_ == "mean") {
+                scale /= MType(local.get_data()->size());
+            }
+            // 缩放和累加在同一次遍历里
+            pred_node->accumulate_jacobi(local * scale);
+        }
     }
 }
\ No newline at end of file
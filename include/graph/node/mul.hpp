@@ -12,12 +12,20 @@ namespace aedlf {
                 using BaseNode<MType>::BaseNode;
                 void compute_forward() override;
                 void compute_jacobi(Matrix<MType>& m, node_ptr parent_node) override;
+                Jacobian<MType> local_jacobi(node_ptr parent_node) override;
+                void vjp(const Matrix<MType>& grad_output) override;
+                double estimate_flops(bool backward) override;
         };
 
         template <typename MType>
         void MulNode<MType>::compute_forward() {
             size_t parents_len {BaseNode<MType>::get_parents_len()};
             assert(parents_len >= 2);
+            if(parents_len == 2) {
+                // 直接写进本节点已有的内存，不重新分配
+                BaseNode<MType>::data.mul_from(BaseNode<MType>::get_parent(0)->get_data(), BaseNode<MType>::get_parent(1)->get_data());
+                return;
+            }
             BaseNode<MType>::data.copy_from(BaseNode<MType>::get_parent(0)->get_data());
             for(size_t i {1}; i < parents_len; ++i) {
                 BaseNode<MType>::data *= BaseNode<MType>::get_parent(i)->get_data();
@@ -27,8 +35,7 @@ namespace aedlf {
         template <typename MType>
         void MulNode<MType>::compute_jacobi(Matrix<MType>& m, node_ptr parent_node) {
             // 注意，这里这个写法只能实现两个节点相乘的反向传播
-            size_t parents_len {BaseNode<MType>::get_parents_len()};
-            assert(parents_len == 2);
+            assert(BaseNode<MType>::get_parents_len() == 2);
             matrix_tools::MakeMatrix<MType> mm {};
             // jacobi_dim is transpose dim
             typename BaseNode<MType>::matrix_dim jacobi_dim {BaseNode<MType>::data.get_dim()};
@@ -38,9 +45,8 @@ namespace aedlf {
                 jacobi_dim[2] = parent0_dim[2] * parent1_dim[3];
                 jacobi_dim[3] = parent0_dim[2] * parent0_dim[3];
                 mm.modify_dim(jacobi_dim);
-                Matrix<MType> fw_m {BaseNode<MType>::parents->at(1)->get_data()};
-                fw_m.T();
-                mm.diagonal(m, fw_m);
+                // X^T只是换了跨度的视图，不拷贝也不改父节点的数据
+                mm.diagonal(m, MatrixView<MType> {BaseNode<MType>::parents->at(1)->get_data()}.T());
             }
             else {
                 typename BaseNode<MType>::matrix_dim parent2_dim {BaseNode<MType>::parents->at(1)->get_data().get_dim()};
@@ -51,5 +57,71 @@ namespace aedlf {
                 mm.special_jacobi(m, BaseNode<MType>::parents->at(0)->get_data(), parent2_dim[3]);
             }
         }
+
+        template <typename MType>
+        Jacobian<MType> MulNode<MType>::local_jacobi(node_ptr parent_node) {
+            // Y(m, n) = W(m, k) * X(k, n)，dY/dW = I_m ⊗ X^T，dY/dX = W ⊗ I_n
+            assert(BaseNode<MType>::get_parents_len() == 2);
+            typename BaseNode<MType>::matrix_dim w_dim {BaseNode<MType>::parents->at(0)->get_data_dim()};
+            typename BaseNode<MType>::matrix_dim x_dim {BaseNode<MType>::parents->at(1)->get_data_dim()};
+            if(parent_node == BaseNode<MType>::parents->at(0)) {
+                return Jacobian<MType>::block_diagonal(MatrixView<MType> {BaseNode<MType>::parents->at(1)->get_data()}.T(), w_dim[2]);
+            }
+            return Jacobian<MType>::kronecker(BaseNode<MType>::parents->at(0)->get_data(), x_dim[3]);
+        }
+
+        template <typename MType>
+        double MulNode<MType>::estimate_flops(bool backward) {
+            if(BaseNode<MType>::get_parents_len() != 2) {
+                return BaseNode<MType>::estimate_flops(backward);
+            }
+            // 逐通道的(h, k) * (k, w)，反向的dW、dX各是一次同样大小的乘法
+            typename BaseNode<MType>::matrix_dim w_dim {BaseNode<MType>::get_parent(0)->get_data_dim()};
+            typename BaseNode<MType>::matrix_dim x_dim {BaseNode<MType>::get_parent(1)->get_data_dim()};
+            double flops {2.0 * std::max(w_dim[0], x_dim[0]) * w_dim[1] * w_dim[2] * w_dim[3] * x_dim[3]};
+            return backward ? 2 * flops : flops;
+        }
+
+        template <typename MType>
+        void MulNode<MType>::vjp(const Matrix<MType>& grad_output) {
+            // dW = G * X^T，dX = W^T * G，batch是1的一边前向时广播过，梯度要按batch加起来
+            node_ptr w_node {BaseNode<MType>::parents->at(0)};
+            node_ptr x_node {BaseNode<MType>::parents->at(1)};
+            matrix_tools::MakeMatrix<MType> mm {};
+            unsigned long batch {grad_output.get_dim()[0]};
+            Matrix<MType> w {w_node->get_data()};
+            Matrix<MType> x {x_node->get_data()};
+            typename BaseNode<MType>::matrix_dim g_dim {grad_output.get_dim()};
+            typename BaseNode<MType>::matrix_dim w_dim {w.get_dim()};
+            typename BaseNode<MType>::matrix_dim x_dim {x.get_dim()};
+            // 乘积直接累加进父节点已有的梯度，不生成中间结果
+            if(w_node->is_require_grad()) {
+                bool sum {w_dim[0] == 1 && batch > 1};
+                typename BaseNode<MType>::matrix_dim w_grad_dim {sum ? 1 : std::max(batch, x_dim[0]), g_dim[1], g_dim[2], x_dim[2]};
+                w_node->accumulate_jacobi_with(w_grad_dim, [&](Matrix<MType>& out, MType beta) {
+                    if(sum) {
+                        mm.mul_bt_sum(grad_output, x, out, MType(1), beta);
+                    }
+                    else {
+                        mm.mul_bt(grad_output, x, out, MType(1), beta);
+                    }
+                });
+            }
+            if(x_node->is_require_grad()) {
+                if(x_dim[0] == 1 && batch > 1) {
+                    Matrix<MType> x_grad {};
+                    mm.mul_at(w, grad_output, x_grad);
+                    Matrix<MType> reduced {};
+                    mm.sum_batch(x_grad, reduced);
+                    x_node->accumulate_jacobi(reduced);
+                }
+                else {
+                    typename BaseNode<MType>::matrix_dim x_grad_dim {std::max(w_dim[0], batch), g_dim[1], w_dim[3], g_dim[3]};
+                    x_node->accumulate_jacobi_with(x_grad_dim, [&](Matrix<MType>& out, MType beta) {
+                        mm.mul_at(w, grad_output, out, MType(1), beta);
+                    });
+                }
+            }
+        }
     }
 }
\ No newline at end of file
@@ -11,7 +11,7 @@ namespace aedlf {
                 using node_ptr = std::shared_ptr<BaseNode<MType>>;
                 using kernel_shape = std::vector<unsigned long>;
                 using matrix_dim = std::vector<unsigned long>;
-                using matrix_data_p = std::shared_ptr<std::vector<MType>>;
+                using matrix_data_p = typename Matrix<MType>::matrix_data_p;
                 using graph_nodes = std::shared_ptr<std::vector<std::shared_ptr<BaseNode<MType>>>>;
                 PaddingNode(std::string node_name, matrix_dim m_dim, kernel_shape padding, MType padding_init) : BaseNode<MType> {node_name, m_dim}, padding_size_(padding), padding_init_(padding_init) {};
                 PaddingNode(std::string node_name, const Matrix<MType>& m, kernel_shape padding, MType padding_init) : BaseNode<MType> {node_name, m}, padding_size_(padding), padding_init_(padding_init) {};
@@ -21,6 +21,7 @@ namespace aedlf {
                 void compute_forward() override;
                 void compute_jacobi(Matrix<MType>& m, node_ptr parent_node) override;
                 void backward(node_ptr output_node) override;
+                void vjp(const Matrix<MType>& grad_output) override;
             protected:
                 matrix_tools::MakeMatrix<MType> mm;
                 kernel_shape padding_size_;
@@ -29,14 +30,15 @@ namespace aedlf {
 
         template <typename MType>
         void PaddingNode<MType>::compute_forward() {
-            size_t parents_len {BaseNode<MType>::get_parents_len()};
-            assert(parents_len == 1);
+            assert(BaseNode<MType>::get_parents_len() == 1);
             if(padding_size_[0] == 0 && padding_size_[1] == 0) {
-                BaseNode<MType>::data = BaseNode<MType>::get_parent(0)->get_data();
+                // 内存规划里节点的数据绑定在自己的槽位上，copy_from写进槽位；没有规划时和父节点共用，谁先改谁拷贝
+                BaseNode<MType>::data.copy_from(BaseNode<MType>::get_parent(0)->get_data());
                 return;
             }
             mm.modify_dim(BaseNode<MType>::data.get_dim());
-            mm.add_padding(BaseNode<MType>::get_parent(0), BaseNode<MType>::data, padding_size_, padding_init_);
+            Matrix<MType> parent_data {BaseNode<MType>::get_parent(0)->get_data()};
+            mm.add_padding(parent_data, BaseNode<MType>::data, padding_size_, padding_init_);
         }
 
         template <typename MType>
@@ -51,5 +53,18 @@ namespace aedlf {
             compute_jacobi(BaseNode<MType>::jacobi, output_node);
             BaseNode<MType>::wait_backward = false;
         }
+
+        template <typename MType>
+        void PaddingNode<MType>::vjp(const Matrix<MType>& grad_output) {
+            // 填充的位置没有梯度，裁掉即可
+            node_ptr parent {BaseNode<MType>::get_parent(0)};
+            if(!parent->is_require_grad()) {
+                return;
+            }
+            Matrix<MType> g {grad_output};
+            Matrix<MType> grad {};
+            mm.sub_padding(g, grad, padding_size_);
+            parent->accumulate_jacobi(grad);
+        }
     }
 }
\ No newline at end of file
@@ -1,8 +1,6 @@
 #pragma once
 #include "common/base.hpp"
-#include <map>
-#include <thread>
-#include <algorithm>
+#include <vector>
 
 
 namespace aedlf {
@@ -13,10 +11,10 @@ namespace aedlf {
                 using ul_pos = const std::pair<unsigned long, unsigned long>;
                 using node_ptr = std::shared_ptr<BaseNode<MType>>;
                 using matrix_dim = std::vector<unsigned long>;
-                using matrix_data_p = std::shared_ptr<std::vector<MType>>;
+                using matrix_data_p = typename Matrix<MType>::matrix_data_p;
                 using graph_nodes = std::shared_ptr<std::vector<std::shared_ptr<BaseNode<MType>>>>;
                 using kernel_shape = std::vector<unsigned long>;
-                using not_zero_index_c = std::vector<unsigned long>;
+                using max_index_c = std::vector<unsigned long>;
                 MaxPool2dNode(std::string node_name, matrix_dim m_dim, kernel_shape kernel_size, unsigned long stride) : BaseNode<MType> {node_name, m_dim}, stride_(stride), kernel_size_(kernel_size) {};
                 MaxPool2dNode(std::string node_name, const Matrix<MType>& m, kernel_shape kernel_size, unsigned long stride) : BaseNode<MType> {node_name, m}, stride_(stride), kernel_size_(kernel_size) {};
                 MaxPool2dNode(std::string node_name, matrix_data_p data, matrix_dim m_dim, kernel_shape kernel_size, unsigned long stride) : BaseNode<MType> {node_name, data, m_dim}, stride_(stride), kernel_size_(kernel_size) {};
@@ -25,98 +23,121 @@ namespace aedlf {
                 void compute_forward() override;
                 void compute_jacobi(Matrix<MType>& m, node_ptr parent_node) override;
                 void backward(node_ptr output_node) override;
+                void vjp(const Matrix<MType>& grad_output) override;
+                double estimate_flops(bool backward) override;
+                void set_inference(bool inference) override;
             protected:
-                void pooling_core(Matrix<MType>& m, Matrix<MType>& fw, ul_pos m_channel_ul, ul_pos fw_channel_ul);
-                void depooling_core(Matrix<MType>& m, ul_pos data_channel_ul, unsigned long nzic_index);
-                int stride_;
+                void pooling_core(const MType* m_data, MType* fw_data, unsigned long* index_data, unsigned long m_h, unsigned long m_w, unsigned long fw_h, unsigned long fw_w);
+                unsigned long stride_;
                 kernel_shape kernel_size_;
-                not_zero_index_c nzic;
+                max_index_c max_index; // 每个输出元素对应的输入元素下标（在输入通道内的偏移）
         };
 
         template <typename MType>
         void MaxPool2dNode<MType>::compute_forward() {
-            nzic.clear();
-            size_t parents_len {BaseNode<MType>::get_parents_len()};
-            assert(parents_len == 1);
-            matrix_dim fw_dim {BaseNode<MType>::get_parent(0)->get_dim()};
-            fw_dim[2] = fw_dim[2] / kernel_size_[0];
-            fw_dim[3] = fw_dim[3] / kernel_size_[1];
-            Matrix<MType> fw {fw_dim, 0};
+            assert(BaseNode<MType>::get_parents_len() == 1);
             Matrix<MType> m {BaseNode<MType>::get_parent(0)->get_data()};
-            std::vector<std::thread> thread_c;
-            for(unsigned long n {0}; n < fw_dim[0]; ++n) {
-                ul_pos m_batch_ul {m.get_batch(n)};
-                ul_pos fw_batch_ul {fw.get_batch(n)};
-                for(unsigned long c {0}; c < fw_dim[1]; ++c) {
-                    ul_pos m_channel_ul {m.get_channel(c, m_batch_ul)};
-                    ul_pos fw_channel_ul {fw.get_channel(c, fw_batch_ul)};
-                    thread_c.emplace_back(&MaxPool2dNode<MType>::pooling_core, this, std::ref(m), std::ref(fw), m_channel_ul, fw_channel_ul);
-                }
-            }
-            for(auto& t : thread_c) {
-                t.join();
+            matrix_dim m_dim {m.get_dim()};
+            assert(m_dim[2] >= kernel_size_[0] && m_dim[3] >= kernel_size_[1]);
+            matrix_dim fw_dim {m_dim};
+            fw_dim[2] = (m_dim[2] - kernel_size_[0]) / stride_ + 1;
+            fw_dim[3] = (m_dim[3] - kernel_size_[1]) / stride_ + 1;
+            Matrix<MType>& fw {BaseNode<MType>::data};
+            fw.resize(fw_dim, MType(0));
+            unsigned long m_len {m_dim[2] * m_dim[3]};
+            unsigned long fw_len {fw_dim[2] * fw_dim[3]};
+            // 推理时不需要反向，不记录最大值的位置
+            if(!BaseNode<MType>::inference) {
+                max_index.assign(fw_dim[0] * fw_dim[1] * fw_len, 0);
             }
-            BaseNode<MType>::data = fw;
+            const MType* m_p {m.get_data()->data()};
+            MType* fw_p {fw.mutable_data()};
+            unsigned long* index_p {BaseNode<MType>::inference ? nullptr : max_index.data()};
+            utils::ThreadPool::global().parallel_for(fw_dim[0] * fw_dim[1], fw_len * kernel_size_[0] * kernel_size_[1], [&](unsigned long task_i) {
+                pooling_core(m_p + task_i * m_len, fw_p + task_i * fw_len, index_p == nullptr ? nullptr : index_p + task_i * fw_len, m_dim[2], m_dim[3], fw_dim[2], fw_dim[3]);
+            });
         }
 
         template <typename MType>
-        void MaxPool2dNode<MType>::pooling_core(Matrix<MType>& m, Matrix<MType>& fw, ul_pos m_channel_ul, ul_pos fw_channel_ul) {
-            matrix_dim fw_dim {fw.get_dim()};
-            matrix_data_p m_data {m.get_m_data()};
-            matrix_data_p fw_data {fw.get_m_data()};
-            for(unsigned long fw_h {0}; fw_h < fw_dim[2]; ++fw_h) {
-                for(unsigned long fw_w {0}; fw_w < fw_dim[3]; ++fw_w) {
-                    MType max {m_data->at(m_channel_ul.first + fw_h * stride_ * fw_dim[3] + fw_w * stride_)};
-                    unsigned long max_i {m_channel_ul.first + fw_h * stride_ * fw_dim[3] + fw_w * stride_};
+        void MaxPool2dNode<MType>::pooling_core(const MType* m_data, MType* fw_data, unsigned long* index_data, unsigned long m_h, unsigned long m_w, unsigned long fw_h, unsigned long fw_w) {
+            assert((fw_h - 1) * stride_ + kernel_size_[0] <= m_h);
+            (void)m_h; // 只在assert里用
+            for(unsigned long h {0}; h < fw_h; ++h) {
+                for(unsigned long w {0}; w < fw_w; ++w) {
+                    unsigned long max_i {h * stride_ * m_w + w * stride_};
                     for(unsigned long k_h {0}; k_h < kernel_size_[0]; ++k_h) {
-                        for(unsigned long k_w {1}; k_w < kernel_size_[1]; ++k_w) {
-                            if(m_data->at(m_channel_ul.first + (fw_h * stride_ + k_h) * fw_dim[3] + fw_w * stride_ + k_w) > max) {
-                                max = m_data->at(m_channel_ul.first + (fw_h * stride_ + k_h) * fw_dim[3] + fw_w * stride_ + k_w);
-                                max_i = m_channel_ul.first + (fw_h * stride_ + k_h) * fw_dim[3] + fw_w * stride_ + k_w;
+                        for(unsigned long k_w {0}; k_w < kernel_size_[1]; ++k_w) {
+                            unsigned long i {(h * stride_ + k_h) * m_w + w * stride_ + k_w};
+                            if(m_data[i] > m_data[max_i]) {
+                                max_i = i;
                             }
                         }
                     }
-                    fw_data->at(fw_channel_ul.first + fw_h * fw_dim[2] + fw_w) = max;
-                    nzic.push_back(max_i);
+                    fw_data[h * fw_w + w] = m_data[max_i];
+                    if(index_data != nullptr) {
+                        index_data[h * fw_w + w] = max_i;
+                    }
                 }
             }
         }
 
         template <typename MType>
         void MaxPool2dNode<MType>::compute_jacobi(Matrix<MType>& m, node_ptr parent_node) {
-            std::sort(nzic.begin(), nzic.end());
+            // 稠密形式只保存每个输入元素被选中的次数，也就是局部jacobi按列求和
             assert(parent_node == BaseNode<MType>::get_parent(0));
-            matrix_dim fw_dim {BaseNode<MType>::get_parent(0)->get_dim()};
-            std::vector<std::thread> thread_c;
-            Matrix<MType> fw {fw_dim, 0};
-            unsigned long nzic_index;
-            for(unsigned long n {0}; n < fw_dim[0]; ++n) {
-                ul_pos data_batch_ul {BaseNode<MType>::data->get_batch(n)};
-                for(unsigned long c {0}; c < fw_dim[1]; ++c) {
-                    nzic_index = (n * fw_dim[1] + c) * (fw_dim[2] * fw_dim[3]);
-                    ul_pos data_channel_ul {BaseNode<MType>::data->get_channel(c, data_batch_ul)};
-                    thread_c.emplace_back(&MaxPool2dNode<MType>::depooling_core, this, std::ref(m), data_channel_ul, nzic_index);
-                }
-            }
-            for(auto& t : thread_c) {
-                t.join();
+            matrix_dim m_dim {parent_node->get_data_dim()};
+            matrix_dim fw_dim {BaseNode<MType>::data.get_dim()};
+            unsigned long m_len {m_dim[2] * m_dim[3]};
+            unsigned long fw_len {fw_dim[2] * fw_dim[3]};
+            Matrix<MType> result {m_dim, MType(0)};
+            MType* result_p {result.mutable_data()};
+            for(unsigned long i {0}; i < max_index.size(); ++i) {
+                result_p[(i / fw_len) * m_len + max_index[i]] += MType(1);
             }
+            m = result;
         }
 
         template <typename MType>
-        void MaxPool2dNode<MType>::depooling_core(Matrix<MType>& m, ul_pos data_channel_ul, unsigned long nzic_index) {
-            matrix_dim data_dim {BaseNode<MType>::data.get_dim()};
-            for(unsigned long m_h {0}; m_h < data_dim[2]; ++m_h) {
-                for(unsigned long m_w {0}; m_w < data_dim[3]; ++m_w) {
-                    m.set(nzic[nzic_index + m_h * data_dim[3] + m_w], BaseNode<MType>::data.get(data_channel_ul.first + m_h * data_dim[3] + m_w));
-                }
+        void MaxPool2dNode<MType>::backward(node_ptr output_node) {
+            compute_jacobi(BaseNode<MType>::jacobi, output_node);
+            BaseNode<MType>::wait_backward = false;
+        }
+
+        template <typename MType>
+        double MaxPool2dNode<MType>::estimate_flops(bool backward) {
+            // 前向每个输出比较k_h * k_w次，反向每个输出累加一次
+            double numel {static_cast<double>(BaseNode<MType>::data.get_data()->size())};
+            return backward ? numel : numel * kernel_size_[0] * kernel_size_[1];
+        }
+
+        template <typename MType>
+        void MaxPool2dNode<MType>::set_inference(bool inference) {
+            BaseNode<MType>::set_inference(inference);
+            if(inference) {
+                max_index_c {}.swap(max_index);
             }
         }
 
         template <typename MType>
-        void MaxPool2dNode<MType>::backward(node_ptr output_node) {
-            compute_jacobi(BaseNode<MType>::jacobi, output_node);
-            BaseNode<MType>::wait_backward = false;
+        void MaxPool2dNode<MType>::vjp(const Matrix<MType>& grad_output) {
+            // 梯度只回传给每个窗口里的最大值
+            node_ptr parent {BaseNode<MType>::get_parent(0)};
+            if(!parent->is_require_grad()) {
+                return;
+            }
+            matrix_dim m_dim {parent->get_data_dim()};
+            matrix_dim fw_dim {grad_output.get_dim()};
+            unsigned long m_len {m_dim[2] * m_dim[3]};
+            unsigned long fw_len {fw_dim[2] * fw_dim[3]};
+            Matrix<MType> grad {m_dim, MType(0)};
+            MType* grad_p {grad.mutable_data()};
+            const MType* g_p {grad_output.get_data()->data()};
+            utils::ThreadPool::global().parallel_for(fw_dim[0] * fw_dim[1], fw_len, [&](unsigned long task_i) {
+                for(unsigned long i {0}; i < fw_len; ++i) {
+                    grad_p[task_i * m_len + max_index[task_i * fw_len + i]] += g_p[task_i * fw_len + i];
+                }
+            });
+            parent->accumulate_jacobi(grad);
         }
     }
-}
\ No newline at end of file
+}
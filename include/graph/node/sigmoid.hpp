@@ -11,36 +11,53 @@ namespace aedlf {
             public:
                 using graph_nodes = std::shared_ptr<std::vector<std::shared_ptr<BaseNode<MType>>>>;
                 using node_ptr = std::shared_ptr<BaseNode<MType>>;
-                using matrix_data_p = std::shared_ptr<std::vector<MType>>;
+                using matrix_data_p = typename Matrix<MType>::matrix_data_p;
                 using matrix_dim = std::vector<unsigned long>;
                 using BaseNode<MType>::BaseNode;
                 void compute_forward() override;
                 void compute_jacobi(Matrix<MType>& m, node_ptr parent_node) override;
+                Jacobian<MType> local_jacobi(node_ptr parent_node) override;
+                void vjp(const Matrix<MType>& grad_output) override;
         };
 
         template <typename MType>
         void SigmoidNode<MType>::compute_forward() {
-            size_t parents_len {BaseNode<MType>::get_parents_len()};
-            assert(parents_len == 1);
+            assert(BaseNode<MType>::get_parents_len() == 1);
+            // 输出写进本节点自己的内存，和父节点共用内存的话mutable_data会先拷贝一份，父节点的数据不会被改写
             Matrix<MType> input_matrix {BaseNode<MType>::get_parent(0)->get_data()};
-            matrix_data_p input_matrix_p {input_matrix.get_m_data()};
-            for(size_t i {0}; i < input_matrix_p->size(); ++i) {
-                input_matrix_p->at(i) = 1 / (1 + std::exp(-1 * input_matrix_p->at(i)));
-            }
-            BaseNode<MType>::data = input_matrix;
+            Matrix<MType>& output_matrix {BaseNode<MType>::data};
+            output_matrix.resize(input_matrix.get_dim(), MType(0));
+            kernel::sigmoid(input_matrix.get_data()->size(), input_matrix.get_data()->data(), output_matrix.mutable_data());
         }
 
         template <typename MType>
         void SigmoidNode<MType>::compute_jacobi(Matrix<MType>& m, node_ptr parent_node) {
-            size_t parents_len {BaseNode<MType>::get_parents_len()};
-            assert(parents_len == 1 && parent_node == BaseNode<MType>::get_parent(0));
-            matrix_dim data_dim {parent_node->get_data_dim()};
-            Matrix<MType> parent_data {parent_node->get_data()};
-            matrix_data_p data_p {parent_data.get_m_data()};
-            m.resize(data_dim, 0);
-            for(size_t i {0}; i < data_p->size(); ++i) {
-                m.set(i, (data_p->at(i) * (1 - data_p->at(i))));
+            assert(BaseNode<MType>::get_parents_len() == 1 && parent_node == BaseNode<MType>::get_parent(0));
+            const Matrix<MType>& s {BaseNode<MType>::data};
+            m = mul_v(s, 1 - s);
+            m.view(parent_node->get_data_dim());
+        }
+
+        template <typename MType>
+        Jacobian<MType> SigmoidNode<MType>::local_jacobi(node_ptr parent_node) {
+            // 对角阵，只保存对角线s * (1 - s)
+            assert(BaseNode<MType>::get_parents_len() == 1 && parent_node == BaseNode<MType>::get_parent(0));
+            const Matrix<MType>& s {BaseNode<MType>::data};
+            Matrix<MType> d {mul_v(s, 1 - s)};
+            d.view(parent_node->get_data_dim());
+            return Jacobian<MType>::diagonal(d);
+        }
+
+        template <typename MType>
+        void SigmoidNode<MType>::vjp(const Matrix<MType>& grad_output) {
+            // dX = G * s * (1 - s)
+            node_ptr parent {BaseNode<MType>::get_parent(0)};
+            if(!parent->is_require_grad()) {
+                return;
             }
+            // 一次遍历直接累加到父节点的梯度上
+            const Matrix<MType>& s {BaseNode<MType>::data};
+            parent->accumulate_jacobi(mul_v(grad_output, mul_v(s, 1 - s)));
         }
     }
 }
\ No newline at end of file
@@ -4,12 +4,25 @@
 
 namespace aedlf {
     namespace graph {
+        /*
+        可训练的参数
+        bfloat16精度下master保存完整精度的主权重，update累加到master上，data只是舍入到bf16以后的副本，前向用的是data
+        这样很小的更新量不会因为bf16只有7位尾数被吃掉
+        */
         template <typename MType>
         class WeightNode : public BaseNode<MType> {
             public:
                 using BaseNode<MType>::BaseNode;
                 void init_data(std::string init_method) override;
+                void set_precision(Precision precision) override;
                 void update(MType lr) override;
+                Precision get_precision() const;
+                Matrix<MType> get_master(); // float32精度下就是data
+                void set_weight(const MType* src); // 从外部（比如checkpoint）写入参数，元素个数和data相同，bf16精度下写到主权重再舍入
+            protected:
+                void round_from_master();
+                Precision precision {Precision::float32};
+                Matrix<MType> master;
         };
 
         template <typename MType>
@@ -22,14 +35,67 @@ namespace aedlf {
                 {std::string("ones"), &matrix_tools::MakeMatrix<MType>::ones},
                 {std::string("zeros"), &matrix_tools::MakeMatrix<MType>::zeros}
             };
-            auto func_map_iter = function_map.find(init_method);
-            assert(func_map_iter != function_map.end());
+            assert(function_map.find(init_method) != function_map.end());
             (mm.*function_map[init_method])(BaseNode<MType>::data);
+            if(precision == Precision::bfloat16) {
+                master.copy_from(BaseNode<MType>::data);
+                round_from_master();
+            }
+        }
+
+        template <typename MType>
+        void WeightNode<MType>::set_precision(Precision precision) {
+            if(precision == this->precision) {
+                return;
+            }
+            Matrix<MType>& weight {BaseNode<MType>::data};
+            if(precision == Precision::bfloat16) {
+                master.copy_from(weight);
+                this->precision = precision;
+                round_from_master();
+                return;
+            }
+            // 回到float32时把主权重写回data，data绑定了槽位的话原地写
+            std::copy(master.get_data()->begin(), master.get_data()->end(), weight.mutable_data());
+            master = Matrix<MType> {};
+            this->precision = precision;
+        }
+
+        template <typename MType>
+        void WeightNode<MType>::round_from_master() {
+            Matrix<MType>& weight {BaseNode<MType>::data};
+            kernel::round_bfloat16(weight.get_data()->size(), master.get_data()->data(), weight.mutable_data());
         }
 
         template <typename MType>
         void WeightNode<MType>::update(MType lr) {
-            BaseNode<MType>::data += BaseNode<MType>::jacobi * (-1.0 * lr);
+            Matrix<MType>& weight {precision == Precision::bfloat16 ? master : BaseNode<MType>::data};
+            Matrix<MType>& grad {BaseNode<MType>::jacobi};
+            // data += -lr * jacobi，尺寸不一样时按add的规则广播，jacobi都不会被改写
+            weight.axpy(-lr, grad);
+            if(precision == Precision::bfloat16) {
+                round_from_master();
+            }
+        }
+
+        template <typename MType>
+        Precision WeightNode<MType>::get_precision() const {
+            return precision;
+        }
+
+        template <typename MType>
+        Matrix<MType> WeightNode<MType>::get_master() {
+            return precision == Precision::bfloat16 ? master : BaseNode<MType>::data;
+        }
+
+        template <typename MType>
+        void WeightNode<MType>::set_weight(const MType* src) {
+            Matrix<MType>& weight {precision == Precision::bfloat16 ? master : BaseNode<MType>::data};
+            // data绑定了槽位的话原地写，否则和别人共用时先拷贝一份
+            std::copy(src, src + weight.get_data()->size(), weight.mutable_data());
+            if(precision == Precision::bfloat16) {
+                round_from_master();
+            }
         }
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,474 @@
+#pragma once
+#include "./graph.hpp"
+#include "./node/weight.hpp"
+#include "./node/mul.hpp"
+#include "./node/add.hpp"
+#include "./node/conv.hpp"
+#include "../math/qgemm.hpp"
+#include "../math/conv.hpp"
+#include "../utils/allocator.hpp"
+#include "../utils/thread_pool.hpp"
+#include "../utils/profiler.hpp"
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+namespace aedlf {
+    namespace graph {
+        /*
+        训练好的计算图的int8推理（训练后量化），只做前向
+        FC（权重乘法+bias加法）和融合卷积换成int8 GEMM：权重按输出通道量化成int8，激活值按calibrate统计到的范围量化成uint8
+        两个量化层直接相连时，上一层的int32结果直接重新量化成下一层的输入，中间不出现实数张量
+        其他节点（Sigmoid、loss等）还是按原来的类型计算，进出量化层的地方自动量化/反量化
+        用法：用几个有代表性的batch调用calibrate，然后quantize，之后forward；权重再训练过需要重新quantize
+        */
+        template <typename MType>
+        class QuantizedGraph {
+            public:
+                using node_ptr = std::shared_ptr<BaseNode<MType>>;
+                using node_ptr_c = std::vector<node_ptr>;
+                using index_c = std::vector<size_t>;
+                using matrix_dim = std::vector<unsigned long>;
+                QuantizedGraph(const Graph<MType>& graph);
+                void calibrate(); // 用输入节点当前的数据跑一次实数前向，记录每个节点输出的范围，可以多次调用
+                void calibrate(std::initializer_list<Matrix<MType>> input_m);
+                void quantize(); // 找出可以量化的层，量化权重，确定每个张量的量化参数
+                void forward();
+                void forward(std::initializer_list<Matrix<MType>> input_m);
+                node_ptr get_output() const;
+                size_t get_layers_len() const; // 换成int8计算的层数
+                unsigned long get_weight_bytes() const; // 量化层int8权重和scale占的字节数
+                unsigned long get_float_weight_bytes() const; // 同样这些权重量化之前占的字节数
+                bool is_quantized() const;
+            protected:
+                struct Observer {
+                    float min {std::numeric_limits<float>::max()};
+                    float max {std::numeric_limits<float>::lowest()};
+                    bool seen {false};
+                };
+                struct QTensor {
+                    std::vector<uint8_t, utils::Allocator<uint8_t>> data;
+                    matrix_dim dim;
+                    kernel::QuantParam param;
+                };
+                struct QuantLayer {
+                    size_t node_id; // 输出节点：FC的加法节点或者卷积节点
+                    size_t input_id;
+                    size_t weight_id;
+                    bool conv;
+                    kernel::ConvShape shape; // 只有卷积用
+                    uint8_t padding_q; // 填充值量化以后的值
+                    unsigned long m; // 输出通道数
+                    unsigned long k; // 每个输出的乘加数
+                    std::vector<int8_t, utils::Allocator<int8_t>> weight;
+                    std::vector<float> weight_scale;
+                    std::vector<int32_t> row_offset;
+                    std::vector<float> row_scale;
+                    Matrix<MType> bias;
+                };
+                void set_input(std::initializer_list<Matrix<MType>> input_m);
+                void observe(size_t node_id);
+                bool match_fc(size_t node_id, QuantLayer& layer);
+                bool match_conv(size_t node_id, QuantLayer& layer);
+                void prepare_weight(QuantLayer& layer);
+                void quantize_tensor(size_t node_id);
+                matrix_dim output_dim(size_t node_id, const matrix_dim& dim);
+                Matrix<MType>& float_output(size_t node_id, const matrix_dim& dim);
+                void run_fc(const QuantLayer& layer);
+                void run_conv(const QuantLayer& layer);
+                node_ptr output;
+                node_ptr_c nodes;
+                index_c forward_plan;
+                index_c input_index;
+                std::vector<index_c> parents;
+                std::vector<unsigned long> childrens_len;
+                std::vector<Observer> observer;
+                std::vector<QTensor> q_tensor;
+                std::vector<bool> need_u8; // 有量化层要用这个节点的uint8数据
+                std::vector<bool> need_float; // 有实数节点要用这个节点的数据，或者是输出节点
+                std::vector<bool> fused; // 合并进量化层、不再单独计算的节点（FC的乘法节点）
+                std::vector<long> layer_of;
+                std::vector<QuantLayer> layers;
+                bool quantized {false};
+        };
+
+        template <typename MType>
+        QuantizedGraph<MType>::QuantizedGraph(const Graph<MType>& graph) {
+            output = graph.get_output();
+            if(!output) {
+                throw std::runtime_error("`QuantizedGraph` needs a compiled `Graph`");
+            }
+            nodes = graph.get_nodes();
+            forward_plan = graph.get_forward_plan();
+            input_index = graph.get_input_index();
+            parents.assign(nodes.size(), index_c {});
+            childrens_len.assign(nodes.size(), 0);
+            for(size_t i {0}; i < nodes.size(); ++i) {
+                for(size_t parent_i {0}; parent_i < graph.get_parents_len(i); ++parent_i) {
+                    size_t p {graph.get_parent_index(i, parent_i)};
+                    parents[i].push_back(p);
+                    ++childrens_len[p];
+                }
+            }
+            observer.assign(nodes.size(), Observer {});
+            q_tensor.assign(nodes.size(), QTensor {});
+        }
+
+        template <typename MType>
+        void QuantizedGraph<MType>::set_input(std::initializer_list<Matrix<MType>> input_m) {
+            if(input_m.size() > input_index.size()) {
+                throw std::runtime_error("`QuantizedGraph` got more input matrices than input nodes");
+            }
+            size_t input_i {0};
+            for(auto m_iter = input_m.begin(); m_iter != input_m.end(); ++m_iter, ++input_i) {
+                nodes[input_index[input_i]]->set_data(*m_iter);
+            }
+        }
+
+        template <typename MType>
+        void QuantizedGraph<MType>::observe(size_t node_id) {
+            Matrix<MType> m {nodes[node_id]->get_data()};
+            Observer& o {observer[node_id]};
+            const MType* p {m.get_data()->data()};
+            for(unsigned long i {0}; i < m.get_data()->size(); ++i) {
+                o.min = std::min(o.min, float(p[i]));
+                o.max = std::max(o.max, float(p[i]));
+            }
+            o.seen = true;
+        }
+
+        template <typename MType>
+        void QuantizedGraph<MType>::calibrate() {
+            utils::ProfileScope profile {"quantize_calibrate", "graph"};
+            for(size_t i {0}; i < input_index.size(); ++i) {
+                observe(input_index[i]);
+            }
+            // 推理模式规划过内存的图里中间结果会被后面的节点覆盖，算完马上统计
+            for(size_t i {0}; i < forward_plan.size(); ++i) {
+                nodes[forward_plan[i]]->run_forward();
+                observe(forward_plan[i]);
+            }
+        }
+
+        template <typename MType>
+        void QuantizedGraph<MType>::calibrate(std::initializer_list<Matrix<MType>> input_m) {
+            set_input(input_m);
+            calibrate();
+        }
+
+        template <typename MType>
+        bool QuantizedGraph<MType>::match_fc(size_t node_id, QuantLayer& layer) {
+            // add(mul(weight, x), bias)，乘法节点只给这个加法节点用
+            if(!std::dynamic_pointer_cast<AddNode<MType>>(nodes[node_id]) || parents[node_id].size() != 2) {
+                return false;
+            }
+            size_t mul_id {parents[node_id][0]};
+            size_t bias_id {parents[node_id][1]};
+            if(!std::dynamic_pointer_cast<MulNode<MType>>(nodes[mul_id]) || parents[mul_id].size() != 2 || childrens_len[mul_id] != 1) {
+                return false;
+            }
+            size_t weight_id {parents[mul_id][0]};
+            size_t input_id {parents[mul_id][1]};
+            if(!std::dynamic_pointer_cast<WeightNode<MType>>(nodes[weight_id]) || !std::dynamic_pointer_cast<WeightNode<MType>>(nodes[bias_id])) {
+                return false;
+            }
+            matrix_dim w_dim {nodes[weight_id]->get_data_dim()};
+            matrix_dim b_dim {nodes[bias_id]->get_data_dim()};
+            matrix_dim x_dim {nodes[input_id]->get_data_dim()};
+            if(w_dim[0] != 1 || w_dim[1] != 1 || b_dim != (matrix_dim {1, 1, w_dim[2], 1}) || x_dim[1] * x_dim[2] * x_dim[3] != w_dim[3]) {
+                return false;
+            }
+            layer.node_id = node_id;
+            layer.input_id = input_id;
+            layer.weight_id = weight_id;
+            layer.conv = false;
+            layer.m = w_dim[2];
+            layer.k = w_dim[3];
+            layer.bias = nodes[bias_id]->get_data();
+            fused[mul_id] = true;
+            return true;
+        }
+
+        template <typename MType>
+        bool QuantizedGraph<MType>::match_conv(size_t node_id, QuantLayer& layer) {
+            std::shared_ptr<FusedConv2dNode<MType>> conv {std::dynamic_pointer_cast<FusedConv2dNode<MType>>(nodes[node_id])};
+            if(!conv || parents[node_id].size() != 3) {
+                return false;
+            }
+            size_t weight_id {parents[node_id][0]};
+            size_t input_id {parents[node_id][1]};
+            size_t bias_id {parents[node_id][2]};
+            kernel::ConvShape shape {conv->get_conv_shape()};
+            matrix_dim w_dim {nodes[weight_id]->get_data_dim()};
+            matrix_dim b_dim {nodes[bias_id]->get_data_dim()};
+            if(w_dim[0] != 1 || b_dim != (matrix_dim {1, 1, shape.out_channel, shape.output_len()})) {
+                return false;
+            }
+            layer.node_id = node_id;
+            layer.input_id = input_id;
+            layer.weight_id = weight_id;
+            layer.conv = true;
+            layer.shape = shape;
+            layer.m = shape.out_channel;
+            layer.k = shape.col_rows();
+            layer.bias = nodes[bias_id]->get_data();
+            return true;
+        }
+
+        template <typename MType>
+        void QuantizedGraph<MType>::prepare_weight(QuantLayer& layer) {
+            Matrix<MType> w {nodes[layer.weight_id]->get_data()};
+            const MType* w_p {w.get_data()->data()};
+            std::vector<MType, utils::Allocator<MType>> packed;
+            if(layer.conv) {
+                // 先排成(output_channel, in_channel * k_h * k_w)，和实数卷积的GEMM一样
+                packed.resize(layer.m * layer.k);
+                kernel::conv_pack_weight(layer.shape, w_p, packed.data());
+                w_p = packed.data();
+            }
+            layer.weight.assign(kernel::qgemm_packed_rows(layer.m) * kernel::qgemm_k4(layer.k), int8_t(0));
+            layer.weight_scale.assign(layer.m, 1.0f);
+            std::vector<int32_t> row_sum(layer.m, 0);
+            kernel::quantize_pack_a(layer.m, layer.k, w_p, layer.k, layer.weight.data(), layer.weight_scale.data(), row_sum.data());
+            const kernel::QuantParam& x_param {q_tensor[layer.input_id].param};
+            layer.row_offset.assign(layer.m, 0);
+            layer.row_scale.assign(layer.m, 1.0f);
+            for(unsigned long i {0}; i < layer.m; ++i) {
+                layer.row_offset[i] = x_param.zero_point * row_sum[i];
+                layer.row_scale[i] = layer.weight_scale[i] * x_param.scale;
+            }
+            if(layer.conv) {
+                MType padding_value {std::static_pointer_cast<FusedConv2dNode<MType>>(nodes[layer.node_id])->get_padding_value()};
+                layer.padding_q = kernel::quantize_u8(float(padding_value), x_param);
+            }
+        }
+
+        template <typename MType>
+        void QuantizedGraph<MType>::quantize() {
+            size_t nodes_len {nodes.size()};
+            need_u8.assign(nodes_len, false);
+            need_float.assign(nodes_len, false);
+            fused.assign(nodes_len, false);
+            layer_of.assign(nodes_len, -1);
+            layers.clear();
+            for(size_t i {0}; i < forward_plan.size(); ++i) {
+                size_t node_id {forward_plan[i]};
+                QuantLayer layer {};
+                if(match_fc(node_id, layer) || match_conv(node_id, layer)) {
+                    layer_of[node_id] = long(layers.size());
+                    need_u8[layer.input_id] = true;
+                    layers.push_back(layer);
+                }
+            }
+            // 实数节点的父节点都要有实数数据；量化层只读输入的uint8数据
+            for(size_t i {0}; i < forward_plan.size(); ++i) {
+                size_t node_id {forward_plan[i]};
+                if(fused[node_id] || layer_of[node_id] >= 0) {
+                    continue;
+                }
+                for(size_t parent_i {0}; parent_i < parents[node_id].size(); ++parent_i) {
+                    need_float[parents[node_id][parent_i]] = true;
+                }
+            }
+            need_float[nodes_len - 1] = true;
+            for(size_t i {0}; i < nodes_len; ++i) {
+                if(!need_u8[i]) {
+                    continue;
+                }
+                if(!observer[i].seen) {
+                    throw std::runtime_error("`QuantizedGraph` needs calibrate() before quantize(), `" + nodes[i]->get_name() + "` has no range");
+                }
+                q_tensor[i].param = kernel::choose_quant_param(observer[i].min, observer[i].max);
+            }
+            for(size_t i {0}; i < layers.size(); ++i) {
+                prepare_weight(layers[i]);
+            }
+            quantized = true;
+        }
+
+        template <typename MType>
+        void QuantizedGraph<MType>::quantize_tensor(size_t node_id) {
+            Matrix<MType> m {nodes[node_id]->get_data()};
+            QTensor& q {q_tensor[node_id]};
+            q.dim = m.get_dim();
+            q.data.resize(m.get_data()->size());
+            kernel::quantize_u8(m.get_data()->size(), m.get_data()->data(), q.param, q.data.data());
+        }
+
+        template <typename MType>
+        typename QuantizedGraph<MType>::matrix_dim QuantizedGraph<MType>::output_dim(size_t node_id, const matrix_dim& dim) {
+            // 下一层可能把这个节点view成了别的形状（比如FC把卷积输出拉平），元素个数一样就沿用
+            matrix_dim node_dim {nodes[node_id]->get_data_dim()};
+            if(node_dim[0] * node_dim[1] * node_dim[2] * node_dim[3] == dim[0] * dim[1] * dim[2] * dim[3]) {
+                return node_dim;
+            }
+            return dim;
+        }
+
+        template <typename MType>
+        Matrix<MType>& QuantizedGraph<MType>::float_output(size_t node_id, const matrix_dim& dim) {
+            // 尺寸不变时直接写进节点已有的内存（可能是规划好的槽位）
+            if(nodes[node_id]->get_data_dim() != dim) {
+                nodes[node_id]->set_data(Matrix<MType>(dim, MType(0)));
+            }
+            return nodes[node_id]->get_m_data();
+        }
+
+        template <typename MType>
+        void QuantizedGraph<MType>::run_fc(const QuantLayer& layer) {
+            const QTensor& x {q_tensor[layer.input_id]};
+            unsigned long batch {x.dim[0]};
+            matrix_dim y_dim {output_dim(layer.node_id, matrix_dim {batch, 1, layer.m, 1})};
+            bool to_float {need_float[layer.node_id]};
+            bool to_u8 {need_u8[layer.node_id]};
+            // 指针在并行之前取好，任务里不能再碰Matrix的引用计数
+            MType* y_p {to_float ? float_output(layer.node_id, y_dim).mutable_data() : nullptr};
+            QTensor& y_q {q_tensor[layer.node_id]};
+            if(to_u8) {
+                y_q.dim = y_dim;
+                y_q.data.resize(batch * layer.m);
+            }
+            const MType* bias_p {layer.bias.get_data()->data()};
+            // 每个任务算一段样本，样本是B的列，结果(m, 样本)转置着写回(n, m)
+            const unsigned long block {64};
+            unsigned long block_num {(batch + block - 1) / block};
+            utils::ThreadPool::global().parallel_for(block_num, block * layer.m * layer.k, [&](unsigned long task_i) {
+                unsigned long j_begin {task_i * block};
+                unsigned long cols {std::min(block, batch - j_begin)};
+                static thread_local std::vector<int32_t, utils::Allocator<int32_t>> acc {utils::Allocator<int32_t> {utils::default_resource()}};
+                acc.resize(layer.m * cols);
+                kernel::qgemm(layer.m, cols, layer.k, layer.weight.data(), x.data.data() + j_begin * layer.k, 1, layer.k, acc.data(), cols);
+                if(to_float) {
+                    kernel::qgemm_dequantize(layer.m, cols, acc.data(), cols, layer.row_offset.data(), layer.row_scale.data(), bias_p, 1, 0, y_p + j_begin * layer.m, 1, layer.m);
+                }
+                if(to_u8) {
+                    kernel::qgemm_requantize(layer.m, cols, acc.data(), cols, layer.row_offset.data(), layer.row_scale.data(), bias_p, 1, 0, y_q.param, y_q.data.data() + j_begin * layer.m, 1, layer.m);
+                }
+            });
+        }
+
+        template <typename MType>
+        void QuantizedGraph<MType>::run_conv(const QuantLayer& layer) {
+            const QTensor& x {q_tensor[layer.input_id]};
+            const kernel::ConvShape& shape {layer.shape};
+            unsigned long x_len {shape.in_channel * shape.in_h * shape.in_w};
+            if(x.dim[1] * x.dim[2] * x.dim[3] != x_len) {
+                throw std::runtime_error("`QuantizedGraph` input of `" + nodes[layer.node_id]->get_name() + "` changed its image size, quantize() again");
+            }
+            unsigned long batch {x.dim[0]};
+            unsigned long output_len {shape.output_len()};
+            unsigned long y_len {shape.out_channel * output_len};
+            matrix_dim y_dim {output_dim(layer.node_id, matrix_dim {batch, 1, shape.out_channel, output_len})};
+            bool to_float {need_float[layer.node_id]};
+            bool to_u8 {need_u8[layer.node_id]};
+            // 指针在并行之前取好，任务里不能再碰Matrix的引用计数
+            MType* y_p {to_float ? float_output(layer.node_id, y_dim).mutable_data() : nullptr};
+            QTensor& y_q {q_tensor[layer.node_id]};
+            if(to_u8) {
+                y_q.dim = y_dim;
+                y_q.data.resize(batch * y_len);
+            }
+            const MType* bias_p {layer.bias.get_data()->data()};
+            unsigned long tile_len {kernel::conv_tile_len(shape)};
+            unsigned long tile_num {(output_len + tile_len - 1) / tile_len};
+            utils::ThreadPool::global().parallel_for(batch * tile_num, layer.m * layer.k * tile_len, [&](unsigned long task_i) {
+                unsigned long n {task_i / tile_num};
+                unsigned long p_begin {task_i % tile_num * tile_len};
+                unsigned long p_len {std::min(tile_len, output_len - p_begin)};
+                std::vector<uint8_t, utils::Allocator<uint8_t>>& col {kernel::conv_col_buffer<uint8_t>()};
+                static thread_local std::vector<int32_t, utils::Allocator<int32_t>> acc {utils::Allocator<int32_t> {utils::default_resource()}};
+                col.resize(layer.k * p_len);
+                acc.resize(layer.m * p_len);
+                kernel::conv_col_tile(shape, x.data.data() + n * x_len, p_begin, p_len, layer.padding_q, col.data());
+                kernel::qgemm(layer.m, p_len, layer.k, layer.weight.data(), col.data(), p_len, 1, acc.data(), p_len);
+                if(to_float) {
+                    kernel::qgemm_dequantize(layer.m, p_len, acc.data(), p_len, layer.row_offset.data(), layer.row_scale.data(), bias_p + p_begin, output_len, 1, y_p + n * y_len + p_begin, output_len, 1);
+                }
+                if(to_u8) {
+                    kernel::qgemm_requantize(layer.m, p_len, acc.data(), p_len, layer.row_offset.data(), layer.row_scale.data(), bias_p + p_begin, output_len, 1, y_q.param, y_q.data.data() + n * y_len + p_begin, output_len, 1);
+                }
+            });
+        }
+
+        template <typename MType>
+        void QuantizedGraph<MType>::forward() {
+            if(!quantized) {
+                throw std::runtime_error("`QuantizedGraph` is not quantized, call calibrate() and quantize() first");
+            }
+            utils::Profiler::global().next_iteration();
+            for(size_t i {0}; i < input_index.size(); ++i) {
+                if(need_u8[input_index[i]]) {
+                    quantize_tensor(input_index[i]);
+                }
+            }
+            for(size_t i {0}; i < forward_plan.size(); ++i) {
+                size_t node_id {forward_plan[i]};
+                if(fused[node_id]) {
+                    continue;
+                }
+                if(layer_of[node_id] < 0) {
+                    nodes[node_id]->run_forward();
+                    if(need_u8[node_id]) {
+                        quantize_tensor(node_id);
+                    }
+                    continue;
+                }
+                const QuantLayer& layer {layers[layer_of[node_id]]};
+                utils::ProfileScope profile {nodes[node_id]->get_name(), "forward_int8"};
+                if(profile.is_active()) {
+                    unsigned long columns {layer.conv ? q_tensor[layer.input_id].dim[0] * layer.shape.output_len() : q_tensor[layer.input_id].dim[0]};
+                    profile.set_flops(2.0 * layer.m * layer.k * columns);
+                }
+                if(layer.conv) {
+                    run_conv(layer);
+                }
+                else {
+                    run_fc(layer);
+                }
+            }
+        }
+
+        template <typename MType>
+        void QuantizedGraph<MType>::forward(std::initializer_list<Matrix<MType>> input_m) {
+            set_input(input_m);
+            forward();
+        }
+
+        template <typename MType>
+        typename QuantizedGraph<MType>::node_ptr QuantizedGraph<MType>::get_output() const {
+            return output;
+        }
+
+        template <typename MType>
+        size_t QuantizedGraph<MType>::get_layers_len() const {
+            return layers.size();
+        }
+
+        template <typename MType>
+        unsigned long QuantizedGraph<MType>::get_weight_bytes() const {
+            unsigned long bytes {0};
+            for(size_t i {0}; i < layers.size(); ++i) {
+                bytes += layers[i].m * layers[i].k * sizeof(int8_t) + layers[i].weight_scale.size() * sizeof(float);
+            }
+            return bytes;
+        }
+
+        template <typename MType>
+        unsigned long QuantizedGraph<MType>::get_float_weight_bytes() const {
+            unsigned long bytes {0};
+            for(size_t i {0}; i < layers.size(); ++i) {
+                bytes += layers[i].m * layers[i].k * sizeof(MType);
+            }
+            return bytes;
+        }
+
+        template <typename MType>
+        bool QuantizedGraph<MType>::is_quantized() const {
+            return quantized;
+        }
+    }
+}
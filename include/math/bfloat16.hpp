@@ -0,0 +1,70 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+
+
+namespace aedlf {
+    /*
+    bfloat16就是float32的高16位：指数位和float32一样宽，尾数只剩7位，所以不需要额外的溢出处理
+    这里只提供存储格式和舍入（round-to-nearest-even），计算时都换回float32
+    */
+    enum class Precision {
+        float32, // 按MType原样计算
+        bfloat16 // 前向的中间结果和参数都舍入到bf16能表示的值，主权重和梯度仍然保持MType精度
+    };
+
+    struct bfloat16 {
+        uint16_t bits {0};
+        bfloat16() {};
+        bfloat16(float value);
+        operator float() const;
+        static bfloat16 from_bits(uint16_t bits);
+    };
+
+    inline bfloat16::bfloat16(float value) {
+        uint32_t u {0};
+        std::memcpy(&u, &value, sizeof(u));
+        if((u & 0x7fffffffu) > 0x7f800000u) {
+            // NaN直接截断会变成inf，保留符号并置上quiet位
+            bits = static_cast<uint16_t>((u >> 16) | 0x0040u);
+            return;
+        }
+        u += 0x7fffu + ((u >> 16) & 1u);
+        bits = static_cast<uint16_t>(u >> 16);
+    }
+
+    inline bfloat16::operator float() const {
+        uint32_t u {static_cast<uint32_t>(bits) << 16};
+        float value {0};
+        std::memcpy(&value, &u, sizeof(value));
+        return value;
+    }
+
+    inline bfloat16 bfloat16::from_bits(uint16_t bits) {
+        bfloat16 b {};
+        b.bits = bits;
+        return b;
+    }
+
+    namespace kernel {
+        inline void to_bfloat16(unsigned long n, const float* x, bfloat16* y) {
+            for(unsigned long i {0}; i < n; ++i) {
+                y[i] = bfloat16 {x[i]};
+            }
+        }
+
+        inline void from_bfloat16(unsigned long n, const bfloat16* x, float* y) {
+            for(unsigned long i {0}; i < n; ++i) {
+                y[i] = float(x[i]);
+            }
+        }
+
+        // y = x舍入到bf16以后的值，可以inplace；MType是double时先转成float，相当于多舍入一次
+        template <typename MType>
+        void round_bfloat16(unsigned long n, const MType* x, MType* y) {
+            for(unsigned long i {0}; i < n; ++i) {
+                y[i] = MType(float(bfloat16 {float(x[i])}));
+            }
+        }
+    }
+}
@@ -0,0 +1,157 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include <stdexcept>
+#include <cassert>
+#include <algorithm>
+#include "elementwise.hpp"
+#include "../utils/thread_pool.hpp"
+
+
+namespace aedlf {
+    namespace kernel {
+        /*
+        NumPy规则的广播，(n,c,h,w)逐维对齐：两边尺寸相同，或者其中一边是1，是1的那一边在这一维上的步长记为0
+        输出y总是连续存放的，x的广播情况相同的相邻维度合并成一维，合并之后最后一维是一整行，交给逐元素kernel
+        x在这一行上连续时调用add/mul/axpy，步长是0时整行只用到x的一个数，调用add_scalar/scale
+        比如bias(1,c,h,w)加到(n,c,h,w)上合并成(n, c*h*w)，一共n行；(1,c,1,1)合并成(n, c, h*w)，每行是一次add_scalar
+        */
+        struct BroadcastShape {
+            unsigned long rank {0}; // 合并之后的维数
+            unsigned long shape[4] {0, 0, 0, 0};
+            unsigned long x_stride[4] {0, 0, 0, 0}; // 0表示x在这一维上被广播
+            unsigned long row_len() const {
+                return shape[rank - 1];
+            }
+            unsigned long row_num() const {
+                unsigned long num {1};
+                for(unsigned long i {0}; i + 1 < rank; ++i) {
+                    num *= shape[i];
+                }
+                return num;
+            }
+            bool x_row_contiguous() const {
+                return x_stride[rank - 1] != 0;
+            }
+            unsigned long x_offset(unsigned long row) const {
+                // 行号按合并后的外层维度行优先展开
+                unsigned long offset {0};
+                for(unsigned long i {rank - 1}; i > 0; --i) {
+                    offset += (row % shape[i - 1]) * x_stride[i - 1];
+                    row /= shape[i - 1];
+                }
+                return offset;
+            }
+        };
+
+        // 两个形状广播之后的形状，不能广播时抛异常
+        inline std::vector<unsigned long> broadcast_dim(const std::vector<unsigned long>& a, const std::vector<unsigned long>& b) {
+            assert(a.size() == 4 && b.size() == 4);
+            std::vector<unsigned long> result(4, 0);
+            for(unsigned long i {0}; i < 4; ++i) {
+                if(a[i] != b[i] && a[i] != 1 && b[i] != 1) {
+                    throw std::runtime_error("Matrix shape is not match for broadcasting");
+                }
+                result[i] = std::max(a[i], b[i]);
+            }
+            return result;
+        }
+
+        // y_dim是输出的形状，x的每一维要么和它相同，要么是1
+        inline BroadcastShape make_broadcast(const std::vector<unsigned long>& y_dim, const std::vector<unsigned long>& x_dim) {
+            assert(y_dim.size() == 4 && x_dim.size() == 4);
+            unsigned long x_contiguous_stride[4];
+            x_contiguous_stride[3] = 1;
+            for(unsigned long i {3}; i > 0; --i) {
+                x_contiguous_stride[i - 1] = x_contiguous_stride[i] * x_dim[i];
+            }
+            BroadcastShape b {};
+            for(unsigned long i {0}; i < 4; ++i) {
+                if(x_dim[i] != y_dim[i] && x_dim[i] != 1) {
+                    throw std::runtime_error("Matrix shape is not match for broadcasting");
+                }
+                if(y_dim[i] == 1) {
+                    continue; // 长度是1的维度不影响寻址
+                }
+                unsigned long stride {x_dim[i] == 1 ? 0 : x_contiguous_stride[i]};
+                if(b.rank > 0 && (b.x_stride[b.rank - 1] == 0) == (stride == 0)) {
+                    // x是连续存放的，相邻两维都不广播时外层步长正好是内层的长度乘步长，合并后取内层的步长
+                    b.shape[b.rank - 1] *= y_dim[i];
+                    b.x_stride[b.rank - 1] = stride;
+                }
+                else {
+                    b.shape[b.rank] = y_dim[i];
+                    b.x_stride[b.rank] = stride;
+                    ++b.rank;
+                }
+            }
+            if(b.rank == 0) {
+                b.rank = 1;
+                b.shape[0] = 1;
+                b.x_stride[0] = 1;
+            }
+            return b;
+        }
+
+        template <typename MType>
+        struct BroadcastAdd {
+            void row(unsigned long n, const MType* x, MType* y) const {
+                add(n, x, y);
+            }
+            void row_scalar(unsigned long n, MType x, MType* y) const {
+                add_scalar(n, x, y);
+            }
+        };
+
+        template <typename MType>
+        struct BroadcastMul {
+            void row(unsigned long n, const MType* x, MType* y) const {
+                mul(n, x, y);
+            }
+            void row_scalar(unsigned long n, MType x, MType* y) const {
+                scale(n, x, y);
+            }
+        };
+
+        template <typename MType>
+        struct BroadcastAxpy {
+            MType alpha;
+            void row(unsigned long n, const MType* x, MType* y) const {
+                axpy(n, alpha, x, y);
+            }
+            void row_scalar(unsigned long n, MType x, MType* y) const {
+                add_scalar(n, alpha * x, y);
+            }
+        };
+
+        // y = x，把x展开成y的形状
+        template <typename MType>
+        struct BroadcastCopy {
+            void row(unsigned long n, const MType* x, MType* y) const {
+                std::copy(x, x + n, y);
+            }
+            void row_scalar(unsigned long n, MType x, MType* y) const {
+                std::fill(y, y + n, x);
+            }
+        };
+
+        // 一次遍历y，按行切给线程池，每行调用一次Op
+        template <typename MType, typename Op>
+        void broadcast_apply(const BroadcastShape& b, const MType* x, MType* y, const Op& op) {
+            unsigned long len {b.row_len()};
+            bool contiguous {b.x_row_contiguous()};
+            utils::ThreadPool::global().parallel_for_range(b.row_num(), len, [&](unsigned long begin, unsigned long end) {
+                for(unsigned long row {begin}; row < end; ++row) {
+                    const MType* x_row {x + b.x_offset(row)};
+                    MType* y_row {y + row * len};
+                    if(contiguous) {
+                        op.row(len, x_row, y_row);
+                    }
+                    else {
+                        op.row_scalar(len, *x_row, y_row);
+                    }
+                }
+            });
+        }
+    }
+}
@@ -0,0 +1,194 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include "gemm.hpp"
+#include "elementwise.hpp"
+#include "../utils/allocator.hpp"
+
+
+namespace aedlf {
+    namespace kernel {
+        /*
+        直接卷积，不展开整张img2col矩阵（隐式img2col + 分块GEMM）
+        输出的像素按tile_len一段切开，每段只在线程自己的缓冲区里展开(c * k_h * k_w, tile_len)的列矩阵
+        padding和stride在展开时处理，超出原图的位置直接填padding值，不再生成填充后的图像
+        权重先重排成(out_channel, c * k_h * k_w)，一次GEMM把所有输入通道一起算完
+        */
+        struct ConvShape {
+            unsigned long in_channel;
+            unsigned long in_h;
+            unsigned long in_w;
+            unsigned long out_channel;
+            unsigned long kernel_h;
+            unsigned long kernel_w;
+            unsigned long padding_h;
+            unsigned long padding_w;
+            unsigned long stride;
+            unsigned long output_h() const {
+                return (in_h + 2 * padding_h - kernel_h) / stride + 1;
+            };
+            unsigned long output_w() const {
+                return (in_w + 2 * padding_w - kernel_w) / stride + 1;
+            };
+            unsigned long output_len() const {
+                return output_h() * output_w();
+            };
+            unsigned long col_rows() const {
+                return in_channel * kernel_h * kernel_w;
+            };
+        };
+
+        // 一段列矩阵控制在32K个元素以内，和GEMM打包的B块一起放得进L2
+        const unsigned long conv_tile_elements {32 * 1024};
+
+        inline unsigned long conv_tile_len(const ConvShape& shape) {
+            unsigned long tile_len {std::max(conv_tile_elements / shape.col_rows(), 16ul)};
+            return std::min(tile_len, shape.output_len());
+        }
+
+        // (in_channel, out_channel, k_h * k_w) -> (out_channel, in_channel * k_h * k_w)
+        template <typename MType>
+        void conv_pack_weight(const ConvShape& shape, const MType* w, MType* packed) {
+            unsigned long k_len {shape.kernel_h * shape.kernel_w};
+            unsigned long col_rows {shape.col_rows()};
+            for(unsigned long c {0}; c < shape.in_channel; ++c) {
+                for(unsigned long o {0}; o < shape.out_channel; ++o) {
+                    std::copy(w + (c * shape.out_channel + o) * k_len, w + (c * shape.out_channel + o + 1) * k_len, packed + o * col_rows + c * k_len);
+                }
+            }
+        }
+
+        // conv_pack_weight的逆过程，累加到w上
+        template <typename MType>
+        void conv_unpack_weight_add(const ConvShape& shape, const MType* packed, MType* w) {
+            unsigned long k_len {shape.kernel_h * shape.kernel_w};
+            unsigned long col_rows {shape.col_rows()};
+            for(unsigned long c {0}; c < shape.in_channel; ++c) {
+                for(unsigned long o {0}; o < shape.out_channel; ++o) {
+                    kernel::add(k_len, packed + o * col_rows + c * k_len, w + (c * shape.out_channel + o) * k_len);
+                }
+            }
+        }
+
+        // 展开输出像素[p_begin, p_begin + p_len)对应的列矩阵，col是(col_rows, p_len)
+        template <typename MType>
+        void conv_col_tile(const ConvShape& shape, const MType* x, unsigned long p_begin, unsigned long p_len, MType padding_value, MType* col) {
+            unsigned long output_w {shape.output_w()};
+            for(unsigned long c {0}; c < shape.in_channel; ++c) {
+                const MType* x_channel {x + c * shape.in_h * shape.in_w};
+                for(unsigned long k_h {0}; k_h < shape.kernel_h; ++k_h) {
+                    for(unsigned long k_w {0}; k_w < shape.kernel_w; ++k_w) {
+                        MType* col_row {col + ((c * shape.kernel_h + k_h) * shape.kernel_w + k_w) * p_len};
+                        // 坐标是填充后图像上的位置，减去padding以后落在原图外面的就是填充值
+                        // 输出的一行对应的w是等差的，落在原图里的是中间连续的一段，两边是填充值
+                        unsigned long w_begin {shape.padding_w > k_w ? (shape.padding_w - k_w + shape.stride - 1) / shape.stride : 0};
+                        unsigned long w_end {shape.padding_w + shape.in_w > k_w ? (shape.padding_w + shape.in_w - k_w + shape.stride - 1) / shape.stride : 0};
+                        for(unsigned long p {p_begin}; p < p_begin + p_len;) {
+                            unsigned long o_h {p / output_w};
+                            unsigned long o_w_begin {p % output_w};
+                            unsigned long o_w_end {std::min(output_w, o_w_begin + p_begin + p_len - p)};
+                            MType* dst {col_row + (p - p_begin) - o_w_begin};
+                            unsigned long h {o_h * shape.stride + k_h};
+                            p += o_w_end - o_w_begin;
+                            if(h < shape.padding_h || h - shape.padding_h >= shape.in_h) {
+                                std::fill(dst + o_w_begin, dst + o_w_end, padding_value);
+                                continue;
+                            }
+                            unsigned long lo {std::min(std::max(w_begin, o_w_begin), o_w_end)};
+                            unsigned long hi {std::max(std::min(w_end, o_w_end), lo)};
+                            std::fill(dst + o_w_begin, dst + lo, padding_value);
+                            if(lo < hi) {
+                                const MType* x_row {x_channel + (h - shape.padding_h) * shape.in_w + (lo * shape.stride + k_w - shape.padding_w)};
+                                if(shape.stride == 1) {
+                                    std::copy(x_row, x_row + (hi - lo), dst + lo);
+                                }
+                                else {
+                                    for(unsigned long o_w {lo}; o_w < hi; ++o_w) {
+                                        dst[o_w] = x_row[(o_w - lo) * shape.stride];
+                                    }
+                                }
+                            }
+                            std::fill(dst + hi, dst + o_w_end, padding_value);
+                        }
+                    }
+                }
+            }
+        }
+
+        // conv_col_tile的转置操作，把列矩阵的梯度累加回原图，填充位置的梯度丢掉
+        template <typename MType>
+        void conv_col_tile_add(const ConvShape& shape, const MType* col, unsigned long p_begin, unsigned long p_len, MType* x) {
+            unsigned long output_w {shape.output_w()};
+            for(unsigned long c {0}; c < shape.in_channel; ++c) {
+                MType* x_channel {x + c * shape.in_h * shape.in_w};
+                for(unsigned long k_h {0}; k_h < shape.kernel_h; ++k_h) {
+                    for(unsigned long k_w {0}; k_w < shape.kernel_w; ++k_w) {
+                        const MType* col_row {col + ((c * shape.kernel_h + k_h) * shape.kernel_w + k_w) * p_len};
+                        unsigned long o_h {p_begin / output_w};
+                        unsigned long o_w {p_begin % output_w};
+                        for(unsigned long j {0}; j < p_len; ++j) {
+                            unsigned long h {o_h * shape.stride + k_h};
+                            unsigned long w {o_w * shape.stride + k_w};
+                            if(h >= shape.padding_h && h - shape.padding_h < shape.in_h && w >= shape.padding_w && w - shape.padding_w < shape.in_w) {
+                                x_channel[(h - shape.padding_h) * shape.in_w + w - shape.padding_w] += col_row[j];
+                            }
+                            if(++o_w == output_w) {
+                                o_w = 0;
+                                ++o_h;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        template <typename MType>
+        std::vector<MType, utils::Allocator<MType>>& conv_col_buffer() {
+            // 每个线程一份，反复使用
+            static thread_local std::vector<MType, utils::Allocator<MType>> buffer {utils::Allocator<MType> {utils::default_resource()}};
+            return buffer;
+        }
+
+        // 单张图像的一段输出，y是(out_channel, output_len)，只写[p_begin, p_begin + p_len)这些列
+        template <typename MType>
+        void conv2d_forward_tile(const ConvShape& shape, const MType* x, const MType* w_packed, MType padding_value, unsigned long p_begin, unsigned long p_len, MType* y) {
+            std::vector<MType, utils::Allocator<MType>>& col {conv_col_buffer<MType>()};
+            col.resize(shape.col_rows() * p_len);
+            conv_col_tile(shape, x, p_begin, p_len, padding_value, col.data());
+            gemm<MType>(shape.out_channel, p_len, shape.col_rows(), w_packed, shape.col_rows(), col.data(), p_len, y + p_begin, shape.output_len());
+        }
+
+        // 单张图像对重排后权重的梯度，dw_packed += g * col^T，g是(out_channel, output_len)
+        template <typename MType>
+        void conv2d_backward_weight(const ConvShape& shape, const MType* x, const MType* g, MType padding_value, MType* dw_packed) {
+            unsigned long output_len {shape.output_len()};
+            unsigned long col_rows {shape.col_rows()};
+            unsigned long tile_len {conv_tile_len(shape)};
+            std::vector<MType, utils::Allocator<MType>>& col {conv_col_buffer<MType>()};
+            std::vector<MType, utils::Allocator<MType>> dw_tile(shape.out_channel * col_rows);
+            for(unsigned long p_begin {0}; p_begin < output_len; p_begin += tile_len) {
+                unsigned long p_len {std::min(tile_len, output_len - p_begin)};
+                col.resize(col_rows * p_len);
+                conv_col_tile(shape, x, p_begin, p_len, padding_value, col.data());
+                gemm<MType>(false, true, shape.out_channel, col_rows, p_len, g + p_begin, output_len, col.data(), p_len, dw_tile.data(), col_rows);
+                kernel::add(dw_tile.size(), dw_tile.data(), dw_packed);
+            }
+        }
+
+        // 单张图像对输入的梯度，dx += col2img(w^T * g)，dx是(in_channel, in_h, in_w)
+        template <typename MType>
+        void conv2d_backward_data(const ConvShape& shape, const MType* w_packed, const MType* g, MType* dx) {
+            unsigned long output_len {shape.output_len()};
+            unsigned long col_rows {shape.col_rows()};
+            unsigned long tile_len {conv_tile_len(shape)};
+            std::vector<MType, utils::Allocator<MType>>& col {conv_col_buffer<MType>()};
+            for(unsigned long p_begin {0}; p_begin < output_len; p_begin += tile_len) {
+                unsigned long p_len {std::min(tile_len, output_len - p_begin)};
+                col.resize(col_rows * p_len);
+                gemm<MType>(true, false, col_rows, p_len, shape.out_channel, w_packed, col_rows, g + p_begin, output_len, col.data(), p_len);
+                conv_col_tile_add(shape, col.data(), p_begin, p_len, dx);
+            }
+        }
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <cstdlib>
+#include <cstring>
+
+
+namespace aedlf {
+    namespace kernel {
+        // 运行时可用的SIMD指令集，从低到高排列
+        enum class SimdLevel {
+            scalar = 0,
+            sse2 = 1,
+            avx2 = 2,
+            avx512 = 3
+        };
+
+        inline SimdLevel detect_simd_level() {
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+            __builtin_cpu_init();
+            if(__builtin_cpu_supports("avx512f")) {
+                return SimdLevel::avx512;
+            }
+            if(__builtin_cpu_supports("avx2")) {
+                return SimdLevel::avx2;
+            }
+            if(__builtin_cpu_supports("sse2")) {
+                return SimdLevel::sse2;
+            }
+#endif
+            return SimdLevel::scalar;
+        }
+
+        inline SimdLevel simd_level() {
+            // AEDLF_SIMD=scalar/sse2/avx2/avx512 可以强制降级，方便对比各条路径
+            static const SimdLevel level {[] {
+                SimdLevel detected {detect_simd_level()};
+                const char* env_level {std::getenv("AEDLF_SIMD")};
+                if(env_level == nullptr) {
+                    return detected;
+                }
+                SimdLevel wanted {detected};
+                if(std::strcmp(env_level, "scalar") == 0) {
+                    wanted = SimdLevel::scalar;
+                }
+                else if(std::strcmp(env_level, "sse2") == 0) {
+                    wanted = SimdLevel::sse2;
+                }
+                else if(std::strcmp(env_level, "avx2") == 0) {
+                    wanted = SimdLevel::avx2;
+                }
+                else if(std::strcmp(env_level, "avx512") == 0) {
+                    wanted = SimdLevel::avx512;
+                }
+                return wanted < detected ? wanted : detected;
+            }()};
+            return level;
+        }
+    }
+}
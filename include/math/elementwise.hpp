@@ -0,0 +1,570 @@
+#pragma once
+#include "cpu.hpp"
+#include <cmath>
+#include <type_traits>
+
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__)
+#define AEDLF_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define AEDLF_X86_SIMD 0
+#endif
+
+
+namespace aedlf {
+    namespace kernel {
+        /*
+        逐元素计算的kernel，全部是裸指针+长度的接口，y是输出（大多数是inplace）
+        float/double在第一次调用时按CPUID选择AVX-512/AVX2/SSE2实现，其他类型只走标量实现
+        sigmoid的向量版本用多项式近似exp，误差在1~2ulp以内
+        */
+        template <typename MType>
+        struct ElementwiseTable {
+            void (*add)(unsigned long n, const MType* x, MType* y); // y += x
+            void (*mul)(unsigned long n, const MType* x, MType* y); // y *= x
+            void (*scale)(unsigned long n, MType a, MType* y); // y *= a
+            void (*add_scalar)(unsigned long n, MType a, MType* y); // y += a
+            void (*axpy)(unsigned long n, MType a, const MType* x, MType* y); // y += a * x
+            void (*sigmoid)(unsigned long n, const MType* x, MType* y); // y = 1 / (1 + exp(-x))
+        };
+
+        namespace scalar {
+            template <typename MType>
+            void add(unsigned long n, const MType* x, MType* y) {
+                for(unsigned long i {0}; i < n; ++i) {
+                    y[i] += x[i];
+                }
+            }
+
+            template <typename MType>
+            void mul(unsigned long n, const MType* x, MType* y) {
+                for(unsigned long i {0}; i < n; ++i) {
+                    y[i] *= x[i];
+                }
+            }
+
+            template <typename MType>
+            void scale(unsigned long n, MType a, MType* y) {
+                for(unsigned long i {0}; i < n; ++i) {
+                    y[i] *= a;
+                }
+            }
+
+            template <typename MType>
+            void add_scalar(unsigned long n, MType a, MType* y) {
+                for(unsigned long i {0}; i < n; ++i) {
+                    y[i] += a;
+                }
+            }
+
+            template <typename MType>
+            void axpy(unsigned long n, MType a, const MType* x, MType* y) {
+                for(unsigned long i {0}; i < n; ++i) {
+                    y[i] += a * x[i];
+                }
+            }
+
+            template <typename MType>
+            void sigmoid(unsigned long n, const MType* x, MType* y) {
+                for(unsigned long i {0}; i < n; ++i) {
+                    y[i] = 1 / (1 + std::exp(-1 * x[i]));
+                }
+            }
+
+            template <typename MType>
+            const ElementwiseTable<MType>& table() {
+                static const ElementwiseTable<MType> t {&add<MType>, &mul<MType>, &scale<MType>, &add_scalar<MType>, &axpy<MType>, &sigmoid<MType>};
+                return t;
+            }
+        }
+
+#if AEDLF_X86_SIMD
+        // exp(x) = 2^n * exp(r), r = x - n * ln2，exp(r)用泰勒多项式，2^n直接拼指数位
+        const double exp_max_d {708.0};
+        const double exp_min_d {-708.0};
+        const double log2e_d {1.4426950408889634};
+        const double ln2_hi_d {6.93147180369123816490e-01};
+        const double ln2_lo_d {1.90821492927058770002e-10};
+        const double round_magic_d {6755399441055744.0}; // 1.5 * 2^52
+        const float exp_max_f {88.3f};
+        const float exp_min_f {-87.3f};
+        const float log2e_f {1.44269504f};
+        const float ln2_hi_f {0.693359375f};
+        const float ln2_lo_f {-2.12194440e-4f};
+        const float round_magic_f {12582912.0f}; // 1.5 * 2^23
+        const double exp_poly_d[13] {
+            1.0 / 479001600.0, 1.0 / 39916800.0, 1.0 / 3628800.0, 1.0 / 362880.0, 1.0 / 40320.0, 1.0 / 5040.0,
+            1.0 / 720.0, 1.0 / 120.0, 1.0 / 24.0, 1.0 / 6.0, 1.0 / 2.0, 1.0, 1.0
+        };
+        const float exp_poly_f[8] {
+            1.0f / 5040.0f, 1.0f / 720.0f, 1.0f / 120.0f, 1.0f / 24.0f, 1.0f / 6.0f, 1.0f / 2.0f, 1.0f, 1.0f
+        };
+
+#pragma GCC push_options
+#pragma GCC target("sse2")
+        namespace sse2 {
+            struct VecD {
+                using reg = __m128d;
+                static const unsigned long width {2};
+                static reg load(const double* p) { return _mm_loadu_pd(p); }
+                static void store(double* p, reg r) { _mm_storeu_pd(p, r); }
+                static reg set1(double a) { return _mm_set1_pd(a); }
+                static reg add(reg a, reg b) { return _mm_add_pd(a, b); }
+                static reg sub(reg a, reg b) { return _mm_sub_pd(a, b); }
+                static reg mul(reg a, reg b) { return _mm_mul_pd(a, b); }
+                static reg div(reg a, reg b) { return _mm_div_pd(a, b); }
+                static reg exp(reg x) {
+                    x = _mm_min_pd(_mm_max_pd(x, set1(exp_min_d)), set1(exp_max_d));
+                    reg t {add(mul(x, set1(log2e_d)), set1(round_magic_d))};
+                    reg n {sub(t, set1(round_magic_d))};
+                    reg r {sub(sub(x, mul(n, set1(ln2_hi_d))), mul(n, set1(ln2_lo_d)))};
+                    reg p {set1(exp_poly_d[0])};
+                    for(unsigned long i {1}; i < 13; ++i) {
+                        p = add(mul(p, r), set1(exp_poly_d[i]));
+                    }
+                    __m128i e {_mm_sub_epi64(_mm_castpd_si128(t), _mm_castpd_si128(set1(round_magic_d)))};
+                    e = _mm_slli_epi64(_mm_add_epi64(e, _mm_set1_epi64x(1023)), 52);
+                    return mul(p, _mm_castsi128_pd(e));
+                }
+            };
+
+            struct VecF {
+                using reg = __m128;
+                static const unsigned long width {4};
+                static reg load(const float* p) { return _mm_loadu_ps(p); }
+                static void store(float* p, reg r) { _mm_storeu_ps(p, r); }
+                static reg set1(float a) { return _mm_set1_ps(a); }
+                static reg add(reg a, reg b) { return _mm_add_ps(a, b); }
+                static reg sub(reg a, reg b) { return _mm_sub_ps(a, b); }
+                static reg mul(reg a, reg b) { return _mm_mul_ps(a, b); }
+                static reg div(reg a, reg b) { return _mm_div_ps(a, b); }
+                static reg exp(reg x) {
+                    x = _mm_min_ps(_mm_max_ps(x, set1(exp_min_f)), set1(exp_max_f));
+                    reg t {add(mul(x, set1(log2e_f)), set1(round_magic_f))};
+                    reg n {sub(t, set1(round_magic_f))};
+                    reg r {sub(sub(x, mul(n, set1(ln2_hi_f))), mul(n, set1(ln2_lo_f)))};
+                    reg p {set1(exp_poly_f[0])};
+                    for(unsigned long i {1}; i < 8; ++i) {
+                        p = add(mul(p, r), set1(exp_poly_f[i]));
+                    }
+                    __m128i e {_mm_sub_epi32(_mm_castps_si128(t), _mm_castps_si128(set1(round_magic_f)))};
+                    e = _mm_slli_epi32(_mm_add_epi32(e, _mm_set1_epi32(127)), 23);
+                    return mul(p, _mm_castsi128_ps(e));
+                }
+            };
+
+            template <typename V, typename MType>
+            void add(unsigned long n, const MType* x, MType* y) {
+                unsigned long i {0};
+                for(; i + V::width <= n; i += V::width) {
+                    V::store(y + i, V::add(V::load(y + i), V::load(x + i)));
+                }
+                scalar::add(n - i, x + i, y + i);
+            }
+
+            template <typename V, typename MType>
+            void mul(unsigned long n, const MType* x, MType* y) {
+                unsigned long i {0};
+                for(; i + V::width <= n; i += V::width) {
+                    V::store(y + i, V::mul(V::load(y + i), V::load(x + i)));
+                }
+                scalar::mul(n - i, x + i, y + i);
+            }
+
+            template <typename V, typename MType>
+            void scale(unsigned long n, MType a, MType* y) {
+                unsigned long i {0};
+                typename V::reg va {V::set1(a)};
+                for(; i + V::width <= n; i += V::width) {
+                    V::store(y + i, V::mul(V::load(y + i), va));
+                }
+                scalar::scale(n - i, a, y + i);
+            }
+
+            template <typename V, typename MType>
+            void add_scalar(unsigned long n, MType a, MType* y) {
+                unsigned long i {0};
+                typename V::reg va {V::set1(a)};
+                for(; i + V::width <= n; i += V::width) {
+                    V::store(y + i, V::add(V::load(y + i), va));
+                }
+                scalar::add_scalar(n - i, a, y + i);
+            }
+
+            template <typename V, typename MType>
+            void axpy(unsigned long n, MType a, const MType* x, MType* y) {
+                unsigned long i {0};
+                typename V::reg va {V::set1(a)};
+                for(; i + V::width <= n; i += V::width) {
+                    V::store(y + i, V::add(V::load(y + i), V::mul(va, V::load(x + i))));
+                }
+                scalar::axpy(n - i, a, x + i, y + i);
+            }
+
+            template <typename V, typename MType>
+            void sigmoid(unsigned long n, const MType* x, MType* y) {
+                unsigned long i {0};
+                typename V::reg zero {V::set1(MType(0))};
+                typename V::reg one {V::set1(MType(1))};
+                for(; i + V::width <= n; i += V::width) {
+                    V::store(y + i, V::div(one, V::add(one, V::exp(V::sub(zero, V::load(x + i))))));
+                }
+                if(i < n) {
+                    // 尾部补齐到一个向量宽度，保证所有元素用同一个exp实现
+                    MType tail[V::width] {};
+                    for(unsigned long j {i}; j < n; ++j) {
+                        tail[j - i] = x[j];
+                    }
+                    V::store(tail, V::div(one, V::add(one, V::exp(V::sub(zero, V::load(tail))))));
+                    for(unsigned long j {i}; j < n; ++j) {
+                        y[j] = tail[j - i];
+                    }
+                }
+            }
+
+            template <typename V, typename MType>
+            const ElementwiseTable<MType>& table() {
+                static const ElementwiseTable<MType> t {&add<V, MType>, &mul<V, MType>, &scale<V, MType>, &add_scalar<V, MType>, &axpy<V, MType>, &sigmoid<V, MType>};
+                return t;
+            }
+        }
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+        namespace avx2 {
+            struct VecD {
+                using reg = __m256d;
+                static const unsigned long width {4};
+                static reg load(const double* p) { return _mm256_loadu_pd(p); }
+                static void store(double* p, reg r) { _mm256_storeu_pd(p, r); }
+                static reg set1(double a) { return _mm256_set1_pd(a); }
+                static reg add(reg a, reg b) { return _mm256_add_pd(a, b); }
+                static reg sub(reg a, reg b) { return _mm256_sub_pd(a, b); }
+                static reg mul(reg a, reg b) { return _mm256_mul_pd(a, b); }
+                static reg div(reg a, reg b) { return _mm256_div_pd(a, b); }
+                static reg exp(reg x) {
+                    x = _mm256_min_pd(_mm256_max_pd(x, set1(exp_min_d)), set1(exp_max_d));
+                    reg t {add(mul(x, set1(log2e_d)), set1(round_magic_d))};
+                    reg n {sub(t, set1(round_magic_d))};
+                    reg r {sub(sub(x, mul(n, set1(ln2_hi_d))), mul(n, set1(ln2_lo_d)))};
+                    reg p {set1(exp_poly_d[0])};
+                    for(unsigned long i {1}; i < 13; ++i) {
+                        p = add(mul(p, r), set1(exp_poly_d[i]));
+                    }
+                    __m256i e {_mm256_sub_epi64(_mm256_castpd_si256(t), _mm256_castpd_si256(set1(round_magic_d)))};
+                    e = _mm256_slli_epi64(_mm256_add_epi64(e, _mm256_set1_epi64x(1023)), 52);
+                    return mul(p, _mm256_castsi256_pd(e));
+                }
+            };
+
+            struct VecF {
+                using reg = __m256;
+                static const unsigned long width {8};
+                static reg load(const float* p) { return _mm256_loadu_ps(p); }
+                static void store(float* p, reg r) { _mm256_storeu_ps(p, r); }
+                static reg set1(float a) { return _mm256_set1_ps(a); }
+                static reg add(reg a, reg b) { return _mm256_add_ps(a, b); }
+                static reg sub(reg a, reg b) { return _mm256_sub_ps(a, b); }
+                static reg mul(reg a, reg b) { return _mm256_mul_ps(a, b); }
+                static reg div(reg a, reg b) { return _mm256_div_ps(a, b); }
+                static reg exp(reg x) {
+                    x = _mm256_min_ps(_mm256_max_ps(x, set1(exp_min_f)), set1(exp_max_f));
+                    reg t {add(mul(x, set1(log2e_f)), set1(round_magic_f))};
+                    reg n {sub(t, set1(round_magic_f))};
+                    reg r {sub(sub(x, mul(n, set1(ln2_hi_f))), mul(n, set1(ln2_lo_f)))};
+                    reg p {set1(exp_poly_f[0])};
+                    for(unsigned long i {1}; i < 8; ++i) {
+                        p = add(mul(p, r), set1(exp_poly_f[i]));
+                    }
+                    __m256i e {_mm256_sub_epi32(_mm256_castps_si256(t), _mm256_castps_si256(set1(round_magic_f)))};
+                    e = _mm256_slli_epi32(_mm256_add_epi32(e, _mm256_set1_epi32(127)), 23);
+                    return mul(p, _mm256_castsi256_ps(e));
+                }
+            };
+
+            template <typename V, typename MType>
+            void add(unsigned long n, const MType* x, MType* y) {
+                unsigned long i {0};
+                for(; i + V::width <= n; i += V::width) {
+                    V::store(y + i, V::add(V::load(y + i), V::load(x + i)));
+                }
+                scalar::add(n - i, x + i, y + i);
+            }
+
+            template <typename V, typename MType>
+            void mul(unsigned long n, const MType* x, MType* y) {
+                unsigned long i {0};
+                for(; i + V::width <= n; i += V::width) {
+                    V::store(y + i, V::mul(V::load(y + i), V::load(x + i)));
+                }
+                scalar::mul(n - i, x + i, y + i);
+            }
+
+            template <typename V, typename MType>
+            void scale(unsigned long n, MType a, MType* y) {
+                unsigned long i {0};
+                typename V::reg va {V::set1(a)};
+                for(; i + V::width <= n; i += V::width) {
+                    V::store(y + i, V::mul(V::load(y + i), va));
+                }
+                scalar::scale(n - i, a, y + i);
+            }
+
+            template <typename V, typename MType>
+            void add_scalar(unsigned long n, MType a, MType* y) {
+                unsigned long i {0};
+                typename V::reg va {V::set1(a)};
+                for(; i + V::width <= n; i += V::width) {
+                    V::store(y + i, V::add(V::load(y + i), va));
+                }
+                scalar::add_scalar(n - i, a, y + i);
+            }
+
+            template <typename V, typename MType>
+            void axpy(unsigned long n, MType a, const MType* x, MType* y) {
+                unsigned long i {0};
+                typename V::reg va {V::set1(a)};
+                for(; i + V::width <= n; i += V::width) {
+                    V::store(y + i, V::add(V::load(y + i), V::mul(va, V::load(x + i))));
+                }
+                scalar::axpy(n - i, a, x + i, y + i);
+            }
+
+            template <typename V, typename MType>
+            void sigmoid(unsigned long n, const MType* x, MType* y) {
+                unsigned long i {0};
+                typename V::reg zero {V::set1(MType(0))};
+                typename V::reg one {V::set1(MType(1))};
+                for(; i + V::width <= n; i += V::width) {
+                    V::store(y + i, V::div(one, V::add(one, V::exp(V::sub(zero, V::load(x + i))))));
+                }
+                if(i < n) {
+                    MType tail[V::width] {};
+                    for(unsigned long j {i}; j < n; ++j) {
+                        tail[j - i] = x[j];
+                    }
+                    V::store(tail, V::div(one, V::add(one, V::exp(V::sub(zero, V::load(tail))))));
+                    for(unsigned long j {i}; j < n; ++j) {
+                        y[j] = tail[j - i];
+                    }
+                }
+            }
+
+            template <typename V, typename MType>
+            const ElementwiseTable<MType>& table() {
+                static const ElementwiseTable<MType> t {&add<V, MType>, &mul<V, MType>, &scale<V, MType>, &add_scalar<V, MType>, &axpy<V, MType>, &sigmoid<V, MType>};
+                return t;
+            }
+        }
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+        namespace avx512 {
+            struct VecD {
+                using reg = __m512d;
+                static const unsigned long width {8};
+                static reg load(const double* p) { return _mm512_loadu_pd(p); }
+                static void store(double* p, reg r) { _mm512_storeu_pd(p, r); }
+                static reg set1(double a) { return _mm512_set1_pd(a); }
+                static reg add(reg a, reg b) { return _mm512_add_pd(a, b); }
+                static reg sub(reg a, reg b) { return _mm512_sub_pd(a, b); }
+                static reg mul(reg a, reg b) { return _mm512_mul_pd(a, b); }
+                static reg div(reg a, reg b) { return _mm512_div_pd(a, b); }
+                static reg exp(reg x) {
+                    // 用全掩码的maskz版本，避免gcc对_mm512_undefined_pd报未初始化警告
+                    x = _mm512_maskz_min_pd(0xFF, _mm512_maskz_max_pd(0xFF, x, set1(exp_min_d)), set1(exp_max_d));
+                    reg t {add(mul(x, set1(log2e_d)), set1(round_magic_d))};
+                    reg n {sub(t, set1(round_magic_d))};
+                    reg r {sub(sub(x, mul(n, set1(ln2_hi_d))), mul(n, set1(ln2_lo_d)))};
+                    reg p {set1(exp_poly_d[0])};
+                    for(unsigned long i {1}; i < 13; ++i) {
+                        p = add(mul(p, r), set1(exp_poly_d[i]));
+                    }
+                    return _mm512_maskz_scalef_pd(0xFF, p, n);
+                }
+            };
+
+            struct VecF {
+                using reg = __m512;
+                static const unsigned long width {16};
+                static reg load(const float* p) { return _mm512_loadu_ps(p); }
+                static void store(float* p, reg r) { _mm512_storeu_ps(p, r); }
+                static reg set1(float a) { return _mm512_set1_ps(a); }
+                static reg add(reg a, reg b) { return _mm512_add_ps(a, b); }
+                static reg sub(reg a, reg b) { return _mm512_sub_ps(a, b); }
+                static reg mul(reg a, reg b) { return _mm512_mul_ps(a, b); }
+                static reg div(reg a, reg b) { return _mm512_div_ps(a, b); }
+                static reg exp(reg x) {
+                    x = _mm512_maskz_min_ps(0xFFFF, _mm512_maskz_max_ps(0xFFFF, x, set1(exp_min_f)), set1(exp_max_f));
+                    reg t {add(mul(x, set1(log2e_f)), set1(round_magic_f))};
+                    reg n {sub(t, set1(round_magic_f))};
+                    reg r {sub(sub(x, mul(n, set1(ln2_hi_f))), mul(n, set1(ln2_lo_f)))};
+                    reg p {set1(exp_poly_f[0])};
+                    for(unsigned long i {1}; i < 8; ++i) {
+                        p = add(mul(p, r), set1(exp_poly_f[i]));
+                    }
+                    return _mm512_maskz_scalef_ps(0xFFFF, p, n);
+                }
+            };
+
+            template <typename V, typename MType>
+            void add(unsigned long n, const MType* x, MType* y) {
+                unsigned long i {0};
+                for(; i + V::width <= n; i += V::width) {
+                    V::store(y + i, V::add(V::load(y + i), V::load(x + i)));
+                }
+                scalar::add(n - i, x + i, y + i);
+            }
+
+            template <typename V, typename MType>
+            void mul(unsigned long n, const MType* x, MType* y) {
+                unsigned long i {0};
+                for(; i + V::width <= n; i += V::width) {
+                    V::store(y + i, V::mul(V::load(y + i), V::load(x + i)));
+                }
+                scalar::mul(n - i, x + i, y + i);
+            }
+
+            template <typename V, typename MType>
+            void scale(unsigned long n, MType a, MType* y) {
+                unsigned long i {0};
+                typename V::reg va {V::set1(a)};
+                for(; i + V::width <= n; i += V::width) {
+                    V::store(y + i, V::mul(V::load(y + i), va));
+                }
+                scalar::scale(n - i, a, y + i);
+            }
+
+            template <typename V, typename MType>
+            void add_scalar(unsigned long n, MType a, MType* y) {
+                unsigned long i {0};
+                typename V::reg va {V::set1(a)};
+                for(; i + V::width <= n; i += V::width) {
+                    V::store(y + i, V::add(V::load(y + i), va));
+                }
+                scalar::add_scalar(n - i, a, y + i);
+            }
+
+            template <typename V, typename MType>
+            void axpy(unsigned long n, MType a, const MType* x, MType* y) {
+                unsigned long i {0};
+                typename V::reg va {V::set1(a)};
+                for(; i + V::width <= n; i += V::width) {
+                    V::store(y + i, V::add(V::load(y + i), V::mul(va, V::load(x + i))));
+                }
+                scalar::axpy(n - i, a, x + i, y + i);
+            }
+
+            template <typename V, typename MType>
+            void sigmoid(unsigned long n, const MType* x, MType* y) {
+                unsigned long i {0};
+                typename V::reg zero {V::set1(MType(0))};
+                typename V::reg one {V::set1(MType(1))};
+                for(; i + V::width <= n; i += V::width) {
+                    V::store(y + i, V::div(one, V::add(one, V::exp(V::sub(zero, V::load(x + i))))));
+                }
+                if(i < n) {
+                    MType tail[V::width] {};
+                    for(unsigned long j {i}; j < n; ++j) {
+                        tail[j - i] = x[j];
+                    }
+                    V::store(tail, V::div(one, V::add(one, V::exp(V::sub(zero, V::load(tail))))));
+                    for(unsigned long j {i}; j < n; ++j) {
+                        y[j] = tail[j - i];
+                    }
+                }
+            }
+
+            template <typename V, typename MType>
+            const ElementwiseTable<MType>& table() {
+                static const ElementwiseTable<MType> t {&add<V, MType>, &mul<V, MType>, &scale<V, MType>, &add_scalar<V, MType>, &axpy<V, MType>, &sigmoid<V, MType>};
+                return t;
+            }
+        }
+#pragma GCC pop_options
+#endif
+
+        template <typename MType>
+        struct ElementwiseDispatch {
+            static const ElementwiseTable<MType>& table() {
+                return scalar::table<MType>();
+            }
+        };
+
+        template <>
+        struct ElementwiseDispatch<double> {
+            static const ElementwiseTable<double>& table() {
+#if AEDLF_X86_SIMD
+                switch(simd_level()) {
+                    case SimdLevel::avx512:
+                        return avx512::table<avx512::VecD, double>();
+                    case SimdLevel::avx2:
+                        return avx2::table<avx2::VecD, double>();
+                    case SimdLevel::sse2:
+                        return sse2::table<sse2::VecD, double>();
+                    default:
+                        break;
+                }
+#endif
+                return scalar::table<double>();
+            }
+        };
+
+        template <>
+        struct ElementwiseDispatch<float> {
+            static const ElementwiseTable<float>& table() {
+#if AEDLF_X86_SIMD
+                switch(simd_level()) {
+                    case SimdLevel::avx512:
+                        return avx512::table<avx512::VecF, float>();
+                    case SimdLevel::avx2:
+                        return avx2::table<avx2::VecF, float>();
+                    case SimdLevel::sse2:
+                        return sse2::table<sse2::VecF, float>();
+                    default:
+                        break;
+                }
+#endif
+                return scalar::table<float>();
+            }
+        };
+
+        template <typename MType>
+        inline const ElementwiseTable<MType>& elementwise() {
+            static const ElementwiseTable<MType>& t {ElementwiseDispatch<MType>::table()};
+            return t;
+        }
+
+        template <typename MType>
+        void add(unsigned long n, const MType* x, MType* y) {
+            elementwise<MType>().add(n, x, y);
+        }
+
+        template <typename MType>
+        void mul(unsigned long n, const MType* x, MType* y) {
+            elementwise<MType>().mul(n, x, y);
+        }
+
+        template <typename MType>
+        void scale(unsigned long n, MType a, MType* y) {
+            elementwise<MType>().scale(n, a, y);
+        }
+
+        template <typename MType>
+        void add_scalar(unsigned long n, MType a, MType* y) {
+            elementwise<MType>().add_scalar(n, a, y);
+        }
+
+        template <typename MType>
+        void axpy(unsigned long n, MType a, const MType* x, MType* y) {
+            elementwise<MType>().axpy(n, a, x, y);
+        }
+
+        template <typename MType>
+        void sigmoid(unsigned long n, const MType* x, MType* y) {
+            elementwise<MType>().sigmoid(n, x, y);
+        }
+    }
+}
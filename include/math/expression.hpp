@@ -0,0 +1,292 @@
+#pragma once
+#include <cstddef>
+#include <cassert>
+#include <stdexcept>
+#include <array>
+#include <vector>
+#include <type_traits>
+#include "../utils/thread_pool.hpp"
+
+
+namespace aedlf {
+    template <typename MType>
+    class Matrix;
+
+    namespace expr {
+        /*
+        Matrix逐元素运算的表达式模板：a + b、g * lr、1 - s这样的式子不立即计算，只记下运算树
+        赋值给Matrix（构造、=、+=、-=）时在一个循环里算完，中间不生成临时矩阵，参与运算的矩阵也不会被改写
+        表达式节点按值保存子表达式，叶子只记矩阵数据的指针，所以要在同一个语句里求值，不能留到矩阵被改写或释放以后
+        参与运算的矩阵形状必须相同（不同时抛异常），标量广播到每个元素上；两个矩阵之间的*仍然是矩阵乘法，逐元素乘用mul_v
+        */
+        using expr_shape = std::array<unsigned long, 4>;
+
+        template <typename Derived>
+        struct Expr {
+            const Derived& self() const {
+                return static_cast<const Derived&>(*this);
+            }
+        };
+
+        template <typename MType>
+        struct Leaf : public Expr<Leaf<MType>> {
+            using value_type = MType;
+            static const bool scalar {false};
+            explicit Leaf(const Matrix<MType>& m) : p(m.get_data()->data()), n(m.get_data()->size()) {
+                std::vector<unsigned long> dim {m.get_dim()};
+                std::copy(dim.begin(), dim.end(), shape_.begin());
+            }
+            MType operator[](unsigned long i) const {
+                return p[i];
+            }
+            unsigned long size() const {
+                return n;
+            }
+            expr_shape shape() const {
+                return shape_;
+            }
+            const MType* p;
+            unsigned long n;
+            expr_shape shape_ {{0, 0, 0, 0}};
+        };
+
+        template <typename MType>
+        struct Scalar : public Expr<Scalar<MType>> {
+            using value_type = MType;
+            static const bool scalar {true};
+            explicit Scalar(MType v) : v(v) {}
+            MType operator[](unsigned long) const {
+                return v;
+            }
+            unsigned long size() const {
+                return 0;
+            }
+            expr_shape shape() const {
+                return expr_shape {{0, 0, 0, 0}};
+            }
+            MType v;
+        };
+
+        struct AddOp {
+            template <typename T>
+            static T apply(T a, T b) {
+                return a + b;
+            }
+        };
+
+        struct SubOp {
+            template <typename T>
+            static T apply(T a, T b) {
+                return a - b;
+            }
+        };
+
+        struct MulOp {
+            template <typename T>
+            static T apply(T a, T b) {
+                return a * b;
+            }
+        };
+
+        struct DivOp {
+            template <typename T>
+            static T apply(T a, T b) {
+                return a / b;
+            }
+        };
+
+        struct NegOp {
+            template <typename T>
+            static T apply(T a) {
+                return -a;
+            }
+        };
+
+        template <typename Op, typename L, typename R>
+        struct Binary : public Expr<Binary<Op, L, R>> {
+            using value_type = typename L::value_type;
+            static_assert(std::is_same<value_type, typename R::value_type>::value, "expression operands must have the same type");
+            static const bool scalar {L::scalar && R::scalar};
+            Binary(const L& l, const R& r) : l(l), r(r) {
+                // 求值时按下标直接读两边，形状不同会读到较小那块内存的外面，不能只在debug下检查
+                if(!L::scalar && !R::scalar && l.shape() != r.shape()) {
+                    throw std::runtime_error("Matrix shape is not match in elementwise expression");
+                }
+            }
+            value_type operator[](unsigned long i) const {
+                return Op::apply(l[i], r[i]);
+            }
+            unsigned long size() const {
+                return L::scalar ? r.size() : l.size();
+            }
+            expr_shape shape() const {
+                return L::scalar ? r.shape() : l.shape();
+            }
+            L l;
+            R r;
+        };
+
+        template <typename Op, typename E>
+        struct Unary : public Expr<Unary<Op, E>> {
+            using value_type = typename E::value_type;
+            static const bool scalar {E::scalar};
+            explicit Unary(const E& e) : e(e) {}
+            value_type operator[](unsigned long i) const {
+                return Op::apply(e[i]);
+            }
+            unsigned long size() const {
+                return e.size();
+            }
+            expr_shape shape() const {
+                return e.shape();
+            }
+            E e;
+        };
+
+        // 能参与表达式的类型：Matrix换成叶子，表达式原样保存
+        template <typename T>
+        struct Operand {
+            static const bool value {false};
+        };
+
+        template <typename MType>
+        struct Operand<Matrix<MType>> {
+            static const bool value {true};
+            using type = Leaf<MType>;
+            using value_type = MType;
+            static type make(const Matrix<MType>& m) {
+                return type {m};
+            }
+        };
+
+        template <typename Op, typename L, typename R>
+        struct Operand<Binary<Op, L, R>> {
+            static const bool value {true};
+            using type = Binary<Op, L, R>;
+            using value_type = typename type::value_type;
+            static const type& make(const type& e) {
+                return e;
+            }
+        };
+
+        template <typename Op, typename E>
+        struct Operand<Unary<Op, E>> {
+            static const bool value {true};
+            using type = Unary<Op, E>;
+            using value_type = typename type::value_type;
+            static const type& make(const type& e) {
+                return e;
+            }
+        };
+
+        template <typename Op, typename L, typename R>
+        using binary_t = typename std::enable_if<Operand<L>::value && Operand<R>::value, Binary<Op, typename Operand<L>::type, typename Operand<R>::type>>::type;
+
+        template <typename Op, typename L>
+        using scalar_right_t = Binary<Op, typename Operand<L>::type, Scalar<typename Operand<L>::value_type>>;
+
+        template <typename Op, typename R>
+        using scalar_left_t = Binary<Op, Scalar<typename Operand<R>::value_type>, typename Operand<R>::type>;
+
+        // 逐元素乘，两边都是矩阵或表达式
+        template <typename L, typename R>
+        binary_t<MulOp, L, R> mul_v(const L& l, const R& r) {
+            return binary_t<MulOp, L, R> {Operand<L>::make(l), Operand<R>::make(r)};
+        }
+
+        struct Assign {
+            template <typename T>
+            static void apply(T& dst, T v) {
+                dst = v;
+            }
+        };
+
+        struct AddAssign {
+            template <typename T>
+            static void apply(T& dst, T v) {
+                dst += v;
+            }
+        };
+
+        struct SubAssign {
+            template <typename T>
+            static void apply(T& dst, T v) {
+                dst -= v;
+            }
+        };
+
+        // 按段并行，每段里是一个普通的循环，整棵表达式内联以后编译器可以直接向量化
+        // dst和叶子指向同一块内存也没关系，每个元素只读写同一个下标
+        template <typename Store, typename MType, typename E>
+        void evaluate(MType* dst, const Expr<E>& e, unsigned long n) {
+            const E& x {e.self()};
+            utils::ThreadPool::global().parallel_for_range(n, 1, [dst, &x](unsigned long begin, unsigned long end) {
+                for(unsigned long i {begin}; i < end; ++i) {
+                    Store::apply(dst[i], x[i]);
+                }
+            });
+        }
+
+        template <typename L, typename R>
+        binary_t<AddOp, L, R> operator+(const L& l, const R& r) {
+            return binary_t<AddOp, L, R> {Operand<L>::make(l), Operand<R>::make(r)};
+        }
+
+        template <typename L, typename R>
+        binary_t<SubOp, L, R> operator-(const L& l, const R& r) {
+            return binary_t<SubOp, L, R> {Operand<L>::make(l), Operand<R>::make(r)};
+        }
+
+        template <typename L>
+        scalar_right_t<AddOp, L> operator+(const L& l, typename Operand<L>::value_type s) {
+            return scalar_right_t<AddOp, L> {Operand<L>::make(l), Scalar<typename Operand<L>::value_type> {s}};
+        }
+
+        template <typename R>
+        scalar_left_t<AddOp, R> operator+(typename Operand<R>::value_type s, const R& r) {
+            return scalar_left_t<AddOp, R> {Scalar<typename Operand<R>::value_type> {s}, Operand<R>::make(r)};
+        }
+
+        template <typename L>
+        scalar_right_t<SubOp, L> operator-(const L& l, typename Operand<L>::value_type s) {
+            return scalar_right_t<SubOp, L> {Operand<L>::make(l), Scalar<typename Operand<L>::value_type> {s}};
+        }
+
+        template <typename R>
+        scalar_left_t<SubOp, R> operator-(typename Operand<R>::value_type s, const R& r) {
+            return scalar_left_t<SubOp, R> {Scalar<typename Operand<R>::value_type> {s}, Operand<R>::make(r)};
+        }
+
+        template <typename L>
+        scalar_right_t<MulOp, L> operator*(const L& l, typename Operand<L>::value_type s) {
+            return scalar_right_t<MulOp, L> {Operand<L>::make(l), Scalar<typename Operand<L>::value_type> {s}};
+        }
+
+        template <typename R>
+        scalar_left_t<MulOp, R> operator*(typename Operand<R>::value_type s, const R& r) {
+            return scalar_left_t<MulOp, R> {Scalar<typename Operand<R>::value_type> {s}, Operand<R>::make(r)};
+        }
+
+        template <typename L>
+        scalar_right_t<DivOp, L> operator/(const L& l, typename Operand<L>::value_type s) {
+            return scalar_right_t<DivOp, L> {Operand<L>::make(l), Scalar<typename Operand<L>::value_type> {s}};
+        }
+
+        template <typename R>
+        scalar_left_t<DivOp, R> operator/(typename Operand<R>::value_type s, const R& r) {
+            return scalar_left_t<DivOp, R> {Scalar<typename Operand<R>::value_type> {s}, Operand<R>::make(r)};
+        }
+
+        template <typename E>
+        Unary<NegOp, typename Operand<E>::type> operator-(const E& e) {
+            return Unary<NegOp, typename Operand<E>::type> {Operand<E>::make(e)};
+        }
+    }
+
+    // Matrix在aedlf里，按参数查找只会找这个命名空间，运算符也放一份过来
+    using expr::operator+;
+    using expr::operator-;
+    using expr::operator*;
+    using expr::operator/;
+    using expr::mul_v;
+}
@@ -0,0 +1,447 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include "../utils/allocator.hpp"
+#include "../utils/thread_pool.hpp"
+#include "elementwise.hpp"
+
+
+namespace aedlf {
+    namespace kernel {
+        /*
+        分块+打包的GEMM，C(m, n) = A(m, k) * B(k, n)，行主序，lda/ldb/ldc是行跨度
+        A按MC x KC分块打包成MR行一组的条带，B按KC x NC分块打包成NR列一组的条带
+        micro kernel在寄存器里累加MR x NR的小块，条带在L1里，A块在L2里，B块在L3里
+        A、B在打包时按行跨度rs和列跨度cs读取，转置过的矩阵（比如MatrixView::T）不用先拷贝成连续的
+        float/double的micro kernel在第一次调用时按CPUID选择，支持AVX2+FMA时累加器整块放在ymm寄存器里，否则走通用实现
+        */
+        template <typename MType>
+        struct GemmBlock {
+            static const unsigned long MR {4};
+            static const unsigned long NR {4};
+            static const unsigned long MC {64};
+            static const unsigned long KC {256};
+            static const unsigned long NC {1024};
+        };
+
+        template <>
+        struct GemmBlock<double> {
+            static const unsigned long MR {4};
+            static const unsigned long NR {8};
+            static const unsigned long MC {72};
+            static const unsigned long KC {256};
+            static const unsigned long NC {4080};
+        };
+
+        template <>
+        struct GemmBlock<float> {
+            static const unsigned long MR {6};
+            static const unsigned long NR {16};
+            static const unsigned long MC {144};
+            static const unsigned long KC {256};
+            static const unsigned long NC {4080};
+        };
+
+        // 小于这个计算量的乘法直接走行乘法，打包的开销比计算本身还大
+        const unsigned long gemm_small_flops {32 * 32 * 32};
+        // 批量GEMM切分输出块时每块至少要有的计算量，每块各自打包A、B，块太小打包的开销就占大头了
+        const unsigned long gemm_tile_min_flops {64 * 64 * 64};
+
+        // C(m, n) = alpha * A * B + beta * C，beta是0时不读C（C里是nan也没关系），和BLAS的约定一样
+        template <typename MType>
+        void gemm_strided(unsigned long m, unsigned long n, unsigned long k, MType alpha, const MType* a, unsigned long rs_a, unsigned long cs_a, const MType* b, unsigned long rs_b, unsigned long cs_b, MType beta, MType* c, unsigned long ldc);
+
+        template <typename MType>
+        void gemm_strided(unsigned long m, unsigned long n, unsigned long k, const MType* a, unsigned long rs_a, unsigned long cs_a, const MType* b, unsigned long rs_b, unsigned long cs_b, MType* c, unsigned long ldc) {
+            gemm_strided(m, n, k, MType(1), a, rs_a, cs_a, b, rs_b, cs_b, MType(0), c, ldc);
+        }
+
+        template <typename MType>
+        void gemm(unsigned long m, unsigned long n, unsigned long k, const MType* a, unsigned long lda, const MType* b, unsigned long ldb, MType* c, unsigned long ldc) {
+            gemm_strided(m, n, k, a, lda, 1, b, ldb, 1, c, ldc);
+        }
+
+        // C(m, n) = op(A) * op(B)，trans_a时A按(k, m)存放，trans_b时B按(n, k)存放，和BLAS的约定一样
+        template <typename MType>
+        void gemm(bool trans_a, bool trans_b, unsigned long m, unsigned long n, unsigned long k, const MType* a, unsigned long lda, const MType* b, unsigned long ldb, MType* c, unsigned long ldc) {
+            gemm_strided(m, n, k, a, trans_a ? 1 : lda, trans_a ? lda : 1, b, trans_b ? 1 : ldb, trans_b ? ldb : 1, c, ldc);
+        }
+
+        // dst(cols, rows) = src(rows, cols)^T，ld是src的行跨度
+        template <typename MType>
+        void transpose(unsigned long rows, unsigned long cols, const MType* src, unsigned long ld, MType* dst) {
+            for(unsigned long i {0}; i < rows; ++i) {
+                for(unsigned long j {0}; j < cols; ++j) {
+                    dst[j * rows + i] = src[i * ld + j];
+                }
+            }
+        }
+
+        // C的每一行乘上beta，beta是0时直接清零
+        template <typename MType>
+        void gemm_scale_c(unsigned long m, unsigned long n, MType beta, MType* c, unsigned long ldc) {
+            if(beta == MType(1)) {
+                return;
+            }
+            for(unsigned long i {0}; i < m; ++i) {
+                if(beta == MType(0)) {
+                    std::fill(c + i * ldc, c + i * ldc + n, MType(0));
+                }
+                else {
+                    scale(n, beta, c + i * ldc);
+                }
+            }
+        }
+
+        template <typename MType>
+        void gemm_small(unsigned long m, unsigned long n, unsigned long k, MType alpha, const MType* a, unsigned long rs_a, unsigned long cs_a, const MType* b, unsigned long rs_b, unsigned long cs_b, MType beta, MType* c, unsigned long ldc) {
+            gemm_scale_c(m, n, beta, c, ldc);
+            for(unsigned long i {0}; i < m; ++i) {
+                MType* c_row {c + i * ldc};
+                for(unsigned long p {0}; p < k; ++p) {
+                    const MType a_ip {alpha * a[i * rs_a + p * cs_a]};
+                    const MType* b_row {b + p * rs_b};
+                    if(cs_b == 1) {
+                        for(unsigned long j {0}; j < n; ++j) {
+                            c_row[j] += a_ip * b_row[j];
+                        }
+                    }
+                    else {
+                        for(unsigned long j {0}; j < n; ++j) {
+                            c_row[j] += a_ip * b_row[j * cs_b];
+                        }
+                    }
+                }
+            }
+        }
+
+        template <typename MType>
+        void gemm_pack_a(unsigned long mc, unsigned long kc, const MType* a, unsigned long rs_a, unsigned long cs_a, MType* packed) {
+            const unsigned long MR {GemmBlock<MType>::MR};
+            for(unsigned long i {0}; i < mc; i += MR) {
+                unsigned long rows {std::min(MR, mc - i)};
+                for(unsigned long p {0}; p < kc; ++p) {
+                    for(unsigned long r {0}; r < rows; ++r) {
+                        packed[r] = a[(i + r) * rs_a + p * cs_a];
+                    }
+                    for(unsigned long r {rows}; r < MR; ++r) {
+                        packed[r] = MType(0);
+                    }
+                    packed += MR;
+                }
+            }
+        }
+
+        template <typename MType>
+        void gemm_pack_b(unsigned long kc, unsigned long nc, const MType* b, unsigned long rs_b, unsigned long cs_b, MType* packed) {
+            const unsigned long NR {GemmBlock<MType>::NR};
+            for(unsigned long j {0}; j < nc; j += NR) {
+                unsigned long cols {std::min(NR, nc - j)};
+                for(unsigned long p {0}; p < kc; ++p) {
+                    const MType* b_row {b + p * rs_b + j * cs_b};
+                    for(unsigned long r {0}; r < cols; ++r) {
+                        packed[r] = b_row[r * cs_b];
+                    }
+                    for(unsigned long r {cols}; r < NR; ++r) {
+                        packed[r] = MType(0);
+                    }
+                    packed += NR;
+                }
+            }
+        }
+
+        template <typename MType>
+        void gemm_micro_kernel(unsigned long kc, const MType* a_panel, const MType* b_panel, MType* c, unsigned long ldc, unsigned long rows, unsigned long cols, bool accumulate) {
+            const unsigned long MR {GemmBlock<MType>::MR};
+            const unsigned long NR {GemmBlock<MType>::NR};
+            MType acc[MR][NR];
+            for(unsigned long i {0}; i < MR; ++i) {
+                for(unsigned long j {0}; j < NR; ++j) {
+                    acc[i][j] = MType(0);
+                }
+            }
+            for(unsigned long p {0}; p < kc; ++p) {
+                const MType* a_p {a_panel + p * MR};
+                const MType* b_p {b_panel + p * NR};
+                for(unsigned long i {0}; i < MR; ++i) {
+                    const MType a_ip {a_p[i]};
+                    for(unsigned long j {0}; j < NR; ++j) {
+                        acc[i][j] += a_ip * b_p[j];
+                    }
+                }
+            }
+            for(unsigned long i {0}; i < rows; ++i) {
+                MType* c_row {c + i * ldc};
+                if(accumulate) {
+                    for(unsigned long j {0}; j < cols; ++j) {
+                        c_row[j] += acc[i][j];
+                    }
+                }
+                else {
+                    for(unsigned long j {0}; j < cols; ++j) {
+                        c_row[j] = acc[i][j];
+                    }
+                }
+            }
+        }
+
+        // 把寄存器里算好的MR x NR小块写回C，边角上的小块只写有效的部分
+        template <typename MType>
+        void gemm_store_tile(const MType* tile, unsigned long nr, MType* c, unsigned long ldc, unsigned long rows, unsigned long cols, bool accumulate) {
+            for(unsigned long i {0}; i < rows; ++i) {
+                MType* c_row {c + i * ldc};
+                const MType* tile_row {tile + i * nr};
+                if(accumulate) {
+                    for(unsigned long j {0}; j < cols; ++j) {
+                        c_row[j] += tile_row[j];
+                    }
+                }
+                else {
+                    for(unsigned long j {0}; j < cols; ++j) {
+                        c_row[j] = tile_row[j];
+                    }
+                }
+            }
+        }
+
+#if AEDLF_X86_SIMD
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+        namespace avx2 {
+            // 6 x 16：每行两个ymm，12个累加器加上两个B向量和一个广播的A，正好放得下16个寄存器
+            inline void gemm_micro_kernel_f(unsigned long kc, const float* a_panel, const float* b_panel, float* c, unsigned long ldc, unsigned long rows, unsigned long cols, bool accumulate) {
+                const unsigned long MR {GemmBlock<float>::MR};
+                const unsigned long NR {GemmBlock<float>::NR};
+                __m256 acc[MR][2];
+                for(unsigned long i {0}; i < MR; ++i) {
+                    acc[i][0] = _mm256_setzero_ps();
+                    acc[i][1] = _mm256_setzero_ps();
+                }
+                for(unsigned long p {0}; p < kc; ++p) {
+                    const float* a_p {a_panel + p * MR};
+                    __m256 b0 {_mm256_loadu_ps(b_panel + p * NR)};
+                    __m256 b1 {_mm256_loadu_ps(b_panel + p * NR + 8)};
+                    for(unsigned long i {0}; i < MR; ++i) {
+                        __m256 a_ip {_mm256_broadcast_ss(a_p + i)};
+                        acc[i][0] = _mm256_fmadd_ps(a_ip, b0, acc[i][0]);
+                        acc[i][1] = _mm256_fmadd_ps(a_ip, b1, acc[i][1]);
+                    }
+                }
+                if(rows == MR && cols == NR) {
+                    for(unsigned long i {0}; i < MR; ++i) {
+                        float* c_row {c + i * ldc};
+                        if(accumulate) {
+                            acc[i][0] = _mm256_add_ps(acc[i][0], _mm256_loadu_ps(c_row));
+                            acc[i][1] = _mm256_add_ps(acc[i][1], _mm256_loadu_ps(c_row + 8));
+                        }
+                        _mm256_storeu_ps(c_row, acc[i][0]);
+                        _mm256_storeu_ps(c_row + 8, acc[i][1]);
+                    }
+                    return;
+                }
+                float tile[MR * NR];
+                for(unsigned long i {0}; i < MR; ++i) {
+                    _mm256_storeu_ps(tile + i * NR, acc[i][0]);
+                    _mm256_storeu_ps(tile + i * NR + 8, acc[i][1]);
+                }
+                gemm_store_tile(tile, NR, c, ldc, rows, cols, accumulate);
+            }
+
+            // 4 x 8：每行两个ymm，8个累加器
+            inline void gemm_micro_kernel_d(unsigned long kc, const double* a_panel, const double* b_panel, double* c, unsigned long ldc, unsigned long rows, unsigned long cols, bool accumulate) {
+                const unsigned long MR {GemmBlock<double>::MR};
+                const unsigned long NR {GemmBlock<double>::NR};
+                __m256d acc[MR][2];
+                for(unsigned long i {0}; i < MR; ++i) {
+                    acc[i][0] = _mm256_setzero_pd();
+                    acc[i][1] = _mm256_setzero_pd();
+                }
+                for(unsigned long p {0}; p < kc; ++p) {
+                    const double* a_p {a_panel + p * MR};
+                    __m256d b0 {_mm256_loadu_pd(b_panel + p * NR)};
+                    __m256d b1 {_mm256_loadu_pd(b_panel + p * NR + 4)};
+                    for(unsigned long i {0}; i < MR; ++i) {
+                        __m256d a_ip {_mm256_broadcast_sd(a_p + i)};
+                        acc[i][0] = _mm256_fmadd_pd(a_ip, b0, acc[i][0]);
+                        acc[i][1] = _mm256_fmadd_pd(a_ip, b1, acc[i][1]);
+                    }
+                }
+                if(rows == MR && cols == NR) {
+                    for(unsigned long i {0}; i < MR; ++i) {
+                        double* c_row {c + i * ldc};
+                        if(accumulate) {
+                            acc[i][0] = _mm256_add_pd(acc[i][0], _mm256_loadu_pd(c_row));
+                            acc[i][1] = _mm256_add_pd(acc[i][1], _mm256_loadu_pd(c_row + 4));
+                        }
+                        _mm256_storeu_pd(c_row, acc[i][0]);
+                        _mm256_storeu_pd(c_row + 4, acc[i][1]);
+                    }
+                    return;
+                }
+                double tile[MR * NR];
+                for(unsigned long i {0}; i < MR; ++i) {
+                    _mm256_storeu_pd(tile + i * NR, acc[i][0]);
+                    _mm256_storeu_pd(tile + i * NR + 4, acc[i][1]);
+                }
+                gemm_store_tile(tile, NR, c, ldc, rows, cols, accumulate);
+            }
+        }
+#pragma GCC pop_options
+#endif
+
+        template <typename MType>
+        using gemm_micro_func = void (*)(unsigned long kc, const MType* a_panel, const MType* b_panel, MType* c, unsigned long ldc, unsigned long rows, unsigned long cols, bool accumulate);
+
+        template <typename MType>
+        struct GemmDispatch {
+            static gemm_micro_func<MType> micro_kernel() {
+                return &gemm_micro_kernel<MType>;
+            }
+        };
+
+        inline bool gemm_use_avx2() {
+#if AEDLF_X86_SIMD
+            return simd_level() >= SimdLevel::avx2 && __builtin_cpu_supports("fma");
+#else
+            return false;
+#endif
+        }
+
+        template <>
+        struct GemmDispatch<float> {
+            static gemm_micro_func<float> micro_kernel() {
+#if AEDLF_X86_SIMD
+                if(gemm_use_avx2()) {
+                    return &avx2::gemm_micro_kernel_f;
+                }
+#endif
+                return &gemm_micro_kernel<float>;
+            }
+        };
+
+        template <>
+        struct GemmDispatch<double> {
+            static gemm_micro_func<double> micro_kernel() {
+#if AEDLF_X86_SIMD
+                if(gemm_use_avx2()) {
+                    return &avx2::gemm_micro_kernel_d;
+                }
+#endif
+                return &gemm_micro_kernel<double>;
+            }
+        };
+
+        template <typename MType>
+        inline gemm_micro_func<MType> gemm_micro() {
+            static const gemm_micro_func<MType> f {GemmDispatch<MType>::micro_kernel()};
+            return f;
+        }
+
+        template <typename MType>
+        void gemm_strided(unsigned long m, unsigned long n, unsigned long k, MType alpha, const MType* a, unsigned long rs_a, unsigned long cs_a, const MType* b, unsigned long rs_b, unsigned long cs_b, MType beta, MType* c, unsigned long ldc) {
+            if(m == 0 || n == 0) {
+                return;
+            }
+            if(k == 0 || alpha == MType(0) || m * n * k <= gemm_small_flops) {
+                gemm_small(m, n, alpha == MType(0) ? 0 : k, alpha, a, rs_a, cs_a, b, rs_b, cs_b, beta, c, ldc);
+                return;
+            }
+            // beta是0或1时micro kernel直接覆盖或累加，其他值先把C缩放一遍
+            if(beta != MType(0)) {
+                gemm_scale_c(m, n, beta, c, ldc);
+            }
+            bool accumulate_c {beta != MType(0)};
+            const unsigned long MR {GemmBlock<MType>::MR};
+            const unsigned long NR {GemmBlock<MType>::NR};
+            const unsigned long MC {GemmBlock<MType>::MC};
+            const unsigned long KC {GemmBlock<MType>::KC};
+            const unsigned long NC {GemmBlock<MType>::NC};
+            const gemm_micro_func<MType> micro_kernel {gemm_micro<MType>()};
+            // 打包缓冲区每个线程一份，反复使用，固定从默认来源分配并按64字节对齐
+            static thread_local std::vector<MType, utils::Allocator<MType>> a_buffer {utils::Allocator<MType> {utils::default_resource()}};
+            static thread_local std::vector<MType, utils::Allocator<MType>> b_buffer {utils::Allocator<MType> {utils::default_resource()}};
+            for(unsigned long jc {0}; jc < n; jc += NC) {
+                unsigned long nc {std::min(NC, n - jc)};
+                for(unsigned long pc {0}; pc < k; pc += KC) {
+                    unsigned long kc {std::min(KC, k - pc)};
+                    b_buffer.resize(((nc + NR - 1) / NR) * NR * kc);
+                    gemm_pack_b(kc, nc, b + pc * rs_b + jc * cs_b, rs_b, cs_b, b_buffer.data());
+                    for(unsigned long ic {0}; ic < m; ic += MC) {
+                        unsigned long mc {std::min(MC, m - ic)};
+                        a_buffer.resize(((mc + MR - 1) / MR) * MR * kc);
+                        gemm_pack_a(mc, kc, a + ic * rs_a + pc * cs_a, rs_a, cs_a, a_buffer.data());
+                        if(alpha != MType(1)) {
+                            // alpha乘在打包好的A块上，只多mc * kc次乘法
+                            scale(a_buffer.size(), alpha, a_buffer.data());
+                        }
+                        for(unsigned long jr {0}; jr < nc; jr += NR) {
+                            for(unsigned long ir {0}; ir < mc; ir += MR) {
+                                micro_kernel(
+                                    kc,
+                                    a_buffer.data() + ir * kc,
+                                    b_buffer.data() + jr * kc,
+                                    c + (ic + ir) * ldc + jc + jr,
+                                    ldc,
+                                    std::min(MR, mc - ir),
+                                    std::min(NR, nc - jr),
+                                    pc != 0 || accumulate_c
+                                );
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        /*
+        批量GEMM：C[i](m, n) = A[i] * B[i]，i < batch，每一项的起始地址放在a、b、c里，跨度所有项都一样，广播的一边可以重复同一个地址
+        任务在(batch项, 输出的行块, 列块)上一起切分：batch项够多时每项一个任务，项少矩阵大时（比如N = C = 1的FC）把输出切成MR x NR对齐的块
+        每个任务按块的计算量交给线程池，各块的计算量相近，单线程时不切块，结果和直接调用gemm_strided完全一样
+        alpha、beta的含义和gemm_strided一样，每一项的C = alpha * A * B + beta * C
+        */
+        template <typename MType>
+        void gemm_batched(unsigned long batch, unsigned long m, unsigned long n, unsigned long k, MType alpha, const MType* const* a, unsigned long rs_a, unsigned long cs_a, const MType* const* b, unsigned long rs_b, unsigned long cs_b, MType beta, MType* const* c, unsigned long ldc) {
+            if(batch == 0 || m == 0 || n == 0) {
+                return;
+            }
+            const unsigned long MR {GemmBlock<MType>::MR};
+            const unsigned long NR {GemmBlock<MType>::NR};
+            utils::ThreadPool& pool {utils::ThreadPool::global()};
+            unsigned long tile_num {1};
+            if(pool.get_worker_num() > 0 && batch < (pool.get_worker_num() + 1) * 4) {
+                // 每个线程分到大约4块，块之间可以互相偷任务
+                tile_num = ((pool.get_worker_num() + 1) * 4 + batch - 1) / batch;
+                tile_num = std::min(tile_num, std::max(1UL, m * n * k / gemm_tile_min_flops));
+            }
+            // 先切行再切列：切行时每块各自打包整个B，切列时各自打包整个A，行方向的块通常更多
+            unsigned long row_blocks {(m + MR - 1) / MR};
+            unsigned long col_blocks {(n + NR - 1) / NR};
+            unsigned long row_tiles {std::min(tile_num, row_blocks)};
+            unsigned long col_tiles {std::min((tile_num + row_tiles - 1) / row_tiles, col_blocks)};
+            unsigned long tile_m {(row_blocks + row_tiles - 1) / row_tiles * MR};
+            unsigned long tile_n {(col_blocks + col_tiles - 1) / col_tiles * NR};
+            row_tiles = (m + tile_m - 1) / tile_m;
+            col_tiles = (n + tile_n - 1) / tile_n;
+            unsigned long tiles {row_tiles * col_tiles};
+            pool.parallel_for(batch * tiles, std::min(tile_m, m) * std::min(tile_n, n) * k, [&](unsigned long task_i) {
+                unsigned long i {task_i / tiles};
+                unsigned long row {task_i % tiles / col_tiles * tile_m};
+                unsigned long col {task_i % col_tiles * tile_n};
+                gemm_strided<MType>(
+                    std::min(tile_m, m - row), std::min(tile_n, n - col), k,
+                    alpha,
+                    a[i] + row * rs_a, rs_a, cs_a,
+                    b[i] + col * cs_b, rs_b, cs_b,
+                    beta,
+                    c[i] + row * ldc + col, ldc
+                );
+            });
+        }
+
+        template <typename MType>
+        void gemm_batched(unsigned long batch, unsigned long m, unsigned long n, unsigned long k, const MType* const* a, unsigned long rs_a, unsigned long cs_a, const MType* const* b, unsigned long rs_b, unsigned long cs_b, MType* const* c, unsigned long ldc) {
+            gemm_batched(batch, m, n, k, MType(1), a, rs_a, cs_a, b, rs_b, cs_b, MType(0), c, ldc);
+        }
+    }
+}
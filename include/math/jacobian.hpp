@@ -0,0 +1,252 @@
+#pragma once
+#include "matrix.hpp"
+#include "view.hpp"
+#include "elementwise.hpp"
+#include "../utils/thread_pool.hpp"
+#include <vector>
+#include <cassert>
+
+
+namespace aedlf {
+    // 局部jacobi矩阵的结构，每个(n, c)通道上都是一个(out_hw, in_hw)的矩阵
+    enum class JacobiKind {
+        identity, // I
+        diagonal, // diag(d)，d的尺寸和父节点数据相同
+        block_diagonal, // I_r ⊗ B，B是(bh, bw)，乘法对左侧参数的jacobi，B = X^T，直接用X的转置视图
+        kronecker, // A ⊗ I_r，A是(ah, aw)，乘法对右侧参数的jacobi，A = W
+        dense // 稠密矩阵，兼容原来compute_jacobi的结果
+    };
+
+    /*
+    结构化的jacobi矩阵，只保存生成矩阵需要的参数，不展开成(out_hw, in_hw)的稠密矩阵
+    反向传播只需要 acc += g * J，g是输出节点对子节点的jacobi(n, c, R, out_hw)，acc是对本节点的jacobi(n, c, R, in_hw)
+    参数矩阵的batch可以是1（所有batch共享），acc的batch是1时会把g的所有batch累加进来
+    结构化的参数存成MatrixView，按跨度读取，转置过的参数不用拷贝
+    */
+    template <typename MType>
+    class Jacobian {
+        public:
+            using matrix_dim = std::vector<unsigned long>;
+            Jacobian();
+            static Jacobian<MType> identity();
+            static Jacobian<MType> diagonal(const MatrixView<MType>& d);
+            static Jacobian<MType> block_diagonal(const MatrixView<MType>& block, unsigned long repeat);
+            static Jacobian<MType> kronecker(const MatrixView<MType>& factor, unsigned long repeat);
+            static Jacobian<MType> dense(const Matrix<MType>& m);
+            JacobiKind get_kind() const;
+            unsigned long get_repeat() const;
+            const MatrixView<MType>& get_factor() const;
+            void left_mul_acc(const Matrix<MType>& g, Matrix<MType>& acc) const;
+        private:
+            void left_mul_row(const MType* g_row, const MType* factor_p, unsigned long rs, unsigned long cs, MType* acc_row, unsigned long out_hw, unsigned long in_hw) const;
+            void dense_mul_acc(const Matrix<MType>& g, Matrix<MType>& acc) const;
+            JacobiKind kind {JacobiKind::identity};
+            MatrixView<MType> factor {};
+            Matrix<MType> dense_factor {};
+            unsigned long repeat {1};
+    };
+
+    template <typename MType>
+    Jacobian<MType>::Jacobian() {}
+
+    template <typename MType>
+    Jacobian<MType> Jacobian<MType>::identity() {
+        return Jacobian<MType> {};
+    }
+
+    template <typename MType>
+    Jacobian<MType> Jacobian<MType>::diagonal(const MatrixView<MType>& d) {
+        Jacobian<MType> j {};
+        j.kind = JacobiKind::diagonal;
+        j.factor = d;
+        return j;
+    }
+
+    template <typename MType>
+    Jacobian<MType> Jacobian<MType>::block_diagonal(const MatrixView<MType>& block, unsigned long repeat) {
+        Jacobian<MType> j {};
+        j.kind = JacobiKind::block_diagonal;
+        j.factor = block;
+        j.repeat = repeat;
+        return j;
+    }
+
+    template <typename MType>
+    Jacobian<MType> Jacobian<MType>::kronecker(const MatrixView<MType>& factor, unsigned long repeat) {
+        Jacobian<MType> j {};
+        j.kind = JacobiKind::kronecker;
+        j.factor = factor;
+        j.repeat = repeat;
+        return j;
+    }
+
+    template <typename MType>
+    Jacobian<MType> Jacobian<MType>::dense(const Matrix<MType>& m) {
+        Jacobian<MType> j {};
+        j.kind = JacobiKind::dense;
+        j.dense_factor = m;
+        return j;
+    }
+
+    template <typename MType>
+    JacobiKind Jacobian<MType>::get_kind() const {
+        return kind;
+    }
+
+    template <typename MType>
+    unsigned long Jacobian<MType>::get_repeat() const {
+        return repeat;
+    }
+
+    template <typename MType>
+    const MatrixView<MType>& Jacobian<MType>::get_factor() const {
+        return factor;
+    }
+
+    template <typename MType>
+    void Jacobian<MType>::left_mul_acc(const Matrix<MType>& g, Matrix<MType>& acc) const {
+        if(kind == JacobiKind::dense) {
+            dense_mul_acc(g, acc);
+            return;
+        }
+        matrix_dim g_dim {g.get_dim()};
+        matrix_dim acc_dim {acc.get_dim()};
+        assert(g_dim[1] == acc_dim[1] && g_dim[2] == acc_dim[2]);
+        assert(acc_dim[0] == g_dim[0] || acc_dim[0] == 1);
+        unsigned long rows {g_dim[2]};
+        unsigned long out_hw {g_dim[3]};
+        unsigned long in_hw {acc_dim[3]};
+        unsigned long channels {g_dim[1]};
+        matrix_dim f_dim {kind == JacobiKind::identity ? matrix_dim {1, channels, 1, 1} : factor.get_dim()};
+        matrix_dim f_strides {kind == JacobiKind::identity ? matrix_dim {0, 0, 0, 0} : factor.get_strides()};
+        switch(kind) {
+            case JacobiKind::identity:
+                assert(out_hw == in_hw);
+                break;
+            case JacobiKind::diagonal:
+                // 按一行h * w读取，通道内必须连续
+                assert(f_dim[2] * f_dim[3] == out_hw && out_hw == in_hw);
+                assert(factor.get_strides()[3] == 1 && (f_dim[2] == 1 || factor.get_strides()[2] == f_dim[3]));
+                break;
+            case JacobiKind::block_diagonal:
+                assert(f_dim[2] * repeat == out_hw && f_dim[3] * repeat == in_hw);
+                break;
+            case JacobiKind::kronecker:
+                assert(f_dim[2] * repeat == out_hw && f_dim[3] * repeat == in_hw);
+                break;
+            default:
+                break;
+        }
+        if(kind != JacobiKind::identity) {
+            assert(f_dim[1] == channels && (f_dim[0] == g_dim[0] || f_dim[0] == 1));
+        }
+        const MType* g_p {g.get_data()->data()};
+        const MType* f_p {kind == JacobiKind::identity ? nullptr : factor.get_ptr()};
+        MType* acc_p {acc.mutable_data()};
+        unsigned long g_batch {g_dim[0]};
+        unsigned long acc_batch {acc_dim[0]};
+        unsigned long f_batch {kind == JacobiKind::identity ? 1 : f_dim[0]};
+        unsigned long row_cost {(kind == JacobiKind::block_diagonal || kind == JacobiKind::kronecker) ? out_hw * (in_hw / repeat) : in_hw};
+        // 按acc的通道切任务，acc的batch是1时在任务内部按顺序累加所有batch，不会有写冲突
+        utils::ThreadPool::global().parallel_for(acc_batch * channels, (g_batch / acc_batch) * rows * row_cost, [&](unsigned long task_i) {
+            unsigned long c {task_i % channels};
+            unsigned long acc_n {task_i / channels};
+            unsigned long n_begin {acc_batch == g_batch ? acc_n : 0};
+            unsigned long n_end {acc_batch == g_batch ? acc_n + 1 : g_batch};
+            MType* acc_channel {acc_p + (acc_n * channels + c) * rows * in_hw};
+            for(unsigned long n {n_begin}; n < n_end; ++n) {
+                const MType* g_channel {g_p + (n * channels + c) * rows * out_hw};
+                const MType* f_channel {f_p == nullptr ? nullptr : f_p + (f_batch == 1 ? 0 : n) * f_strides[0] + c * f_strides[1]};
+                for(unsigned long r {0}; r < rows; ++r) {
+                    left_mul_row(g_channel + r * out_hw, f_channel, f_strides[2], f_strides[3], acc_channel + r * in_hw, out_hw, in_hw);
+                }
+            }
+        });
+    }
+
+    template <typename MType>
+    void Jacobian<MType>::left_mul_row(const MType* g_row, const MType* factor_p, unsigned long rs, unsigned long cs, MType* acc_row, unsigned long out_hw, unsigned long in_hw) const {
+        // 参数矩阵的(i, j)在factor_p[i * rs + j * cs]
+        switch(kind) {
+            case JacobiKind::identity:
+                kernel::add(in_hw, g_row, acc_row);
+                break;
+            case JacobiKind::diagonal:
+                for(unsigned long i {0}; i < in_hw; ++i) {
+                    acc_row[i] += g_row[i] * factor_p[i];
+                }
+                break;
+            case JacobiKind::block_diagonal: {
+                // acc[t * bw: (t + 1) * bw] += g[t * bh: (t + 1) * bh] * B
+                unsigned long bh {out_hw / repeat};
+                unsigned long bw {in_hw / repeat};
+                for(unsigned long t {0}; t < repeat; ++t) {
+                    const MType* g_block {g_row + t * bh};
+                    MType* acc_block {acc_row + t * bw};
+                    if(cs == 1) {
+                        for(unsigned long p {0}; p < bh; ++p) {
+                            kernel::axpy(bw, g_block[p], factor_p + p * rs, acc_block);
+                        }
+                    }
+                    else if(rs == 1) {
+                        // B是X^T的视图，B的一列是X连续的一行，按点积算
+                        for(unsigned long j {0}; j < bw; ++j) {
+                            const MType* b_col {factor_p + j * cs};
+                            MType sum {0};
+                            for(unsigned long p {0}; p < bh; ++p) {
+                                sum += g_block[p] * b_col[p];
+                            }
+                            acc_block[j] += sum;
+                        }
+                    }
+                    else {
+                        for(unsigned long p {0}; p < bh; ++p) {
+                            for(unsigned long j {0}; j < bw; ++j) {
+                                acc_block[j] += g_block[p] * factor_p[p * rs + j * cs];
+                            }
+                        }
+                    }
+                }
+                break;
+            }
+            case JacobiKind::kronecker: {
+                // g看作(ah, r)，acc看作(aw, r)，acc += A^T * g
+                unsigned long ah {out_hw / repeat};
+                unsigned long aw {in_hw / repeat};
+                for(unsigned long i {0}; i < ah; ++i) {
+                    for(unsigned long p {0}; p < aw; ++p) {
+                        kernel::axpy(repeat, factor_p[i * rs + p * cs], g_row + i * repeat, acc_row + p * repeat);
+                    }
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    template <typename MType>
+    void Jacobian<MType>::dense_mul_acc(const Matrix<MType>& g, Matrix<MType>& acc) const {
+        // 原来BaseNode::backward里的逻辑，只是不再原地修改子节点的jacobi
+        matrix_dim g_dim {g.get_dim()};
+        matrix_dim f_dim {dense_factor.get_dim()};
+        if(g_dim[2] == f_dim[3]) {
+            if(acc.get_dim() == matrix_dim {std::max(g_dim[0], f_dim[0]), g_dim[1], g_dim[2], f_dim[3]}) {
+                // 尺寸正好时乘积直接累加进acc，不生成临时矩阵
+                acc.mul_acc(g, dense_factor);
+            }
+            else {
+                acc += g * dense_factor;
+            }
+        }
+        else if(acc.get_dim() == dense_factor.get_dim() && g.get_data()->size() == dense_factor.get_data()->size()) {
+            // 逐元素乘直接累加，一次遍历
+            acc += mul_v(dense_factor, g);
+        }
+        else {
+            Matrix<MType> product {};
+            product.copy_from(dense_factor);
+            acc += product.mul_v(g);
+        }
+    }
+}
@@ -6,46 +6,75 @@
 #include <utility>
 #include <cassert>
 #include <cmath>
-#include <thread>
 #include <initializer_list>
+#include <type_traits>
+#include <algorithm>
+#include "gemm.hpp"
+#include "elementwise.hpp"
+#include "broadcast.hpp"
+#include "expression.hpp"
+#include "../utils/thread_pool.hpp"
+#include "../utils/allocator.hpp"
 
 
 namespace aedlf {
+    template <typename MType>
+    class MatrixView;
+
+    /*
+    Matrix的拷贝（拷贝构造、赋值、copy_from）是O(1)的，几个Matrix共用同一块内存，直到其中一个要改写数据时才整块拷贝一份（copy-on-write）
+    Matrix自己的成员函数改数据之前都会先做这一步；kernel要直接写内存的话用mutable_data()拿指针，拿到的内存只属于这个Matrix
+    例外是用Matrix(shape, matrix_data_p)绑定的外部内存（比如内存规划的槽位），本来就是有意共用的，写入不拷贝，所有共用者都看得到
+    绑定只属于构造出来的那个Matrix（移动时跟着走），拷贝出来的矩阵不绑定，改写时照常拷贝；绑定的一方之后原地写入时拷贝也会看到，要留住当时的数据用clone()
+    */
     template <typename MType>
     class Matrix{
         public:
-            using matrix_data_p = std::shared_ptr<std::vector<MType>>;
-            using matrix_data = std::vector<MType>;
+            using matrix_data = std::vector<MType, utils::Allocator<MType>>; // 内存来自utils::current_resource，64字节对齐
+            using matrix_data_p = std::shared_ptr<matrix_data>;
             using matrix_dim = std::vector<unsigned long>;
             using slice_parma = std::vector<unsigned long>;
             using ul_pos = const std::pair<unsigned long, unsigned long>;
             Matrix();
             ~Matrix();
+            template <typename... Args>
+            static matrix_data_p make_data(Args&&... args); // 和make_shared一样，控制块和数据都走当前的内存来源
             Matrix(matrix_dim shape, MType fill_with);
-            Matrix(matrix_dim shape, matrix_data_p data); // 这里仿照caffe使用1d-array
+            Matrix(matrix_dim shape, matrix_data_p data); // 这里仿照caffe使用1d-array；绑定外部内存，写入不拷贝
             Matrix(matrix_dim shape, std::initializer_list<MType> init_data);
             Matrix(std::initializer_list<unsigned long> shape, std::initializer_list<MType> init_data);
             Matrix(std::initializer_list<unsigned long> shape, MType fill_with);
             Matrix(std::initializer_list<unsigned long> shape, matrix_data_p data);
-            Matrix(const Matrix<MType>& m);
+            Matrix(const Matrix<MType>& m); // 和m共用内存，但不继承绑定
+            Matrix(Matrix<MType>&& m); // 绑定的内存跟着移动
+            template <typename E>
+            Matrix(const expr::Expr<E>& e); // 逐元素表达式求值到新分配的内存里
             Matrix<MType>& operator=(const Matrix<MType>& m);
-            Matrix<MType>& operator+(const Matrix<MType>& m);
-            Matrix<MType>& operator+(MType number);
-            Matrix<MType>& operator*(MType scale_number);
-            Matrix<MType>& operator*(const Matrix<MType>& m);
+            Matrix<MType>& operator=(Matrix<MType>&& m);
+            template <typename E>
+            Matrix<MType>& operator=(const expr::Expr<E>& e); // 尺寸按表达式调整，写进本矩阵已有的内存
+            template <typename E>
+            Matrix<MType>& operator+=(const expr::Expr<E>& e);
+            template <typename E>
+            Matrix<MType>& operator-=(const expr::Expr<E>& e);
+            Matrix<MType> operator*(const Matrix<MType>& m) const; // 矩阵乘法，结果是新的矩阵，两边都不变；+、-和乘标量见expression.hpp
             Matrix<MType>& operator+=(const Matrix<MType>& m);
             Matrix<MType>& operator+=(MType number);
             Matrix<MType>& operator*=(const Matrix<MType>& m);
             Matrix<MType>& operator*=(MType number);
             bool operator==(const Matrix<MType>& m);
-            void copy_from(const Matrix<MType>& m);
-            Matrix<MType>& add(const Matrix<MType>& addend); // inplace计算
+            void copy_from(const Matrix<MType>& m); // 和m共用内存，谁先改谁拷贝；本矩阵绑定了外部内存时把数据写进去
+            Matrix<MType> clone() const; // 立即整块拷贝到当前内存来源新分配的内存里，不和任何矩阵共用
+            Matrix<MType>& add(const Matrix<MType>& addend); // inplace计算，形状按NumPy规则广播
             Matrix<MType>& add(MType number);
             Matrix<MType>& mul(const Matrix<MType>& mutiplier); // inplace计算
-            Matrix<MType>& mul_v(const Matrix<MType>& mutiplier); // inplace计算
+            Matrix<MType>& mul_from(const Matrix<MType>& a, const Matrix<MType>& b); // this = a * b，尺寸不变时直接写进已有的内存
+            Matrix<MType>& mul_acc(const Matrix<MType>& a, const Matrix<MType>& b, MType alpha = MType(1), MType beta = MType(1)); // this = alpha * a * b + beta * this，不生成乘积的临时矩阵
+            Matrix<MType>& axpy(MType alpha, const Matrix<MType>& x); // this += alpha * x，x不变，广播同add
+            Matrix<MType>& mul_v(const Matrix<MType>& mutiplier); // inplace逐元素乘，广播同add
             Matrix<MType>& scale(MType scale_number);
             void clear_data();
-            void set_data(matrix_data_p data);
+            void set_data(matrix_data_p data); // 接管这块内存，之后按copy-on-write处理
             void resize(matrix_dim shape, MType fill_with);
             void resize(unsigned long n, unsigned long c, unsigned long h, unsigned long w, MType fill_with);
             void view(matrix_dim shape);
@@ -68,26 +97,36 @@ namespace aedlf {
             ul_pos get_batch(unsigned long batch_id) const;
             ul_pos get_channel(matrix_dim dim, unsigned long channel_id, ul_pos batch_pos) const;
             ul_pos get_channel(unsigned long channel_id, ul_pos batch_pos) const;
-            const matrix_data_p get_data() const;
+            const matrix_data_p& get_data() const; // 只读，不要通过它写数据；返回引用，不会让引用计数变多而触发拷贝
             const matrix_dim get_dim() const;
-            matrix_data_p get_m_data();
+            MType* mutable_data(); // 先保证内存只属于本矩阵（或是绑定的外部内存）再返回，指针在本矩阵下一次被拷贝之前有效
+            bool is_shared() const; // 还有别的Matrix共用这块内存，改写之前要拷贝
         private:
-            void mul_core(const matrix_data_p inplace_m, ul_pos inplace_m_pos, matrix_dim inplace_m_dim, const matrix_data_p mul_m, ul_pos mul_m_pos, matrix_dim mul_m_dim, matrix_data_p result, ul_pos result_pos);
-            void add_boardcast_core(Matrix<MType>& summand, const Matrix<MType>& addend, ul_pos channel_ul, ul_pos a_channel_ul, int piece);
-            void mul_v_boardcast_core(Matrix<MType>& multiplied, const Matrix<MType>& mutiplier, ul_pos channel_ul, ul_pos m_channel_ul, int piece);
-            void T_core(ul_pos channel_ul);
-            unsigned long T_core_get_next(unsigned long now_index, unsigned long m_h, unsigned long m_len);
+            void check_expr_shape(const expr::expr_shape& e_shape) const; // +=、-=的表达式必须和本矩阵形状相同
+            void detach(bool keep_data = true); // 内存被共用时换成自己的一份，keep_data为false时不拷贝旧的内容（马上要整块覆盖）
+            static void mul_batched(const Matrix<MType>& a, const Matrix<MType>& b, MType alpha, MType beta, MType* result, std::true_type use_gemm);
+            static void mul_batched(const Matrix<MType>& a, const Matrix<MType>& b, MType alpha, MType beta, MType* result, std::false_type use_gemm);
+            static void check_mul_shape(const Matrix<MType>& a, const Matrix<MType>& b); // a * b的batch、channel和内侧尺寸，不匹配时抛异常
+            static void mul_core(const MType* a, const MType* b, MType* c, unsigned long m, unsigned long k, unsigned long n, MType alpha, MType beta);
+            template <typename Op>
+            void broadcast_inplace(const Matrix<MType>& x, const Op& op); // this = this op x，按NumPy规则广播，需要时本矩阵也扩展成广播后的形状
             void sum_by_dim_core(Matrix<MType>& m, Matrix<MType>& result, unsigned long sum_dim, unsigned long batch_id);
-            void concat_core(Matrix<MType>& m, Matrix<MType>& result, unsigned long dim, unsigned long batch_id);
             matrix_data_p data;
             matrix_dim shape; // (n,c,h,w)
             bool uninitialized {false};
+            bool bound {false}; // data是绑定的外部内存
     };
 
+    template <typename MType>
+    template <typename... Args>
+    typename Matrix<MType>::matrix_data_p Matrix<MType>::make_data(Args&&... args) {
+        return std::allocate_shared<matrix_data>(utils::Allocator<matrix_data> {}, std::forward<Args>(args)...);
+    }
+
     template <typename MType>
     Matrix<MType>::Matrix() {
         uninitialized = true;
-        data = std::make_shared<matrix_data>(0, MType(0));
+        data = make_data(0, MType(0));
         shape = matrix_dim {0,0,0,0};
     }
 
@@ -95,7 +134,7 @@ namespace aedlf {
     Matrix<MType>::Matrix(matrix_dim shape, std::initializer_list<MType> init_data) {
         assert(shape[0] * shape[1] * shape[2] * shape[3] == init_data.size()); // warning here
         this->shape = shape;
-        data = std::make_shared<matrix_data>(init_data);
+        data = make_data(init_data);
     }
 
     template <typename MType>
@@ -123,7 +162,7 @@ namespace aedlf {
             assert(dim >= 1);
             data_len *= dim;
         }
-        data = std::make_shared<matrix_data>(data_len, fill_with);
+        data = make_data(data_len, fill_with);
         this->shape = shape;
     }
 
@@ -138,6 +177,7 @@ namespace aedlf {
         assert(data->size() == data_len);
         this->data = data;
         this->shape = shape;
+        bound = true;
     }
 
     template <typename MType>
@@ -148,15 +188,26 @@ namespace aedlf {
 
     template <typename MType>
     Matrix<MType>::Matrix(const Matrix<MType>& m) {
+        // 拷贝不继承绑定，第一次改写时拷贝，不会写进绑定的内存
         data = m.data;
         shape = m.shape;
     }
 
+    template <typename MType>
+    Matrix<MType>::Matrix(Matrix<MType>&& m) {
+        // 移动时绑定跟着走，源矩阵不再绑定
+        data = m.data;
+        shape = m.shape;
+        bound = m.bound;
+        m.bound = false;
+    }
+
     template <typename MType>
     Matrix<MType>& Matrix<MType>::operator=(const Matrix<MType>& m) {
         if(uninitialized) {
             this->data = m.data;
             this->shape = m.shape;
+            this->bound = false;
             uninitialized = false;
             return *this;
         }
@@ -166,36 +217,82 @@ namespace aedlf {
         else {
             this->data = m.data;
             this->shape = m.shape;
+            this->bound = false;
         }
         uninitialized = false;
         return *this;
     }
 
     template <typename MType>
-    Matrix<MType>& Matrix<MType>::operator+(const Matrix<MType>& m) {
-        add(m);
+    Matrix<MType>& Matrix<MType>::operator=(Matrix<MType>&& m) {
+        if(this == &m) {
+            return *this;
+        }
+        this->data = m.data;
+        this->shape = m.shape;
+        this->bound = m.bound;
+        m.bound = false;
+        uninitialized = false;
         return *this;
     }
 
+
+
     template <typename MType>
-    Matrix<MType>& Matrix<MType>::operator+(MType number) {
-        add(number);
+    Matrix<MType> Matrix<MType>::operator*(const Matrix<MType>& m) const {
+        Matrix<MType> product {};
+        product.mul_from(*this, m);
+        return product;
+    }
+
+    template <typename MType>
+    template <typename E>
+    Matrix<MType>::Matrix(const expr::Expr<E>& e) : Matrix() {
+        *this = e;
+    }
+
+    template <typename MType>
+    template <typename E>
+    Matrix<MType>& Matrix<MType>::operator=(const expr::Expr<E>& e) {
+        static_assert(std::is_same<typename E::value_type, MType>::value, "expression type must match the matrix");
+        expr::expr_shape e_shape {e.self().shape()};
+        // 共用的旧内存不用拷贝，叶子指向它，求值期间别的共用者还拿着，不会被释放
+        detach(false);
+        resize(matrix_dim {e_shape.begin(), e_shape.end()}, MType(0));
+        expr::evaluate<expr::Assign>(data->data(), e, data->size());
         return *this;
     }
 
     template <typename MType>
-    Matrix<MType>& Matrix<MType>::operator*(const Matrix<MType>& m) {
+    template <typename E>
+    Matrix<MType>& Matrix<MType>::operator+=(const expr::Expr<E>& e) {
+        static_assert(std::is_same<typename E::value_type, MType>::value, "expression type must match the matrix");
         check_initialized();
-        mul(m);
+        check_expr_shape(e.self().shape());
+        detach();
+        expr::evaluate<expr::AddAssign>(data->data(), e, data->size());
         return *this;
     }
 
     template <typename MType>
-    Matrix<MType>& Matrix<MType>::operator*(MType scale_number) {
-        scale(scale_number);
+    template <typename E>
+    Matrix<MType>& Matrix<MType>::operator-=(const expr::Expr<E>& e) {
+        static_assert(std::is_same<typename E::value_type, MType>::value, "expression type must match the matrix");
+        check_initialized();
+        check_expr_shape(e.self().shape());
+        detach();
+        expr::evaluate<expr::SubAssign>(data->data(), e, data->size());
         return *this;
     }
 
+
+    template <typename MType>
+    void Matrix<MType>::check_expr_shape(const expr::expr_shape& e_shape) const {
+        if(matrix_dim {e_shape.begin(), e_shape.end()} != shape) {
+            throw std::runtime_error("Matrix shape is not match the expression");
+        }
+    }
+
     template <typename MType>
     Matrix<MType>& Matrix<MType>::operator+=(const Matrix<MType>& m) {
         add(m);
@@ -234,94 +331,72 @@ namespace aedlf {
 
     template <typename MType>
     void Matrix<MType>::copy_from(const Matrix<MType>& m) {
-        shape = m.shape;
-        data->resize(shape[0] * shape[1] * shape[2] * shape[3], MType(0));
-        for(size_t i {0}; i < data->size(); ++i) {
-            data->at(i) = m.data->at(i);
+        if(bound) {
+            // 绑定的内存要原地写，别的共用者靠它拿到数据
+            if(data != m.data) {
+                data->resize(m.data->size(), MType(0));
+                std::copy(m.data->begin(), m.data->end(), data->begin());
+            }
+        }
+        else if(m.bound) {
+            // 绑定的内存随时会被别人原地改写，不能共用，整块拷贝一份
+            data = make_data(m.data->begin(), m.data->end());
         }
+        else {
+            data = m.data;
+        }
+        shape = m.shape;
         uninitialized = false;
     }
 
+    template <typename MType>
+    Matrix<MType> Matrix<MType>::clone() const {
+        check_initialized();
+        Matrix<MType> copied {};
+        copied.data = make_data(data->begin(), data->end());
+        copied.shape = shape;
+        copied.uninitialized = false;
+        return copied;
+    }
+
     template <typename MType>
     Matrix<MType>& Matrix<MType>::add(const Matrix<MType>& addend) {
+        broadcast_inplace(addend, kernel::BroadcastAdd<MType> {});
+        return *this;
+    }
+
+    template <typename MType>
+    template <typename Op>
+    void Matrix<MType>::broadcast_inplace(const Matrix<MType>& x, const Op& op) {
         check_initialized();
-        assert(addend.shape[0] == shape[0] && addend.shape[1] == shape[1]);
-        if(this->data->size() == (addend.data)->size()) {
-            for(size_t i {0}; i < data->size(); ++i) {
-                data->at(i) += (addend.data)->at(i);
-            }
-        }
-        else if(this->data->size() % (addend.data)->size() == 0 && this->data->size() >= (addend.data)->size()) {
-            std::vector<std::thread> thread_c;
-            unsigned long max_piece = data->size() / addend.data->size();
-            for(unsigned long n {0}; n < shape[0]; ++n) {
-                ul_pos this_batch_ul {get_batch(n)};
-                ul_pos addend_batch_ul {addend.get_batch(n)};
-                for(unsigned long c {0}; c < shape[1]; ++c) {
-                    ul_pos this_channel_ul {get_channel(c, this_batch_ul)};
-                    ul_pos addend_channel_ul {addend.get_channel(c, addend_batch_ul)};
-                    for(unsigned long piece {0}; piece < max_piece; ++piece) {
-                        thread_c.emplace_back(&Matrix<MType>::add_boardcast_core, this, std::ref(*this), addend, this_channel_ul, addend_channel_ul, piece);
-                    }
-                }
-            }
-            for(auto& t : thread_c) {
-                t.join();
-            }
+        x.check_initialized();
+        if(shape == x.shape) {
+            // 形状相同时不用算步长，直接整块逐元素计算
+            detach();
+            op.row(data->size(), x.data->data(), data->data());
+            return;
         }
-        else if((addend.data)->size() % this->data->size() == 0 && (addend.data)->size() >= this->data->size()) {
-            Matrix<MType> bigger_one {addend};
-            std::vector<std::thread> thread_c;
-            size_t max_piece = data->size() / addend.data->size();
-            for(unsigned long n {0}; n < shape[0]; ++n) {
-                ul_pos this_batch_ul {get_batch(n)};
-                ul_pos addend_batch_ul {addend.get_batch(n)};
-                for(unsigned long c {0}; c < shape[1]; ++c) {
-                    ul_pos this_channel_ul {get_channel(c, this_batch_ul)};
-                    ul_pos addend_channel_ul {addend.get_channel(c, addend_batch_ul)};
-                    for(unsigned long piece {0}; piece < max_piece; ++piece) {
-                        thread_c.emplace_back(&Matrix<MType>::add_boardcast_core, this, std::ref(bigger_one), *this, this_channel_ul, addend_channel_ul, piece);
-                    }
-                }
-            }
-            for(auto& t : thread_c) {
-                t.join();
-            }
-            data = bigger_one.data;
-            shape = bigger_one.shape;
+        matrix_dim result_dim {kernel::broadcast_dim(shape, x.shape)};
+        if(result_dim != shape) {
+            // 本矩阵自己也要广播，先展开到新的内存里（绑定的内存放不下，不再绑定）
+            matrix_data_p expanded {make_data(result_dim[0] * result_dim[1] * result_dim[2] * result_dim[3])};
+            kernel::broadcast_apply(kernel::make_broadcast(result_dim, shape), data->data(), expanded->data(), kernel::BroadcastCopy<MType> {});
+            data = expanded;
+            shape = result_dim;
+            bound = false;
         }
         else {
-            throw std::runtime_error("Matrix is shape is not match");
+            detach();
         }
-        return *this;
+        kernel::broadcast_apply(kernel::make_broadcast(shape, x.shape), x.data->data(), data->data(), op);
     }
 
     template <typename MType>
     Matrix<MType>& Matrix<MType>::add(MType number) {
         check_initialized();
-        for(size_t i {0}; i < data->size(); ++i) {
-            data->at(i) += number;
-        }
-    }
-
-    template <typename MType>
-    void Matrix<MType>::add_boardcast_core(Matrix<MType>& summand, const Matrix<MType>& addend, ul_pos channel_ul, ul_pos a_channel_ul, int piece) {
-        assert(summand.data->size() > addend.data->size());
-        assert(summand.data->size() % addend.data->size() == 0);
-        size_t max_piece = summand.data->size() / addend.data->size();
-        assert(piece < max_piece);
-        matrix_dim addend_dim {addend.get_dim()};
-        assert(summand.shape[2] % addend_dim[2] == 0);
-        assert(summand.shape[3] % addend_dim[3] == 0);
-        unsigned long piece_w, piece_x, piece_y;
-        piece_w = summand.shape[3] / addend_dim[3];
-        piece_x = piece % piece_w; //x is w
-        piece_y = piece / piece_w; // y is h
-        for(unsigned long addend_h {0}; addend_h < addend_dim[2]; ++addend_h) {
-            for(unsigned long addend_w {0}; addend_w < addend_dim[3]; ++addend_w) {
-                summand.data->at(channel_ul.first + (piece_y * addend_dim[2] + addend_h) * summand.shape[2] + piece_x * addend_dim[3] + addend_w) += addend.data->at(a_channel_ul.first + addend_h * addend_dim[2] + addend_w);
-            }
-        }
+        detach();
+        kernel::add_scalar(data->size(), number, data->data());
+        return *this;
     }
 
     template <typename MType>
@@ -349,6 +424,7 @@ namespace aedlf {
         assert(c >= 0 && c < shape[1]);
         assert(h >= 0 && h < shape[2]);
         assert(w >= 0 && w < shape[3]);
+        detach();
         data->at(
             n * shape[1] * shape[2] * shape[3] + c * shape[2] * shape[3] + h * shape[3] + w
         ) = value;
@@ -358,6 +434,7 @@ namespace aedlf {
     void Matrix<MType>::set(unsigned long index, MType value) {
         check_initialized();
         assert(index < data->size());
+        detach();
         data->at(index) = value;
     }
 
@@ -397,139 +474,182 @@ namespace aedlf {
     template <typename MType>
     Matrix<MType>& Matrix<MType>::scale(MType scale_number) {
         check_initialized();
-        for(size_t i {0}; i < data->size(); ++i) {
-            data->at(i) *= scale_number;
-        }
+        detach();
+        kernel::scale(data->size(), scale_number, data->data());
         return *this;
     }
 
     template <typename MType>
-    void Matrix<MType>::mul_core(const matrix_data_p inplace_m, ul_pos inplace_m_pos, matrix_dim inplace_m_dim, const matrix_data_p mul_m, ul_pos mul_m_pos, matrix_dim mul_m_dim, matrix_data_p result, ul_pos result_pos) {
-        // (h, w) -> implace_m_dim (w, h) -> mul_m_dim
-        assert(inplace_m_dim.size() == 2 && mul_m_dim.size() == 2);
-        assert(inplace_m_dim[0] == mul_m_dim[1] && inplace_m_dim[1] == mul_m_dim[0]);
-        assert(result->size() % inplace_m_dim[0] * mul_m_dim[1] == 0);
+    void Matrix<MType>::mul_core(const MType* a, const MType* b, MType* c, unsigned long m, unsigned long k, unsigned long n, MType alpha, MType beta) {
         unsigned long result_h, result_w, i;
         MType sum;
-        for(result_h = 0; result_h < inplace_m_dim[0]; ++result_h) {
-            for(result_w = 0; result_w < mul_m_dim[1]; ++result_w) {
+        for(result_h = 0; result_h < m; ++result_h) {
+            for(result_w = 0; result_w < n; ++result_w) {
                 sum = MType(0);
-                for(i = 0; i < inplace_m_dim[1]; ++i) {
-                    sum += inplace_m->at(inplace_m_pos.first + result_h * inplace_m_dim[1] + i) * mul_m->at(mul_m_pos.first + i * inplace_m_dim[0] + result_w);
+                for(i = 0; i < k; ++i) {
+                    sum += a[result_h * k + i] * b[i * n + result_w];
                 }
-                result->at(result_pos.first + result_h * mul_m_dim[1] + result_w) = sum;
-            }
+                MType& c_hw {c[result_h * n + result_w]};
+                c_hw = beta == MType(0) ? alpha * sum : alpha * sum + beta * c_hw;
+            }
+        }
+    }
+
+    template <typename MType>
+    void Matrix<MType>::mul_batched(const Matrix<MType>& a, const Matrix<MType>& b, MType alpha, MType beta, MType* result, std::true_type) {
+        // 一边的batch是1时广播到另一边的每个样本上，(n, c)展开成批量GEMM的batch项，广播的一边重复同一个地址
+        unsigned long batch {std::max(a.shape[0], b.shape[0])};
+        unsigned long channels {a.shape[1]};
+        unsigned long m {a.shape[2]};
+        unsigned long k {a.shape[3]};
+        unsigned long n {b.shape[3]};
+        const MType* a_p {a.data->data()};
+        const MType* b_p {b.data->data()};
+        std::vector<const MType*> a_list;
+        std::vector<const MType*> b_list;
+        std::vector<MType*> c_list;
+        if(a.shape[0] == 1 && b.shape[0] > 1 && n == 1) {
+            // 参数广播到每个样本上、每个样本是列向量（FC）时，每个通道的整个batch合成一次(batch, k) x (k, m)的GEMM，结果正好是(batch, m)的行主序
+            // 按样本拆开的话每次只是一个矩阵向量乘，走不到打包的GEMM
+            for(unsigned long c {0}; c < channels; ++c) {
+                a_list.push_back(b_p + c * k);
+                b_list.push_back(a_p + c * m * k);
+                c_list.push_back(result + c * m);
+            }
+            kernel::gemm_batched<MType>(channels, batch, m, k, alpha, a_list.data(), channels * k, 1, b_list.data(), 1, k, beta, c_list.data(), channels * m);
+            return;
+        }
+        for(unsigned long i {0}; i < batch * channels; ++i) {
+            unsigned long c {i % channels};
+            unsigned long n_i {i / channels};
+            a_list.push_back(a_p + ((a.shape[0] == 1 ? 0 : n_i) * channels + c) * m * k);
+            b_list.push_back(b_p + ((b.shape[0] == 1 ? 0 : n_i) * channels + c) * k * n);
+            c_list.push_back(result + i * m * n);
+        }
+        kernel::gemm_batched<MType>(batch * channels, m, n, k, alpha, a_list.data(), k, 1, b_list.data(), n, 1, beta, c_list.data(), n);
+    }
+
+    template <typename MType>
+    void Matrix<MType>::mul_batched(const Matrix<MType>& a, const Matrix<MType>& b, MType alpha, MType beta, MType* result, std::false_type) {
+        unsigned long batch {std::max(a.shape[0], b.shape[0])};
+        unsigned long channels {a.shape[1]};
+        unsigned long m {a.shape[2]};
+        unsigned long k {a.shape[3]};
+        unsigned long n {b.shape[3]};
+        utils::ThreadPool::global().parallel_for(batch * channels, m * k * n, [&](unsigned long task_i) {
+            unsigned long c {task_i % channels};
+            unsigned long n_i {task_i / channels};
+            mul_core(
+                a.data->data() + ((a.shape[0] == 1 ? 0 : n_i) * channels + c) * m * k,
+                b.data->data() + ((b.shape[0] == 1 ? 0 : n_i) * channels + c) * k * n,
+                result + task_i * m * n,
+                m, k, n, alpha, beta
+            );
+        });
+    }
+
+    template <typename MType>
+    void Matrix<MType>::check_mul_shape(const Matrix<MType>& a, const Matrix<MType>& b) {
+        // GEMM按形状直接读裸指针，形状不对会读到内存外面，不能只在debug下检查
+        if(!(a.shape[0] == b.shape[0] || a.shape[0] == 1 || b.shape[0] == 1) || a.shape[1] != b.shape[1]) {
+            throw std::runtime_error("Matrix batch or channel is not match in mul");
+        }
+        if(a.shape[3] != b.shape[2]) {
+            throw std::runtime_error("Matrix shape is not match in mul");
         }
     }
 
     template <typename MType>
     Matrix<MType>& Matrix<MType>::mul(const Matrix<MType>& mutiplier) {
         check_initialized();
-        assert(shape[0] == mutiplier.shape[0] && shape[1] == mutiplier.shape[1]);
-        matrix_data_p mul_result {std::make_shared<matrix_data>()};
-        mul_result->resize(shape[0] * shape[1] * shape[2] * mutiplier.shape[3], 0);
-        matrix_dim mul_dim {shape[0], shape[1], shape[2], mutiplier.shape[3]};
-        std::vector<std::thread> thread_c;
-        for(unsigned long n {0}; n < shape[0]; ++n) {
-            ul_pos this_batch_ul {get_batch(shape, n)};
-            ul_pos m_batch_ul {get_batch(mutiplier.shape, n)};
-            for(unsigned long c {0}; c < shape[1]; ++c) {
-                ul_pos this_channel_ul {get_channel(shape, c, this_batch_ul)};
-                ul_pos m_channel_ul {get_channel(mutiplier.shape, c, m_batch_ul)};
-                matrix_dim this_dim {shape[2], shape[3]};
-                matrix_dim m_dim {mutiplier.shape[2], mutiplier.shape[3]};
-                ul_pos result_batch_ul = get_batch(mul_dim, n);
-                ul_pos result_channel_ul = get_channel(mul_dim, c, result_batch_ul);
-                // thread_c.push_back(std::thread {&Matrix<MType>::mul_core, this, std::as_const(data), this_channel_ul, this_dim, std::as_const(mutiplier.data), m_channel_ul, m_dim, mul_result, result_channel_ul});
-                thread_c.push_back(std::thread {&Matrix<MType>::mul_core, this, static_cast<const matrix_data_p>(data), this_channel_ul, this_dim, static_cast<const matrix_data_p>(mutiplier.data), m_channel_ul, m_dim, mul_result, result_channel_ul});
-            }
+        mutiplier.check_initialized();
+        check_mul_shape(*this, mutiplier);
+        using use_gemm = std::integral_constant<bool, std::is_same<MType, float>::value || std::is_same<MType, double>::value>;
+        unsigned long batch {std::max(shape[0], mutiplier.shape[0])};
+        matrix_data_p mul_result {make_data()};
+        mul_result->resize(batch * shape[1] * shape[2] * mutiplier.shape[3], 0);
+        mul_batched(*this, mutiplier, MType(1), MType(0), mul_result->data(), use_gemm {});
+        if(bound) {
+            // 绑定的内存不换，结果写回去
+            data->resize(mul_result->size(), MType(0));
+            std::copy(mul_result->begin(), mul_result->end(), data->begin());
         }
-        for(auto& t : thread_c) {
-            t.join();
+        else {
+            data = mul_result;
         }
-        data.reset();
-        data = mul_result;
-        shape = mul_dim;
+        shape = matrix_dim {batch, shape[1], shape[2], mutiplier.shape[3]};
         return *this;
     }
 
     template <typename MType>
-    Matrix<MType>& Matrix<MType>::mul_v(const Matrix<MType> &mutiplier) {
-        check_initialized();
-        if(data->size() == mutiplier.data->size()) {
-            for(unsigned long i {0}; i < shape[0]; ++i) {
-                data->at(i) *= mutiplier.data->at(i);
-            }
+    Matrix<MType>& Matrix<MType>::mul_from(const Matrix<MType>& a, const Matrix<MType>& b) {
+        a.check_initialized();
+        b.check_initialized();
+        check_mul_shape(a, b);
+        using use_gemm = std::integral_constant<bool, std::is_same<MType, float>::value || std::is_same<MType, double>::value>;
+        unsigned long batch {std::max(a.shape[0], b.shape[0])};
+        matrix_dim mul_dim {batch, a.shape[1], a.shape[2], b.shape[3]};
+        // 和a、b共用内存的话这里就换成自己的了；绑定的内存不会换，GEMM不能边读边写同一块
+        detach(false);
+        if(data == a.data || data == b.data) {
+            throw std::runtime_error("Matrix mul_from output shares memory with an operand");
         }
-        else if(data->size() % mutiplier.data->size() == 0 && this->data->size() >= mutiplier.data->size()) {
-            std::vector<std::thread> thread_c;
-            size_t max_piece = data->size() / mutiplier.data->size();
-            for(unsigned long n {0}; n < shape[0]; ++n) {
-                ul_pos this_batch_ul {get_batch(n)};
-                ul_pos addend_batch_ul {mutiplier.get_batch(n)};
-                for(unsigned long c {0}; c < shape[1]; ++c) {
-                    ul_pos this_channel_ul {get_channel(c, this_batch_ul)};
-                    ul_pos addend_channel_ul {mutiplier.get_channel(c, addend_batch_ul)};
-                    for(unsigned long piece {0}; piece < max_piece; ++piece) {
-                        thread_c.emplace_back(&Matrix<MType>::mul_v_boardcast_core, this, std::ref(*this), mutiplier, this_channel_ul, addend_channel_ul, piece);
-                    }
-                }
-            }
-            for(auto& t : thread_c) {
-                t.join();
-            }
+        resize(mul_dim, 0);
+        mul_batched(a, b, MType(1), MType(0), data->data(), use_gemm {});
+        return *this;
+    }
+
+    template <typename MType>
+    Matrix<MType>& Matrix<MType>::mul_acc(const Matrix<MType>& a, const Matrix<MType>& b, MType alpha, MType beta) {
+        a.check_initialized();
+        b.check_initialized();
+        check_mul_shape(a, b);
+        using use_gemm = std::integral_constant<bool, std::is_same<MType, float>::value || std::is_same<MType, double>::value>;
+        matrix_dim mul_dim {std::max(a.shape[0], b.shape[0]), a.shape[1], a.shape[2], b.shape[3]};
+        if(beta == MType(0)) {
+            detach(false);
+            resize(mul_dim, 0);
         }
-        else if(mutiplier.data->size() % data->size() == 0 && mutiplier.data->size() >= this->data->size()) {
-            Matrix<MType> bigger_one {mutiplier};
-            std::vector<std::thread> thread_c;
-            size_t max_piece = data->size() / mutiplier.data->size();
-            for(unsigned long n {0}; n < shape[0]; ++n) {
-                ul_pos this_batch_ul {get_batch(n)};
-                ul_pos addend_batch_ul {mutiplier.get_batch(n)};
-                for(unsigned long c {0}; c < shape[1]; ++c) {
-                    ul_pos this_channel_ul {get_channel(c, this_batch_ul)};
-                    ul_pos addend_channel_ul {mutiplier.get_channel(c, addend_batch_ul)};
-                    for(unsigned long piece {0}; piece < max_piece; ++piece) {
-                        thread_c.emplace_back(&Matrix<MType>::mul_v_boardcast_core, this, std::ref(bigger_one), *this, this_channel_ul, addend_channel_ul, piece);
-                    }
-                }
-            }
-            for(auto& t : thread_c) {
-                t.join();
+        else {
+            // 累加的目标必须已经是乘积的尺寸，不做广播
+            check_initialized();
+            if(shape != mul_dim) {
+                throw std::runtime_error("Matrix shape is not match the product in mul_acc");
             }
-            data = bigger_one.data;
-            shape = bigger_one.shape;
+            detach();
         }
-        else {
-            throw std::runtime_error("Matrix shape is not match");
+        if(data == a.data || data == b.data) {
+            throw std::runtime_error("Matrix mul_acc output shares memory with an operand");
         }
+        mul_batched(a, b, alpha, beta, data->data(), use_gemm {});
         return *this;
     }
 
     template <typename MType>
-    void Matrix<MType>::mul_v_boardcast_core(Matrix<MType>& multiplied, const Matrix<MType>& mutiplier, ul_pos channel_ul, ul_pos m_channel_ul, int piece) {
-        assert(multiplied.data->size() > mutiplier.data->size());
-        assert(multiplied.data->size() % mutiplier.data->size() == 0);
-        size_t max_piece = multiplied.data->size() / mutiplier.data->size();
-        assert(piece < max_piece);
-        matrix_dim mutiplier_dim {mutiplier.get_dim()};
-        assert(multiplied.shape[2] % mutiplier_dim[2] == 0);
-        assert(multiplied.shape[3] % mutiplier_dim[3] == 0);
-        unsigned long piece_w, piece_x, piece_y;
-        piece_w = multiplied.shape[3] / mutiplier_dim[3];
-        piece_x = piece % piece_w; //x is w
-        piece_y = piece / piece_w; // y is h
-        for(unsigned long addend_h {0}; addend_h < mutiplier_dim[2]; ++addend_h) {
-            for(unsigned long addend_w {0}; addend_w < mutiplier_dim[3]; ++addend_w) {
-                multiplied.data->at(channel_ul.first + (piece_y * mutiplier_dim[2] + addend_h) * multiplied.shape[2] + piece_x * mutiplier_dim[3] + addend_w) *= mutiplier.data->at(m_channel_ul.first + addend_h * mutiplier_dim[2] + addend_w);
-            }
-        }
+    Matrix<MType>& Matrix<MType>::axpy(MType alpha, const Matrix<MType>& x) {
+        check_initialized();
+        x.check_initialized();
+        broadcast_inplace(x, kernel::BroadcastAxpy<MType> {alpha});
+        return *this;
+    }
+
+    template <typename MType>
+    Matrix<MType>& Matrix<MType>::mul_v(const Matrix<MType> &mutiplier) {
+        broadcast_inplace(mutiplier, kernel::BroadcastMul<MType> {});
+        return *this;
     }
 
     template <typename MType>
     void Matrix<MType>::clear_data() {
         uninitialized = true;
-        data->resize(0, 0);
+        if(data.use_count() > 1) {
+            // 别的Matrix还在用（包括绑定的槽位），换一块空的，不动它们的数据
+            data = make_data(0, MType(0));
+            bound = false;
+        }
+        else {
+            data->resize(0, 0);
+        }
         shape = matrix_dim {0,0,0,0};
     }
 
@@ -539,6 +659,7 @@ namespace aedlf {
             return;
         }
         this->data = data;
+        bound = false;
         uninitialized = false;
     }
 
@@ -549,6 +670,7 @@ namespace aedlf {
         if(this->shape == shape) {
             return;
         }
+        detach();
         this->shape = shape;
         data->resize(shape[0] * shape[1] * shape[2] * shape[3], fill_with);
         uninitialized = false;
@@ -584,7 +706,7 @@ namespace aedlf {
     template <typename MType>
     Matrix<MType> Matrix<MType>::sum_by_dim(unsigned long sum_dim) {
         check_initialized();
-        if(sum_dim == -1) {
+        if(sum_dim == static_cast<unsigned long>(-1)) {
             matrix_dim new_shape {1,1,1,1};
             MType sum_num {0};
             for(size_t i {0}; i < data->size(); ++i) {
@@ -649,48 +771,20 @@ namespace aedlf {
 
     template <typename MType>
     void Matrix<MType>::T() {
+        // 只读的场合用MatrixView::T，不拷贝
         check_initialized();
-        std::vector<std::thread> thread_c;
-        for(unsigned long n {0}; n < shape[0]; ++n) {
-            ul_pos batch_ul {get_batch(n)};
-            for(unsigned long c{0}; c < shape[1]; ++c) {
-                ul_pos channel_ul {get_channel(c, batch_ul)};
-                thread_c.emplace_back(&Matrix<MType>::T_core, this, channel_ul);
-            }
+        unsigned long hxw {shape[2] * shape[3]};
+        matrix_data_p transposed {make_data(data->size(), MType(0))};
+        utils::ThreadPool::global().parallel_for(shape[0] * shape[1], hxw, [&](unsigned long task_i) {
+            kernel::transpose(shape[2], shape[3], data->data() + task_i * hxw, shape[3], transposed->data() + task_i * hxw);
+        });
+        if(bound) {
+            std::copy(transposed->begin(), transposed->end(), data->begin());
         }
-        for(auto& t : thread_c) {
-            t.join();
-        }
-        resize(shape[0], shape[1], shape[3], shape[2], MType(0));
-    }
-
-    template <typename MType>
-    void Matrix<MType>::T_core(ul_pos channel_ul) {
-        // 这里转置转换的位置关系是：index -> (index * h) % (len - 1)，有环，需要思考怎么o(1)空间处理环
-        unsigned long m_len {shape[2] * shape[3]};
-        for(unsigned long i {0}; i < m_len; ++i) {
-            unsigned long next_index = T_core_get_next(i, shape[2], m_len);
-            while(i < next_index) {
-                next_index = T_core_get_next(next_index, shape[2], m_len);
-            }
-            if(i == next_index) {               
-                unsigned long next = T_core_get_next(i, shape[2], m_len);
-                MType pre = data->at(channel_ul.first + i);
-                MType temp;
-                while(i != next) {
-                    temp = data->at(channel_ul.first + next);
-                    data->at(channel_ul.first + next) = pre;
-                    pre = temp;
-                    next = T_core_get_next(next, shape[2], m_len);
-                }
-                data->at(channel_ul.first + next) = pre;
-            }
+        else {
+            data = transposed;
         }
-    }
-
-    template <typename MType>
-    unsigned long Matrix<MType>::T_core_get_next(unsigned long now_index, unsigned long m_h, unsigned long m_len) {
-        return (now_index * m_h) % (m_len - 1);
+        std::swap(shape[2], shape[3]);
     }
 
     template <typename MType>
@@ -701,107 +795,36 @@ namespace aedlf {
     template <typename MType>
     void Matrix<MType>::concat(Matrix<MType> &m, unsigned long dim) {
         check_initialized();
-        assert(dim > 0 && dim <= 3);
+        m.check_initialized();
+        if(dim == 0 || dim > 3) {
+            throw std::runtime_error("Matrix concat dim must be 1, 2 or 3");
+        }
+        for(unsigned long i {0}; i < 4; ++i) {
+            if(i != dim && shape[i] != m.shape[i]) {
+                throw std::runtime_error("Matrix shape is not match in concat");
+            }
+        }
         matrix_dim result_dim {shape};
         result_dim[dim] += m.shape[dim];
         Matrix<MType> result {result_dim, 0};
-        std::vector<std::thread> thread_c;
-        for(unsigned long n {0}; n < shape[0]; ++n) {
-            thread_c.emplace_back(&Matrix<MType>::concat_core, this, std::ref(m), std::ref(result), dim, n);
-        }
-        for(auto& t : thread_c) {
-            t.join();
-        }
+        // 两部分按视图整行写进结果，不再逐个元素get/set
+        MatrixView<MType> result_view {result};
+        result_view.slice(dim, 0, shape[dim]).assign(MatrixView<MType> {*this});
+        result_view.slice(dim, shape[dim], result_dim[dim]).assign(MatrixView<MType> {m});
         this->copy_from(result);
     }
 
-    template <typename MType>
-    void Matrix<MType>::concat_core(Matrix<MType>& m, Matrix<MType>& result, unsigned long dim, unsigned long batch_id) {
-        if(dim == 1) {
-            assert(this->shape[0] == m.shape[0]);
-            assert(this->shape[2] == m.shape[2]);
-            assert(this->shape[3] == m.shape[3]);
-            matrix_dim result_dim {result.shape};
-            for(unsigned long inner_c {0}; inner_c < shape[1]; ++inner_c) {
-                for(unsigned long h {0}; h < shape[2]; ++h) {
-                    for(unsigned long w {0}; w < shape[3]; ++w) {
-                        result.set(batch_id, inner_c, h, w, this->get(batch_id, inner_c, h, w));
-                    }
-                }
-            }
-            for(unsigned long inner_c {0}; inner_c < m.shape[1]; ++inner_c) {
-                for(unsigned long h {0}; h < shape[2]; ++h) {
-                    for(unsigned long w {0}; w < shape[3]; ++w) {
-                        result.set(batch_id, inner_c + shape[1], h, w, m.get(batch_id, inner_c, h, w));
-                    }
-                }
-            }
-        }
-        else if(dim == 2) {
-            assert(this->shape[0] == m.shape[0]);
-            assert(this->shape[1] == m.shape[1]);
-            assert(this->shape[3] == m.shape[3]);
-            matrix_dim result_dim {result.shape};
-            for(unsigned long c {0}; c < shape[1]; ++c) {
-                for(unsigned long inner_h {0}; inner_h < shape[2]; ++inner_h) {
-                    for(unsigned long w {0}; w < shape[3]; ++w) {
-                        result.set(batch_id, c, inner_h, w, this->get(batch_id, c, inner_h, w));
-                    }
-                }
-                for(unsigned long inner_h {0}; inner_h < m.shape[2]; ++inner_h) {
-                    for(unsigned long w {0}; w < shape[3]; ++w) {
-                        result.set(batch_id, c, inner_h + shape[2], w, m.get(batch_id, c, inner_h, w));
-                    }
-                }
-            }
-        }
-        else if(dim == 3) {
-            assert(this->shape[0] == m.shape[0]);
-            assert(this->shape[1] == m.shape[1]);
-            assert(this->shape[2] == m.shape[2]);
-            matrix_dim result_dim {result.shape};
-            for(unsigned long c {0}; c < shape[1]; ++c) {
-                for(unsigned long h {0}; h < shape[2]; ++h) {
-                    for(unsigned long inner_w {0}; inner_w < shape[3]; ++inner_w) {
-                        result.set(batch_id, c, h, inner_w, this->get(batch_id, c, h, inner_w));
-                    }
-                    for(unsigned long inner_w {0}; inner_w < m.shape[3]; ++inner_w) {
-                        result.set(batch_id, c, h, inner_w + shape[3], m.get(batch_id, c, h, inner_w));
-                    }
-                }
-            }
-        }
-    }
-
     template <typename MType>
     Matrix<MType> Matrix<MType>::slice(unsigned long slice_dim, unsigned long start, unsigned long end) {
         check_initialized();
-        slice_parma sr_dim {0,0,0,0,0,0,0,0};
-        sr_dim[slice_dim * 2] = start;
-        sr_dim[slice_dim * 2 + 1] = end;
-        for(size_t i {0}; i < 8; i+=2) {
-            if(i == slice_dim) {
-                continue;
-            }
-            sr_dim[i * 2 + 1] = shape[i / 2];
-        }
-        return slice(sr_dim);
+        return MatrixView<MType> {*this}.slice(slice_dim, start, end).copy();
     }
 
     template <typename MType>
     Matrix<MType> Matrix<MType>::slice(unsigned long slice_dim, std::initializer_list<unsigned long> range) {
         check_initialized();
         assert(range.size() == 2);
-        slice_parma sr_dim {0,0,0,0,0,0,0,0};
-        sr_dim[slice_dim * 2] = *range.begin();
-        sr_dim[slice_dim * 2 + 1] = *(range.begin() + 1);
-        for(size_t i {0}; i < 8; i+=2) {
-            if(i / 2 == slice_dim) {
-                continue;
-            }
-            sr_dim[i + 1] = shape[i / 2];
-        }
-        return slice(sr_dim);
+        return slice(slice_dim, *range.begin(), *(range.begin() + 1));
     }
 
     template <typename MType>
@@ -813,34 +836,8 @@ namespace aedlf {
     Matrix<MType> Matrix<MType>::slice(slice_parma slice_index) {
         check_initialized();
         // slice_index {n[start], n[end], c[start], c[end], h[start], h[end], w[start], w[end]}
-        assert(slice_index.size() == 8);
-        for(size_t slice_i {0}; slice_i < slice_index.size(); ++slice_i) {
-            if(slice_index[slice_i] < 0) {
-                slice_index[slice_i] += shape[slice_i / 2];
-            }
-            if(slice_index[slice_i] > shape[slice_i / 2]) {
-                throw std::runtime_error("Slice index out of range");
-            }
-        }
-        matrix_dim sr_dim {0,0,0,0};
-        for(size_t slice_i {0}; slice_i < slice_index.size(); slice_i+=2) {
-            if(slice_index[slice_i + 1] < slice_index[slice_i]) {
-                throw std::runtime_error("Slice range invalid");
-            }
-            sr_dim[slice_i / 2] = slice_index[slice_i + 1] - slice_index[slice_i];
-        }
-        Matrix<MType> slice_result {sr_dim, 0};
-        int sw_index {0};
-        for(unsigned long n {slice_index[0]}; n < slice_index[1]; ++n) {
-            for(unsigned long c {slice_index[2]}; c < slice_index[3]; ++c) {
-                for(unsigned long h {slice_index[4]}; h < slice_index[5]; ++h) {
-                    for(unsigned long w {slice_index[6]}; w < slice_index[7]; ++w) {
-                        slice_result.set(sw_index++, this->get(n, c, h, w));
-                    }
-                }
-            }
-        }
-        return slice_result;
+        // 返回的是拷贝，不想拷贝的话直接用MatrixView::slice
+        return MatrixView<MType> {*this}.slice(slice_index).copy();
     }
 
     template <typename MType>
@@ -850,12 +847,11 @@ namespace aedlf {
         }
     }
 
-    // 后面两个函数存在bug，实际上并不能阻止修改shared_ptr的内容, 要用const T&修改
+    // get_data实际上并不能阻止修改shared_ptr的内容，要写数据用mutable_data
     template <typename MType>
-    const typename Matrix<MType>::matrix_data_p Matrix<MType>::get_data() const {
+    const typename Matrix<MType>::matrix_data_p& Matrix<MType>::get_data() const {
         check_initialized();
-        // return std::as_const(data);
-        return static_cast<const matrix_data_p>(data);
+        return data;
     }
 
     template <typename MType>
@@ -866,8 +862,29 @@ namespace aedlf {
     }
 
     template <typename MType>
-    typename Matrix<MType>::matrix_data_p Matrix<MType>::get_m_data() {
+    MType* Matrix<MType>::mutable_data() {
         check_initialized();
-        return data;
+        detach();
+        return data->data();
     }
-};
\ No newline at end of file
+
+    template <typename MType>
+    bool Matrix<MType>::is_shared() const {
+        return !bound && data.use_count() > 1;
+    }
+
+    template <typename MType>
+    void Matrix<MType>::detach(bool keep_data) {
+        if(!is_shared()) {
+            return;
+        }
+        if(keep_data) {
+            data = make_data(data->begin(), data->end());
+        }
+        else {
+            data = make_data(data->size(), MType(0));
+        }
+    }
+};
+
+#include "view.hpp"
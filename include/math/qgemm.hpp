@@ -0,0 +1,310 @@
+#pragma once
+#include "cpu.hpp"
+#include "elementwise.hpp"
+#include "../utils/allocator.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+
+namespace aedlf {
+    namespace kernel {
+        /*
+        int8推理用的量化和GEMM，C(m, n) = A(m, k) * B(k, n)，A是int8的权重，B是uint8的激活值，C是int32
+        权重按输出通道（A的每一行）对称量化到[-127, 127]，激活值非对称量化到[0, 127]
+        激活值只用7位：AVX2的maddubs把两对u8 x s8的乘积加成int16，8位激活值会饱和，7位时最大是2 * 127 * 128 = 32512
+        这样VNNI、AVX2和标量实现的结果完全一致
+        A在量化时打包一次：行数补到MR的倍数，每行的k补到4的倍数；B每次调用时打包成NR列一组、每列连续4个k的条带
+        */
+        struct QuantParam {
+            float scale {1};
+            int32_t zero_point {0};
+        };
+
+        const int32_t quant_u8_max {127};
+        const int32_t quant_s8_max {127};
+
+        struct QGemmBlock {
+            static const unsigned long MR {4};
+            static const unsigned long NR {16};
+        };
+
+        inline unsigned long qgemm_k4(unsigned long k) {
+            return (k + 3) / 4 * 4;
+        }
+
+        inline unsigned long qgemm_packed_rows(unsigned long m) {
+            return (m + QGemmBlock::MR - 1) / QGemmBlock::MR * QGemmBlock::MR;
+        }
+
+        // 覆盖[min, max]的量化参数，0必须能精确表示（填充和ReLU之后的0很多）
+        inline QuantParam choose_quant_param(float min, float max) {
+            min = std::min(min, 0.0f);
+            max = std::max(max, 0.0f);
+            QuantParam param {};
+            param.scale = (max - min) / float(quant_u8_max);
+            if(!(param.scale > 0)) {
+                param.scale = 1;
+            }
+            long zero_point {std::lround(-min / param.scale)};
+            param.zero_point = int32_t(std::min(std::max(zero_point, 0l), long(quant_u8_max)));
+            return param;
+        }
+
+        // 先截到[0, quant_u8_max]再加0.5取整，不调用lround，循环可以向量化；nan变成0
+        inline uint8_t round_u8(float q) {
+            q = q > 0.0f ? q : 0.0f;
+            q = q < float(quant_u8_max) ? q : float(quant_u8_max);
+            return uint8_t(q + 0.5f);
+        }
+
+        inline uint8_t quantize_u8(float x, const QuantParam& param) {
+            return round_u8(x / param.scale + float(param.zero_point));
+        }
+
+        template <typename MType>
+        void quantize_u8(unsigned long n, const MType* x, const QuantParam& param, uint8_t* y) {
+            for(unsigned long i {0}; i < n; ++i) {
+                y[i] = quantize_u8(float(x[i]), param);
+            }
+        }
+
+        template <typename MType>
+        void dequantize_u8(unsigned long n, const uint8_t* x, const QuantParam& param, MType* y) {
+            for(unsigned long i {0}; i < n; ++i) {
+                y[i] = MType(param.scale * float(int32_t(x[i]) - param.zero_point));
+            }
+        }
+
+        // 按行对称量化并打包成qgemm的A，scale[i]是第i行的scale，row_sum[i]是量化后第i行的和（用来扣掉激活值的零点）
+        template <typename MType>
+        void quantize_pack_a(unsigned long m, unsigned long k, const MType* a, unsigned long lda, int8_t* packed, float* scale, int32_t* row_sum) {
+            unsigned long k4 {qgemm_k4(k)};
+            std::fill(packed, packed + qgemm_packed_rows(m) * k4, int8_t(0));
+            for(unsigned long i {0}; i < m; ++i) {
+                const MType* a_row {a + i * lda};
+                float max_abs {0};
+                for(unsigned long p {0}; p < k; ++p) {
+                    max_abs = std::max(max_abs, std::fabs(float(a_row[p])));
+                }
+                scale[i] = max_abs > 0 ? max_abs / float(quant_s8_max) : 1.0f;
+                row_sum[i] = 0;
+                for(unsigned long p {0}; p < k; ++p) {
+                    long q {std::lround(float(a_row[p]) / scale[i])};
+                    q = std::min(std::max(q, long(-quant_s8_max)), long(quant_s8_max));
+                    packed[i * k4 + p] = int8_t(q);
+                    row_sum[i] += int32_t(q);
+                }
+            }
+        }
+
+#if AEDLF_X86_SIMD
+        namespace sse2 {
+            // 行连续时4行x16列一起转置：两次unpack把4个k交错到每一列上
+            inline void qgemm_pack_b_quad(const uint8_t* b, unsigned long rs_b, uint8_t* packed) {
+                __m128i r0 {_mm_loadu_si128(reinterpret_cast<const __m128i*>(b))};
+                __m128i r1 {_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + rs_b))};
+                __m128i r2 {_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + 2 * rs_b))};
+                __m128i r3 {_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + 3 * rs_b))};
+                __m128i t0 {_mm_unpacklo_epi8(r0, r1)};
+                __m128i t1 {_mm_unpackhi_epi8(r0, r1)};
+                __m128i t2 {_mm_unpacklo_epi8(r2, r3)};
+                __m128i t3 {_mm_unpackhi_epi8(r2, r3)};
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(packed), _mm_unpacklo_epi16(t0, t2));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(packed + 16), _mm_unpackhi_epi16(t0, t2));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(packed + 32), _mm_unpacklo_epi16(t1, t3));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(packed + 48), _mm_unpackhi_epi16(t1, t3));
+            }
+        }
+#endif
+
+        // B(k, n)按行跨度rs和列跨度cs读取，打包成(n / NR)个条带，每个条带是(k4 / 4, NR, 4)，补出来的位置是0
+        inline void qgemm_pack_b(unsigned long k, unsigned long n, const uint8_t* b, unsigned long rs_b, unsigned long cs_b, uint8_t* packed) {
+            const unsigned long NR {QGemmBlock::NR};
+            unsigned long k4 {qgemm_k4(k)};
+            for(unsigned long j {0}; j < n; j += NR) {
+                unsigned long cols {std::min(NR, n - j)};
+                for(unsigned long p {0}; p < k4; p += 4) {
+#if AEDLF_X86_SIMD
+                    if(cs_b == 1 && cols == NR && p + 4 <= k) {
+                        sse2::qgemm_pack_b_quad(b + p * rs_b + j, rs_b, packed);
+                        packed += NR * 4;
+                        continue;
+                    }
+#endif
+                    for(unsigned long r {0}; r < NR; ++r) {
+                        for(unsigned long q {0}; q < 4; ++q) {
+                            bool inside {r < cols && p + q < k};
+                            packed[r * 4 + q] = inside ? b[(p + q) * rs_b + (j + r) * cs_b] : uint8_t(0);
+                        }
+                    }
+                    packed += NR * 4;
+                }
+            }
+        }
+
+        using qgemm_micro_func = void (*)(unsigned long k4, const int8_t* a, const uint8_t* b_panel, int32_t* c, unsigned long ldc, unsigned long rows, unsigned long cols);
+
+        inline void qgemm_store_tile(const int32_t* tile, int32_t* c, unsigned long ldc, unsigned long rows, unsigned long cols) {
+            for(unsigned long i {0}; i < rows; ++i) {
+                std::copy(tile + i * QGemmBlock::NR, tile + i * QGemmBlock::NR + cols, c + i * ldc);
+            }
+        }
+
+        namespace scalar {
+            inline void qgemm_micro_kernel(unsigned long k4, const int8_t* a, const uint8_t* b_panel, int32_t* c, unsigned long ldc, unsigned long rows, unsigned long cols) {
+                const unsigned long MR {QGemmBlock::MR};
+                const unsigned long NR {QGemmBlock::NR};
+                int32_t acc[MR * NR];
+                std::fill(acc, acc + MR * NR, 0);
+                for(unsigned long p {0}; p < k4; p += 4) {
+                    const uint8_t* b_p {b_panel + p * NR};
+                    for(unsigned long i {0}; i < MR; ++i) {
+                        const int8_t* a_p {a + i * k4 + p};
+                        for(unsigned long j {0}; j < NR; ++j) {
+                            acc[i * NR + j] += int32_t(b_p[j * 4]) * a_p[0] + int32_t(b_p[j * 4 + 1]) * a_p[1] + int32_t(b_p[j * 4 + 2]) * a_p[2] + int32_t(b_p[j * 4 + 3]) * a_p[3];
+                        }
+                    }
+                }
+                qgemm_store_tile(acc, c, ldc, rows, cols);
+            }
+        }
+
+#if AEDLF_X86_SIMD
+#pragma GCC push_options
+#pragma GCC target("avx2")
+        namespace avx2 {
+            // 每行两个ymm累加器，maddubs得到相邻两个k的int16和，再和1做madd加成4个k的int32和
+            inline void qgemm_micro_kernel(unsigned long k4, const int8_t* a, const uint8_t* b_panel, int32_t* c, unsigned long ldc, unsigned long rows, unsigned long cols) {
+                const unsigned long MR {QGemmBlock::MR};
+                const unsigned long NR {QGemmBlock::NR};
+                const __m256i ones {_mm256_set1_epi16(1)};
+                __m256i acc[MR][2];
+                for(unsigned long i {0}; i < MR; ++i) {
+                    acc[i][0] = _mm256_setzero_si256();
+                    acc[i][1] = _mm256_setzero_si256();
+                }
+                for(unsigned long p {0}; p < k4; p += 4) {
+                    const uint8_t* b_p {b_panel + p * NR};
+                    __m256i b0 {_mm256_loadu_si256(reinterpret_cast<const __m256i*>(b_p))};
+                    __m256i b1 {_mm256_loadu_si256(reinterpret_cast<const __m256i*>(b_p + 32))};
+                    for(unsigned long i {0}; i < MR; ++i) {
+                        int32_t a_quad {0};
+                        std::memcpy(&a_quad, a + i * k4 + p, sizeof(a_quad));
+                        __m256i a_ip {_mm256_set1_epi32(a_quad)};
+                        acc[i][0] = _mm256_add_epi32(acc[i][0], _mm256_madd_epi16(_mm256_maddubs_epi16(b0, a_ip), ones));
+                        acc[i][1] = _mm256_add_epi32(acc[i][1], _mm256_madd_epi16(_mm256_maddubs_epi16(b1, a_ip), ones));
+                    }
+                }
+                int32_t tile[MR * NR];
+                for(unsigned long i {0}; i < MR; ++i) {
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(tile + i * NR), acc[i][0]);
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(tile + i * NR + 8), acc[i][1]);
+                }
+                qgemm_store_tile(tile, c, ldc, rows, cols);
+            }
+        }
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2,avx512f,avx512vl,avx512vnni")
+        namespace vnni {
+            // vpdpbusd一条指令完成u8 x s8的4路点积并累加到int32，没有中间的int16
+            inline void qgemm_micro_kernel(unsigned long k4, const int8_t* a, const uint8_t* b_panel, int32_t* c, unsigned long ldc, unsigned long rows, unsigned long cols) {
+                const unsigned long MR {QGemmBlock::MR};
+                const unsigned long NR {QGemmBlock::NR};
+                __m256i acc[MR][2];
+                for(unsigned long i {0}; i < MR; ++i) {
+                    acc[i][0] = _mm256_setzero_si256();
+                    acc[i][1] = _mm256_setzero_si256();
+                }
+                for(unsigned long p {0}; p < k4; p += 4) {
+                    const uint8_t* b_p {b_panel + p * NR};
+                    __m256i b0 {_mm256_loadu_si256(reinterpret_cast<const __m256i*>(b_p))};
+                    __m256i b1 {_mm256_loadu_si256(reinterpret_cast<const __m256i*>(b_p + 32))};
+                    for(unsigned long i {0}; i < MR; ++i) {
+                        int32_t a_quad {0};
+                        std::memcpy(&a_quad, a + i * k4 + p, sizeof(a_quad));
+                        __m256i a_ip {_mm256_set1_epi32(a_quad)};
+                        acc[i][0] = _mm256_dpbusd_epi32(acc[i][0], b0, a_ip);
+                        acc[i][1] = _mm256_dpbusd_epi32(acc[i][1], b1, a_ip);
+                    }
+                }
+                int32_t tile[MR * NR];
+                for(unsigned long i {0}; i < MR; ++i) {
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(tile + i * NR), acc[i][0]);
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(tile + i * NR + 8), acc[i][1]);
+                }
+                qgemm_store_tile(tile, c, ldc, rows, cols);
+            }
+        }
+#pragma GCC pop_options
+#endif
+
+        inline qgemm_micro_func select_qgemm_micro_kernel() {
+#if AEDLF_X86_SIMD
+            SimdLevel level {simd_level()};
+            if(level >= SimdLevel::avx512 && __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx512vnni")) {
+                return &vnni::qgemm_micro_kernel;
+            }
+            if(level >= SimdLevel::avx2) {
+                return &avx2::qgemm_micro_kernel;
+            }
+#endif
+            return &scalar::qgemm_micro_kernel;
+        }
+
+        inline qgemm_micro_func qgemm_micro() {
+            static const qgemm_micro_func f {select_qgemm_micro_kernel()};
+            return f;
+        }
+
+        // C(m, n) = A * B，A是quantize_pack_a打包好的权重，B按跨度读取
+        inline void qgemm(unsigned long m, unsigned long n, unsigned long k, const int8_t* a_packed, const uint8_t* b, unsigned long rs_b, unsigned long cs_b, int32_t* c, unsigned long ldc) {
+            if(m == 0 || n == 0) {
+                return;
+            }
+            const unsigned long MR {QGemmBlock::MR};
+            const unsigned long NR {QGemmBlock::NR};
+            unsigned long k4 {qgemm_k4(k)};
+            const qgemm_micro_func micro_kernel {qgemm_micro()};
+            static thread_local std::vector<uint8_t, utils::Allocator<uint8_t>> b_buffer {utils::Allocator<uint8_t> {utils::default_resource()}};
+            b_buffer.resize((n + NR - 1) / NR * NR * k4);
+            qgemm_pack_b(k, n, b, rs_b, cs_b, b_buffer.data());
+            for(unsigned long jr {0}; jr < n; jr += NR) {
+                for(unsigned long ir {0}; ir < m; ir += MR) {
+                    micro_kernel(k4, a_packed + ir * k4, b_buffer.data() + jr * k4, c + ir * ldc + jr, ldc, std::min(MR, m - ir), std::min(NR, n - jr));
+                }
+            }
+        }
+
+        /*
+        把int32结果换回实数：real(i, j) = (c(i, j) - row_offset[i]) * row_scale[i] + bias(i, j)
+        row_offset是激活值零点乘权重行和，row_scale是权重scale乘激活值scale，bias按跨度读取（FC的bias列跨度是0）
+        */
+        template <typename MType>
+        void qgemm_dequantize(unsigned long m, unsigned long n, const int32_t* c, unsigned long ldc, const int32_t* row_offset, const float* row_scale, const MType* bias, unsigned long rs_bias, unsigned long cs_bias, MType* y, unsigned long rs_y, unsigned long cs_y) {
+            for(unsigned long i {0}; i < m; ++i) {
+                for(unsigned long j {0}; j < n; ++j) {
+                    float real {float(c[i * ldc + j] - row_offset[i]) * row_scale[i] + float(bias[i * rs_bias + j * cs_bias])};
+                    y[i * rs_y + j * cs_y] = MType(real);
+                }
+            }
+        }
+
+        // 和qgemm_dequantize一样，但直接量化成下一层的输入，不经过实数张量
+        template <typename MType>
+        void qgemm_requantize(unsigned long m, unsigned long n, const int32_t* c, unsigned long ldc, const int32_t* row_offset, const float* row_scale, const MType* bias, unsigned long rs_bias, unsigned long cs_bias, const QuantParam& out_param, uint8_t* y, unsigned long rs_y, unsigned long cs_y) {
+            float inv_scale {1.0f / out_param.scale};
+            for(unsigned long i {0}; i < m; ++i) {
+                float multiplier {row_scale[i] * inv_scale};
+                for(unsigned long j {0}; j < n; ++j) {
+                    float q {float(c[i * ldc + j] - row_offset[i]) * multiplier + float(bias[i * rs_bias + j * cs_bias]) * inv_scale};
+                    y[i * rs_y + j * cs_y] = round_u8(q + float(out_param.zero_point));
+                }
+            }
+        }
+    }
+}
@@ -1,14 +1,16 @@
 #pragma once
 #include "matrix.hpp"
+#include "gemm.hpp"
 #include <cmath>
 #include <cstddef>
 #include <memory>
-#include <pthread.h>
+#include <stdexcept>
 #include <vector>
+#include <algorithm>
 #include <utility>
 #include <random>
-#include <thread>
 #include <initializer_list>
+#include "../utils/thread_pool.hpp"
 
 
 namespace aedlf {
@@ -16,7 +18,7 @@ namespace aedlf {
         template <typename MType>
         class MakeMatrix {
             public:
-                using matrix_data_p = std::shared_ptr<std::vector<MType>>;
+                using matrix_data_p = typename Matrix<MType>::matrix_data_p;
                 using matrix_dim = std::vector<unsigned long>;
                 using kernel_shape = std::vector<unsigned long>;
                 using ul_pos = const std::pair<int, int>;
@@ -27,7 +29,7 @@ namespace aedlf {
                 void xavier(Matrix<MType>& m);
                 void kaiming(Matrix<MType>& m);
                 void diagonal(Matrix<MType>& m, MType fill_with);
-                void diagonal(Matrix<MType>& m, const Matrix<MType>& fill_with);
+                void diagonal(Matrix<MType>& m, const MatrixView<MType>& fill_with); // fill_with可以是转置过的视图
                 void special_jacobi(Matrix<MType>& m, const Matrix<MType>& s_jacobi_fw, unsigned long jacobi_k);
                 void zeros(Matrix<MType>& m);
                 void ones(Matrix<MType>& m);
@@ -44,15 +46,21 @@ namespace aedlf {
                 void col2img(Matrix<MType>& m, Matrix<MType>& fw, unsigned long kernel_size, unsigned long stride, matrix_dim fw_dim);
                 void col2img(Matrix<MType>& m, Matrix<MType>& fw, kernel_shape kernel_size, unsigned long stride, matrix_dim fw_dim);
                 void col2img(Matrix<MType>& m, Matrix<MType>& fw, std::initializer_list<unsigned long> kernel_size, unsigned long stride, matrix_dim fw_dim);
+                // 下面三个乘法都是result = alpha * 乘积 + beta * result，beta是0时重新分配result，否则result必须已经是结果的尺寸
+                void mul_bt(const Matrix<MType>& a, const Matrix<MType>& b, Matrix<MType>& result, MType alpha = MType(1), MType beta = MType(0)); // a * b^T，逐通道，batch是1的一边广播
+                void mul_at(const Matrix<MType>& a, const Matrix<MType>& b, Matrix<MType>& result, MType alpha = MType(1), MType beta = MType(0)); // a^T * b，逐通道，batch是1的一边广播
+                void mul_bt_sum(const Matrix<MType>& a, const Matrix<MType>& b, Matrix<MType>& result, MType alpha = MType(1), MType beta = MType(0)); // (1, c, m, k) = sum_n a_n * b_n^T，广播参数的梯度
+                void sum_batch(const Matrix<MType>& m, Matrix<MType>& result); // (n, c, h, w)按batch加起来得到(1, c, h, w)
                 void modify_dim(matrix_dim new_dim);
                 void modify_dim(std::initializer_list<unsigned long> new_dim);
             private:
-                void diagonal_core(Matrix<MType>& m, ul_pos m_channel_ul, const Matrix<MType>& fill_with, ul_pos fw_channel_ul, unsigned long h, unsigned long w);
+                void diagonal_core(Matrix<MType>& m, ul_pos m_channel_ul, const MatrixView<MType>& fill_with, unsigned long n, unsigned long c, unsigned long h, unsigned long w);
                 void special_jacobi_core(Matrix<MType>& m, ul_pos m_channel_ul, const Matrix<MType>& sjb, ul_pos fw_channel_ul, unsigned long jacobi_k);
                 void add_padding_core(Matrix<MType>& m, Matrix<MType>& result, kernel_shape padding, ul_pos m_channel_ul, ul_pos fw_channel_ul);
                 void sub_padding_core(Matrix<MType>& m, Matrix<MType>& result, kernel_shape padding, ul_pos m_channel_ul, ul_pos fw_channel_ul);
                 void img2col_core(Matrix<MType>& m, Matrix<MType>& fw, ul_pos m_channel_ul, ul_pos fw_channel_ul, kernel_shape kernel_size, unsigned long stride, unsigned long output_h, unsigned long output_w);
                 void col2img_core(Matrix<MType>& m, Matrix<MType>& fw, ul_pos m_channel_ul, ul_pos fw_channel_ul, kernel_shape kernel_size, unsigned long stride, unsigned long output_h, unsigned long output_w);
+                void prepare_result(Matrix<MType>& result, matrix_dim dim, MType beta);
                 matrix_dim m_dim;
         };
 
@@ -70,11 +78,12 @@ namespace aedlf {
         void MakeMatrix<MType>::gaussian(Matrix<MType>& m) {
             std::random_device gauss_rd {};
             std::mt19937 gauss_gen {gauss_rd()};
-            std::normal_distribution<MType> gauss_d {0, 0.2};
+            std::normal_distribution<MType> gauss_d {MType(0), MType(0.2)};
             m.resize(m_dim, 0);
-            matrix_data_p m_matrix_data = m.get_m_data();
-            for(size_t i {0}; i < m_matrix_data->size(); ++i) {
-                m_matrix_data->at(i) = MType(gauss_d(gauss_gen));
+            MType* m_p {m.mutable_data()};
+            unsigned long m_len {m.get_data()->size()};
+            for(unsigned long i {0}; i < m_len; ++i) {
+                m_p[i] = MType(gauss_d(gauss_gen));
             }
         }
 
@@ -82,56 +91,49 @@ namespace aedlf {
         void MakeMatrix<MType>::diagonal(Matrix<MType>& m, MType fill_with) {
             assert(m_dim[2] == m_dim[3]);
             m.resize(m_dim, 0);
-            matrix_data_p m_matrix_data = m.get_m_data();
+            MType* m_p {m.mutable_data()};
             unsigned long nxc = m_dim[0] * m_dim[1];
             unsigned long hxw = m_dim[2] * m_dim[3];
             for(unsigned long nc {0}; nc < nxc; ++nc) {
                 for(unsigned long hw {0}; hw < m_dim[2]; ++hw) {
-                    m_matrix_data->at(nc * hxw + hw * m_dim[2] + hw) = fill_with;
+                    m_p[nc * hxw + hw * m_dim[2] + hw] = fill_with;
                 }
             }
         }
 
         template <typename MType>
-        void MakeMatrix<MType>::diagonal(Matrix<MType>& m, const Matrix<MType>& fill_with) {
+        void MakeMatrix<MType>::diagonal(Matrix<MType>& m, const MatrixView<MType>& fill_with) {
             matrix_dim fill_with_dim {fill_with.get_dim()};
             assert(m_dim[2] % fill_with_dim[2] == 0);
             assert(m_dim[3] % fill_with_dim[3] == 0);
             unsigned long n_h {m_dim[2] / fill_with_dim[2]};
-            unsigned long n_w {m_dim[3] / fill_with_dim[3]};
-            assert(n_h == n_w);
+            assert(n_h == m_dim[3] / fill_with_dim[3]);
             m.resize(m_dim, 0);
-            std::vector<std::thread> thread_c;
-            for(unsigned long n {0}; n < m_dim[0]; ++n) {
-                ul_pos m_batch_ul {m.get_batch(n)};
-                ul_pos fw_batch_ul {fill_with.get_batch(n)};
-                for(unsigned long c {0}; c < m_dim[1]; ++c) {
-                    ul_pos m_channel_ul {m.get_channel(c, m_batch_ul)};
-                    ul_pos fw_channel_ul {fill_with.get_channel(c, fw_batch_ul)};
-                    for(unsigned long i {0}; i < n_h; ++i) {
-                        unsigned long h {i * fill_with_dim[2]};
-                        unsigned long w {i * fill_with_dim[3]};
-                        thread_c.emplace_back(&MakeMatrix<MType>::diagonal_core, this, std::ref(m), m_channel_ul, std::ref(fill_with), fw_channel_ul, h, w);
-                    }
-                }
-            }
-            for (auto& t : thread_c) {
-                t.join();
-            }
+            // 并行之前先让内存只属于m，core里再取指针不会拷贝
+            m.mutable_data();
+            unsigned long block_len {fill_with_dim[2] * fill_with_dim[3]};
+            utils::ThreadPool::global().parallel_for(m_dim[0] * m_dim[1] * n_h, block_len, [&](unsigned long task_i) {
+                unsigned long i {task_i % n_h};
+                unsigned long c {task_i / n_h % m_dim[1]};
+                unsigned long n {task_i / n_h / m_dim[1]};
+                ul_pos m_channel_ul {m.get_channel(c, m.get_batch(n))};
+                diagonal_core(m, m_channel_ul, fill_with, n, c, i * fill_with_dim[2], i * fill_with_dim[3]);
+            });
         }
 
         template <typename MType>
-        void MakeMatrix<MType>::diagonal_core(Matrix<MType>& m, ul_pos m_channel_ul, const Matrix<MType>& fill_with, ul_pos fw_channel_ul, unsigned long h, unsigned long w) {
-            // channel scale [ul_pos.first, ul_pos.second]
-            matrix_dim fill_with_dim {fill_with.get_dim()};
+        void MakeMatrix<MType>::diagonal_core(Matrix<MType>& m, ul_pos m_channel_ul, const MatrixView<MType>& fill_with, unsigned long n, unsigned long c, unsigned long h, unsigned long w) {
+            // channel scale [ul_pos.first, ul_pos.second]，fill_with按视图的跨度读取
+            const matrix_dim& fill_with_dim {fill_with.get_dim()};
+            const matrix_dim& fw_strides {fill_with.get_strides()};
             matrix_dim m_dim {m.get_dim()};
-            matrix_data_p m_data_p = m.get_m_data();
-            const matrix_data_p fw_data_p = fill_with.get_data();
+            MType* m_p {m.mutable_data()};
+            const MType* fw_channel {fill_with.get_ptr() + n * fw_strides[0] + c * fw_strides[1]};
             assert(h + fill_with_dim[2] <= m_dim[2]);
             assert(w + fill_with_dim[3] <= m_dim[3]);
             for(unsigned long inner_h {0}; inner_h < fill_with_dim[2]; ++inner_h) {
                 for(unsigned long inner_w {0}; inner_w < fill_with_dim[3]; ++inner_w) {
-                    m_data_p->at(m_channel_ul.first + (inner_h + h) * m_dim[3] + w + inner_w) = fw_data_p->at(fw_channel_ul.first + inner_h * fill_with_dim[3] + inner_w);
+                    m_p[m_channel_ul.first + (inner_h + h) * m_dim[3] + w + inner_w] = fw_channel[inner_h * fw_strides[2] + inner_w * fw_strides[3]];
                 }
             }
         }
@@ -143,26 +145,21 @@ namespace aedlf {
             assert(m_dim[0] == sjfw_dim[0]);
             assert(m_dim[1] == sjfw_dim[1]);
             m.resize(m_dim, 0);
-            std::vector<std::thread> thread_c;
-            for(unsigned long n {0}; n < m_dim[0]; ++n) {
-                ul_pos m_batch_ul {m.get_batch(n)};
-                ul_pos fw_batch_ul {s_jacobi_fw.get_batch(n)};
-                for(unsigned long c {0}; c < m_dim[1]; ++c) {
-                    ul_pos m_channel_ul {m.get_channel(c, m_batch_ul)};
-                    ul_pos fw_channel_ul {s_jacobi_fw.get_channel(c, fw_batch_ul)};
-                    thread_c.emplace_back(&MakeMatrix<MType>::special_jacobi_core, this, std::ref(m), m_channel_ul, std::ref(s_jacobi_fw), fw_channel_ul, jacobi_k);
-                }
-            }
-            for(auto& t : thread_c) {
-                t.join();
-            }
+            m.mutable_data();
+            utils::ThreadPool::global().parallel_for(m_dim[0] * m_dim[1], m_dim[2] * m_dim[3], [&](unsigned long task_i) {
+                unsigned long c {task_i % m_dim[1]};
+                unsigned long n {task_i / m_dim[1]};
+                ul_pos m_channel_ul {m.get_channel(c, m.get_batch(n))};
+                ul_pos fw_channel_ul {s_jacobi_fw.get_channel(c, s_jacobi_fw.get_batch(n))};
+                special_jacobi_core(m, m_channel_ul, s_jacobi_fw, fw_channel_ul, jacobi_k);
+            });
         }
 
         template <typename MType>
         void MakeMatrix<MType>::special_jacobi_core(Matrix<MType>& m, ul_pos m_channel_ul, const Matrix<MType>& sjfw, ul_pos fw_channel_ul, unsigned long jacobi_k) {
             matrix_dim m_dim {m.get_dim()};
             matrix_dim sjfw_dim {sjfw.get_dim()};
-            matrix_data_p m_data {m.get_m_data()};
+            MType* m_p {m.mutable_data()};
             const matrix_data_p sjfw_data {sjfw.get_data()};
             unsigned long offset_w;
             unsigned long fake_h;
@@ -170,26 +167,22 @@ namespace aedlf {
                 offset_w = h % jacobi_k;
                 fake_h = h / jacobi_k;
                 for(unsigned long fake_w {0}; fake_w < (m_dim[3] / jacobi_k); ++fake_w) {
-                    m_data->at(m_channel_ul.first + h * m_dim[3] + fake_w * jacobi_k + offset_w) = sjfw_data->at(fw_channel_ul.first + fake_h * sjfw_dim[3] + fake_w);
+                    m_p[m_channel_ul.first + h * m_dim[3] + fake_w * jacobi_k + offset_w] = sjfw_data->at(fw_channel_ul.first + fake_h * sjfw_dim[3] + fake_w);
                 }
             }
         }
 
         template <typename MType>
         void MakeMatrix<MType>::zeros(Matrix<MType> &m) {
-            matrix_data_p m_data_p = m.get_m_data();
-            for(size_t i {0}; i < m_data_p->size(); ++i) {
-                m_data_p->at(i) = 0;
-            }
+            MType* m_p {m.mutable_data()};
+            std::fill(m_p, m_p + m.get_data()->size(), MType(0));
             m.resize(m_dim, 0);
         }
 
         template <typename MType>
         void MakeMatrix<MType>::ones(Matrix<MType>& m) {
-            matrix_data_p m_data_p = m.get_m_data();
-            for(size_t i {0}; i < m_data_p->size(); ++i) {
-                m_data_p->at(i) = 1;
-            }
+            MType* m_p {m.mutable_data()};
+            std::fill(m_p, m_p + m.get_data()->size(), MType(1));
             m.resize(m_dim, 1);
         }
         
@@ -207,7 +200,7 @@ namespace aedlf {
 
         // TODO
         template <typename MType>
-        void MakeMatrix<MType>::kaiming(Matrix<MType>& m) {
+        void MakeMatrix<MType>::kaiming(Matrix<MType>& /*m*/) {
 
         }
 
@@ -222,19 +215,16 @@ namespace aedlf {
             m_dim[2] += (padding[0] != 0) ? padding[0] * 2 : 0;
             m_dim[3] += (padding[1] != 0) ? padding[1] * 2 : 0;
             result.resize(m_dim, fill_with);
-            std::vector<std::thread> thread_c;
-            for(unsigned long n {0}; n < m_dim[0]; ++n) {
-                ul_pos m_batch_ul {m.get_batch(n)};
-                ul_pos fw_batch_ul {result.get_batch(n)};
-                for(unsigned long c {0}; c < m_dim[1]; ++c) {
-                    ul_pos m_channel_ul {m.get_channel(c, m_batch_ul)};
-                    ul_pos fw_channel_ul {result.get_channel(c, fw_batch_ul)};
-                    thread_c.emplace_back(&MakeMatrix<MType>::add_padding_core, this, std::ref(m), std::ref(result), padding, m_channel_ul, fw_channel_ul);
-                }
-            }
-            for(auto& t : thread_c) {
-                t.join();
-            }
+            // 尺寸没变时resize不会重新填充，边框要自己填
+            MType* r_p {result.mutable_data()};
+            std::fill(r_p, r_p + result.get_data()->size(), fill_with);
+            utils::ThreadPool::global().parallel_for(m_dim[0] * m_dim[1], m_dim[2] * m_dim[3], [&](unsigned long task_i) {
+                unsigned long c {task_i % m_dim[1]};
+                unsigned long n {task_i / m_dim[1]};
+                ul_pos m_channel_ul {m.get_channel(c, m.get_batch(n))};
+                ul_pos fw_channel_ul {result.get_channel(c, result.get_batch(n))};
+                add_padding_core(m, result, padding, m_channel_ul, fw_channel_ul);
+            });
         }
 
         template <typename MType>
@@ -252,11 +242,11 @@ namespace aedlf {
             // padding[h, w]
             matrix_dim m_dim {m.get_dim()};
             matrix_dim fw_dim {result.get_dim()};
-            matrix_data_p m_data {m.get_m_data()};
-            matrix_data_p fw_data {result.get_m_data()};
+            const MType* m_p {m.get_data()->data()};
+            MType* fw_p {result.mutable_data()};
             for(unsigned long h {0}; h < m_dim[2]; ++h) {
                 for(unsigned long w{0}; w < m_dim[3]; ++w) {
-                    fw_data->at(fw_channel_ul.first + (padding[0] + h) * fw_dim[3] + padding[1] + w) = m_data->at(m_channel_ul.first + h * m_dim[3] + w);
+                    fw_p[fw_channel_ul.first + (padding[0] + h) * fw_dim[3] + padding[1] + w] = m_p[m_channel_ul.first + h * m_dim[3] + w];
                 }
             }
         }       
@@ -273,19 +263,14 @@ namespace aedlf {
             m_dim[3] -= (padding[1] != 0) ? padding[1] * 2 : 0;
             assert(m_dim[2] > 0 && m_dim[3] > 0);
             result.resize(m_dim, 0);
-            std::vector<std::thread> thread_c;
-            for(unsigned long n {0}; n < m_dim[0]; ++n) {
-                ul_pos m_batch_ul {m.get_batch(n)};
-                ul_pos fw_batch_ul {result.get_batch(n)};
-                for(unsigned long c {0}; c < m_dim[1]; ++c) {
-                    ul_pos m_channel_ul {m.get_channel(c, m_batch_ul)};
-                    ul_pos fw_channel_ul {result.get_channel(c, fw_batch_ul)};
-                    thread_c.emplace_back(&MakeMatrix<MType>::sub_padding_core, this, std::ref(m), std::ref(result), padding, m_channel_ul, fw_channel_ul);
-                }
-            }
-            for(auto& t : thread_c) {
-                t.join();
-            }
+            result.mutable_data();
+            utils::ThreadPool::global().parallel_for(m_dim[0] * m_dim[1], m_dim[2] * m_dim[3], [&](unsigned long task_i) {
+                unsigned long c {task_i % m_dim[1]};
+                unsigned long n {task_i / m_dim[1]};
+                ul_pos m_channel_ul {m.get_channel(c, m.get_batch(n))};
+                ul_pos fw_channel_ul {result.get_channel(c, result.get_batch(n))};
+                sub_padding_core(m, result, padding, m_channel_ul, fw_channel_ul);
+            });
         }
 
         template <typename MType>
@@ -302,13 +287,13 @@ namespace aedlf {
         void MakeMatrix<MType>::sub_padding_core(Matrix<MType>& m, Matrix<MType>& result, kernel_shape padding, ul_pos m_channel_ul, ul_pos fw_channel_ul) {
             matrix_dim m_dim {m.get_dim()};
             matrix_dim fw_dim {result.get_dim()};
-            matrix_data_p m_data {m.get_m_data()};
-            matrix_data_p fw_data {result.get_m_data()};
+            const MType* m_p {m.get_data()->data()};
+            MType* fw_p {result.mutable_data()};
             unsigned long start_h {padding[0]};
             unsigned long start_w {padding[1]};
             for(unsigned long h {0}; h < fw_dim[2]; ++h) {
                 for(unsigned long w {0}; w < fw_dim[3]; ++w) {
-                    fw_data->at(fw_channel_ul.first + h * fw_dim[3] + w) = m_data->at(m_channel_ul.first + (start_h + h) * m_dim[3] + start_w + w);
+                    fw_p[fw_channel_ul.first + h * fw_dim[3] + w] = m_p[m_channel_ul.first + (start_h + h) * m_dim[3] + start_w + w];
                 }
             }
         }
@@ -322,31 +307,26 @@ namespace aedlf {
             fw_dim[2] = kernel_size[0] * kernel_size[1];
             fw_dim[3] = output_h * output_w;
             fw.resize(fw_dim, 0);
-            std::vector<std::thread> thread_c;
-            for(unsigned long n {0}; n < m_dim[0]; ++n) {
-                ul_pos m_batch_ul {m.get_batch(n)};
-                ul_pos fw_batch_ul {fw.get_batch(n)};
-                for(unsigned long c {0}; c < m_dim[1]; ++c) {
-                    ul_pos m_channel_ul {m.get_channel(c, m_batch_ul)};
-                    ul_pos fw_channel_ul {fw.get_channel(c, fw_batch_ul)};
-                    thread_c.emplace_back(&MakeMatrix<MType>::img2col_core, this, std::ref(m), std::ref(fw), m_channel_ul, fw_channel_ul, kernel_size, stride, output_h, output_w);
-                }
-            }
-            for(auto& t : thread_c) {
-                t.join();
-            }
+            fw.mutable_data();
+            utils::ThreadPool::global().parallel_for(m_dim[0] * m_dim[1], fw_dim[2] * fw_dim[3], [&](unsigned long task_i) {
+                unsigned long c {task_i % m_dim[1]};
+                unsigned long n {task_i / m_dim[1]};
+                ul_pos m_channel_ul {m.get_channel(c, m.get_batch(n))};
+                ul_pos fw_channel_ul {fw.get_channel(c, fw.get_batch(n))};
+                img2col_core(m, fw, m_channel_ul, fw_channel_ul, kernel_size, stride, output_h, output_w);
+            });
         }
 
         template <typename MType>
         void MakeMatrix<MType>::img2col_core(Matrix<MType>& m, Matrix<MType>& fw, ul_pos m_channel_ul, ul_pos fw_channel_ul, kernel_shape kernel_size, unsigned long stride, unsigned long output_h, unsigned long output_w) {
-            matrix_data_p m_data {m.get_m_data()};
-            matrix_data_p fw_data {fw.get_m_data()};
+            const MType* m_p {m.get_data()->data()};
+            MType* fw_p {fw.mutable_data()};
             matrix_dim m_dim {m.get_dim()};
             for(unsigned long h {0}; h < output_h; ++h) {
                 for(unsigned long w {0}; w < output_w; ++w) {
                     for(unsigned long k_h {0}; k_h < kernel_size[0]; ++k_h) {
                         for(unsigned long k_w {0}; k_w < kernel_size[1]; ++k_w) {
-                            fw_data->at(fw_channel_ul.first + (k_h * kernel_size[1] + k_w) * (output_h * output_w) + h * output_w + w) = m_data->at(m_channel_ul.first + (h * stride + k_h) * m_dim[3] + w * stride + k_w);
+                            fw_p[fw_channel_ul.first + (k_h * kernel_size[1] + k_w) * (output_h * output_w) + h * output_w + w] = m_p[m_channel_ul.first + (h * stride + k_h) * m_dim[3] + w * stride + k_w];
                         }
                     }
                 }
@@ -371,19 +351,15 @@ namespace aedlf {
             assert(output_h * output_w == m_dim[3]);
             assert(m_dim[0] == fw_dim[0] && m_dim[1] == fw_dim[1]);
             fw.resize(fw_dim, 0);
-            std::vector<std::thread> thread_c;
-            for(unsigned long n {0}; n < m_dim[0]; ++n) {
-                ul_pos m_batch_ul {m.get_batch(n)};
-                ul_pos fw_batch_ul {fw.get_batch(n)};
-                for(unsigned long c {0}; c < m_dim[1]; ++c) {
-                    ul_pos m_channel_ul {m.get_channel(c, m_batch_ul)};
-                    ul_pos fw_channel_ul {fw.get_channel(c, fw_batch_ul)};
-                    thread_c.emplace_back(&MakeMatrix<MType>::col2img_core, this, std::ref(m), std::ref(fw), m_channel_ul, fw_channel_ul, kernel_size, stride, output_h, output_w);
-                }
-            }
-            for(auto& t : thread_c) {
-                t.join();
-            }
+            MType* fw_p {fw.mutable_data()};
+            std::fill(fw_p, fw_p + fw.get_data()->size(), MType(0));
+            utils::ThreadPool::global().parallel_for(m_dim[0] * m_dim[1], m_dim[2] * m_dim[3], [&](unsigned long task_i) {
+                unsigned long c {task_i % m_dim[1]};
+                unsigned long n {task_i / m_dim[1]};
+                ul_pos m_channel_ul {m.get_channel(c, m.get_batch(n))};
+                ul_pos fw_channel_ul {fw.get_channel(c, fw.get_batch(n))};
+                col2img_core(m, fw, m_channel_ul, fw_channel_ul, kernel_size, stride, output_h, output_w);
+            });
         }
 
         template <typename MType>
@@ -397,21 +373,146 @@ namespace aedlf {
         }
 
         template <typename MType>
-        // 这里有个问题，例如5x5卷积以 2x2 stride 2卷积过形成的img2col的jacobi，在这里恢复的时候会出错，第五列会全0
+        // 没有被任何窗口覆盖的位置（例如5x5以2x2 stride 2做img2col的第五列）梯度本来就是0
         void MakeMatrix<MType>::col2img_core(Matrix<MType>& m, Matrix<MType>& fw, ul_pos m_channel_ul, ul_pos fw_channel_ul, kernel_shape kernel_size, unsigned long stride, unsigned long output_h, unsigned long output_w) {
             matrix_dim m_dim {m.get_dim()};
             matrix_dim fw_dim {fw.get_dim()};
-            matrix_data_p m_data {m.get_m_data()};
-            matrix_data_p fw_data {fw.get_m_data()};
+            const MType* m_p {m.get_data()->data()};
+            MType* fw_p {fw.mutable_data()};
             for(unsigned long h {0}; h < output_h; ++h) {
                 for(unsigned long w {0}; w < output_w; ++w) {
                     for(unsigned long k_h {0}; k_h < kernel_size[0]; ++k_h) {
                         for(unsigned long k_w {0}; k_w < kernel_size[1]; ++k_w) {
-                            fw_data->at(fw_channel_ul.first + (h * stride + k_h) * fw_dim[2] + w * stride + k_w) += m_data->at(m_channel_ul.first + (k_h * kernel_size[1] + k_w) * m_dim[3] + h * output_h + w);
+                            fw_p[fw_channel_ul.first + (h * stride + k_h) * fw_dim[3] + w * stride + k_w] += m_p[m_channel_ul.first + (k_h * kernel_size[1] + k_w) * m_dim[3] + h * output_w + w];
                         }
                     }
                 }
             }
         }
+
+        template <typename MType>
+        void MakeMatrix<MType>::prepare_result(Matrix<MType>& result, matrix_dim dim, MType beta) {
+            if(beta == MType(0)) {
+                result.resize(dim, 0);
+                return;
+            }
+            // 累加到已有的结果上，不能换内存，尺寸也必须一样
+            result.check_initialized();
+            if(result.get_dim() != dim) {
+                throw std::runtime_error("result shape is not match the product");
+            }
+        }
+
+        template <typename MType>
+        void MakeMatrix<MType>::mul_bt(const Matrix<MType>& a, const Matrix<MType>& b, Matrix<MType>& result, MType alpha, MType beta) {
+            // a(m, n) * b(k, n)^T -> (m, k)
+            matrix_dim a_dim {a.get_dim()};
+            matrix_dim b_dim {b.get_dim()};
+            // GEMM按形状直接读裸指针，不能只在debug下检查
+            if(!(a_dim[0] == b_dim[0] || a_dim[0] == 1 || b_dim[0] == 1) || a_dim[1] != b_dim[1]) {
+                throw std::runtime_error("Matrix batch or channel is not match in mul");
+            }
+            if(a_dim[3] != b_dim[3]) {
+                throw std::runtime_error("Matrix shape is not match in mul");
+            }
+            unsigned long m {a_dim[2]}, n {a_dim[3]}, k {b_dim[2]};
+            unsigned long batch {std::max(a_dim[0], b_dim[0])};
+            unsigned long channel {a_dim[1]};
+            prepare_result(result, matrix_dim {batch, channel, m, k}, beta);
+            const MType* a_p {a.get_data()->data()};
+            const MType* b_p {b.get_data()->data()};
+            MType* r_p {result.mutable_data()};
+            std::vector<const MType*> a_list(batch * channel);
+            std::vector<const MType*> b_list(batch * channel);
+            std::vector<MType*> r_list(batch * channel);
+            for(unsigned long i {0}; i < batch * channel; ++i) {
+                a_list[i] = a_p + (a_dim[0] == 1 ? i % channel : i) * m * n;
+                b_list[i] = b_p + (b_dim[0] == 1 ? i % channel : i) * k * n;
+                r_list[i] = r_p + i * m * k;
+            }
+            kernel::gemm_batched<MType>(batch * channel, m, k, n, alpha, a_list.data(), n, 1, b_list.data(), 1, n, beta, r_list.data(), k);
+        }
+
+        template <typename MType>
+        void MakeMatrix<MType>::mul_bt_sum(const Matrix<MType>& a, const Matrix<MType>& b, Matrix<MType>& result, MType alpha, MType beta) {
+            // a(n, c, m, p)，b(n, c, k, p)，不生成(n, c, m, k)的中间结果
+            matrix_dim a_dim {a.get_dim()};
+            matrix_dim b_dim {b.get_dim()};
+            // batch不广播，a、b都按a的batch和通道寻址
+            if(a_dim[0] != b_dim[0] || a_dim[1] != b_dim[1]) {
+                throw std::runtime_error("Matrix batch or channel is not match in mul");
+            }
+            if(a_dim[3] != b_dim[3]) {
+                throw std::runtime_error("Matrix shape is not match in mul");
+            }
+            unsigned long batch {a_dim[0]}, channel {a_dim[1]}, m {a_dim[2]}, p {a_dim[3]}, k {b_dim[2]};
+            prepare_result(result, matrix_dim {1, channel, m, k}, beta);
+            const MType* a_p {a.get_data()->data()};
+            const MType* b_p {b.get_data()->data()};
+            MType* r_p {result.mutable_data()};
+            if(p == 1) {
+                // 每个样本是一列，整个batch就是一次(m, n) * (n, k)的乘法，a、b按跨度读，不用转置
+                std::vector<const MType*> a_list(channel);
+                std::vector<const MType*> b_list(channel);
+                std::vector<MType*> r_list(channel);
+                for(unsigned long c {0}; c < channel; ++c) {
+                    a_list[c] = a_p + c * m;
+                    b_list[c] = b_p + c * k;
+                    r_list[c] = r_p + c * m * k;
+                }
+                kernel::gemm_batched<MType>(channel, m, k, batch, alpha, a_list.data(), 1, channel * m, b_list.data(), channel * k, 1, beta, r_list.data(), k);
+                return;
+            }
+            utils::ThreadPool::global().parallel_for(channel, batch * m * p * k, [&](unsigned long c) {
+                // 第一个样本按beta处理result原有的值，之后的样本直接累加，不用每个样本的乘积缓冲
+                for(unsigned long n {0}; n < batch; ++n) {
+                    unsigned long offset {n * channel + c};
+                    kernel::gemm_strided<MType>(m, k, p, alpha, a_p + offset * m * p, p, 1, b_p + offset * k * p, 1, p, n == 0 ? beta : MType(1), r_p + c * m * k, k);
+                }
+            });
+        }
+
+        template <typename MType>
+        void MakeMatrix<MType>::sum_batch(const Matrix<MType>& m, Matrix<MType>& result) {
+            matrix_dim dim {m.get_dim()};
+            unsigned long len {dim[1] * dim[2] * dim[3]};
+            result.resize(matrix_dim {1, dim[1], dim[2], dim[3]}, 0);
+            const MType* m_p {m.get_data()->data()};
+            MType* r_p {result.mutable_data()};
+            std::copy(m_p, m_p + len, r_p);
+            for(unsigned long n {1}; n < dim[0]; ++n) {
+                kernel::add(len, m_p + n * len, r_p);
+            }
+        }
+
+        template <typename MType>
+        void MakeMatrix<MType>::mul_at(const Matrix<MType>& a, const Matrix<MType>& b, Matrix<MType>& result, MType alpha, MType beta) {
+            // a(k, m)^T * b(k, n) -> (m, n)
+            matrix_dim a_dim {a.get_dim()};
+            matrix_dim b_dim {b.get_dim()};
+            // GEMM按形状直接读裸指针，不能只在debug下检查
+            if(!(a_dim[0] == b_dim[0] || a_dim[0] == 1 || b_dim[0] == 1) || a_dim[1] != b_dim[1]) {
+                throw std::runtime_error("Matrix batch or channel is not match in mul");
+            }
+            if(a_dim[2] != b_dim[2]) {
+                throw std::runtime_error("Matrix shape is not match in mul");
+            }
+            unsigned long k {a_dim[2]}, m {a_dim[3]}, n {b_dim[3]};
+            unsigned long batch {std::max(a_dim[0], b_dim[0])};
+            unsigned long channel {a_dim[1]};
+            prepare_result(result, matrix_dim {batch, channel, m, n}, beta);
+            const MType* a_p {a.get_data()->data()};
+            const MType* b_p {b.get_data()->data()};
+            MType* r_p {result.mutable_data()};
+            std::vector<const MType*> a_list(batch * channel);
+            std::vector<const MType*> b_list(batch * channel);
+            std::vector<MType*> r_list(batch * channel);
+            for(unsigned long i {0}; i < batch * channel; ++i) {
+                a_list[i] = a_p + (a_dim[0] == 1 ? i % channel : i) * k * m;
+                b_list[i] = b_p + (b_dim[0] == 1 ? i % channel : i) * k * n;
+                r_list[i] = r_p + i * m * n;
+            }
+            kernel::gemm_batched<MType>(batch * channel, m, n, k, alpha, a_list.data(), 1, m, b_list.data(), n, 1, beta, r_list.data(), n);
+        }
     }
 }
\ No newline at end of file
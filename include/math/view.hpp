@@ -0,0 +1,285 @@
+#pragma once
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cassert>
+#include "matrix.hpp"
+
+
+namespace aedlf {
+    /*
+    不持有数据的strided视图，和Matrix共用同一块内存，只记下尺寸、每一维的跨度和起始位置
+    slice、T、view都只改这三样东西，O(1)，不拷贝数据
+    assign、set、get_m_ptr直接写这块内存，不经过Matrix的copy-on-write，要写的话先对Matrix调用mutable_data()再建视图
+    需要连续内存的地方用copy/copy_to落地成Matrix，最后一维跨度是1时按行走连续的kernel
+    */
+    template <typename MType>
+    class MatrixView {
+        public:
+            using matrix_data_p = typename Matrix<MType>::matrix_data_p;
+            using matrix_dim = std::vector<unsigned long>;
+            using slice_parma = std::vector<unsigned long>;
+            MatrixView();
+            MatrixView(const Matrix<MType>& m);
+            MatrixView(matrix_data_p data, matrix_dim shape, matrix_dim strides, unsigned long offset);
+            MatrixView<MType> slice(slice_parma slice_index) const;
+            MatrixView<MType> slice(std::initializer_list<unsigned long> slice_index) const;
+            MatrixView<MType> slice(unsigned long slice_dim, unsigned long start, unsigned long end) const;
+            MatrixView<MType> T() const; // 交换h、w两维的尺寸和跨度
+            MatrixView<MType> view(matrix_dim shape) const; // 只有连续的视图可以改尺寸
+            MType get(unsigned long n, unsigned long c, unsigned long h, unsigned long w) const;
+            void set(unsigned long n, unsigned long c, unsigned long h, unsigned long w, MType value) const;
+            bool is_contiguous() const;
+            unsigned long size() const;
+            Matrix<MType> copy() const;
+            void copy_to(Matrix<MType>& m) const; // m按视图的尺寸重新分配后写入
+            void add_to(Matrix<MType>& m) const; // m += 视图，尺寸必须相同
+            void assign(const MatrixView<MType>& src) const; // 把src写进视图指向的内存
+            const MType* get_ptr() const; // 指向(0, 0, 0, 0)
+            MType* get_m_ptr() const;
+            const matrix_dim& get_dim() const;
+            const matrix_dim& get_strides() const;
+            unsigned long get_offset() const;
+            const matrix_data_p get_data() const;
+        private:
+            template <typename RowFunc>
+            void for_each_row(RowFunc row_func) const;
+            matrix_data_p data;
+            matrix_dim shape {0, 0, 0, 0};
+            matrix_dim strides {0, 0, 0, 0}; // 按元素计
+            unsigned long offset {0};
+    };
+
+    template <typename MType>
+    MatrixView<MType>::MatrixView() {}
+
+    template <typename MType>
+    MatrixView<MType>::MatrixView(const Matrix<MType>& m) : data(m.get_data()), shape(m.get_dim()) {
+        strides = {shape[1] * shape[2] * shape[3], shape[2] * shape[3], shape[3], 1};
+    }
+
+    template <typename MType>
+    MatrixView<MType>::MatrixView(matrix_data_p data, matrix_dim shape, matrix_dim strides, unsigned long offset) : data(data), shape(shape), strides(strides), offset(offset) {
+        assert(shape.size() == 4 && strides.size() == 4);
+    }
+
+    template <typename MType>
+    MatrixView<MType> MatrixView<MType>::slice(slice_parma slice_index) const {
+        // slice_index {n[start], n[end], c[start], c[end], h[start], h[end], w[start], w[end]}
+        assert(slice_index.size() == 8);
+        MatrixView<MType> result {*this};
+        for(size_t dim {0}; dim < 4; ++dim) {
+            unsigned long start {slice_index[dim * 2]};
+            unsigned long end {slice_index[dim * 2 + 1]};
+            if(start > shape[dim] || end > shape[dim]) {
+                throw std::runtime_error("Slice index out of range");
+            }
+            if(end < start) {
+                throw std::runtime_error("Slice range invalid");
+            }
+            result.shape[dim] = end - start;
+            result.offset += start * strides[dim];
+        }
+        return result;
+    }
+
+    template <typename MType>
+    MatrixView<MType> MatrixView<MType>::slice(std::initializer_list<unsigned long> slice_index) const {
+        return slice(slice_parma {slice_index});
+    }
+
+    template <typename MType>
+    MatrixView<MType> MatrixView<MType>::slice(unsigned long slice_dim, unsigned long start, unsigned long end) const {
+        assert(slice_dim < 4);
+        slice_parma slice_index {0, shape[0], 0, shape[1], 0, shape[2], 0, shape[3]};
+        slice_index[slice_dim * 2] = start;
+        slice_index[slice_dim * 2 + 1] = end;
+        return slice(slice_index);
+    }
+
+    template <typename MType>
+    MatrixView<MType> MatrixView<MType>::T() const {
+        MatrixView<MType> result {*this};
+        std::swap(result.shape[2], result.shape[3]);
+        std::swap(result.strides[2], result.strides[3]);
+        return result;
+    }
+
+    template <typename MType>
+    MatrixView<MType> MatrixView<MType>::view(matrix_dim shape) const {
+        assert(shape.size() == 4);
+        assert(shape[0] * shape[1] * shape[2] * shape[3] == size());
+        if(!is_contiguous()) {
+            throw std::runtime_error("View of a non-contiguous matrix, copy it first");
+        }
+        return MatrixView<MType> {data, shape, matrix_dim {shape[1] * shape[2] * shape[3], shape[2] * shape[3], shape[3], 1}, offset};
+    }
+
+    template <typename MType>
+    MType MatrixView<MType>::get(unsigned long n, unsigned long c, unsigned long h, unsigned long w) const {
+        assert(n < shape[0] && c < shape[1] && h < shape[2] && w < shape[3]);
+        return (*data)[offset + n * strides[0] + c * strides[1] + h * strides[2] + w * strides[3]];
+    }
+
+    template <typename MType>
+    void MatrixView<MType>::set(unsigned long n, unsigned long c, unsigned long h, unsigned long w, MType value) const {
+        assert(n < shape[0] && c < shape[1] && h < shape[2] && w < shape[3]);
+        (*data)[offset + n * strides[0] + c * strides[1] + h * strides[2] + w * strides[3]] = value;
+    }
+
+    template <typename MType>
+    bool MatrixView<MType>::is_contiguous() const {
+        // 尺寸是1的维度跨度无所谓
+        unsigned long expected {1};
+        for(size_t i {4}; i > 0; --i) {
+            if(shape[i - 1] != 1 && strides[i - 1] != expected) {
+                return false;
+            }
+            expected *= shape[i - 1];
+        }
+        return true;
+    }
+
+    template <typename MType>
+    unsigned long MatrixView<MType>::size() const {
+        return shape[0] * shape[1] * shape[2] * shape[3];
+    }
+
+    template <typename MType>
+    template <typename RowFunc>
+    void MatrixView<MType>::for_each_row(RowFunc row_func) const {
+        // row_func(行号, 行首相对data的位置)，行号按视图的逻辑顺序
+        unsigned long row {0};
+        for(unsigned long n {0}; n < shape[0]; ++n) {
+            for(unsigned long c {0}; c < shape[1]; ++c) {
+                for(unsigned long h {0}; h < shape[2]; ++h) {
+                    row_func(row++, offset + n * strides[0] + c * strides[1] + h * strides[2]);
+                }
+            }
+        }
+    }
+
+    template <typename MType>
+    Matrix<MType> MatrixView<MType>::copy() const {
+        Matrix<MType> m {};
+        copy_to(m);
+        return m;
+    }
+
+    template <typename MType>
+    void MatrixView<MType>::copy_to(Matrix<MType>& m) const {
+        assert(data != nullptr);
+        if(m.is_uninitialized() || m.get_data() == data) {
+            // 不能原地写自己的内存，换一块新的
+            m.set_data(Matrix<MType>::make_data(size()));
+        }
+        m.resize(shape, MType(0));
+        MType* dst {m.mutable_data()};
+        const MType* src {data->data()};
+        unsigned long w {shape[3]};
+        unsigned long w_stride {strides[3]};
+        if(is_contiguous()) {
+            std::copy(src + offset, src + offset + size(), dst);
+            return;
+        }
+        for_each_row([&](unsigned long row, unsigned long row_begin) {
+            MType* dst_row {dst + row * w};
+            const MType* src_row {src + row_begin};
+            if(w_stride == 1) {
+                std::copy(src_row, src_row + w, dst_row);
+            }
+            else {
+                for(unsigned long i {0}; i < w; ++i) {
+                    dst_row[i] = src_row[i * w_stride];
+                }
+            }
+        });
+    }
+
+    template <typename MType>
+    void MatrixView<MType>::add_to(Matrix<MType>& m) const {
+        // 按形状整行读写裸指针，形状不对会写到内存外面
+        if(m.get_dim() != shape) {
+            throw std::runtime_error("View shape is not match the matrix in add_to");
+        }
+        MType* dst {m.mutable_data()};
+        const MType* src {data->data()};
+        unsigned long w {shape[3]};
+        unsigned long w_stride {strides[3]};
+        for_each_row([&](unsigned long row, unsigned long row_begin) {
+            MType* dst_row {dst + row * w};
+            const MType* src_row {src + row_begin};
+            if(w_stride == 1) {
+                kernel::add(w, src_row, dst_row);
+            }
+            else {
+                for(unsigned long i {0}; i < w; ++i) {
+                    dst_row[i] += src_row[i * w_stride];
+                }
+            }
+        });
+    }
+
+    template <typename MType>
+    void MatrixView<MType>::assign(const MatrixView<MType>& src) const {
+        if(src.shape != shape) {
+            throw std::runtime_error("View shape is not match in assign");
+        }
+        if(src.data == data) {
+            throw std::runtime_error("View assign from a view of the same matrix");
+        }
+        MType* dst {data->data()};
+        const MType* src_p {src.data->data()};
+        unsigned long w {shape[3]};
+        unsigned long src_w_stride {src.strides[3]};
+        unsigned long dst_w_stride {strides[3]};
+        for_each_row([&](unsigned long row, unsigned long row_begin) {
+            MType* dst_row {dst + row_begin};
+            // 两边尺寸相同，行号换算回(n, c, h)再按源视图的跨度取行
+            unsigned long h {row % shape[2]};
+            unsigned long c {row / shape[2] % shape[1]};
+            unsigned long n {row / shape[2] / shape[1]};
+            const MType* src_row {src_p + src.offset + n * src.strides[0] + c * src.strides[1] + h * src.strides[2]};
+            if(src_w_stride == 1 && dst_w_stride == 1) {
+                std::copy(src_row, src_row + w, dst_row);
+            }
+            else {
+                for(unsigned long i {0}; i < w; ++i) {
+                    dst_row[i * dst_w_stride] = src_row[i * src_w_stride];
+                }
+            }
+        });
+    }
+
+    template <typename MType>
+    const MType* MatrixView<MType>::get_ptr() const {
+        return data->data() + offset;
+    }
+
+    template <typename MType>
+    MType* MatrixView<MType>::get_m_ptr() const {
+        return data->data() + offset;
+    }
+
+    template <typename MType>
+    const typename MatrixView<MType>::matrix_dim& MatrixView<MType>::get_dim() const {
+        return shape;
+    }
+
+    template <typename MType>
+    const typename MatrixView<MType>::matrix_dim& MatrixView<MType>::get_strides() const {
+        return strides;
+    }
+
+    template <typename MType>
+    unsigned long MatrixView<MType>::get_offset() const {
+        return offset;
+    }
+
+    template <typename MType>
+    const typename MatrixView<MType>::matrix_data_p MatrixView<MType>::get_data() const {
+        return data;
+    }
+}
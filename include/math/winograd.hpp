@@ -0,0 +1,425 @@
+#pragma once
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include "gemm.hpp"
+#include "conv.hpp"
+#include "elementwise.hpp"
+#include "../utils/allocator.hpp"
+
+
+namespace aedlf {
+    namespace kernel {
+        /*
+        3x3、stride 1卷积的Winograd算法，F(m x m, 3 x 3)，m是2或4，每个tile的输入是alpha = m + 2
+        前向 Y = A^T [U ⊙ V] A，U = G g G^T，V = B^T d B，各个通道的⊙求和按alpha * alpha个位置各做一次GEMM
+        对输入的梯度 dd = B [U ⊙ P] B^T，对权重的梯度 dg = G^T [P ⊙ V] G，P = A dy A^T，同样拆成GEMM
+        乘法次数从m * m * 9降到alpha * alpha，F(2x2)少2.25倍，F(4x4)少4倍
+        环境变量AEDLF_WINOGRAD=off/2/4/check，check时前向和梯度都再用img2col算一遍比较，超过容差就抛异常
+        */
+        struct WinogradMatrix {
+            unsigned long m;
+            unsigned long alpha;
+            const double* bt; // (alpha, alpha)
+            const double* g; // (alpha, 3)
+            const double* at; // (m, alpha)
+        };
+
+        inline WinogradMatrix winograd_matrix(unsigned long m) {
+            static const double bt_2[16] {
+                1, 0, -1, 0,
+                0, 1, 1, 0,
+                0, -1, 1, 0,
+                0, 1, 0, -1
+            };
+            static const double g_2[12] {
+                1, 0, 0,
+                0.5, 0.5, 0.5,
+                0.5, -0.5, 0.5,
+                0, 0, 1
+            };
+            static const double at_2[8] {
+                1, 1, 1, 0,
+                0, 1, -1, -1
+            };
+            static const double bt_4[36] {
+                4, 0, -5, 0, 1, 0,
+                0, -4, -4, 1, 1, 0,
+                0, 4, -4, -1, 1, 0,
+                0, -2, -1, 2, 1, 0,
+                0, 2, -1, -2, 1, 0,
+                0, 4, 0, -5, 0, 1
+            };
+            static const double g_4[18] {
+                1.0 / 4, 0, 0,
+                -1.0 / 6, -1.0 / 6, -1.0 / 6,
+                -1.0 / 6, 1.0 / 6, -1.0 / 6,
+                1.0 / 24, 1.0 / 12, 1.0 / 6,
+                1.0 / 24, -1.0 / 12, 1.0 / 6,
+                0, 0, 1
+            };
+            static const double at_4[24] {
+                1, 1, 1, 1, 1, 0,
+                0, 1, -1, 2, -2, 0,
+                0, 1, 1, 4, 4, 0,
+                0, 1, -1, 8, -8, 1
+            };
+            if(m == 4) {
+                return WinogradMatrix {4, 6, bt_4, g_4, at_4};
+            }
+            return WinogradMatrix {2, 4, bt_2, g_2, at_2};
+        }
+
+        enum class WinogradMode {
+            automatic,
+            off,
+            tile_2,
+            tile_4,
+            check
+        };
+
+        inline WinogradMode winograd_mode() {
+            static WinogradMode mode {[] {
+                const char* env_winograd {std::getenv("AEDLF_WINOGRAD")};
+                if(env_winograd == nullptr) {
+                    return WinogradMode::automatic;
+                }
+                if(std::strcmp(env_winograd, "off") == 0) {
+                    return WinogradMode::off;
+                }
+                if(std::strcmp(env_winograd, "2") == 0) {
+                    return WinogradMode::tile_2;
+                }
+                if(std::strcmp(env_winograd, "4") == 0) {
+                    return WinogradMode::tile_4;
+                }
+                if(std::strcmp(env_winograd, "check") == 0) {
+                    return WinogradMode::check;
+                }
+                return WinogradMode::automatic;
+            }()};
+            return mode;
+        }
+
+        // 返回tile的输出尺寸m，0表示这个形状不走Winograd
+        inline unsigned long winograd_select(const ConvShape& shape) {
+            WinogradMode mode {winograd_mode()};
+            if(mode == WinogradMode::off || shape.kernel_h != 3 || shape.kernel_w != 3 || shape.stride != 1) {
+                return 0;
+            }
+            if(mode == WinogradMode::tile_2) {
+                return 2;
+            }
+            if(mode == WinogradMode::tile_4) {
+                return 4;
+            }
+            // 输出太小时F(4x4)的tile大半是浪费
+            return shape.output_h() >= 8 && shape.output_w() >= 8 ? 4 : 2;
+        }
+
+        // 和img2col结果比较时允许的相对误差
+        template <typename MType>
+        MType winograd_tolerance() {
+            return MType(1e-3);
+        }
+
+        template <>
+        inline double winograd_tolerance<double>() {
+            return 1e-9;
+        }
+
+        // out = L * in * L^T，L是(lr, lc)，in是(lc, lc)；trans时out = L^T * in * L，in是(lr, lr)
+        template <typename MType>
+        void winograd_sandwich(const double* l, unsigned long lr, unsigned long lc, bool trans, const MType* in, MType* out) {
+            unsigned long in_len {trans ? lr : lc};
+            unsigned long out_len {trans ? lc : lr};
+            MType temp[6 * 6];
+            // temp = op(L) * in
+            for(unsigned long i {0}; i < out_len; ++i) {
+                for(unsigned long j {0}; j < in_len; ++j) {
+                    MType sum {0};
+                    for(unsigned long p {0}; p < in_len; ++p) {
+                        sum += MType(trans ? l[p * lc + i] : l[i * lc + p]) * in[p * in_len + j];
+                    }
+                    temp[i * in_len + j] = sum;
+                }
+            }
+            // out = temp * op(L)^T
+            for(unsigned long i {0}; i < out_len; ++i) {
+                for(unsigned long j {0}; j < out_len; ++j) {
+                    MType sum {0};
+                    for(unsigned long p {0}; p < in_len; ++p) {
+                        sum += temp[i * in_len + p] * MType(trans ? l[p * lc + j] : l[j * lc + p]);
+                    }
+                    out[i * out_len + j] = sum;
+                }
+            }
+        }
+
+        // 一次变换t_len个tile：in的第k行是所有tile在位置k上的值，行之间隔in_stride，out同理隔out_stride
+        // 和winograd_sandwich算的一样，系数是0的项跳过，其余每项是一次长度t_len的axpy；temp至少要lr * lc * t_len
+        template <typename MType>
+        void winograd_sandwich_rows(const double* l, unsigned long lr, unsigned long lc, bool trans, unsigned long t_len, const MType* in, unsigned long in_stride, MType* temp, MType* out, unsigned long out_stride) {
+            unsigned long in_len {trans ? lr : lc};
+            unsigned long out_len {trans ? lc : lr};
+            // temp = op(L) * in
+            std::fill(temp, temp + out_len * in_len * t_len, MType(0));
+            for(unsigned long i {0}; i < out_len; ++i) {
+                for(unsigned long p {0}; p < in_len; ++p) {
+                    double coef {trans ? l[p * lc + i] : l[i * lc + p]};
+                    if(coef == 0) {
+                        continue;
+                    }
+                    for(unsigned long j {0}; j < in_len; ++j) {
+                        kernel::axpy(t_len, MType(coef), in + (p * in_len + j) * in_stride, temp + (i * in_len + j) * t_len);
+                    }
+                }
+            }
+            // out = temp * op(L)^T
+            for(unsigned long i {0}; i < out_len; ++i) {
+                for(unsigned long j {0}; j < out_len; ++j) {
+                    MType* out_row {out + (i * out_len + j) * out_stride};
+                    std::fill(out_row, out_row + t_len, MType(0));
+                    for(unsigned long p {0}; p < in_len; ++p) {
+                        double coef {trans ? l[p * lc + j] : l[j * lc + p]};
+                        if(coef != 0) {
+                            kernel::axpy(t_len, MType(coef), temp + (i * in_len + p) * t_len, out_row);
+                        }
+                    }
+                }
+            }
+        }
+
+        template <typename MType>
+        std::vector<MType, utils::Allocator<MType>>& winograd_buffer(unsigned long buffer_id) {
+            // 每个线程五块，反复使用；0到2给GEMM的输入输出，3、4给按行变换时的分块和中间结果
+            static thread_local std::vector<std::vector<MType, utils::Allocator<MType>>> buffers(5, std::vector<MType, utils::Allocator<MType>> {utils::Allocator<MType> {utils::default_resource()}});
+            return buffers[buffer_id];
+        }
+
+        struct WinogradTiles {
+            unsigned long tiles_h;
+            unsigned long tiles_w;
+            unsigned long len() const {
+                return tiles_h * tiles_w;
+            };
+        };
+
+        inline WinogradTiles winograd_tiles(const ConvShape& shape, unsigned long m) {
+            return WinogradTiles {(shape.output_h() + m - 1) / m, (shape.output_w() + m - 1) / m};
+        }
+
+        // w是(in_channel, output_channel, 9)，u是(alpha * alpha, output_channel, in_channel)
+        template <typename MType>
+        void winograd_transform_weight(const ConvShape& shape, unsigned long m, const MType* w, MType* u) {
+            WinogradMatrix wm {winograd_matrix(m)};
+            unsigned long alpha2 {wm.alpha * wm.alpha};
+            unsigned long plane {shape.out_channel * shape.in_channel};
+            MType tile[6 * 6];
+            for(unsigned long c {0}; c < shape.in_channel; ++c) {
+                for(unsigned long o {0}; o < shape.out_channel; ++o) {
+                    winograd_sandwich(wm.g, wm.alpha, 3, false, w + (c * shape.out_channel + o) * 9, tile);
+                    for(unsigned long xi {0}; xi < alpha2; ++xi) {
+                        u[xi * plane + o * shape.in_channel + c] = tile[xi];
+                    }
+                }
+            }
+        }
+
+        // z是(alpha * alpha, output_channel, in_channel)，dw += G^T z G，dw是(in_channel, output_channel, 9)
+        template <typename MType>
+        void winograd_weight_grad_add(const ConvShape& shape, unsigned long m, const MType* z, MType* dw) {
+            WinogradMatrix wm {winograd_matrix(m)};
+            unsigned long alpha2 {wm.alpha * wm.alpha};
+            unsigned long plane {shape.out_channel * shape.in_channel};
+            MType tile[6 * 6];
+            MType grad[3 * 3];
+            for(unsigned long c {0}; c < shape.in_channel; ++c) {
+                for(unsigned long o {0}; o < shape.out_channel; ++o) {
+                    for(unsigned long xi {0}; xi < alpha2; ++xi) {
+                        tile[xi] = z[xi * plane + o * shape.in_channel + c];
+                    }
+                    winograd_sandwich(wm.g, wm.alpha, 3, true, tile, grad);
+                    kernel::add(9, grad, dw + (c * shape.out_channel + o) * 9);
+                }
+            }
+        }
+
+        // v是(alpha * alpha, in_channel, tiles)，tile超出填充后图像的部分也按padding值处理，只影响被丢掉的输出
+        template <typename MType>
+        void winograd_transform_input(const ConvShape& shape, unsigned long m, const MType* x, MType padding_value, MType* v) {
+            WinogradMatrix wm {winograd_matrix(m)};
+            WinogradTiles tiles {winograd_tiles(shape, m)};
+            unsigned long t_len {tiles.len()};
+            unsigned long plane {shape.in_channel * t_len};
+            std::vector<MType, utils::Allocator<MType>>& d {winograd_buffer<MType>(3)};
+            std::vector<MType, utils::Allocator<MType>>& temp {winograd_buffer<MType>(4)};
+            d.resize(wm.alpha * wm.alpha * t_len);
+            temp.resize(wm.alpha * wm.alpha * t_len);
+            for(unsigned long c {0}; c < shape.in_channel; ++c) {
+                const MType* x_channel {x + c * shape.in_h * shape.in_w};
+                // 所有tile的(alpha, alpha)输入块摊成(alpha * alpha, tiles)
+                for(unsigned long i {0}; i < wm.alpha; ++i) {
+                    for(unsigned long j {0}; j < wm.alpha; ++j) {
+                        MType* d_row {d.data() + (i * wm.alpha + j) * t_len};
+                        for(unsigned long t_h {0}; t_h < tiles.tiles_h; ++t_h) {
+                            unsigned long h {t_h * m + i};
+                            for(unsigned long t_w {0}; t_w < tiles.tiles_w; ++t_w) {
+                                unsigned long w {t_w * m + j};
+                                bool inside {h >= shape.padding_h && h - shape.padding_h < shape.in_h && w >= shape.padding_w && w - shape.padding_w < shape.in_w};
+                                d_row[t_h * tiles.tiles_w + t_w] = inside ? x_channel[(h - shape.padding_h) * shape.in_w + w - shape.padding_w] : padding_value;
+                            }
+                        }
+                    }
+                }
+                winograd_sandwich_rows(wm.bt, wm.alpha, wm.alpha, false, t_len, d.data(), t_len, temp.data(), v + c * t_len, plane);
+            }
+        }
+
+        // p是(alpha * alpha, output_channel, tiles)，P = A dy A^T，超出输出的位置梯度按0处理
+        template <typename MType>
+        void winograd_transform_grad(const ConvShape& shape, unsigned long m, const MType* g, MType* p) {
+            WinogradMatrix wm {winograd_matrix(m)};
+            WinogradTiles tiles {winograd_tiles(shape, m)};
+            unsigned long t_len {tiles.len()};
+            unsigned long plane {shape.out_channel * t_len};
+            unsigned long output_h {shape.output_h()};
+            unsigned long output_w {shape.output_w()};
+            std::vector<MType, utils::Allocator<MType>>& dy {winograd_buffer<MType>(3)};
+            std::vector<MType, utils::Allocator<MType>>& temp {winograd_buffer<MType>(4)};
+            dy.resize(m * m * t_len);
+            temp.resize(wm.alpha * m * t_len);
+            for(unsigned long o {0}; o < shape.out_channel; ++o) {
+                const MType* g_channel {g + o * output_h * output_w};
+                for(unsigned long i {0}; i < m; ++i) {
+                    for(unsigned long j {0}; j < m; ++j) {
+                        MType* dy_row {dy.data() + (i * m + j) * t_len};
+                        for(unsigned long t_h {0}; t_h < tiles.tiles_h; ++t_h) {
+                            unsigned long h {t_h * m + i};
+                            for(unsigned long t_w {0}; t_w < tiles.tiles_w; ++t_w) {
+                                unsigned long w {t_w * m + j};
+                                dy_row[t_h * tiles.tiles_w + t_w] = h < output_h && w < output_w ? g_channel[h * output_w + w] : MType(0);
+                            }
+                        }
+                    }
+                }
+                winograd_sandwich_rows(wm.at, m, wm.alpha, true, t_len, dy.data(), t_len, temp.data(), p + o * t_len, plane);
+            }
+        }
+
+        // 单张图像的前向，u是winograd_transform_weight的结果，y是(output_channel, output_h * output_w)
+        template <typename MType>
+        void winograd_forward(const ConvShape& shape, unsigned long m, const MType* x, const MType* u, MType padding_value, MType* y) {
+            WinogradMatrix wm {winograd_matrix(m)};
+            WinogradTiles tiles {winograd_tiles(shape, m)};
+            unsigned long alpha2 {wm.alpha * wm.alpha};
+            unsigned long t_len {tiles.len()};
+            unsigned long output_h {shape.output_h()};
+            unsigned long output_w {shape.output_w()};
+            std::vector<MType, utils::Allocator<MType>>& v {winograd_buffer<MType>(0)};
+            std::vector<MType, utils::Allocator<MType>>& mm {winograd_buffer<MType>(1)};
+            v.resize(alpha2 * shape.in_channel * t_len);
+            mm.resize(alpha2 * shape.out_channel * t_len);
+            winograd_transform_input(shape, m, x, padding_value, v.data());
+            for(unsigned long xi {0}; xi < alpha2; ++xi) {
+                gemm<MType>(shape.out_channel, t_len, shape.in_channel, u + xi * shape.out_channel * shape.in_channel, shape.in_channel, v.data() + xi * shape.in_channel * t_len, t_len, mm.data() + xi * shape.out_channel * t_len, t_len);
+            }
+            std::vector<MType, utils::Allocator<MType>>& out {winograd_buffer<MType>(3)};
+            std::vector<MType, utils::Allocator<MType>>& temp {winograd_buffer<MType>(4)};
+            out.resize(m * m * t_len);
+            temp.resize(m * wm.alpha * t_len);
+            for(unsigned long o {0}; o < shape.out_channel; ++o) {
+                winograd_sandwich_rows(wm.at, m, wm.alpha, false, t_len, mm.data() + o * t_len, shape.out_channel * t_len, temp.data(), out.data(), t_len);
+                MType* y_channel {y + o * output_h * output_w};
+                for(unsigned long i {0}; i < m; ++i) {
+                    for(unsigned long j {0}; j < m; ++j) {
+                        const MType* out_row {out.data() + (i * m + j) * t_len};
+                        for(unsigned long t_h {0}; t_h < tiles.tiles_h && t_h * m + i < output_h; ++t_h) {
+                            for(unsigned long t_w {0}; t_w < tiles.tiles_w && t_w * m + j < output_w; ++t_w) {
+                                y_channel[(t_h * m + i) * output_w + t_w * m + j] = out_row[t_h * tiles.tiles_w + t_w];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        // 单张图像对权重的梯度，z += P V^T，z是(alpha * alpha, output_channel, in_channel)，最后用winograd_weight_grad_add变回3x3
+        template <typename MType>
+        void winograd_backward_weight(const ConvShape& shape, unsigned long m, const MType* x, const MType* g, MType padding_value, MType* z) {
+            WinogradMatrix wm {winograd_matrix(m)};
+            unsigned long alpha2 {wm.alpha * wm.alpha};
+            unsigned long t_len {winograd_tiles(shape, m).len()};
+            unsigned long plane {shape.out_channel * shape.in_channel};
+            std::vector<MType, utils::Allocator<MType>>& v {winograd_buffer<MType>(0)};
+            std::vector<MType, utils::Allocator<MType>>& p {winograd_buffer<MType>(1)};
+            std::vector<MType, utils::Allocator<MType>>& z_plane {winograd_buffer<MType>(2)};
+            v.resize(alpha2 * shape.in_channel * t_len);
+            p.resize(alpha2 * shape.out_channel * t_len);
+            z_plane.resize(plane);
+            winograd_transform_input(shape, m, x, padding_value, v.data());
+            winograd_transform_grad(shape, m, g, p.data());
+            for(unsigned long xi {0}; xi < alpha2; ++xi) {
+                gemm<MType>(false, true, shape.out_channel, shape.in_channel, t_len, p.data() + xi * shape.out_channel * t_len, t_len, v.data() + xi * shape.in_channel * t_len, t_len, z_plane.data(), shape.in_channel);
+                kernel::add(plane, z_plane.data(), z + xi * plane);
+            }
+        }
+
+        // 单张图像对输入的梯度，dx += B [U^T P] B^T，重叠的tile直接累加，填充位置的梯度丢掉
+        template <typename MType>
+        void winograd_backward_data(const ConvShape& shape, unsigned long m, const MType* u, const MType* g, MType* dx) {
+            WinogradMatrix wm {winograd_matrix(m)};
+            WinogradTiles tiles {winograd_tiles(shape, m)};
+            unsigned long alpha2 {wm.alpha * wm.alpha};
+            unsigned long t_len {tiles.len()};
+            std::vector<MType, utils::Allocator<MType>>& p {winograd_buffer<MType>(0)};
+            std::vector<MType, utils::Allocator<MType>>& dv {winograd_buffer<MType>(1)};
+            p.resize(alpha2 * shape.out_channel * t_len);
+            dv.resize(alpha2 * shape.in_channel * t_len);
+            winograd_transform_grad(shape, m, g, p.data());
+            for(unsigned long xi {0}; xi < alpha2; ++xi) {
+                gemm<MType>(true, false, shape.in_channel, t_len, shape.out_channel, u + xi * shape.out_channel * shape.in_channel, shape.in_channel, p.data() + xi * shape.out_channel * t_len, t_len, dv.data() + xi * shape.in_channel * t_len, t_len);
+            }
+            std::vector<MType, utils::Allocator<MType>>& dd {winograd_buffer<MType>(3)};
+            std::vector<MType, utils::Allocator<MType>>& temp {winograd_buffer<MType>(4)};
+            dd.resize(alpha2 * t_len);
+            temp.resize(alpha2 * t_len);
+            for(unsigned long c {0}; c < shape.in_channel; ++c) {
+                winograd_sandwich_rows(wm.bt, wm.alpha, wm.alpha, true, t_len, dv.data() + c * t_len, shape.in_channel * t_len, temp.data(), dd.data(), t_len);
+                MType* dx_channel {dx + c * shape.in_h * shape.in_w};
+                for(unsigned long i {0}; i < wm.alpha; ++i) {
+                    for(unsigned long j {0}; j < wm.alpha; ++j) {
+                        const MType* dd_row {dd.data() + (i * wm.alpha + j) * t_len};
+                        for(unsigned long t_h {0}; t_h < tiles.tiles_h; ++t_h) {
+                            unsigned long h {t_h * m + i};
+                            if(h < shape.padding_h || h - shape.padding_h >= shape.in_h) {
+                                continue;
+                            }
+                            for(unsigned long t_w {0}; t_w < tiles.tiles_w; ++t_w) {
+                                unsigned long w {t_w * m + j};
+                                if(w >= shape.padding_w && w - shape.padding_w < shape.in_w) {
+                                    dx_channel[(h - shape.padding_h) * shape.in_w + w - shape.padding_w] += dd_row[t_h * tiles.tiles_w + t_w];
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        // AEDLF_WINOGRAD=check时用，result和img2col算出来的reference逐个比较
+        template <typename MType>
+        void winograd_check(unsigned long n, const MType* reference, const MType* result) {
+            for(unsigned long i {0}; i < n; ++i) {
+                MType scale {std::max(MType(1), MType(std::abs(reference[i])))};
+                if(std::abs(reference[i] - result[i]) > winograd_tolerance<MType>() * scale) {
+                    throw std::runtime_error("Winograd convolution differs from the img2col result");
+                }
+            }
+        }
+    }
+}
@@ -1,6 +1,6 @@
 #pragma once
 #include "../graph/graph.hpp"
-#include "../graph/node/base.hpp"
+#include "../graph/node/common/base.hpp"
 #include <memory>
 
 
@@ -0,0 +1,352 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+
+namespace aedlf {
+    namespace utils {
+        /*
+        Matrix的内存来源，所有实现返回的地址都按64字节对齐，方便SIMD整块加载
+        SystemResource直接走malloc，PoolResource按2的幂分档缓存释放掉的块
+        ScratchArena是按步重置的bump分配器，释放什么都不做，reset以后整块复用
+        环境变量AEDLF_ALLOCATOR=system/pool选择默认的内存来源，默认是pool
+        */
+        const std::size_t memory_alignment {64};
+
+        class MemoryResource {
+            public:
+                virtual ~MemoryResource() {};
+                virtual void* allocate(std::size_t bytes) = 0;
+                virtual void deallocate(void* p, std::size_t bytes) = 0;
+        };
+
+        inline void* aligned_malloc(std::size_t bytes) {
+            // 多申请一个对齐量，把原始地址存在返回地址的前面
+            void* raw {std::malloc(bytes + memory_alignment + sizeof(void*))};
+            if(raw == nullptr) {
+                throw std::bad_alloc();
+            }
+            std::uintptr_t start {reinterpret_cast<std::uintptr_t>(raw) + sizeof(void*)};
+            std::uintptr_t aligned {(start + memory_alignment - 1) & ~(std::uintptr_t(memory_alignment) - 1)};
+            reinterpret_cast<void**>(aligned)[-1] = raw;
+            return reinterpret_cast<void*>(aligned);
+        }
+
+        inline void aligned_free(void* p) {
+            if(p != nullptr) {
+                std::free(reinterpret_cast<void**>(p)[-1]);
+            }
+        }
+
+        class SystemResource : public MemoryResource {
+            public:
+                void* allocate(std::size_t bytes) override {
+                    return aligned_malloc(bytes);
+                };
+                void deallocate(void* p, std::size_t) override {
+                    aligned_free(p);
+                };
+        };
+
+        class PoolResource : public MemoryResource {
+            public:
+                PoolResource() : free_lists(class_num) {};
+                PoolResource(const PoolResource&) = delete;
+                PoolResource& operator=(const PoolResource&) = delete;
+                ~PoolResource();
+                void* allocate(std::size_t bytes) override;
+                void deallocate(void* p, std::size_t bytes) override;
+                void release(); // 把缓存的块都还给系统
+                std::size_t get_cached_bytes() const;
+            private:
+                static const std::size_t min_class_bytes {64};
+                static const std::size_t class_num {21}; // 64B ~ 64MB，更大的直接走系统
+                static std::size_t size_class(std::size_t bytes);
+                std::vector<std::vector<void*>> free_lists;
+                std::size_t cached_bytes {0};
+                mutable std::mutex lock;
+        };
+
+        inline PoolResource::~PoolResource() {
+            release();
+        }
+
+        inline std::size_t PoolResource::size_class(std::size_t bytes) {
+            std::size_t class_id {0};
+            std::size_t class_bytes {min_class_bytes};
+            while(class_bytes < bytes && class_id < class_num) {
+                class_bytes <<= 1;
+                ++class_id;
+            }
+            return class_id;
+        }
+
+        inline void* PoolResource::allocate(std::size_t bytes) {
+            std::size_t class_id {size_class(bytes)};
+            if(class_id == class_num) {
+                return aligned_malloc(bytes);
+            }
+            {
+                std::lock_guard<std::mutex> guard {lock};
+                std::vector<void*>& free_list {free_lists[class_id]};
+                if(!free_list.empty()) {
+                    void* p {free_list.back()};
+                    free_list.pop_back();
+                    cached_bytes -= min_class_bytes << class_id;
+                    return p;
+                }
+            }
+            return aligned_malloc(min_class_bytes << class_id);
+        }
+
+        inline void PoolResource::deallocate(void* p, std::size_t bytes) {
+            if(p == nullptr) {
+                return;
+            }
+            std::size_t class_id {size_class(bytes)};
+            if(class_id == class_num) {
+                aligned_free(p);
+                return;
+            }
+            std::lock_guard<std::mutex> guard {lock};
+            free_lists[class_id].push_back(p);
+            cached_bytes += min_class_bytes << class_id;
+        }
+
+        inline void PoolResource::release() {
+            std::lock_guard<std::mutex> guard {lock};
+            for(std::size_t class_id {0}; class_id < free_lists.size(); ++class_id) {
+                for(std::size_t i {0}; i < free_lists[class_id].size(); ++i) {
+                    aligned_free(free_lists[class_id][i]);
+                }
+                free_lists[class_id].clear();
+            }
+            cached_bytes = 0;
+        }
+
+        inline std::size_t PoolResource::get_cached_bytes() const {
+            std::lock_guard<std::mutex> guard {lock};
+            return cached_bytes;
+        }
+
+        class ScratchArena : public MemoryResource {
+            public:
+                explicit ScratchArena(std::size_t block_bytes = 1 << 20) : block_bytes_(block_bytes) {};
+                ScratchArena(const ScratchArena&) = delete;
+                ScratchArena& operator=(const ScratchArena&) = delete;
+                ~ScratchArena();
+                void* allocate(std::size_t bytes) override;
+                void deallocate(void*, std::size_t) override {};
+                void reset(); // 之前分配出去的内存全部作废
+                std::size_t get_used_bytes() const;
+                std::size_t get_capacity() const;
+            private:
+                struct Block {
+                    char* data;
+                    std::size_t size;
+                };
+                std::vector<Block> blocks;
+                std::size_t block_bytes_;
+                std::size_t block_i {0};
+                std::size_t offset {0};
+                std::size_t used_bytes {0};
+                std::size_t peak_bytes {0};
+                mutable std::mutex lock;
+        };
+
+        inline ScratchArena::~ScratchArena() {
+            for(std::size_t i {0}; i < blocks.size(); ++i) {
+                aligned_free(blocks[i].data);
+            }
+        }
+
+        inline void* ScratchArena::allocate(std::size_t bytes) {
+            std::size_t aligned_bytes {(bytes + memory_alignment - 1) & ~(memory_alignment - 1)};
+            std::lock_guard<std::mutex> guard {lock};
+            while(block_i < blocks.size() && offset + aligned_bytes > blocks[block_i].size) {
+                ++block_i;
+                offset = 0;
+            }
+            if(block_i == blocks.size()) {
+                std::size_t size {aligned_bytes > block_bytes_ ? aligned_bytes : block_bytes_};
+                blocks.push_back(Block {static_cast<char*>(aligned_malloc(size)), size});
+                offset = 0;
+            }
+            void* p {blocks[block_i].data + offset};
+            offset += aligned_bytes;
+            used_bytes += aligned_bytes;
+            peak_bytes = used_bytes > peak_bytes ? used_bytes : peak_bytes;
+            return p;
+        }
+
+        inline void ScratchArena::reset() {
+            std::lock_guard<std::mutex> guard {lock};
+            if(blocks.size() > 1) {
+                // 上一步用了多个块，合并成一个足够大的块，之后每步只用一块
+                for(std::size_t i {0}; i < blocks.size(); ++i) {
+                    aligned_free(blocks[i].data);
+                }
+                blocks.clear();
+                std::size_t size {peak_bytes > block_bytes_ ? peak_bytes : block_bytes_};
+                blocks.push_back(Block {static_cast<char*>(aligned_malloc(size)), size});
+            }
+            block_i = 0;
+            offset = 0;
+            used_bytes = 0;
+        }
+
+        inline std::size_t ScratchArena::get_used_bytes() const {
+            std::lock_guard<std::mutex> guard {lock};
+            return used_bytes;
+        }
+
+        inline std::size_t ScratchArena::get_capacity() const {
+            std::lock_guard<std::mutex> guard {lock};
+            std::size_t capacity {0};
+            for(std::size_t i {0}; i < blocks.size(); ++i) {
+                capacity += blocks[i].size;
+            }
+            return capacity;
+        }
+
+        // 进程级的内存来源，故意不析构，避免静态对象析构顺序的问题
+        inline MemoryResource* system_resource() {
+            static MemoryResource* resource {new SystemResource {}};
+            return resource;
+        }
+
+        inline PoolResource* pool_resource() {
+            static PoolResource* resource {new PoolResource {}};
+            return resource;
+        }
+
+        inline MemoryResource*& default_resource_slot() {
+            static MemoryResource* resource {[] {
+                const char* env_allocator {std::getenv("AEDLF_ALLOCATOR")};
+                if(env_allocator != nullptr && std::strcmp(env_allocator, "system") == 0) {
+                    return system_resource();
+                }
+                return static_cast<MemoryResource*>(pool_resource());
+            }()};
+            return resource;
+        }
+
+        inline MemoryResource* default_resource() {
+            return default_resource_slot();
+        }
+
+        inline void set_default_resource(MemoryResource* resource) {
+            default_resource_slot() = resource == nullptr ? system_resource() : resource;
+        }
+
+        inline MemoryResource*& scratch_resource_slot() {
+            static thread_local MemoryResource* resource {nullptr};
+            return resource;
+        }
+
+        // 当前线程新建的Matrix从哪里分配，ScratchScope里是scratch，否则是默认来源
+        inline MemoryResource* current_resource() {
+            MemoryResource* scratch {scratch_resource_slot()};
+            return scratch != nullptr ? scratch : default_resource();
+        }
+
+        /*
+        作用域内当前线程新建的Matrix都从arena里分配，离开作用域恢复
+        只能用来包住临时变量，分配出来的内存在arena reset以后就失效了
+        */
+        class ScratchScope {
+            public:
+                explicit ScratchScope(ScratchArena& arena) : previous(scratch_resource_slot()) {
+                    scratch_resource_slot() = &arena;
+                };
+                ScratchScope(const ScratchScope&) = delete;
+                ScratchScope& operator=(const ScratchScope&) = delete;
+                ~ScratchScope() {
+                    scratch_resource_slot() = previous;
+                };
+            private:
+                MemoryResource* previous;
+        };
+
+        // 作用域内暂时关掉scratch，给需要活过当前步的内存用
+        class NoScratchScope {
+            public:
+                NoScratchScope() : previous(scratch_resource_slot()) {
+                    scratch_resource_slot() = nullptr;
+                };
+                NoScratchScope(const NoScratchScope&) = delete;
+                NoScratchScope& operator=(const NoScratchScope&) = delete;
+                ~NoScratchScope() {
+                    scratch_resource_slot() = previous;
+                };
+            private:
+                MemoryResource* previous;
+        };
+
+        // 当前线程通过Allocator申请过的字节数，只增不减，profiler用前后的差值算一段代码分配了多少
+        inline unsigned long long& allocated_bytes_counter() {
+            static thread_local unsigned long long counter {0};
+            return counter;
+        }
+
+        inline unsigned long long allocated_bytes() {
+            return allocated_bytes_counter();
+        }
+
+        /*
+        标准库接口的分配器，构造时记下当时的内存来源，之后的分配和释放都走同一个来源
+        拷贝容器时重新取当前的来源，scratch里的临时变量拷贝出去以后不会跟着失效
+        */
+        template <typename T>
+        class Allocator {
+            public:
+                using value_type = T;
+                using propagate_on_container_copy_assignment = std::false_type;
+                using propagate_on_container_move_assignment = std::true_type;
+                using propagate_on_container_swap = std::true_type;
+                template <typename U>
+                struct rebind {
+                    using other = Allocator<U>;
+                };
+                Allocator() : resource(current_resource()) {};
+                explicit Allocator(MemoryResource* r) : resource(r) {};
+                template <typename U>
+                Allocator(const Allocator<U>& other) : resource(other.get_resource()) {};
+                T* allocate(std::size_t n) {
+                    if(n > std::numeric_limits<std::size_t>::max() / sizeof(T)) {
+                        throw std::bad_alloc();
+                    }
+                    allocated_bytes_counter() += n * sizeof(T);
+                    return static_cast<T*>(resource->allocate(n * sizeof(T)));
+                };
+                void deallocate(T* p, std::size_t n) {
+                    resource->deallocate(p, n * sizeof(T));
+                };
+                Allocator select_on_container_copy_construction() const {
+                    return Allocator {};
+                };
+                MemoryResource* get_resource() const {
+                    return resource;
+                };
+            private:
+                MemoryResource* resource;
+        };
+
+        template <typename T, typename U>
+        bool operator==(const Allocator<T>& a, const Allocator<U>& b) {
+            return a.get_resource() == b.get_resource();
+        }
+
+        template <typename T, typename U>
+        bool operator!=(const Allocator<T>& a, const Allocator<U>& b) {
+            return !(a == b);
+        }
+    }
+}
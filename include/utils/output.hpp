@@ -6,7 +6,7 @@ namespace aedlf {
     namespace utils {
         template <typename MType>
         void print_matrix(Matrix<MType>& m) {
-            const std::shared_ptr<std::vector<MType>> m_data_p = m.get_data();
+            const typename Matrix<MType>::matrix_data_p m_data_p = m.get_data();
             const std::vector<unsigned long> m_dim = m.get_dim();
             std::cout << "[";
             for(unsigned long n {0}; n < m_dim[0]; ++n) {
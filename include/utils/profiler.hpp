@@ -0,0 +1,318 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "allocator.hpp"
+
+
+namespace aedlf {
+    namespace utils {
+        /*
+        按节点名记录每次forward/backward/update的耗时、分配的字节数和浮点运算量估计
+        关掉时ProfileScope只读一次开关；打开时每个事件带上所在的迭代号，Graph::forward开始一次新的迭代
+        事件可以嵌套（组件的forward里调用节点的forward），汇总表里self是去掉内层事件以后自己的部分
+        字节数只统计当前线程通过Allocator申请的内存，parallel_for里worker的分配不算在内
+        环境变量AEDLF_PROFILE=文件名时程序启动就打开，退出时把Chrome trace写到这个文件，汇总表打到stderr
+        */
+        struct ProfileEvent {
+            std::string name;
+            std::string category; // forward/backward/update，组件的是component_forward等
+            double start_us;
+            double duration_us;
+            double self_us;
+            unsigned long long bytes;
+            unsigned long long self_bytes;
+            double flops;
+            unsigned long iteration;
+            unsigned long thread_id;
+        };
+
+        class Profiler {
+            public:
+                static Profiler& global();
+                Profiler();
+                Profiler(const Profiler&) = delete;
+                Profiler& operator=(const Profiler&) = delete;
+                ~Profiler();
+                void enable();
+                void disable();
+                bool is_enabled() const;
+                void clear(); // 清掉已经记录的事件，迭代号归零
+                void next_iteration();
+                unsigned long get_iteration() const;
+                double now_us() const; // 相对profiler创建时刻的微秒数
+                void record(const ProfileEvent& event);
+                std::vector<ProfileEvent> get_events() const;
+                void write_trace(std::ostream& out) const; // Chrome trace_event格式，chrome://tracing或perfetto直接打开
+                void write_trace(const std::string& path) const;
+                void write_summary(std::ostream& out) const; // 按节点名和类别汇总，按self时间从大到小排
+            private:
+                static unsigned long thread_index();
+                std::chrono::steady_clock::time_point origin;
+                std::atomic<bool> enabled {false};
+                std::atomic<unsigned long> iteration {0};
+                std::vector<ProfileEvent> events;
+                std::string exit_trace_path;
+                mutable std::mutex lock;
+        };
+
+        /*
+        RAII的计时区间，析构时把事件交给Profiler::global()
+        flops一般在调用结束以后才知道尺寸，用set_flops补上，关掉时不要去算它
+        */
+        class ProfileScope {
+            public:
+                ProfileScope(const std::string& name, const char* category);
+                ProfileScope(const ProfileScope&) = delete;
+                ProfileScope& operator=(const ProfileScope&) = delete;
+                ~ProfileScope();
+                bool is_active() const;
+                void set_flops(double flops);
+            private:
+                static ProfileScope*& current();
+                bool active;
+                std::string name; // 只在打开时拷贝
+                const char* category;
+                ProfileScope* outer {nullptr};
+                double start_us {0};
+                unsigned long long start_bytes {0};
+                double inner_us {0};
+                unsigned long long inner_bytes {0};
+                double flops {0};
+        };
+
+        inline Profiler& Profiler::global() {
+            static Profiler profiler;
+            return profiler;
+        }
+
+        inline Profiler::Profiler() : origin(std::chrono::steady_clock::now()) {
+            const char* env_profile {std::getenv("AEDLF_PROFILE")};
+            if(env_profile != nullptr && env_profile[0] != '\0') {
+                exit_trace_path = env_profile;
+                enabled = true;
+            }
+        }
+
+        inline Profiler::~Profiler() {
+            if(exit_trace_path.empty()) {
+                return;
+            }
+            try {
+                write_trace(exit_trace_path);
+                write_summary(std::cerr);
+            }
+            catch(const std::exception& e) {
+                std::cerr << e.what() << std::endl;
+            }
+        }
+
+        inline void Profiler::enable() {
+            enabled = true;
+        }
+
+        inline void Profiler::disable() {
+            enabled = false;
+        }
+
+        inline bool Profiler::is_enabled() const {
+            return enabled.load(std::memory_order_relaxed);
+        }
+
+        inline void Profiler::clear() {
+            std::lock_guard<std::mutex> guard {lock};
+            events.clear();
+            iteration = 0;
+        }
+
+        inline void Profiler::next_iteration() {
+            if(is_enabled()) {
+                ++iteration;
+            }
+        }
+
+        inline unsigned long Profiler::get_iteration() const {
+            return iteration;
+        }
+
+        inline double Profiler::now_us() const {
+            return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - origin).count();
+        }
+
+        inline unsigned long Profiler::thread_index() {
+            // trace里的tid用小整数，按线程第一次记录事件的顺序编号
+            static std::atomic<unsigned long> next_index {0};
+            static thread_local unsigned long index {next_index++};
+            return index;
+        }
+
+        inline void Profiler::record(const ProfileEvent& event) {
+            std::lock_guard<std::mutex> guard {lock};
+            events.push_back(event);
+            events.back().iteration = iteration;
+            events.back().thread_id = thread_index();
+        }
+
+        inline std::vector<ProfileEvent> Profiler::get_events() const {
+            std::lock_guard<std::mutex> guard {lock};
+            return events;
+        }
+
+        inline void profile_json_string(std::ostream& out, const std::string& s) {
+            out << '"';
+            for(char ch : s) {
+                if(ch == '"' || ch == '\\') {
+                    out << '\\' << ch;
+                }
+                else if(static_cast<unsigned char>(ch) < 0x20) {
+                    char escaped[8];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned char>(ch));
+                    out << escaped;
+                }
+                else {
+                    out << ch;
+                }
+            }
+            out << '"';
+        }
+
+        inline void Profiler::write_trace(std::ostream& out) const {
+            std::vector<ProfileEvent> snapshot {get_events()};
+            std::ios::fmtflags flags {out.flags()};
+            out << std::fixed << std::setprecision(3);
+            out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+            for(size_t i {0}; i < snapshot.size(); ++i) {
+                const ProfileEvent& event {snapshot[i]};
+                out << "{\"name\": ";
+                profile_json_string(out, event.name);
+                out << ", \"cat\": ";
+                profile_json_string(out, event.category);
+                out << ", \"ph\": \"X\", \"pid\": 0, \"tid\": " << event.thread_id;
+                out << ", \"ts\": " << event.start_us << ", \"dur\": " << event.duration_us;
+                out << ", \"args\": {\"iteration\": " << event.iteration << ", \"bytes\": " << event.bytes;
+                out << ", \"self_bytes\": " << event.self_bytes << ", \"flops\": " << event.flops << "}}";
+                out << (i + 1 == snapshot.size() ? "\n" : ",\n");
+            }
+            out << "]}\n";
+            out.flags(flags);
+        }
+
+        inline void Profiler::write_trace(const std::string& path) const {
+            std::ofstream out {path};
+            if(!out) {
+                throw std::runtime_error("Can not open profile trace file `" + path + "`");
+            }
+            write_trace(out);
+        }
+
+        inline void Profiler::write_summary(std::ostream& out) const {
+            struct Row {
+                std::string name;
+                std::string category;
+                unsigned long calls {0};
+                double total_us {0};
+                double self_us {0};
+                unsigned long long self_bytes {0};
+                double flops {0};
+            };
+            std::vector<ProfileEvent> snapshot {get_events()};
+            std::map<std::pair<std::string, std::string>, Row> rows;
+            double self_sum {0};
+            unsigned long first_iteration {snapshot.empty() ? 0 : snapshot.front().iteration};
+            unsigned long last_iteration {first_iteration};
+            for(const ProfileEvent& event : snapshot) {
+                Row& row {rows[std::make_pair(event.name, event.category)]};
+                row.name = event.name;
+                row.category = event.category;
+                ++row.calls;
+                row.total_us += event.duration_us;
+                row.self_us += event.self_us;
+                row.self_bytes += event.self_bytes;
+                row.flops += event.flops;
+                self_sum += event.self_us;
+                first_iteration = std::min(first_iteration, event.iteration);
+                last_iteration = std::max(last_iteration, event.iteration);
+            }
+            std::vector<Row> sorted;
+            for(const auto& row : rows) {
+                sorted.push_back(row.second);
+            }
+            std::sort(sorted.begin(), sorted.end(), [](const Row& a, const Row& b) {
+                return a.self_us > b.self_us;
+            });
+            // 每行的时间、字节、运算量都是平均到一次迭代上的
+            double iterations {static_cast<double>(last_iteration - first_iteration + 1)};
+            size_t name_width {4};
+            for(const Row& row : sorted) {
+                name_width = std::max(name_width, row.name.size());
+            }
+            std::ios::fmtflags flags {out.flags()};
+            out << "profile: " << snapshot.size() << " events, " << static_cast<unsigned long>(iterations) << " iterations, per iteration:\n";
+            out << std::left << std::setw(name_width + 2) << "name" << std::setw(20) << "category" << std::right
+                << std::setw(8) << "calls" << std::setw(12) << "total(ms)" << std::setw(12) << "self(ms)" << std::setw(8) << "self%"
+                << std::setw(14) << "alloc(KB)" << std::setw(12) << "MFLOP" << std::setw(10) << "GFLOPS" << "\n";
+            out << std::fixed;
+            for(const Row& row : sorted) {
+                out << std::left << std::setw(name_width + 2) << row.name << std::setw(20) << row.category << std::right
+                    << std::setw(8) << std::setprecision(1) << row.calls / iterations
+                    << std::setw(12) << std::setprecision(3) << row.total_us / iterations / 1e3
+                    << std::setw(12) << row.self_us / iterations / 1e3
+                    << std::setw(8) << std::setprecision(1) << (self_sum > 0 ? row.self_us / self_sum * 100 : 0)
+                    << std::setw(14) << row.self_bytes / iterations / 1024
+                    << std::setw(12) << std::setprecision(3) << row.flops / iterations / 1e6
+                    << std::setw(10) << std::setprecision(2) << (row.self_us > 0 ? row.flops / row.self_us / 1e3 : 0) << "\n";
+            }
+            out.flags(flags);
+        }
+
+        inline ProfileScope*& ProfileScope::current() {
+            static thread_local ProfileScope* scope {nullptr};
+            return scope;
+        }
+
+        inline ProfileScope::ProfileScope(const std::string& name, const char* category) : active(Profiler::global().is_enabled()), category(category) {
+            if(!active) {
+                return;
+            }
+            this->name = name;
+            outer = current();
+            current() = this;
+            start_bytes = allocated_bytes();
+            start_us = Profiler::global().now_us();
+        }
+
+        inline ProfileScope::~ProfileScope() {
+            if(!active) {
+                return;
+            }
+            double duration_us {Profiler::global().now_us() - start_us};
+            unsigned long long bytes {allocated_bytes() - start_bytes};
+            current() = outer;
+            if(outer != nullptr) {
+                outer->inner_us += duration_us;
+                outer->inner_bytes += bytes;
+            }
+            Profiler::global().record(ProfileEvent {name, category, start_us, duration_us, duration_us - inner_us, bytes, bytes - inner_bytes, flops, 0, 0});
+        }
+
+        inline bool ProfileScope::is_active() const {
+            return active;
+        }
+
+        inline void ProfileScope::set_flops(double flops) {
+            this->flops = flops;
+        }
+    }
+}
@@ -0,0 +1,303 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace aedlf {
+    namespace utils {
+        /*
+        进程级的work-stealing线程池，Matrix和MakeMatrix的kernel通过parallel_for提交任务
+        每个worker有自己的双端队列，自己从队尾取，空闲时从其他worker的队头偷
+        等待任务完成的线程（包括worker自己）也会参与执行，所以嵌套的parallel_for不会死锁
+        worker数量默认取环境变量AEDLF_NUM_THREADS，否则取hardware_concurrency - 1（调用线程本身也会干活）
+        任务里抛出的异常记在所属的TaskGroup上，等整组任务都结束之后在调用线程重新抛出
+        */
+        class ThreadPool {
+            public:
+                using range_func = std::function<void(unsigned long, unsigned long)>;
+                using index_func = std::function<void(unsigned long)>;
+                static ThreadPool& global();
+                explicit ThreadPool(unsigned long worker_num);
+                ThreadPool(const ThreadPool&) = delete;
+                ThreadPool& operator=(const ThreadPool&) = delete;
+                ~ThreadPool();
+                void set_worker_num(unsigned long worker_num);
+                unsigned long get_worker_num() const;
+                void set_serial_threshold(unsigned long threshold);
+                unsigned long get_serial_threshold() const;
+                void parallel_for(unsigned long task_num, unsigned long task_cost, const index_func& func);
+                void parallel_for_range(unsigned long task_num, unsigned long task_cost, const range_func& func);
+            private:
+                struct TaskGroup {
+                    std::atomic<unsigned long> pending {0};
+                    std::mutex error_lock;
+                    std::exception_ptr error; // 只保留第一个异常
+                };
+                struct Task {
+                    std::function<void()> func;
+                    TaskGroup* group;
+                };
+                struct WorkerQueue {
+                    std::mutex lock;
+                    std::deque<Task> tasks;
+                };
+                void start(unsigned long worker_num);
+                void stop();
+                void worker_loop(unsigned long worker_id);
+                void push(Task task);
+                bool try_pop(unsigned long queue_id, Task& task);
+                bool try_steal(unsigned long thief_id, Task& task);
+                bool try_get(Task& task);
+                void run(Task& task);
+                void wait(TaskGroup& group);
+                static long& current_worker();
+                static unsigned long default_worker_num();
+                std::vector<std::unique_ptr<WorkerQueue>> queues;
+                std::vector<std::thread> workers;
+                std::mutex sleep_lock;
+                std::condition_variable sleep_cv;
+                std::atomic<unsigned long> queued {0};
+                std::atomic<unsigned long> next_queue {0};
+                std::atomic<unsigned long> serial_threshold {1 << 14};
+                bool stopping {false};
+        };
+
+        inline ThreadPool& ThreadPool::global() {
+            static ThreadPool pool {default_worker_num()};
+            return pool;
+        }
+
+        inline unsigned long ThreadPool::default_worker_num() {
+            const char* env_num {std::getenv("AEDLF_NUM_THREADS")};
+            if(env_num != nullptr) {
+                long num {std::atol(env_num)};
+                // 环境变量里的数量包括调用线程
+                return num > 1 ? static_cast<unsigned long>(num - 1) : 0;
+            }
+            unsigned long hw {std::thread::hardware_concurrency()};
+            return hw > 1 ? hw - 1 : 0;
+        }
+
+        inline long& ThreadPool::current_worker() {
+            static thread_local long worker_id {-1};
+            return worker_id;
+        }
+
+        inline ThreadPool::ThreadPool(unsigned long worker_num) {
+            start(worker_num);
+        }
+
+        inline ThreadPool::~ThreadPool() {
+            stop();
+        }
+
+        inline void ThreadPool::start(unsigned long worker_num) {
+            stopping = false;
+            // 至少保留一个队列给外部线程提交任务
+            unsigned long queue_num {worker_num > 0 ? worker_num : 1};
+            for(unsigned long i {0}; i < queue_num; ++i) {
+                queues.emplace_back(new WorkerQueue {});
+            }
+            for(unsigned long i {0}; i < worker_num; ++i) {
+                workers.emplace_back(&ThreadPool::worker_loop, this, i);
+            }
+        }
+
+        inline void ThreadPool::stop() {
+            {
+                std::lock_guard<std::mutex> guard {sleep_lock};
+                stopping = true;
+            }
+            sleep_cv.notify_all();
+            for(auto& t : workers) {
+                t.join();
+            }
+            workers.clear();
+            queues.clear();
+        }
+
+        inline void ThreadPool::set_worker_num(unsigned long worker_num) {
+            // 不能在还有任务在执行的时候调用
+            if(worker_num == workers.size()) {
+                return;
+            }
+            stop();
+            start(worker_num);
+        }
+
+        inline unsigned long ThreadPool::get_worker_num() const {
+            return workers.size();
+        }
+
+        inline void ThreadPool::set_serial_threshold(unsigned long threshold) {
+            serial_threshold = threshold;
+        }
+
+        inline unsigned long ThreadPool::get_serial_threshold() const {
+            return serial_threshold;
+        }
+
+        inline void ThreadPool::push(Task task) {
+            long worker_id {current_worker()};
+            unsigned long queue_id;
+            if(worker_id >= 0 && static_cast<unsigned long>(worker_id) < queues.size()) {
+                queue_id = worker_id;
+            }
+            else {
+                queue_id = next_queue.fetch_add(1) % queues.size();
+            }
+            {
+                std::lock_guard<std::mutex> guard {queues[queue_id]->lock};
+                queues[queue_id]->tasks.push_back(std::move(task));
+            }
+            {
+                std::lock_guard<std::mutex> guard {sleep_lock};
+                ++queued;
+            }
+            sleep_cv.notify_one();
+        }
+
+        inline bool ThreadPool::try_pop(unsigned long queue_id, Task& task) {
+            WorkerQueue& q {*queues[queue_id]};
+            std::lock_guard<std::mutex> guard {q.lock};
+            if(q.tasks.empty()) {
+                return false;
+            }
+            task = std::move(q.tasks.back());
+            q.tasks.pop_back();
+            --queued;
+            return true;
+        }
+
+        inline bool ThreadPool::try_steal(unsigned long thief_id, Task& task) {
+            unsigned long queue_num {queues.size()};
+            for(unsigned long i {1}; i <= queue_num; ++i) {
+                WorkerQueue& q {*queues[(thief_id + i) % queue_num]};
+                std::lock_guard<std::mutex> guard {q.lock};
+                if(q.tasks.empty()) {
+                    continue;
+                }
+                task = std::move(q.tasks.front());
+                q.tasks.pop_front();
+                --queued;
+                return true;
+            }
+            return false;
+        }
+
+        inline bool ThreadPool::try_get(Task& task) {
+            long worker_id {current_worker()};
+            if(worker_id >= 0 && static_cast<unsigned long>(worker_id) < queues.size()) {
+                if(try_pop(worker_id, task)) {
+                    return true;
+                }
+                return try_steal(worker_id, task);
+            }
+            return try_steal(0, task);
+        }
+
+        inline void ThreadPool::run(Task& task) {
+            try {
+                task.func();
+            }
+            catch(...) {
+                // 不能让异常离开worker，否则直接terminate
+                std::lock_guard<std::mutex> guard {task.group->error_lock};
+                if(!task.group->error) {
+                    task.group->error = std::current_exception();
+                }
+            }
+            task.group->pending.fetch_sub(1);
+        }
+
+        inline void ThreadPool::worker_loop(unsigned long worker_id) {
+            current_worker() = worker_id;
+            Task task;
+            while(true) {
+                if(try_get(task)) {
+                    run(task);
+                    continue;
+                }
+                std::unique_lock<std::mutex> guard {sleep_lock};
+                sleep_cv.wait(guard, [this] { return stopping || queued > 0; });
+                if(stopping && queued == 0) {
+                    return;
+                }
+            }
+        }
+
+        inline void ThreadPool::wait(TaskGroup& group) {
+            Task task;
+            while(group.pending > 0) {
+                if(try_get(task)) {
+                    run(task);
+                }
+                else {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+        inline void ThreadPool::parallel_for_range(unsigned long task_num, unsigned long task_cost, const range_func& func) {
+            if(task_num == 0) {
+                return;
+            }
+            unsigned long worker_num {workers.size()};
+            if(worker_num == 0 || task_num == 1 || task_num * task_cost < serial_threshold) {
+                func(0, task_num);
+                return;
+            }
+            // 切成若干段，保证每段的计算量不低于阈值，同时段数足够让worker之间偷任务做负载均衡
+            unsigned long max_chunk_num {(worker_num + 1) * 4};
+            unsigned long min_chunk_len {task_cost > 0 ? (serial_threshold + task_cost - 1) / task_cost : task_num};
+            unsigned long chunk_len {(task_num + max_chunk_num - 1) / max_chunk_num};
+            if(chunk_len < min_chunk_len) {
+                chunk_len = min_chunk_len;
+            }
+            unsigned long chunk_num {(task_num + chunk_len - 1) / chunk_len};
+            if(chunk_num <= 1) {
+                func(0, task_num);
+                return;
+            }
+            TaskGroup group;
+            group.pending = chunk_num - 1;
+            for(unsigned long chunk {1}; chunk < chunk_num; ++chunk) {
+                unsigned long begin {chunk * chunk_len};
+                unsigned long end {begin + chunk_len < task_num ? begin + chunk_len : task_num};
+                push(Task {[&func, begin, end] { func(begin, end); }, &group});
+            }
+            // 调用线程处理第一段，然后帮忙处理剩下的
+            // 队列里的任务引用着栈上的group和func，第一段抛异常也要等它们都结束再离开
+            std::exception_ptr error;
+            try {
+                func(0, chunk_len);
+            }
+            catch(...) {
+                error = std::current_exception();
+            }
+            wait(group);
+            if(!error) {
+                error = group.error;
+            }
+            if(error) {
+                std::rethrow_exception(error);
+            }
+        }
+
+        inline void ThreadPool::parallel_for(unsigned long task_num, unsigned long task_cost, const index_func& func) {
+            parallel_for_range(task_num, task_cost, [&func](unsigned long begin, unsigned long end) {
+                for(unsigned long i {begin}; i < end; ++i) {
+                    func(i);
+                }
+            });
+        }
+    }
+}
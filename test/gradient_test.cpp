@@ -0,0 +1,82 @@
+#include "test.hpp"
+#include "net.hpp"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+
+namespace {
+    /*
+    反向传播的梯度和中心差分比较，double下误差要在5e-8以内
+    3x3、stride 1的融合卷积默认走Winograd，ctest里再用AEDLF_WINOGRAD=off和2各跑一遍，覆盖img2col和F(2x2)
+    */
+    using namespace aedlf;
+    using test::node_ptr;
+
+    const double fd_step {1e-5};
+    const double fd_tolerance {5e-8};
+    const unsigned long fd_samples {24}; // 每个参数最多检查这么多个位置，均匀分布
+
+    double loss_value(graph::Graph<double>& g) {
+        g.forward();
+        return g.get_output()->get_data().get(0);
+    }
+
+    void check_gradient(graph::Graph<double>& g) {
+        std::vector<node_ptr> params {test::parameters(g)};
+        test::check(!params.empty(), "graph has no parameter");
+        g.forward();
+        g.backward();
+        for(const node_ptr& param : params) {
+            Matrix<double> grad {param->get_jacobi()};
+            Matrix<double>& value {param->get_m_data()};
+            unsigned long len {value.get_data()->size()};
+            test::check(grad.get_dim() == value.get_dim(), param->get_name() + " gradient shape is not match");
+            unsigned long step {len > fd_samples ? len / fd_samples : 1};
+            double error {0};
+            for(unsigned long i {0}; i < len; i += step) {
+                double origin {value.get(i)};
+                value.set(i, origin + fd_step);
+                double loss_plus {loss_value(g)};
+                value.set(i, origin - fd_step);
+                double loss_minus {loss_value(g)};
+                value.set(i, origin);
+                double numeric {(loss_plus - loss_minus) / (2 * fd_step)};
+                error = std::max(error, std::fabs(numeric - grad.get(i)));
+            }
+            test::check_near(error, fd_tolerance, param->get_name() + " gradient");
+        }
+    }
+
+    // 先按原来的batch检查，再换一个batch大小不重建图检查一次
+    void check_net(test::Net& net, unsigned long new_batch) {
+        graph::Graph<double> g {net.loss};
+        check_gradient(g);
+        test::next_batch(net, new_batch);
+        check_gradient(g);
+    }
+}
+
+AEDLF_TEST(fc_gradient) {
+    test::Net net {test::make_fc_net(5)};
+    check_net(net, 3);
+}
+
+AEDLF_TEST(conv_unfused_gradient) {
+    test::Net net {test::make_conv_net(3, false, 1)};
+    check_net(net, 2);
+}
+
+AEDLF_TEST(conv_fused_gradient) {
+    test::Net net {test::make_conv_net(3, true, 1)};
+    check_net(net, 2);
+}
+
+AEDLF_TEST(conv_fused_stride2_gradient) {
+    test::Net net {test::make_conv_net(3, true, 2)};
+    check_net(net, 4);
+}
+
+int main(int argc, char** argv) {
+    return aedlf::test::Registry::global().run(argc, argv);
+}
@@ -0,0 +1,117 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include "test.hpp"
+#include "../include/math/matrix.hpp"
+#include "../include/graph/components/data.hpp"
+#include "../include/graph/components/fc.hpp"
+#include "../include/graph/components/conv.hpp"
+#include "../include/graph/components/sigmoid.hpp"
+#include "../include/graph/components/logloss.hpp"
+#include "../include/graph/node/mul.hpp"
+#include "../include/graph/graph.hpp"
+#include "../include/utils/node_construct.hpp"
+
+
+namespace aedlf {
+    namespace test {
+        /*
+        测试用的小网络，最后都是FC(1) -> sigmoid -> logloss，输入和标签可以换成别的batch大小
+        组件和节点都放在Net里，图析构之前不会被释放
+        */
+        using matrix_dim = std::vector<unsigned long>;
+        using node_ptr = std::shared_ptr<graph::BaseNode<double>>;
+        using node_ptr_c = std::shared_ptr<std::vector<node_ptr>>;
+
+        struct Net {
+            std::shared_ptr<components::Data<double>> input;
+            std::shared_ptr<components::FC<double>> fc;
+            std::shared_ptr<components::Conv2d<double>> conv;
+            std::shared_ptr<components::Sigmoid<double>> conv_act;
+            std::shared_ptr<components::FC<double>> head;
+            std::shared_ptr<components::Sigmoid<double>> out_act;
+            std::shared_ptr<components::LogLoss<double>> loss_layer;
+            node_ptr input_node;
+            node_ptr label_node;
+            node_ptr loss;
+        };
+
+        // 偶数下标的样本是正类
+        inline Matrix<double> make_label(unsigned long batch) {
+            Matrix<double> label {matrix_dim {batch, 1, 1, 1}, 0.0};
+            for(unsigned long n {0}; n < batch; n += 2) {
+                label.set(n, 1.0);
+            }
+            return label;
+        }
+
+        // hidden是(n, 1, hidden_len, 1)
+        inline void finish_net(Net& net, node_ptr hidden, unsigned long hidden_len, unsigned long batch) {
+            Matrix<double> label {make_label(batch)};
+            net.label_node = utils::construct_data_node("label", label);
+            net.head = std::make_shared<components::FC<double>>("head", hidden_len, 1);
+            net.out_act = std::make_shared<components::Sigmoid<double>>("out_act");
+            net.loss_layer = std::make_shared<components::LogLoss<double>>("loss");
+            node_ptr_c out {(*net.out_act)((*net.head)({hidden}))};
+            out->push_back(net.label_node);
+            net.loss = (*net.loss_layer)(out)->at(0);
+        }
+
+        // (n, 1, 6, 1) -> FC(5) -> FC(1)
+        inline Net make_fc_net(unsigned long batch) {
+            Net net;
+            Matrix<double> x {uniform<double>(matrix_dim {batch, 1, 6, 1})};
+            net.input = std::make_shared<components::Data<double>>("input");
+            node_ptr_c in {(*net.input)(x)};
+            net.input_node = in->at(0);
+            net.fc = std::make_shared<components::FC<double>>("fc", 6, 5);
+            finish_net(net, (*net.fc)(in)->at(0), 5, batch);
+            return net;
+        }
+
+        /*
+        (n, 2, 10, 10) -> Conv2d(3, 3x3, padding 1) -> sigmoid -> FC(1)
+        卷积的输出是(n, 1, 3, h * w)，FC不能直接接在后面，先乘一个固定的(h * w, 1)向量得到(n, 1, 3, 1)
+        */
+        inline Net make_conv_net(unsigned long batch, bool fused, unsigned long stride) {
+            Net net;
+            const unsigned long size {10};
+            Matrix<double> x {uniform<double>(matrix_dim {batch, 2, size, size})};
+            net.input = std::make_shared<components::Data<double>>("input");
+            node_ptr_c in {(*net.input)(x)};
+            net.input_node = in->at(0);
+            net.conv = std::make_shared<components::Conv2d<double>>("conv", 2, 3, 3, 1, stride);
+            net.conv->set_fused(fused);
+            net.conv_act = std::make_shared<components::Sigmoid<double>>("conv_act");
+            node_ptr_c act {(*net.conv_act)((*net.conv)(in))};
+            unsigned long out_size {(size + 2 - 3) / stride + 1};
+            Matrix<double> v {uniform<double>(matrix_dim {1, 1, out_size * out_size, 1})};
+            node_ptr v_node {utils::construct_data_node("v", v)};
+            node_ptr reduce {std::make_shared<graph::MulNode<double>>("reduce", matrix_dim {batch, 1, 3, 1})};
+            reduce->add_parent(act->at(0));
+            reduce->add_parent(v_node);
+            finish_net(net, reduce, 3, batch);
+            return net;
+        }
+
+        // 换一批新的输入和标签，batch大小可以不同
+        inline void next_batch(Net& net, unsigned long batch) {
+            matrix_dim dim {net.input_node->get_data_dim()};
+            dim[0] = batch;
+            net.input_node->set_data(uniform<double>(dim));
+            net.label_node->set_data(make_label(batch));
+        }
+
+        // 没有父节点、需要梯度的节点就是参数，按拓扑序排列
+        inline std::vector<node_ptr> parameters(const graph::Graph<double>& g) {
+            std::vector<node_ptr> params;
+            for(const node_ptr& node : g.get_nodes()) {
+                if(node->get_parents_len() == 0 && node->is_require_grad()) {
+                    params.push_back(node);
+                }
+            }
+            return params;
+        }
+    }
+}
@@ -0,0 +1,79 @@
+#include "test.hpp"
+#include "net.hpp"
+#include <vector>
+
+
+namespace {
+    /*
+    同一个网络建两份，一份plan_memory以后在槽位上训练，一份始终用独立的内存
+    中间换几次batch大小（规划的图会重新规划），每一步的loss和更新后的参数都要完全一样
+    */
+    using namespace aedlf;
+    using test::node_ptr;
+
+    const double lr {0.5};
+    const unsigned long batches[] {4, 4, 2, 6, 6, 3, 4};
+
+    // 叶子节点按拓扑序一一对应，need_grad为true时拷贝参数，否则拷贝输入、标签这些数据
+    void copy_leaves(const graph::Graph<double>& from, const graph::Graph<double>& to, bool need_grad) {
+        test::check(from.size() == to.size(), "graphs are not the same");
+        for(size_t i {0}; i < from.size(); ++i) {
+            node_ptr src {from.get_node(i)};
+            if(src->get_parents_len() == 0 && src->is_require_grad() == need_grad) {
+                to.get_node(i)->get_m_data().copy_from(src->get_data());
+            }
+        }
+    }
+
+    void check_planned(test::Net& plain_net, test::Net& planned_net) {
+        graph::Graph<double> plain {plain_net.loss};
+        graph::Graph<double> planned {planned_net.loss};
+        copy_leaves(plain, planned, true);
+        copy_leaves(plain, planned, false);
+        planned.forward();
+        planned.plan_memory();
+        test::check(planned.is_memory_planned(), "memory is not planned");
+        std::vector<node_ptr> plain_params {test::parameters(plain)};
+        std::vector<node_ptr> planned_params {test::parameters(planned)};
+        for(unsigned long step {0}; step < sizeof(batches) / sizeof(batches[0]); ++step) {
+            if(step > 0) {
+                test::next_batch(plain_net, batches[step]);
+                copy_leaves(plain, planned, false);
+            }
+            plain.forward();
+            plain.backward();
+            plain.update(lr);
+            planned.forward();
+            planned.backward();
+            planned.update(lr);
+            std::string where {"step " + std::to_string(step)};
+            test::check(planned.is_memory_planned(), where + ": memory plan is released");
+            test::check_near(test::max_abs_diff(plain.get_output()->get_data(), planned.get_output()->get_data()), 0, where + " loss");
+            for(size_t i {0}; i < plain_params.size(); ++i) {
+                test::check_near(test::max_abs_diff(plain_params[i]->get_data(), planned_params[i]->get_data()), 0, where + " " + plain_params[i]->get_name());
+            }
+        }
+    }
+}
+
+AEDLF_TEST(fc_planned) {
+    test::Net plain {test::make_fc_net(batches[0])};
+    test::Net planned {test::make_fc_net(batches[0])};
+    check_planned(plain, planned);
+}
+
+AEDLF_TEST(conv_unfused_planned) {
+    test::Net plain {test::make_conv_net(batches[0], false, 1)};
+    test::Net planned {test::make_conv_net(batches[0], false, 1)};
+    check_planned(plain, planned);
+}
+
+AEDLF_TEST(conv_fused_planned) {
+    test::Net plain {test::make_conv_net(batches[0], true, 1)};
+    test::Net planned {test::make_conv_net(batches[0], true, 1)};
+    check_planned(plain, planned);
+}
+
+int main(int argc, char** argv) {
+    return aedlf::test::Registry::global().run(argc, argv);
+}
@@ -0,0 +1,138 @@
+#include "test.hpp"
+#include "../include/math/qgemm.hpp"
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+
+namespace {
+    /*
+    int8 GEMM没有舍入误差，标量、AVX2和VNNI的micro kernel都必须和逐个相乘累加的结果完全一样
+    机器不支持的指令集跳过，尺寸覆盖MR、NR的整数倍和零头，以及k不是4的倍数
+    */
+    using namespace aedlf;
+    using kernel::qgemm_micro_func;
+
+    struct Shape {
+        unsigned long m;
+        unsigned long n;
+        unsigned long k;
+    };
+
+    const Shape shapes[] {
+        {1, 1, 1}, {4, 16, 4}, {3, 5, 7}, {8, 32, 64}, {5, 17, 13}, {13, 40, 131}, {64, 9, 300}
+    };
+
+    struct Operands {
+        std::vector<int8_t> a_packed;
+        std::vector<uint8_t> b; // (k, n)，行连续
+        std::vector<int32_t> reference;
+    };
+
+    /*
+    权重先按qgemm的规则量化打包，参考结果直接用打包好的int8和激活值算
+    extreme时权重都是±127、激活值都是127，AVX2的int16中间结果最接近饱和
+    */
+    Operands make_operands(const Shape& s, bool extreme = false) {
+        std::uniform_real_distribution<float> weight {-1, 1};
+        std::uniform_int_distribution<int> activation {0, kernel::quant_u8_max};
+        std::vector<float> a(s.m * s.k);
+        for(float& v : a) {
+            v = extreme ? (weight(test::generator()) < 0 ? -1.0f : 1.0f) : weight(test::generator());
+        }
+        unsigned long k4 {kernel::qgemm_k4(s.k)};
+        Operands op;
+        op.a_packed.resize(kernel::qgemm_packed_rows(s.m) * k4);
+        std::vector<float> scale(s.m);
+        std::vector<int32_t> row_sum(s.m);
+        kernel::quantize_pack_a(s.m, s.k, a.data(), s.k, op.a_packed.data(), scale.data(), row_sum.data());
+        op.b.resize(s.k * s.n);
+        for(uint8_t& v : op.b) {
+            v = uint8_t(extreme ? kernel::quant_u8_max : activation(test::generator()));
+        }
+        op.reference.assign(s.m * s.n, 0);
+        for(unsigned long i {0}; i < s.m; ++i) {
+            for(unsigned long j {0}; j < s.n; ++j) {
+                int32_t acc {0};
+                for(unsigned long p {0}; p < s.k; ++p) {
+                    acc += int32_t(op.a_packed[i * k4 + p]) * int32_t(op.b[p * s.n + j]);
+                }
+                op.reference[i * s.n + j] = acc;
+            }
+        }
+        return op;
+    }
+
+    // 和kernel::qgemm的分块一样，只是指定micro kernel
+    void qgemm_with(qgemm_micro_func micro_kernel, const Shape& s, const Operands& op, int32_t* c) {
+        const unsigned long MR {kernel::QGemmBlock::MR};
+        const unsigned long NR {kernel::QGemmBlock::NR};
+        unsigned long k4 {kernel::qgemm_k4(s.k)};
+        std::vector<uint8_t> packed((s.n + NR - 1) / NR * NR * k4);
+        kernel::qgemm_pack_b(s.k, s.n, op.b.data(), s.n, 1, packed.data());
+        for(unsigned long jr {0}; jr < s.n; jr += NR) {
+            for(unsigned long ir {0}; ir < s.m; ir += MR) {
+                micro_kernel(k4, op.a_packed.data() + ir * k4, packed.data() + jr * k4, c + ir * s.n + jr, s.n, std::min(MR, s.m - ir), std::min(NR, s.n - jr));
+            }
+        }
+    }
+
+    void check_kernel(qgemm_micro_func micro_kernel) {
+        for(const Shape& s : shapes) {
+            for(bool extreme : {false, true}) {
+                Operands op {make_operands(s, extreme)};
+                std::vector<int32_t> c(s.m * s.n, -1);
+                qgemm_with(micro_kernel, s, op, c.data());
+                std::string name {std::to_string(s.m) + "x" + std::to_string(s.n) + "x" + std::to_string(s.k) + (extreme ? " extreme" : "")};
+                test::check(c == op.reference, "qgemm " + name + " is not exact");
+            }
+        }
+    }
+}
+
+AEDLF_TEST(qgemm_scalar) {
+    check_kernel(&kernel::scalar::qgemm_micro_kernel);
+}
+
+AEDLF_TEST(qgemm_avx2) {
+#if AEDLF_X86_SIMD
+    if(!__builtin_cpu_supports("avx2")) {
+        test::skip("cpu has no avx2");
+    }
+    check_kernel(&kernel::avx2::qgemm_micro_kernel);
+#else
+    test::skip("not built for x86");
+#endif
+}
+
+AEDLF_TEST(qgemm_vnni) {
+#if AEDLF_X86_SIMD
+    if(!__builtin_cpu_supports("avx512vl") || !__builtin_cpu_supports("avx512vnni")) {
+        test::skip("cpu has no avx512 vnni");
+    }
+    check_kernel(&kernel::vnni::qgemm_micro_kernel);
+#else
+    test::skip("not built for x86");
+#endif
+}
+
+// 按运行时选出来的kernel，B按列跨度读取（转置存放）
+AEDLF_TEST(qgemm_dispatch_strided) {
+    for(const Shape& s : shapes) {
+        Operands op {make_operands(s)};
+        std::vector<uint8_t> b_t(s.n * s.k);
+        for(unsigned long p {0}; p < s.k; ++p) {
+            for(unsigned long j {0}; j < s.n; ++j) {
+                b_t[j * s.k + p] = op.b[p * s.n + j];
+            }
+        }
+        std::vector<int32_t> c(s.m * s.n, -1);
+        kernel::qgemm(s.m, s.n, s.k, op.a_packed.data(), b_t.data(), 1, s.k, c.data(), s.n);
+        test::check(c == op.reference, "strided qgemm " + std::to_string(s.m) + "x" + std::to_string(s.n) + "x" + std::to_string(s.k) + " is not exact");
+    }
+}
+
+int main(int argc, char** argv) {
+    return aedlf::test::Registry::global().run(argc, argv);
+}
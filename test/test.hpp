@@ -0,0 +1,148 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "../include/math/matrix.hpp"
+
+
+namespace aedlf {
+    namespace test {
+        /*
+        自带的测试框架，不依赖第三方库，每个测试文件编译成一个可执行文件交给ctest
+        用例用AEDLF_TEST注册，check失败时抛Failure，一个用例失败不影响后面的用例，有失败时返回值非0
+        机器不支持的用例调用skip，算通过
+        命令行参数是子串时只跑名字里包含它的用例
+        */
+        using case_func = std::function<void()>;
+
+        struct Case {
+            std::string name;
+            case_func func;
+        };
+
+        class Failure : public std::runtime_error {
+            public:
+                explicit Failure(const std::string& message) : std::runtime_error {message} {};
+        };
+
+        class Skipped : public std::runtime_error {
+            public:
+                explicit Skipped(const std::string& reason) : std::runtime_error {reason} {};
+        };
+
+        class Registry {
+            public:
+                static Registry& global();
+                void add(std::string name, case_func func);
+                int run(int argc, char** argv) const;
+            private:
+                std::vector<Case> cases;
+        };
+
+        struct Register {
+            Register(std::string name, case_func func) {
+                Registry::global().add(name, func);
+            }
+        };
+
+        inline Registry& Registry::global() {
+            static Registry registry;
+            return registry;
+        }
+
+        inline void Registry::add(std::string name, case_func func) {
+            for(const Case& c : cases) {
+                if(c.name == name) {
+                    throw std::runtime_error("Test `" + name + "` is registered twice");
+                }
+            }
+            cases.push_back(Case {name, func});
+        }
+
+        inline int Registry::run(int argc, char** argv) const {
+            std::string filter {argc > 1 ? argv[1] : ""};
+            unsigned long failed {0};
+            unsigned long ran {0};
+            for(const Case& c : cases) {
+                if(c.name.find(filter) == std::string::npos) {
+                    continue;
+                }
+                ++ran;
+                try {
+                    c.func();
+                    std::cout << "[  OK  ] " << c.name << std::endl;
+                }
+                catch(const Skipped& e) {
+                    std::cout << "[ SKIP ] " << c.name << ": " << e.what() << std::endl;
+                }
+                catch(const std::exception& e) {
+                    ++failed;
+                    std::cout << "[ FAIL ] " << c.name << ": " << e.what() << std::endl;
+                }
+            }
+            std::cout << ran - failed << " / " << ran << " passed" << std::endl;
+            return failed == 0 && ran > 0 ? 0 : 1;
+        }
+
+        inline void check(bool condition, const std::string& message) {
+            if(!condition) {
+                throw Failure {message};
+            }
+        }
+
+        inline void skip(const std::string& reason) {
+            throw Skipped {reason};
+        }
+
+        // 误差检查，失败信息里带上实际的误差
+        inline void check_near(double error, double tolerance, const std::string& message) {
+            if(!(error <= tolerance)) {
+                std::ostringstream detail;
+                detail << message << ": error " << error << " > " << tolerance;
+                throw Failure {detail.str()};
+            }
+        }
+
+        // 固定种子，每次运行的结果一样
+        inline std::mt19937& generator() {
+            static std::mt19937 gen {20221021};
+            return gen;
+        }
+
+        template <typename MType>
+        Matrix<MType> uniform(std::vector<unsigned long> dim, double low = -1, double high = 1) {
+            Matrix<MType> m {dim, MType(0)};
+            std::uniform_real_distribution<double> dist {low, high};
+            MType* m_p {m.mutable_data()};
+            for(unsigned long i {0}; i < m.get_data()->size(); ++i) {
+                m_p[i] = MType(dist(generator()));
+            }
+            return m;
+        }
+
+        // 形状不同时返回无穷大
+        template <typename MType>
+        double max_abs_diff(const Matrix<MType>& a, const Matrix<MType>& b) {
+            if(a.get_dim() != b.get_dim()) {
+                return INFINITY;
+            }
+            double diff {0};
+            for(unsigned long i {0}; i < a.get_data()->size(); ++i) {
+                diff = std::max(diff, std::fabs(double(a.get_data()->at(i)) - double(b.get_data()->at(i))));
+            }
+            return diff;
+        }
+    }
+}
+
+// 定义并注册一个用例：AEDLF_TEST(name) { ... }
+#define AEDLF_TEST(name) \
+    static void aedlf_test_##name(); \
+    static aedlf::test::Register aedlf_test_register_##name {#name, &aedlf_test_##name}; \
+    static void aedlf_test_##name()